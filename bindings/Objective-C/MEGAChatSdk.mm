@@ -572,6 +572,10 @@ static DelegateMEGAChatLoggerListener *externalLogger = NULL;
     }
 }
 
++ (void)setVideoFramesInWorkerThreads:(BOOL)enable {
+    MegaChatApi::setVideoFramesInWorkerThreads(enable);
+}
+
 #endif
 
 #pragma mark - My user attributes
@@ -685,6 +689,11 @@ static DelegateMEGAChatLoggerListener *externalLogger = NULL;
     return [[MEGAChatListItemList alloc] initWithMegaChatListItemList:self.megaChatApi->getChatListItems((int)mask, (int)filter) cMemoryOwn:YES];
 }
 
+- (MEGAChatListItemList *)chatListItemsPageByMask:(MEGAChatListMask)mask filter:(MEGAChatListFilter)filter pageSize:(NSUInteger)pageSize after:(MEGAChatListItem *)after {
+    if (self.megaChatApi == nil) return nil;
+    return [[MEGAChatListItemList alloc] initWithMegaChatListItemList:self.megaChatApi->getChatListItemsPage((int)mask, (int)filter, (unsigned int)pageSize, after.getCPtr) cMemoryOwn:YES];
+}
+
 - (uint64_t)chatIdByUserHandle:(uint64_t)userHandle {
     if (self.megaChatApi == nil) return MEGACHAT_INVALID_HANDLE;
     return self.megaChatApi->getChatHandleByUser(userHandle);
@@ -1447,6 +1456,54 @@ static DelegateMEGAChatLoggerListener *externalLogger = NULL;
     }
 }
 
+- (void)setDbGroupCommit:(BOOL)enable {
+    if (self.megaChatApi) {
+        self.megaChatApi->setDbGroupCommit(enable);
+    }
+}
+
+- (void)setLazyChatroomInit:(BOOL)enable {
+    if (self.megaChatApi) {
+        self.megaChatApi->setLazyChatroomInit(enable);
+    }
+}
+
+- (void)setHistoryMemoryBudgetWithMaxMessagesPerChat:(NSUInteger)maxMessagesPerChat maxMessages:(NSUInteger)maxMessages {
+    if (self.megaChatApi) {
+        self.megaChatApi->setHistoryMemoryBudget((unsigned int)maxMessagesPerChat, (unsigned int)maxMessages);
+    }
+}
+
+- (NSDictionary<NSString *, NSNumber *> *)historyMemoryStats {
+    if (!self.megaChatApi) return nil;
+    
+    MegaStringMap *stats = self.megaChatApi->getHistoryMemoryStats();
+    if (!stats) return nil;
+    
+    MegaStringList *keys = stats->getKeys();
+    NSMutableDictionary<NSString *, NSNumber *> *statsDictionary = [NSMutableDictionary dictionaryWithCapacity:keys->size()];
+    for (int i = 0; i < keys->size(); i++) {
+        const char *key = keys->get(i);
+        statsDictionary[[NSString stringWithUTF8String:key]] = [NSNumber numberWithUnsignedLongLong:strtoull(stats->get(key), NULL, 10)];
+    }
+    
+    delete keys;
+    delete stats;
+    return statsDictionary;
+}
+
+- (void)setNotificationCoalescing:(BOOL)enable windowMs:(NSUInteger)windowMs {
+    if (self.megaChatApi) {
+        self.megaChatApi->setNotificationCoalescing(enable, (unsigned int)windowMs);
+    }
+}
+
+- (void)setNotificationCoalescing:(BOOL)enable {
+    if (self.megaChatApi) {
+        self.megaChatApi->setNotificationCoalescing(enable);
+    }
+}
+
 - (void)sendTypingNotificationForChat:(uint64_t)chatId {
     if (self.megaChatApi) {
         self.megaChatApi->sendTypingNotification(chatId);
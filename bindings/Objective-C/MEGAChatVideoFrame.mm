@@ -0,0 +1,50 @@
+
+#import "MEGAChatVideoFrame.h"
+
+#import "megachatapi.h"
+
+using namespace megachat;
+
+@interface MEGAChatVideoFrame ()
+
+@property MegaChatVideoFrame *megaChatVideoFrame;
+@property BOOL cMemoryOwn;
+
+@end
+
+@implementation MEGAChatVideoFrame
+
+- (instancetype)initWithMegaChatVideoFrame:(MegaChatVideoFrame *)megaChatVideoFrame cMemoryOwn:(BOOL)cMemoryOwn {
+    NSParameterAssert(megaChatVideoFrame);
+    
+    if (self = [super init]) {
+        _megaChatVideoFrame = megaChatVideoFrame;
+        _cMemoryOwn = cMemoryOwn;
+    }
+    
+    return self;
+}
+
+- (NSInteger)width {
+    return self.megaChatVideoFrame->getWidth();
+}
+
+- (NSInteger)height {
+    return self.megaChatVideoFrame->getHeight();
+}
+
+- (NSData *)buffer {
+    if (!self.megaChatVideoFrame || !self.megaChatVideoFrame->getBuffer()) return nil;
+    MegaChatVideoFrame *frame = self.megaChatVideoFrame->copy();
+    return [[NSData alloc] initWithBytesNoCopy:frame->getBuffer() length:frame->getSize() deallocator:^(void *bytes, NSUInteger length) {
+        delete frame;
+    }];
+}
+
+- (void)dealloc {
+    if (self.cMemoryOwn) {
+        delete _megaChatVideoFrame;
+    }
+}
+
+@end
@@ -19,6 +19,7 @@ public:
     void onMessageUpdate(megachat::MegaChatApi *api, megachat::MegaChatMessage *message);
     void onHistoryReloaded(megachat::MegaChatApi *api, megachat::MegaChatRoom *chat);
     void onReactionUpdate(megachat::MegaChatApi *api, megachat::MegaChatHandle msgid, const char *reaction, int count);
+    void onMessagesSeen(megachat::MegaChatApi *api, megachat::MegaChatHandle oldestMsgid, megachat::MegaChatHandle newestMsgid, unsigned int count);
     
 private:
     __weak MEGAChatSdk *megaChatSDK;
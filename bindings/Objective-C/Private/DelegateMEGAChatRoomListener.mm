@@ -84,3 +84,13 @@ void DelegateMEGAChatRoomListener::onReactionUpdate(MegaChatApi *api, MegaChatHa
         });
     }
 }
+
+void DelegateMEGAChatRoomListener::onMessagesSeen(MegaChatApi *api, MegaChatHandle oldestMsgid, MegaChatHandle newestMsgid, unsigned int count) {
+    if (listener != nil && [listener respondsToSelector:@selector(onMessagesSeen:oldestMessageId:newestMessageId:count:)]) {
+        MEGAChatSdk *tempMegaChatSDK = this->megaChatSDK;
+        id<MEGAChatRoomDelegate> tempListener = this->listener;
+        dispatch(this->queueType, ^{
+            [tempListener onMessagesSeen:tempMegaChatSDK oldestMessageId:oldestMsgid newestMessageId:newestMsgid count:count];
+        });
+    }
+}
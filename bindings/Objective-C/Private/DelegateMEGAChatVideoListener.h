@@ -8,7 +8,7 @@ public:
     DelegateMEGAChatVideoListener(MEGAChatSdk *megaChatSdk, id<MEGAChatVideoDelegate>listener, bool singleListener = true);
     id<MEGAChatVideoDelegate>getUserListener();
     
-    void onChatVideoData(megachat::MegaChatApi *api, uint64_t chatid, int width, int height, char *buffer, size_t size);
+    void onChatVideoFrame(megachat::MegaChatApi *api, uint64_t chatid, megachat::MegaChatVideoFrame *frame);
     
 private:
     __weak MEGAChatSdk *megaChatSdk;
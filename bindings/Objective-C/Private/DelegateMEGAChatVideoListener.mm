@@ -1,6 +1,7 @@
 
 #import "DelegateMEGAChatVideoListener.h"
 #import "MEGAChatCall+init.h"
+#import "MEGAChatVideoFrame+init.h"
 
 using namespace megachat;
 
@@ -14,11 +15,23 @@ id<MEGAChatVideoDelegate>DelegateMEGAChatVideoListener::getUserListener() {
     return listener;
 }
 
-void DelegateMEGAChatVideoListener::onChatVideoData(megachat::MegaChatApi *api, MegaChatHandle chatid, int width, int height, char *buffer, size_t size) {
-    if (listener != nil && [listener respondsToSelector:@selector(onChatVideoData:chatId:width:height:buffer:)]) {
-        MEGAChatSdk *tempMEGAChatSdk = this->megaChatSdk;
-        id<MEGAChatVideoDelegate>tempListener = this->listener;
-        NSData *data = [[NSData alloc] initWithBytes:buffer length:size];
+void DelegateMEGAChatVideoListener::onChatVideoFrame(megachat::MegaChatApi *api, MegaChatHandle chatid, megachat::MegaChatVideoFrame *frame) {
+    if (listener == nil) {
+        return;
+    }
+
+    MEGAChatSdk *tempMEGAChatSdk = this->megaChatSdk;
+    id<MEGAChatVideoDelegate>tempListener = this->listener;
+    // keep a reference to the frame instead of copying the image, it's released with the last reference to its data
+    MEGAChatVideoFrame *videoFrame = [[MEGAChatVideoFrame alloc] initWithMegaChatVideoFrame:frame->copy() cMemoryOwn:YES];
+    if ([listener respondsToSelector:@selector(onChatVideoFrame:chatId:frame:)]) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [tempListener onChatVideoFrame:tempMEGAChatSdk chatId:chatid frame:videoFrame];
+        });
+    } else if ([listener respondsToSelector:@selector(onChatVideoData:chatId:width:height:buffer:)]) {
+        NSInteger width = videoFrame.width;
+        NSInteger height = videoFrame.height;
+        NSData *data = videoFrame.buffer;
         dispatch_async(dispatch_get_main_queue(), ^{
             [tempListener onChatVideoData:tempMEGAChatSdk chatId:chatid width:width height:height buffer:data];
         });
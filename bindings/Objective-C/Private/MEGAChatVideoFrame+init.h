@@ -0,0 +1,13 @@
+
+#import "MEGAChatVideoFrame.h"
+#import "megachatapi.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+@interface MEGAChatVideoFrame (init)
+
+- (instancetype)initWithMegaChatVideoFrame:(megachat::MegaChatVideoFrame *)megaChatVideoFrame cMemoryOwn:(BOOL)cMemoryOwn;
+
+@end
+
+NS_ASSUME_NONNULL_END
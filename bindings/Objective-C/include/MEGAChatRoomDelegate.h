@@ -16,6 +16,7 @@ NS_ASSUME_NONNULL_BEGIN
 - (void)onMessageUpdate:(MEGAChatSdk *)api message:(MEGAChatMessage *)message;
 - (void)onHistoryReloaded:(MEGAChatSdk *)api chat:(MEGAChatRoom *)chat;
 - (void)onReactionUpdate:(MEGAChatSdk *)api messageId:(uint64_t)messageId reaction:(NSString *)reaction count:(NSInteger)count;
+- (void)onMessagesSeen:(MEGAChatSdk *)api oldestMessageId:(uint64_t)oldestMessageId newestMessageId:(uint64_t)newestMessageId count:(NSUInteger)count;
 
 @end
 
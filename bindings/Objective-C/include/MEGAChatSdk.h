@@ -200,6 +200,9 @@ NS_ASSUME_NONNULL_BEGIN
 - (void)addChatRemoteVideo:(uint64_t)chatId cliendId:(uint64_t)clientId hiRes:(BOOL)hiRes delegate:(id<MEGAChatVideoDelegate>)delegate;
 - (void)removeChatRemoteVideo:(uint64_t)chatId cliendId:(uint64_t)clientId hiRes:(BOOL)hiRes delegate:(id<MEGAChatVideoDelegate>)delegate;
 
+/// Delivers video frames to the MEGAChatVideoDelegate from worker threads instead of the thread of the other callbacks. Disabled by default
++ (void)setVideoFramesInWorkerThreads:(BOOL)enable;
+
 #endif
 
 #pragma mark - Chat rooms and chat list items
@@ -210,6 +213,7 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (nullable MEGAChatListItem *)chatListItemForChatId:(uint64_t)chatId;
 - (nullable MEGAChatListItemList *)chatListItemsByMask:(MEGAChatListMask)mask filter:(MEGAChatListFilter)filter;
+- (nullable MEGAChatListItemList *)chatListItemsPageByMask:(MEGAChatListMask)mask filter:(MEGAChatListFilter)filter pageSize:(NSUInteger)pageSize after:(nullable MEGAChatListItem *)after;
 
 - (uint64_t)chatIdByUserHandle:(uint64_t)userHandle;
 
@@ -379,6 +383,12 @@ NS_ASSUME_NONNULL_BEGIN
 - (nullable MEGAStringList *)messageReactionsForChat:(uint64_t)chatId messageId:(uint64_t)messageId;
 - (nullable MEGAHandleList *)reactionUsersForChat:(uint64_t)chatId messageId:(uint64_t)messageId reaction:(NSString *)reaction;
 - (void)setPublicKeyPinning:(BOOL)enable;
+- (void)setDbGroupCommit:(BOOL)enable;
+- (void)setLazyChatroomInit:(BOOL)enable;
+- (void)setHistoryMemoryBudgetWithMaxMessagesPerChat:(NSUInteger)maxMessagesPerChat maxMessages:(NSUInteger)maxMessages;
+- (nullable NSDictionary<NSString *, NSNumber *> *)historyMemoryStats;
+- (void)setNotificationCoalescing:(BOOL)enable windowMs:(NSUInteger)windowMs;
+- (void)setNotificationCoalescing:(BOOL)enable;
 
 - (void)sendTypingNotificationForChat:(uint64_t)chatId;
 - (void)sendStopTypingNotificationForChat:(uint64_t)chatId;
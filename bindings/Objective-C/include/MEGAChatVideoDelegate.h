@@ -1,6 +1,7 @@
 
 #import <Foundation/Foundation.h>
 #import "MEGAChatCall.h"
+#import "MEGAChatVideoFrame.h"
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -12,6 +13,9 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (void)onChatVideoData:(MEGAChatSdk *)api chatId:(uint64_t)chatId width:(NSInteger)width height:(NSInteger)height buffer:(NSData *)buffer;
 
+/// Called instead of onChatVideoData:chatId:width:height:buffer: when implemented. The frame keeps the image without copying it
+- (void)onChatVideoFrame:(MEGAChatSdk *)api chatId:(uint64_t)chatId frame:(MEGAChatVideoFrame *)frame;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -0,0 +1,16 @@
+
+#import <Foundation/Foundation.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@interface MEGAChatVideoFrame : NSObject
+
+@property (readonly, nonatomic) NSInteger width;
+@property (readonly, nonatomic) NSInteger height;
+
+/// Image in format ARGB: 4 bytes per pixel. The image isn't copied, the data keeps a reference to the frame
+@property (nullable, readonly, nonatomic) NSData *buffer;
+
+@end
+
+NS_ASSUME_NONNULL_END
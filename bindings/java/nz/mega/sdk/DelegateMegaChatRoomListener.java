@@ -136,4 +136,14 @@ class DelegateMegaChatRoomListener extends MegaChatRoomListener {
             });
         }
     }
+
+    @Override
+    public void onMessagesSeen(MegaChatApi api, long oldestMsgid, long newestMsgid, long count){
+        if (listener != null) {
+            megaChatApi.runCallback((Runnable) () -> {
+                if (listener != null)
+                    listener.onMessagesSeen(megaChatApi, oldestMsgid, newestMsgid, count);
+            });
+        }
+    }
 }
@@ -46,7 +46,7 @@ class DelegateMegaChatVideoListener extends MegaChatVideoListener{
     }
 
     @Override
-    public void onChatVideoData(MegaChatApi api, long chatid, int width, int height, byte[] byteBuffer)
+    public void onChatVideoFrame(MegaChatApi api, long chatid, MegaChatVideoFrame frame)
     {
         if (listener != null) {
             int pending = pendingFrames.incrementAndGet();
@@ -56,16 +56,16 @@ class DelegateMegaChatVideoListener extends MegaChatVideoListener{
                 return;
             }
 
-            final byte[] megaByteBuffer = byteBuffer;
+            // keep a reference to the frame instead of copying the image in the SDK thread
+            final MegaChatVideoFrame megaFrame = frame.copy();
             final long megaChatid = chatid;
-            final int megaWidth = width;
-            final int megaHeigth = height;
             final DelegateMegaChatVideoListener delegate = this;
             megaChatApi.runCallback(() -> {
                 if (!delegate.removed) {
                     delegate.pendingFrames.decrementAndGet();
-                    listener.onChatVideoData(megaChatApi, megaChatid, megaWidth, megaHeigth, megaByteBuffer);
+                    listener.onChatVideoFrame(megaChatApi, megaChatid, megaFrame);
                 }
+                megaFrame.delete();
             });
         }
     }
@@ -176,6 +176,109 @@ public class MegaChatApiJava {
         megaChatApi.setPublicKeyPinning(enable);
     }
 
+    /**
+     * Enable / disable grouping the writes to the local cache in transactions
+     *
+     * When enabled, changes to the local cache are written to disk in groups, which reduces the
+     * disk writes when many messages are received in a row. If the app crashes or is killed, up
+     * to 500 ms of changes are lost, which are received again from the servers. Messages being
+     * sent, the seen and received pointers and the keys of the messages are always written
+     * right away.
+     *
+     * Grouping of writes is disabled by default. This method can be called at any time.
+     *
+     * @param enable true to group the writes to the local cache, false to write every change
+     */
+    public void setDbGroupCommit(boolean enable) {
+        megaChatApi.setDbGroupCommit(enable);
+    }
+
+    /**
+     * Enable / disable the lazy initialization of chatrooms loaded from the local cache
+     *
+     * When enabled, MegaChatApiJava::init only loads from the local cache a summary of every chatroom
+     * (last message, unread count and timestamp of the last message), which is enough to provide
+     * the MegaChatListItem of every chatroom. The history and the rest of the state of a chatroom
+     * are loaded on first access (ie. when the chatroom is opened) or before connecting to the
+     * chat servers, whichever happens first. This reduces the time required by MegaChatApiJava::init
+     * for accounts with many chatrooms.
+     *
+     * Lazy initialization is disabled by default. It must be enabled before calling
+     * MegaChatApiJava::init in order to take effect.
+     *
+     * @param enable true to enable the lazy initialization of chatrooms, false to disable it
+     */
+    public void setLazyChatroomInit(boolean enable) {
+        megaChatApi.setLazyChatroomInit(enable);
+    }
+
+    /**
+     * Limit the number of messages kept in memory for the history of the chatrooms
+     *
+     * When a limit is exceeded, the oldest messages loaded in memory are released. They are still
+     * stored in the local cache, so they will be loaded again if the app requests them through
+     * MegaChatApiJava::loadMessages. The chatrooms that are open (see MegaChatApiJava::openChatRoom) are
+     * never affected by these limits. When the limit of all chatrooms together is exceeded, messages
+     * are released first from the chatrooms whose history was accessed least recently.
+     *
+     * Every chatroom keeps a minimum of 32 messages in memory regardless of the limits.
+     *
+     * This method can be called at any time. By default, there is no limit.
+     *
+     * @param maxMessagesPerChat Max number of messages in memory for every chatroom, or 0 for no limit
+     * @param maxMessages Max number of messages in memory for all chatrooms, or 0 for no limit
+     */
+    public void setHistoryMemoryBudget(long maxMessagesPerChat, long maxMessages) {
+        megaChatApi.setHistoryMemoryBudget(maxMessagesPerChat, maxMessages);
+    }
+
+    /**
+     * Returns statistics about the memory used by the history of the chatrooms
+     *
+     * The returned map contains the following keys, with numeric values:
+     *  - "chats": number of chatrooms with messages loaded in memory
+     *  - "pinnedChats": number of open chatrooms with messages loaded in memory
+     *  - "messages": number of messages loaded in memory
+     *  - "pinnedMessages": number of messages loaded in memory for open chatrooms
+     *  - "bytes": estimated size in bytes of the messages loaded in memory
+     *  - "evictedMessages": number of messages released from memory due to MegaChatApiJava::setHistoryMemoryBudget
+     *  - "evictions": number of times that messages have been released from memory
+     *
+     * You take the ownership of the returned value.
+     *
+     * @return Map with the statistics, or NULL if MegaChatApiJava::init has not been called yet
+     */
+    public MegaStringMap getHistoryMemoryStats() {
+        return megaChatApi.getHistoryMemoryStats();
+     * Enable / disable the coalescing of notifications
+     *
+     * When enabled, the updates of the same item are merged into a single callback, with the
+     * changes of all of them. MegaChatListenerInterface.onChatListItemUpdate and
+     * MegaChatRoomListenerInterface.onMessageUpdate are coalesced, and the messages that change
+     * to MegaChatMessage.STATUS_SEEN together are notified by MegaChatRoomListenerInterface.onMessagesSeen.
+     *
+     * Coalescing of notifications is disabled by default.
+     *
+     * @param enable true to enable the coalescing of notifications, false to disable it
+     * @param windowMs Max time in milliseconds to hold an update, or 0 to hold it only until the
+     * current batch of events is processed
+     */
+    public void setNotificationCoalescing(boolean enable, long windowMs) {
+        megaChatApi.setNotificationCoalescing(enable, windowMs);
+    }
+
+    /**
+     * Enable / disable the coalescing of notifications
+     *
+     * The updates are held until the current batch of events is processed.
+     * See MegaChatApiJava.setNotificationCoalescing(boolean, long).
+     *
+     * @param enable true to enable the coalescing of notifications, false to disable it
+     */
+    public void setNotificationCoalescing(boolean enable) {
+        megaChatApi.setNotificationCoalescing(enable);
+    }
+
     /**
      * Change the SFU id
      *
@@ -2432,6 +2535,40 @@ public class MegaChatApiJava {
         return chatRoomListItemToArray(megaChatApi.getChatListItems(mask, filter));
     }
 
+    /**
+     * Get a page of chatrooms with limited information, sorted by last activity
+     *
+     * It is needed to have successfully called \c MegaChatApi::init (the initialization
+     * state should be \c MegaChatApi::INIT_OFFLINE_SESSION or \c MegaChatApi::INIT_ONLINE_SESSION)
+     * before calling this function.
+     *
+     * Chatrooms are sorted by MegaChatListItem::getLastTimestamp, the most recent first. Chatrooms
+     * with the same timestamp are sorted by chatid. The first page is obtained by passing null
+     * in the param \c after, and the following ones by passing the last item of the previous page.
+     *
+     * Chatrooms are sorted by their activity when this function is called, so a chatroom with new
+     * activity after a page was obtained is not returned by the following pages. The app can
+     * get the changes from MegaChatListenerInterface::onChatListItemUpdate.
+     *
+     * This function is more efficient than sorting the result of \c getChatListItems, and it
+     * can be called from any thread without waiting for the chat engine.
+     *
+     * @param mask represents what filters to apply to the list of chats, as in \c getChatListItems
+     * CHAT_FILTER_BY_NO_FILTER mask should be used alone and it will ignore any value in the param filter
+     * @param filter represents the values to apply in the filter, as in \c getChatListItems
+     * @param pageSize Maximum number of chatrooms to return
+     * @param after Last item of the previous page, or null to get the first page
+     *
+     * In case you provide an invalid filter (i.e. combination of mask and filter params), this function
+     * returns an empty list
+     *
+     * @return List of MegaChatListItem objects, with \c pageSize chatrooms at maximum. If it has
+     * less than \c pageSize chatrooms, there are no more pages.
+     */
+    public ArrayList<MegaChatListItem> getChatListItemsPage(int mask, int filter, long pageSize, MegaChatListItem after) {
+        return chatRoomListItemToArray(megaChatApi.getChatListItemsPage(mask, filter, pageSize, after));
+    }
+
     /**
      * @deprecated Use {@link #getChatListItems(int, int)} instead.
      * Get all chatrooms (1on1 and groupal) with limited information
@@ -4610,6 +4747,19 @@ public class MegaChatApiJava {
         MegaChatApi.setCatchException(enable);
     }
 
+    /**
+     * Enable / disable the delivery of video frames from worker threads
+     *
+     * By default, video frames are delivered to the MegaChatVideoListenerInterface from the
+     * thread of the other callbacks. When enabled, they are converted and delivered from worker
+     * threads of the SDK instead, so the listeners must be safe to call from another thread.
+     *
+     * @param enable true to deliver video frames from worker threads
+     */
+    public static void setVideoFramesInWorkerThreads(boolean enable) {
+        MegaChatApi.setVideoFramesInWorkerThreads(enable);
+    }
+
     /**
      * This method should be called when a node history is opened
      *
@@ -24,4 +24,18 @@ public interface MegaChatRoomListenerInterface {
     public void onHistoryReloaded(MegaChatApiJava api, MegaChatRoom chat);
     public void onReactionUpdate(MegaChatApiJava api, long msgid, String reaction, int count);
     public void onHistoryTruncatedByRetentionTime(MegaChatApiJava api, MegaChatMessage msg);
+
+    /**
+     * This function is called when several messages from other users have been seen at once
+     *
+     * It's only called when the coalescing of notifications is enabled
+     * (see MegaChatApiJava.setNotificationCoalescing).
+     *
+     * @param api MegaChatApiJava connected to the account
+     * @param oldestMsgid MegaChatHandle that identifies the oldest message that has been seen
+     * @param newestMsgid MegaChatHandle that identifies the newest message that has been seen
+     * @param count Number of messages that have been seen
+     */
+    public default void onMessagesSeen(MegaChatApiJava api, long oldestMsgid, long newestMsgid, long count) {
+    }
 }
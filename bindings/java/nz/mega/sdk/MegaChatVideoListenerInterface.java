@@ -18,4 +18,22 @@ package nz.mega.sdk;
 
 public interface MegaChatVideoListenerInterface {
     public void onChatVideoData(MegaChatApiJava api, long chatid, int width, int height, byte[] byteBuffer);
+
+    /**
+     * This function is called when a new frame from a local or remote device is available
+     *
+     * The default implementation copies the image and calls onChatVideoData. Override it to
+     * read the image from the frame only when it's going to be rendered.
+     *
+     * The frame is only valid until this function returns. Use MegaChatVideoFrame.copy to keep it.
+     *
+     * @param api MegaChatApiJava connected to the account
+     * @param chatid MegaChatHandle that provides the video
+     * @param frame MegaChatVideoFrame with the image
+     */
+    public default void onChatVideoFrame(MegaChatApiJava api, long chatid, MegaChatVideoFrame frame) {
+        byte[] byteBuffer = new byte[(int) frame.getSize()];
+        frame.getBuffer(byteBuffer);
+        onChatVideoData(api, chatid, frame.getWidth(), frame.getHeight(), byteBuffer);
+    }
 }
@@ -222,6 +222,21 @@ void webrtc_on_load(JavaVM* jvm, JNIEnv* jenv)
 
 %javamethodmodifiers copy ""
 
+// The image of a MegaChatVideoFrame is copied to a Java byte array, of MegaChatVideoFrame::getSize() bytes.
+// Java listeners are registered for ARGB frames, so the YUV planes aren't exposed
+%ignore megachat::MegaChatVideoFrame::getBuffer() const;
+%ignore megachat::MegaChatVideoFrame::getPlane;
+%extend megachat::MegaChatVideoFrame
+{
+    void getBuffer(char *buffer, size_t size)
+    {
+        if ($self->getBuffer())
+        {
+            memcpy(buffer, $self->getBuffer(), size < $self->getSize() ? size : $self->getSize());
+        }
+    }
+}
+
 #endif
 
 //Generate inheritable wrappers for listener objects
@@ -256,6 +271,7 @@ void webrtc_on_load(JavaVM* jvm, JNIEnv* jenv)
 %newobject megachat::MegaChatContainsMeta::copy;
 %newobject megachat::MegaChatSession::copy;
 %newobject megachat::MegaChatPresenceConfig::copy;
+%newobject megachat::MegaChatVideoFrame::copy;
 
 %newobject megachat::MegaChatApi::getMessageReactions;
 %newobject megachat::MegaChatApi::getReactionUsers;
@@ -78,6 +78,8 @@ SOURCES += megachatapi.cpp \
             sfu.cpp \
             base/logger.cpp \
             base/cservices.cpp \
+            base/timers.cpp \
+            base/workerPool.cpp \
             net/websocketsIO.cpp \
             karereDbSchema.cpp \
             net/libwebsocketsIO.cpp \
@@ -125,10 +127,12 @@ HEADERS  += async_utils.h \
             base/loggerFile.h \
             base/loggerConsole.h \
             base/retryHandler.h \
+            base/sdkMutex.h \
             base/promise.h \
             base/services.h \
             base/timers.hpp \
             base/trackDelete.h \
+            base/workerPool.h \
             net/libwebsocketsIO.h \
             net/websocketsIO.h \
             rtcModule/IRtcCrypto.h \
@@ -141,6 +141,11 @@ public:
 
         /** @brief Called when the number of previewers in a public chat has changed */
         virtual void onPreviewersCountUpdate(uint32_t /*numPrev*/) {}
+
+        /** @brief Called when the chatd::Chat of a room loaded lazily is created (see
+         * Client::setLazyChatInit). Its properties may differ from those cached until then
+         */
+        virtual void onChatdChatCreated() {}
     };
 
     /**
@@ -248,6 +253,12 @@ public:
      */
     virtual void onInitStateChange(int /*newState*/) {}
 
+    /** @brief Whether the calling thread can run karere code: it's the thread that runs the
+     * event loop, or a thread that blocks it while it calls the client synchronously.
+     * It's only used by assertions.
+     */
+    virtual bool isKarereContext() const { return true; }
+
     virtual void onChatNotification(karere::Id /*chatid*/, const chatd::Message &/*msg*/, chatd::Message::Status /*status*/, chatd::Idx /*idx*/) {}
 
     /** @brief Called when an error occurred in an operation with karere Db
@@ -12,14 +12,18 @@ set(CHATLIB_BASE_HEADERS
     base/logger.h
     base/promise.h
     base/retryHandler.h
+    base/sdkMutex.h
     base/services.h
     base/timers.hpp
     base/trackDelete.h
+    base/workerPool.h
 )
 
 set(CHATLIB_BASE_SOURCES
     base/logger.cpp
     base/cservices.cpp
+    base/timers.cpp
+    base/workerPool.cpp
 )
 
 target_sources(CHATlib
@@ -12,11 +12,6 @@
 #include <sys/time.h>
 #endif
 
-namespace karere
-{
-    std::recursive_mutex timerMutex;
-}
-
 extern "C"
 {
 MEGA_GCM_DLLEXPORT GcmPostFunc megaPostMessageToGui = NULL;
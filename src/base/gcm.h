@@ -3,6 +3,10 @@
 
 /* This is a plain C header */
 
+#ifdef __cplusplus
+    #include <atomic>
+#endif
+
 #ifdef _WIN32
     #ifndef MEGA_FULL_STATIC
         #define MEGA_GCM_DLLEXPORT __declspec(dllexport)
@@ -51,6 +55,9 @@ struct megaMessage
      * implement a constructor in case we are included in C++ code
      */
      #ifdef __cplusplus
+         /** Link used by the lock-free queue that holds the message until it's processed.
+          * It's owned by the queue, user code must not touch it */
+         std::atomic<megaMessage*> next{nullptr};
          megaMessage(megaMessageFunc aFunc): func(aFunc){}
          virtual ~megaMessage() = default;
      #endif
@@ -7,6 +7,9 @@
 #include <string>
 #include <utility>
 #include <memory>
+#include <new>
+#include <cstddef>
+#include <type_traits>
 #include <assert.h>
 
 /** @brief The name of the unhandled promise error handler. This handler is
@@ -142,61 +145,199 @@ public:
     virtual ~PromiseBase(){}
 };
 
+/** @brief Per-thread cache of freed objects of type \c O, so that objects that are created
+ * and destroyed at a high rate (i.e. the shared state of promises) are recycled instead
+ * of being allocated on the heap every time.
+ * An object can be freed by any thread, its memory is cached by the thread that frees it.
+ */
+template <class O>
+class ObjectPool
+{
+protected:
+    enum { kMaxCachedPerThread = 256 };
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+    // Trivially destructible, so that it can still be used after the drainer of the thread is destroyed
+    struct FreeList
+    {
+        FreeBlock* head;
+        size_t count;
+        bool hasDrainer;
+        bool closed;    // the thread is exiting, freed objects are not cached anymore
+    };
+    struct Drainer
+    {
+        ~Drainer()
+        {
+            FreeList& list = freeList();
+            list.closed = true;
+            while (list.head)
+            {
+                FreeBlock* block = list.head;
+                list.head = block->next;
+                ::operator delete(block);
+            }
+            list.count = 0;
+        }
+    };
+    static FreeList& freeList()
+    {
+        static thread_local FreeList sList;
+        if (!sList.hasDrainer)
+        {
+            sList.hasDrainer = true;
+            static thread_local Drainer sDrainer;
+            (void)sDrainer;
+        }
+        return sList;
+    }
+public:
+    static void* allocate()
+    {
+        static_assert(sizeof(O) >= sizeof(FreeBlock), "Pooled objects must be able to hold a pointer");
+        FreeList& list = freeList();
+        FreeBlock* block = list.head;
+        if (!block)
+        {
+            return ::operator new(sizeof(O));
+        }
+        list.head = block->next;
+        list.count--;
+        return block;
+    }
+    static void release(void* ptr)
+    {
+        FreeList& list = freeList();
+        if (list.closed || list.count >= kMaxCachedPerThread)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+        FreeBlock* block = static_cast<FreeBlock*>(ptr);
+        block->next = list.head;
+        list.head = block;
+        list.count++;
+    }
+};
+
 template <class C>
 class CallbackList
 {
+public:
+    /** Size of the buffer where the first callback of the list is constructed, if it fits */
+    enum { kInlineSize = 64 };
 protected:
-    std::vector<C*> items;
+    // Most promises get a single then() and/or fail() callback: the first one is kept
+    // in mInline when possible, and the rest are allocated on the heap
+    alignas(std::max_align_t) unsigned char mInline[kInlineSize];
+    C* mFirst = nullptr;
+    bool mFirstInline = false;
+    std::vector<C*> mRest;
 public:
     CallbackList(){}
+    CallbackList(const CallbackList&) = delete;
+    CallbackList& operator=(const CallbackList&) = delete;
 /**
- * Takes ownership of callback, copies the promise.
- * Accepts the callback as a smart pointer of type SP.
- * This is because the method can throw if the list is full,
- * and in this case the smartpointer will prevent the pointer leak.
-*/
-    template<class SP>
-    inline void push(SP& cb)
+ * Creates a callback of type CB with the given constructor arguments and takes ownership of it.
+ */
+    template<class CB, class... Args>
+    inline void emplace(Args&&... args)
     {
-        items.push_back(cb.release());
+        static_assert(std::is_base_of<C, CB>::value, "Callback type must be inherited from the list's item type");
+        if constexpr (sizeof(CB) <= kInlineSize && alignof(CB) <= alignof(std::max_align_t))
+        {
+            if (!mFirst)
+            {
+                mFirst = new (mInline) CB(std::forward<Args>(args)...);
+                mFirstInline = true;
+                return;
+            }
+        }
+        std::unique_ptr<CB> cb(new CB(std::forward<Args>(args)...));
+        if (mFirst)
+        {
+            mRest.push_back(cb.get());
+        }
+        else
+        {
+            mFirst = cb.get();
+        }
+        cb.release();
     }
 
-    inline C*& operator[](int idx)
-    {
-        assert((idx >= 0) && (idx < (int)items.size()));
-        return items[idx];
-    }
-    inline const C*& operator[](int idx) const
+    inline C* operator[](int idx) const
     {
-        assert((idx >= 0) && (idx < items.size()));
-        return items[idx];
+        assert((idx >= 0) && (idx < count()));
+        return idx ? mRest[static_cast<size_t>(idx - 1)] : mFirst;
     }
-    inline C*& first()
+    inline C* first() const
     {
-        assert(!items.empty());
-        return items[0];
+        assert(mFirst);
+        return mFirst;
     }
     inline int count() const
     {
-        return static_cast<int>(items.size());
+        return (mFirst ? 1 : 0) + static_cast<int>(mRest.size());
     }
     inline void addListMoveItems(CallbackList& other)
     {
-        items.insert(items.end(), other.items.begin(), other.items.end());
-        other.items.clear();
+        if (!other.mFirst)
+        {
+            assert(other.mRest.empty());
+            return;
+        }
+
+        C* item = other.mFirst;
+        bool toInline = false;
+        if (other.mFirstInline)
+        {
+            // the callback lives inside the other list, it has to be moved out of it
+            toInline = !mFirst;
+            item = static_cast<C*>(other.mFirst->moveTo(toInline ? mInline : nullptr));
+            other.mFirst->~C();
+        }
+        other.mFirst = nullptr;
+        other.mFirstInline = false;
+
+        if (mFirst)
+        {
+            mRest.push_back(item);
+        }
+        else
+        {
+            mFirst = item;
+            mFirstInline = toInline;
+        }
+        mRest.insert(mRest.end(), other.mRest.begin(), other.mRest.end());
+        other.mRest.clear();
     }
     void clear()
     {
         static_assert(std::is_base_of<IVirtDtor, C>::value, "Callback type must be inherited from IVirtDtor");
-        for (auto it = items.begin(); it != items.end(); it++)
+        if (mFirst)
+        {
+            if (mFirstInline)
+            {
+                mFirst->~C();
+            }
+            else
+            {
+                delete mFirst;
+            }
+            mFirst = nullptr;
+            mFirstInline = false;
+        }
+        for (auto it = mRest.begin(); it != mRest.end(); it++)
         {
-            delete ((IVirtDtor*)*it); //static_cast wont work here because there is no info that ICallback inherits from IVirtDtor
+            delete *it;
         }
-        items.clear();
+        mRest.clear();
     }
     ~CallbackList()
     {
-        assert(items.empty());
+        assert(!mFirst && mRest.empty());
     }
 };
 
@@ -213,6 +354,8 @@ protected:
     {
         virtual void operator()(const P&) = 0;
         virtual void rejectNextPromise(const Error&) = 0;
+        /** Move-constructs the callback in \c buf, or on the heap if \c buf is null */
+        virtual ICallback* moveTo(void* buf) = 0;
     };
 
     template <class P, class TP>
@@ -231,8 +374,14 @@ protected:
         CB mCb;
     public:
         virtual void operator()(const P& arg) { mCb(arg, *this); }
+        virtual ICallback<P>* moveTo(void* buf)
+        {
+            return buf ? new (buf) Callback(std::move(*this)) : new Callback(std::move(*this));
+        }
         Callback(CB&& cb, const Promise<TP>& next)
             :ICallbackWithPromise<P, TP>(next), mCb(std::forward<CB>(cb)){}
+        Callback(Callback&& other)
+            :ICallbackWithPromise<P, TP>(other.nextPromise), mCb(std::move(other.mCb)){}
         CB& callback() { return mCb; }
     };
     typedef ICallback<typename MaskVoid<T>::type> ISuccessCb;
@@ -252,35 +401,34 @@ protected:
         FailCb(CB&& cb, const Promise<T>& next)
         :Callback<Error, CB, T>(std::forward<CB>(cb), next){}
     };
-/** Helper funtion to be able to deduce the callback type of the passed lambda and create and
-  * Callback object with that type. We cannot do that by directly calling the Callback constructor
-  */
-    template <class P, class CB, class TP>
-    ICallback<typename MaskVoid<P>::type>* createCb(CB&& cb, Promise<TP>& next)
-    {
-        return new Callback<typename MaskVoid<P>::type, CB, TP>(std::forward<CB>(cb), next);
-    }
 //===
     struct SharedObj
     {
-        struct CbLists
-        {
-            CallbackList<ISuccessCb> mSuccessCbs;
-            CallbackList<IFailCb> mFailCbs;
-        };
         int mRefCount;
-        CbLists* mCbs;
+        bool mHasCbs; //a callback was added at some point, so resolving has to go through the lists
         ResolvedState mResolved;
         bool mPending;
         Promise<T> mMaster;
         typename MaskVoid<typename std::remove_const<T>::type>::type mResult;
         Error mError;
+        CallbackList<ISuccessCb> mSuccessCbs;
+        CallbackList<IFailCb> mFailCbs;
         SharedObj()
-        :mRefCount(1), mCbs(NULL), mResolved(kNotResolved),
+        :mRefCount(1), mHasCbs(false), mResolved(kNotResolved),
          mPending(false), mMaster(_Empty())
         {
             PROMISE_LOG_REF("%p: addRef -> 1 (SharedObj ctor)", this);
         }
+        static void* operator new(size_t size)
+        {
+            assert(size == sizeof(SharedObj));
+            (void)size;
+            return ObjectPool<SharedObj>::allocate();
+        }
+        static void operator delete(void* ptr)
+        {
+            ObjectPool<SharedObj>::release(ptr);
+        }
         void ref()
         {
             mRefCount++;
@@ -299,18 +447,8 @@ protected:
         }
         ~SharedObj()
         {
-            if (mCbs)
-            {
-                mCbs->mSuccessCbs.clear();
-                mCbs->mFailCbs.clear();
-                delete mCbs;
-            }
-        }
-        inline CbLists& cbs()
-        {
-            if (!mCbs)
-                mCbs = new CbLists;
-            return *mCbs;
+            mSuccessCbs.clear();
+            mFailCbs.clear();
         }
     };
 
@@ -349,8 +487,8 @@ protected:
             mSharedObj->ref();
         }
     }
-    inline CallbackList<ISuccessCb>& thenCbs() {return mSharedObj->cbs().mSuccessCbs;}
-    inline CallbackList<IFailCb>& failCbs() {return mSharedObj->cbs().mFailCbs;}
+    inline CallbackList<ISuccessCb>& thenCbs() {return mSharedObj->mSuccessCbs;}
+    inline CallbackList<IFailCb>& failCbs() {return mSharedObj->mFailCbs;}
     SharedObj* mSharedObj;
     template <class FT> friend class Promise;
 public:
@@ -455,44 +593,46 @@ protected:
         return ret;
     }
 
-/** Creates a wrapper function around a then() or fail() handler that handles exceptions and propagates
- * the result to resolve/reject chained promises. \c In is the type of the callback's parameter,
- * \c Out is its return type, \c CB is the type of the callback itself.
+/** Calls a then() or fail() handler, converting the exceptions that it throws to a failed
+ * promise. \c In is the type of the callback's parameter, \c Out is its return type.
  */
     template <typename In, typename Out, typename RealOut, class CB>
-    ICallback<In>* createChainedCb(CB&& cb, Promise<Out>& next)
+    static Promise<Out> callHandler(CB& cb, const In& arg)
     {
         //cb must have the singature Promise<Out>(const In&)
-        return createCb<In>(
-            [cb](const In& result, ICallbackWithPromise<typename MaskVoid<In>::type, Out >& handler)
+        try
+        {
+            return CallCbHandleVoids::template call<Out, RealOut, In>(cb, arg);
+        }
+        catch(std::exception& e)
+        {
+            return Error(e.what(), kErrException);
+        }
+        catch(Error& e)
+        {
+            return e;
+        }
+        catch(const char* e)
+        {
+            return Error(e, kErrException);
+        }
+        catch(...)
+        {
+            return Error("(unknown exception type)", kErrException);
+        }
+    }
+
+/** Adds to \c list a wrapper around a then() or fail() handler that handles exceptions and
+ * propagates the result to resolve/reject the chained promise \c next
+ */
+    template <typename In, typename Out, typename RealOut, class CB>
+    static void addChainedCb(CallbackList<ICallback<In> >& list, CB&& cb, Promise<Out>& next)
+    {
+        auto wrapper = [cb = std::forward<CB>(cb)](const In& result, ICallbackWithPromise<In, Out>& handler)
             mutable->void
         {
             Promise<Out>& next = handler.nextPromise; //the 'chaining' promise
-            Promise<Out> promise((_Empty())); //the promise returned by the user callback
-            try
-            {
-                promise = CallCbHandleVoids::template call<Out, RealOut, In>(cb, result);
-            }
-            catch(std::exception& e)
-            {
-                next.reject(Error(e.what(), kErrException));
-                return;
-            }
-            catch(Error& e)
-            {
-                next.reject(e);
-                return;
-            }
-            catch(const char* e)
-            {
-                next.reject(Error(e, kErrException));
-                return;
-            }
-            catch(...)
-            {
-                next.reject(Error("(unknown exception type)", kErrException));
-                return;
-            }
+            Promise<Out> promise = callHandler<In, Out, RealOut>(cb, result); //the promise returned by the user callback
 
 // connect the promise returned by the user's callback (actually its master)
 // to the chaining promise, returned earlier by then() or fail()
@@ -501,25 +641,18 @@ protected:
             next.mSharedObj->mMaster = master; //makes 'next' attach subsequently added callbacks to 'master'
             assert(next.hasMaster());
             // Move the callbacks and errbacks of 'next' to 'master'
-            if (!master.hasCallbacks())
+            if (next.hasCallbacks())
             {
-                master.mSharedObj->mCbs = next.mSharedObj->mCbs;
-                next.mSharedObj->mCbs = nullptr;
-            }
-            else
-            {
-                auto& nextCbs = next.thenCbs();
-                if (nextCbs.count())
-                    master.thenCbs().addListMoveItems(nextCbs);
-
-                auto& nextEbs = next.failCbs();
-                if (nextEbs.count())
-                    master.failCbs().addListMoveItems(nextEbs);
+                master.thenCbs().addListMoveItems(next.thenCbs());
+                master.failCbs().addListMoveItems(next.failCbs());
+                master.mSharedObj->mHasCbs = true;
+                next.mSharedObj->mHasCbs = false;
             }
             //====
             if (master.mSharedObj->mPending)
                 master.doPendingResolveOrFail();
-        }, next);
+        };
+        list.template emplace<Callback<In, decltype(wrapper), Out> >(std::move(wrapper), next);
     }
 
 public:
@@ -539,21 +672,17 @@ public:
             return mSharedObj->mError;
 
         typedef typename RemovePromise<typename FuncTraits<F>::RetType>::Type Out;
-        Promise<Out> next;
-
-        std::unique_ptr<ISuccessCb> resolveCb(createChainedCb<typename MaskVoid<T>::type, Out,
-            typename FuncTraits<F>::RetType>(std::forward<F>(cb), next));
+        typedef typename MaskVoid<T>::type In;
 
+        // Already resolved: the promise returned by the callback is all that the caller needs,
+        // so neither a callback object nor a chaining promise are created
         if (mSharedObj->mResolved == kSucceeded)
-        {
-            (*resolveCb)(mSharedObj->mResult);
-        }
-        else
-        {
-            assert((mSharedObj->mResolved == kNotResolved));
-            thenCbs().push(resolveCb);
-        }
+            return callHandler<In, Out, typename FuncTraits<F>::RetType>(cb, mSharedObj->mResult);
 
+        assert((mSharedObj->mResolved == kNotResolved));
+        Promise<Out> next;
+        addChainedCb<In, Out, typename FuncTraits<F>::RetType>(thenCbs(), std::forward<F>(cb), next);
+        mSharedObj->mHasCbs = true;
         return next;
     }
 /** Adds a handler to be executed in case the promise is rejected
@@ -574,23 +703,19 @@ public:
             return master.fail(std::forward<F>(eb));
 
         if (mSharedObj->mResolved == kSucceeded)
-            return mSharedObj->mResult; //don't call the errorback, just return the successful resolve value
-
-        Promise<T> next;
-        std::unique_ptr<IFailCb> failCb(createChainedCb<Error, T,
-            typename FuncTraits<F>::RetType>(std::forward<F>(eb), next));
+            return *this; //don't call the errorback, just return the successful resolve value
 
         if (mSharedObj->mResolved == kFailed)
         {
-            (*failCb)(mSharedObj->mError);
+            Promise<T> ret = callHandler<Error, T, typename FuncTraits<F>::RetType>(eb, mSharedObj->mError);
             mSharedObj->mError.setHandled();
-        }
-        else
-        {
-            assert((mSharedObj->mResolved == kNotResolved));
-            failCbs().push(failCb);
+            return ret;
         }
 
+        assert((mSharedObj->mResolved == kNotResolved));
+        Promise<T> next;
+        addChainedCb<Error, T, typename FuncTraits<F>::RetType>(failCbs(), std::forward<F>(eb), next);
+        mSharedObj->mHasCbs = true;
         return next;
     }
     //val can be a by-value param, const& or &&
@@ -626,7 +751,7 @@ public:
     }
 
 protected:
-    inline bool hasCallbacks() const { return (mSharedObj->mCbs!=NULL); }
+    inline bool hasCallbacks() const { return mSharedObj->mHasCbs; }
     void doResolve(const typename MaskVoid<T>::type& val)
     {
         auto& cbs = thenCbs();
@@ -661,7 +786,7 @@ protected:
             {
                 for (int i=0; i<cnt; i++)
                 {
-                    auto& item = ebs[i];
+                    auto item = ebs[i];
                     static_cast<IFailCbWithPromise*>(item)->nextPromise.resolve(val);
                 }
             }
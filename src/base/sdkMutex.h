@@ -0,0 +1,86 @@
+#ifndef _MEGA_BASE_SDKMUTEX_INCLUDED
+#define _MEGA_BASE_SDKMUTEX_INCLUDED
+/**
+ * @file sdkMutex.h
+ * @brief Recursive mutex shared by the MEGAchat API, its timers and its websockets
+ *
+ * (c) 2013-2015 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+namespace karere
+{
+/**
+ * @brief Recursive mutex that also tells whether the calling thread holds it
+ *
+ * It meets the Lockable requirements, so it can be used with std::lock_guard and
+ * std::unique_lock. Everything that shares the lock must take it through this class,
+ * otherwise isHeldByThisThread() would miss those locks.
+ */
+class SdkMutex
+{
+public:
+    SdkMutex() = default;
+    SdkMutex(const SdkMutex&) = delete;
+    SdkMutex& operator=(const SdkMutex&) = delete;
+
+    void lock()
+    {
+        mMutex.lock();
+        onLocked();
+    }
+
+    bool try_lock()
+    {
+        if (!mMutex.try_lock())
+        {
+            return false;
+        }
+
+        onLocked();
+        return true;
+    }
+
+    void unlock()
+    {
+        if (--mDepth == 0)
+        {
+            mOwner = std::thread::id();
+        }
+        mMutex.unlock();
+    }
+
+    bool isHeldByThisThread() const { return mOwner == std::this_thread::get_id(); }
+
+private:
+    std::recursive_mutex mMutex;
+    std::atomic<std::thread::id> mOwner{std::thread::id()};
+    unsigned int mDepth = 0;    // only accessed by the owner
+
+    void onLocked()
+    {
+        if (mDepth++ == 0)
+        {
+            mOwner = std::this_thread::get_id();
+        }
+    }
+};
+}
+
+#endif
@@ -0,0 +1,346 @@
+#include "timers.hpp"
+#include <algorithm>
+
+namespace karere
+{
+
+namespace
+{
+unsigned lowestBit(uint64_t bits)
+{
+    assert(bits);
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctzll(bits));
+#else
+    unsigned idx = 0;
+    while (!(bits & 1))
+    {
+        bits >>= 1;
+        idx++;
+    }
+    return idx;
+#endif
+}
+}
+
+TimerWheel::TimerWheel(uv_loop_t* loop, SdkMutex& mutex, void* appCtx)
+    : mLoop(loop),
+      mUvTimer(new uv_timer_t()),
+      mMutex(mutex),
+      mAppCtx(appCtx),
+      mLoopThread(std::this_thread::get_id()),
+      mStartTime(uv_now(loop))
+{
+    uv_timer_init(mLoop, mUvTimer);
+    mUvTimer->data = this;
+}
+
+TimerWheel::~TimerWheel()
+{
+    assert(isLoopThread());
+    // the handle is freed by the loop, which may outlive the wheel
+    uv_timer_stop(mUvTimer);
+    uv_close(reinterpret_cast<uv_handle_t*>(mUvTimer), [](uv_handle_t* handle)
+    {
+        delete reinterpret_cast<uv_timer_t*>(handle);
+    });
+
+    for (auto& entry: mTimers)
+    {
+        if (entry.second != mFiring)
+        {
+            delete entry.second;
+        }
+    }
+    for (auto& entry: mPendingStart)
+    {
+        delete entry.second;
+    }
+}
+
+TimerWheel::Timer* TimerWheel::takePendingStart(megaHandle handle)
+{
+    std::lock_guard<std::mutex> lock(mPendingMutex);
+    auto it = mPendingStart.find(handle);
+    if (it == mPendingStart.end())
+    {
+        return nullptr;
+    }
+    Timer* timer = it->second;
+    mPendingStart.erase(it);
+    return timer;
+}
+
+megaHandle TimerWheel::add(Timer* timer, unsigned delay, unsigned period)
+{
+    megaHandle handle = ++mLastHandle;
+    if (!handle) // wrapped around, 0 is the invalid handle
+    {
+        handle = ++mLastHandle;
+    }
+    timer->handle = handle;
+    timer->delay = delay;
+    timer->period = period;
+
+    if (isLoopThread())
+    {
+        start(timer);
+    }
+    else
+    {
+        {
+            // until it's started in the loop, the timer can still be cancelled from there
+            std::lock_guard<std::mutex> lock(mPendingMutex);
+            mPendingStart.emplace(handle, timer);
+        }
+        marshallCall([this, handle]()
+        {
+            Timer* timer = takePendingStart(handle);
+            if (timer)
+            {
+                start(timer);
+            }
+        }, mAppCtx);
+    }
+    return handle;
+}
+
+bool TimerWheel::cancel(megaHandle handle)
+{
+    if (!isLoopThread())
+    {
+        marshallCall([this, handle]() { cancel(handle); }, mAppCtx);
+        return true;
+    }
+
+    auto it = mTimers.find(handle);
+    if (it == mTimers.end())
+    {
+        // added from another thread and not started yet, or not valid anymore
+        Timer* pending = takePendingStart(handle);
+        delete pending;
+        return pending != nullptr;
+    }
+    Timer* timer = it->second;
+    mTimers.erase(it);
+    if (timer == mFiring)
+    {
+        // cancelled from its own callback, it's deleted once the callback returns
+        mFiringCanceled = true;
+        return true;
+    }
+    unlink(timer);
+    delete timer;
+    if (mTimers.empty() && mScheduledTick)
+    {
+        uv_timer_stop(mUvTimer);
+        mScheduledTick = 0;
+    }
+    return true;
+}
+
+uint64_t TimerWheel::loopTick() const
+{
+    return uv_now(mLoop) - mStartTime;
+}
+
+void TimerWheel::start(Timer* timer)
+{
+    assert(isLoopThread());
+    if (mTimers.empty() && !mFiring)
+    {
+        // nothing is pending, the wheel can jump to the current time
+        mNow = std::max(mNow, loopTick());
+    }
+    mTimers.emplace(timer->handle, timer);
+    timer->expiry = loopTick() + timer->delay;
+    insert(timer);
+    if (!mFiring)
+    {
+        schedule();
+    }
+}
+
+void TimerWheel::insert(Timer* timer, bool cascading)
+{
+    // the slots of the current tick have been processed already, except while the timers
+    // of the upper levels are moved down: they are processed right after, so the timers
+    // that expire at this tick still fire on time
+    uint64_t earliest = cascading ? mNow : mNow + 1;
+    assert(!cascading || timer->expiry >= mNow);
+    if (timer->expiry < earliest)
+    {
+        timer->expiry = earliest;
+    }
+
+    // the lowest level whose span contains both the current tick and the expiry
+    unsigned level = 0;
+    while (level + 1 < kLevels
+           && (timer->expiry >> (kSlotBits * (level + 1))) != (mNow >> (kSlotBits * (level + 1))))
+    {
+        level++;
+    }
+    assert((timer->expiry >> (kSlotBits * kLevels)) == (mNow >> (kSlotBits * kLevels)));
+
+    unsigned idx = static_cast<unsigned>(timer->expiry >> (kSlotBits * level)) & (kSlotsPerLevel - 1);
+    timer->slot = static_cast<int>(level * kSlotsPerLevel + idx);
+    Link& slot = mSlots[timer->slot];
+    timer->prev = slot.prev;
+    timer->next = &slot;
+    slot.prev->next = timer;
+    slot.prev = timer;
+    mOccupied[level] |= uint64_t(1) << idx;
+}
+
+void TimerWheel::unlink(Timer* timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = timer->next = timer;
+    if (timer->slot >= 0)
+    {
+        Link& slot = mSlots[timer->slot];
+        if (slot.next == &slot)
+        {
+            unsigned slotIdx = static_cast<unsigned>(timer->slot);
+            mOccupied[slotIdx / kSlotsPerLevel] &= ~(uint64_t(1) << (slotIdx % kSlotsPerLevel));
+        }
+        timer->slot = -1;
+    }
+}
+
+bool TimerWheel::nextTick(uint64_t& tick) const
+{
+    // Occupied slots are always ahead of the current tick in their level, and the slots
+    // of a level are processed before any slot of the upper levels
+    for (unsigned level = 0; level < kLevels; level++)
+    {
+        if (mOccupied[level])
+        {
+            unsigned shift = kSlotBits * level;
+            uint64_t base = (mNow >> (shift + kSlotBits)) << (shift + kSlotBits);
+            tick = base | (uint64_t(lowestBit(mOccupied[level])) << shift);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TimerWheel::schedule()
+{
+    uint64_t tick;
+    if (!nextTick(tick))
+    {
+        if (mScheduledTick)
+        {
+            uv_timer_stop(mUvTimer);
+            mScheduledTick = 0;
+        }
+        return;
+    }
+    if (tick == mScheduledTick)
+    {
+        return;
+    }
+    uint64_t now = loopTick();
+    mScheduledTick = tick;
+    uv_timer_start(mUvTimer, &TimerWheel::onUvTimer, tick > now ? tick - now : 0, 0);
+}
+
+void TimerWheel::onUvTimer(uv_timer_t* handle)
+{
+    TimerWheel* self = static_cast<TimerWheel*>(handle->data);
+    std::lock_guard<SdkMutex> lock(self->mMutex);
+    self->mScheduledTick = 0;
+    self->process(self->loopTick());
+    self->schedule();
+}
+
+void TimerWheel::process(uint64_t now)
+{
+    uint64_t tick;
+    while (nextTick(tick) && tick <= now)
+    {
+        processTick(tick);
+    }
+    // no slot has to be processed up to now
+    mNow = std::max(mNow, now);
+}
+
+void TimerWheel::processTick(uint64_t tick)
+{
+    mNow = tick;
+
+    // move the timers of the upper levels whose span starts at this tick to the lower levels
+    for (unsigned level = kLevels - 1; level > 0; level--)
+    {
+        unsigned shift = kSlotBits * level;
+        if (tick & ((uint64_t(1) << shift) - 1))
+        {
+            continue;
+        }
+        unsigned idx = static_cast<unsigned>(tick >> shift) & (kSlotsPerLevel - 1);
+        Link& slot = mSlots[level * kSlotsPerLevel + idx];
+        while (slot.next != &slot)
+        {
+            Timer* timer = static_cast<Timer*>(slot.next);
+            unlink(timer);
+            insert(timer, true);
+        }
+    }
+
+    // detach the expired timers, so that their callbacks can add and cancel timers freely
+    Link& slot = mSlots[tick & (kSlotsPerLevel - 1)];
+    Link expired;
+    while (slot.next != &slot)
+    {
+        Timer* timer = static_cast<Timer*>(slot.next);
+        unlink(timer);
+        timer->prev = expired.prev;
+        timer->next = &expired;
+        expired.prev->next = timer;
+        expired.prev = timer;
+    }
+
+    while (expired.next != &expired)
+    {
+        Timer* timer = static_cast<Timer*>(expired.next);
+        unlink(timer);
+        assert(timer->expiry == tick);
+
+        mFiring = timer;
+        mFiringCanceled = false;
+        if (!gCatchException)
+        {
+            timer->fire();
+        }
+        else
+        {
+            try
+            {
+                timer->fire();
+            }
+            catch (std::exception& e)
+            {
+                KR_LOG_ERROR("ERROR: Exception in a timer callback: %s\n", e.what());
+            }
+        }
+        mFiring = nullptr;
+
+        if (mFiringCanceled)
+        {
+            delete timer;
+        }
+        else if (!timer->period)
+        {
+            mTimers.erase(timer->handle);
+            delete timer;
+        }
+        else
+        {
+            timer->expiry = loopTick() + timer->period;
+            insert(timer);
+        }
+    }
+}
+}
@@ -2,7 +2,7 @@
 #define _MEGA_BASE_TIMERS_INCLUDED
 /**
  * @file timers.h
- * @brief C++11 asynchronous timer header-only lib. Provides a timer API similar
+ * @brief C++11 asynchronous timer lib. Provides a timer API similar
  * to that of javascript
  *
  * (c) 2013-2015 by Mega Limited, Auckland, New Zealand
@@ -23,98 +23,131 @@
  */
 #include "cservices.h"
 #include "gcmpp.h"
+#include "sdkMutex.h"
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <assert.h>
 
 namespace karere
 {
 
-struct TimerMsg: public megaMessage
+/** @brief Runs the timers of an event loop, driven by a single uv timer.
+ *
+ * Timers are kept in a hierarchical timing wheel of 1 ms ticks: each level has 64 slots,
+ * and covers 64 times the span of the previous one. A timer is stored in the lowest level
+ * whose span contains both the current tick and its expiration, and it moves down to the
+ * lower levels as the wheel gets closer to its expiration. Adding and cancelling a timer
+ * is O(1), and the uv timer is only started for the next tick at which a slot has to be
+ * processed, so an idle wheel doesn't wake up the loop.
+ *
+ * The wheel is meant to be used from the thread of its event loop, where the callbacks
+ * are called with \c mutex locked. Timers added or cancelled from other threads are
+ * marshalled to the loop.
+ */
+class TimerWheel
 {
-    timerevent* timerEvent = nullptr;
-    bool canceled = false;
-    megaHandle handle;
-    TimerMsg(megaMessageFunc aFunc)
-        :megaMessage(aFunc),
-          handle(services_hstore_add_handle(MEGA_HTYPE_TIMER, this))
-    {}
-   virtual ~TimerMsg()
+public:
+    struct Link
     {
-        services_hstore_remove_handle(MEGA_HTYPE_TIMER, handle);
-        if (timerEvent)
-        {
-            uv_close((uv_handle_t *)timerEvent, [](uv_handle_t* var)
-            {
-                delete (timerevent*)var;
-            });
-        }
-    }
-};
+        Link* prev = this;
+        Link* next = this;
+    };
+    struct Timer: public Link
+    {
+        uint64_t expiry = 0;    // in ticks of the wheel
+        unsigned delay = 0;
+        unsigned period = 0;    // 0 for one-shot timers
+        megaHandle handle = 0;
+        int slot = -1;          // index in mSlots, -1 if the timer is not in the wheel
+        virtual void fire() = 0;
+        virtual ~Timer() {}
+    };
+
+    TimerWheel(uv_loop_t* loop, SdkMutex& mutex, void* appCtx);
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+    ~TimerWheel();
+
+    /** @brief Takes ownership of \c timer, and starts it after \c delay ms, repeating it every
+     * \c period ms if not zero.
+     * @return The handle to cancel it
+     */
+    megaHandle add(Timer* timer, unsigned delay, unsigned period);
+
+    /** @brief Cancels and deletes a timer
+     * @return \c false if the handle is not valid (i.e. the timeout already triggered).
+     * When called from another thread, the cancellation is marshalled and \c true
+     * is returned. A timer added from another thread can be cancelled from the loop
+     * before it's started.
+     */
+    bool cancel(megaHandle handle);
+
+    size_t size() const { return mTimers.size(); }
 
-void init_uv_timer(void *ctx, uv_timer_t *timer);
+protected:
+    static constexpr unsigned kSlotBits = 6;
+    static constexpr unsigned kSlotsPerLevel = 1 << kSlotBits;
+    static constexpr unsigned kLevels = 8; // 2^48 ms
 
-extern std::recursive_mutex timerMutex;
+    uv_loop_t* mLoop;
+    uv_timer_t* mUvTimer;
+    SdkMutex& mMutex;
+    void* mAppCtx;
+    std::thread::id mLoopThread;
+    uint64_t mStartTime;                // loop time (ms) of tick 0
+    uint64_t mNow = 0;                  // tick up to which the wheel has been processed
+    uint64_t mScheduledTick = 0;        // tick for which mUvTimer is started, 0 if stopped
+    Link mSlots[kLevels * kSlotsPerLevel];
+    uint64_t mOccupied[kLevels] = {};   // bitmap of non-empty slots per level
+    std::unordered_map<megaHandle, Timer*> mTimers;
+    std::atomic<megaHandle> mLastHandle{0};
+    Timer* mFiring = nullptr;           // timer whose callback is being called
+    bool mFiringCanceled = false;
+    std::mutex mPendingMutex;
+    std::unordered_map<megaHandle, Timer*> mPendingStart;   // added from other threads, not started yet
+
+    bool isLoopThread() const { return std::this_thread::get_id() == mLoopThread; }
+    uint64_t loopTick() const;
+    void start(Timer* timer);
+    void insert(Timer* timer, bool cascading = false);
+    void unlink(Timer* timer);
+    bool nextTick(uint64_t& tick) const;
+    void schedule();
+    Timer* takePendingStart(megaHandle handle);
+    // processes the slots up to the tick \c now
+    void process(uint64_t now);
+    void processTick(uint64_t tick);
+    static void onUvTimer(uv_timer_t* handle);
+};
+
+/** @brief Returns the timer wheel of the event loop of the app context \c ctx, or null
+ * if its event loop is not running.
+ */
+TimerWheel* timerWheel(void *ctx);
 
 template <int persist, class CB>
 inline megaHandle setTimer(CB&& callback, unsigned time, void *ctx)
 {
-    struct Msg: public TimerMsg
+    struct Timer: public TimerWheel::Timer
     {
-        CB cb;
-        void *appCtx;
-        Msg(CB&& aCb, megaMessageFunc cFunc)
-        :TimerMsg(cFunc), cb(aCb)
+        typename std::decay<CB>::type cb;
+        Timer(CB&& aCb)
+        :cb(std::forward<CB>(aCb))
         {}
-        unsigned time;
-        int loop;
+        void fire() override { cb(); }
     };
-    megaMessageFunc cfunc = persist
-        ? (megaMessageFunc) [](megaMessage* arg)
-          {
-              Msg* msg = static_cast<Msg*>(arg);
-              if (msg->canceled)
-                  return;
-              msg->cb();
-          }
-        : (megaMessageFunc) [](megaMessage* arg)
-          {
-              timerMutex.lock();
-              Msg* msg = static_cast<Msg*>(arg);
-              if (msg->canceled)
-              {
-                  timerMutex.unlock();
-                  return;
-              }
-              msg->cb();
-              if (msg->canceled)
-              {
-                  timerMutex.unlock();
-                  return;
-              }
-              delete msg;
-              timerMutex.unlock();
-          };
-
-    timerMutex.lock();
-    Msg* pMsg = new Msg(std::forward<CB>(callback), cfunc);
-    timerMutex.unlock();
 
-    pMsg->appCtx = ctx;
-    pMsg->time = time;
-    pMsg->loop = persist;
-    marshallCall([pMsg, ctx]()
+    TimerWheel* wheel = timerWheel(ctx);
+    assert(wheel);
+    if (!wheel)
     {
-        pMsg->timerEvent = new uv_timer_t();
-        pMsg->timerEvent->data = pMsg;
-        init_uv_timer(ctx, pMsg->timerEvent);
-        uv_timer_start(pMsg->timerEvent,
-                       [](uv_timer_t* handle)
-                       {
-                           Msg* message = static_cast<Msg*>(handle->data);
-                           megaPostMessageToGui(message, message->appCtx);
-                       }, pMsg->time, pMsg->loop ? pMsg->time : 0);
-    }, ctx);
-    return pMsg->handle;
+        return 0;
+    }
+    return wheel->add(new Timer(std::forward<CB>(callback)), time, persist ? time : 0);
 }
 /** Cancels a previously set timeout with setTimeout()
  * @return \c false if the handle is not valid. This can happen if the timeout
@@ -123,32 +156,9 @@ inline megaHandle setTimer(CB&& callback, unsigned time, void *ctx)
  */
 static inline bool cancelTimeout(megaHandle handle, void *ctx)
 {
-    timerMutex.lock();
-
     assert(handle);
-    TimerMsg* timer = static_cast<TimerMsg*>(services_hstore_get_handle(MEGA_HTYPE_TIMER, handle));
-    if (!timer)
-    {
-        timerMutex.unlock();
-        return false; //not valid anymore
-    }
-
-//we have to make sure that we delete the timer only after all possibly queued
-//timer messages in the app's message queue are processed. For this purpose,
-//we first stop the timer, and only then post a call to delete the timer.
-//That call should be processed after all timer messages
-    timer->canceled = true; //disable timer callback being called by possibly queued messages, and message freeing in one-shot timer handler
-    timerMutex.unlock();
-    marshallCall([timer, ctx]()
-    {
-        uv_timer_stop(timer->timerEvent);
-
-        marshallCall([timer]()
-        {
-            delete timer;
-        }, ctx);
-    }, ctx);
-    return true;
+    TimerWheel* wheel = timerWheel(ctx);
+    return wheel && wheel->cancel(handle);
 }
 /** @brief Cancels a previously set timer with setInterval.
  * @return \c false if the handle is not valid.
@@ -0,0 +1,85 @@
+#include "workerPool.h"
+#include <algorithm>
+
+namespace karere
+{
+
+WorkerPool& WorkerPool::getInstance()
+{
+    static WorkerPool pool(defaultNumThreads());
+    return pool;
+}
+
+unsigned int WorkerPool::defaultNumThreads()
+{
+    return std::min(4u, std::max(1u, std::thread::hardware_concurrency() / 2));
+}
+
+WorkerPool::WorkerPool(unsigned int numThreads)
+{
+    for (unsigned int i = 0; i < numThreads; i++)
+    {
+        mThreads.emplace_back(&WorkerPool::run, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mExit = true;
+    }
+    mCondition.notify_all();
+    for (std::thread& thread : mThreads)
+    {
+        thread.join();
+    }
+
+    // destroy the tasks that didn't get to run, out of the lock, since they may own
+    // objects whose destructors schedule more work
+    std::deque<std::function<void()>> discarded;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        discarded.swap(mTasks);
+    }
+}
+
+void WorkerPool::schedule(std::function<void()>&& task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mExit)
+        {
+            return;     // dropped, like the tasks that were queued at exit
+        }
+        mTasks.emplace_back(std::move(task));
+    }
+    mCondition.notify_one();
+}
+
+size_t WorkerPool::pendingTasks() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mTasks.size();
+}
+
+void WorkerPool::run()
+{
+    for (;;)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondition.wait(lock, [this]() { return mExit || !mTasks.empty(); });
+            if (mExit)
+            {
+                return;
+            }
+
+            task = std::move(mTasks.front());
+            mTasks.pop_front();
+        }
+        task();
+    }
+}
+}
@@ -0,0 +1,109 @@
+#ifndef _MEGA_BASE_WORKERPOOL_INCLUDED
+#define _MEGA_BASE_WORKERPOOL_INCLUDED
+/**
+ * @file workerPool.h
+ * @brief Pool of worker threads for CPU-bound work that must not run in the event loop
+ *
+ * (c) 2013-2015 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace karere
+{
+/**
+ * @brief Runs tasks in a fixed set of threads, in the order they were scheduled
+ *
+ * Tasks must not touch karere objects: they compute a result that is handed back to the
+ * event loop with marshallCall(), and the event loop must check that the result still
+ * applies (see WorkGeneration). When the pool is destroyed, the workers finish the task
+ * they're running and the tasks still queued are destroyed without running, which releases
+ * whatever they captured.
+ */
+class WorkerPool
+{
+public:
+    /** @brief The pool where messages are decrypted */
+    static WorkerPool& getInstance();
+
+    /** @brief Half of the available cores, between 1 and 4 */
+    static unsigned int defaultNumThreads();
+
+    explicit WorkerPool(unsigned int numThreads);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void schedule(std::function<void()>&& task);
+
+    /** @brief Number of tasks waiting for a worker */
+    size_t pendingTasks() const;
+
+private:
+    void run();
+
+    mutable std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::deque<std::function<void()>> mTasks;
+    std::vector<std::thread> mThreads;
+    bool mExit = false;
+};
+
+/**
+ * @brief Tells whether the results of work started in the WorkerPool still apply to its owner
+ *
+ * The owner calls invalidate() whenever the data the work was started for is discarded (ie. the
+ * history is reloaded). A Token taken when the work is started is valid until then, or until
+ * the owner (and so its WorkGeneration) is destroyed.
+ * The generation must only be accessed from the thread that owns it.
+ */
+class WorkGeneration
+{
+public:
+    class Token
+    {
+    public:
+        Token() = default;
+        bool valid() const
+        {
+            std::shared_ptr<unsigned int> current = mCurrent.lock();
+            return current && *current == mGeneration;
+        }
+
+    private:
+        friend class WorkGeneration;
+        Token(const std::shared_ptr<unsigned int>& current)
+            : mCurrent(current), mGeneration(*current) {}
+
+        std::weak_ptr<unsigned int> mCurrent;
+        unsigned int mGeneration = 0;
+    };
+
+    Token token() const { return Token(mCurrent); }
+    void invalidate() { ++*mCurrent; }
+
+private:
+    std::shared_ptr<unsigned int> mCurrent = std::make_shared<unsigned int>(0);
+};
+}
+
+#endif
@@ -1,7 +1,10 @@
 #ifndef __BUFFER_H__
 #define __BUFFER_H__
 #include <assert.h>
+#include <atomic>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
 #include <stdlib.h>
@@ -172,6 +175,8 @@ class Buffer: public StaticBuffer
 {
 protected:
     size_t mBufSize;
+    // Keeps alive the storage referenced by mBuf when the data is shared (not owned) by the buffer
+    std::shared_ptr<const void> mSharedOwner;
     enum {kMinBufSize = 64};
     void zero()
     {
@@ -179,6 +184,27 @@ protected:
         mBufSize = 0;
         mDataSize = 0;
     }
+    /** @brief Replaces shared data by a private copy, so it can be modified */
+    void unshare()
+    {
+        if (!mSharedOwner)
+            return;
+        const char* data = mBuf;
+        size_t datalen = mDataSize;
+        zero();
+        if (datalen)
+        {
+            mBuf = (char*)malloc(datalen);
+            if (!mBuf)
+            {
+                zero();
+                throw std::runtime_error("Buffer::unshare: Out of memory allocating block of size "+ std::to_string(datalen));
+            }
+            memcpy(mBuf, data, datalen);
+            mBufSize = mDataSize = datalen;
+        }
+        mSharedOwner.reset();
+    }
 public:
     char* buf() { return mBuf;}
     const char* buf() const { return mBuf;}
@@ -226,8 +252,29 @@ public:
             zero();
         }
     }
+    /** @brief Creates a buffer that references \c datalen bytes at \c data, without copying them.
+     * The storage is kept alive by \c owner, and it's copied the first time the buffer is modified.
+     * The referenced range must not be shared with other buffers, since it can be written via buf()
+     */
+    Buffer(const char* data, size_t datalen, std::shared_ptr<const void> owner)
+        :StaticBuffer(data, datalen), mBufSize(datalen), mSharedOwner(std::move(owner)) {}
     Buffer(Buffer&& other)
-        :StaticBuffer(other.mBuf, other.mDataSize), mBufSize(other.mBufSize) { other.zero(); }
+        :StaticBuffer(other.mBuf, other.mDataSize), mBufSize(other.mBufSize),
+         mSharedOwner(std::move(other.mSharedOwner)) { other.zero(); }
+    bool isShared() const { return mSharedOwner != nullptr; }
+    /** @brief The object that keeps alive the data of a shared buffer, or null if it's not shared */
+    const std::shared_ptr<const void>& sharedOwner() const { return mSharedOwner; }
+    /** @brief Replaces the data of the buffer by a reference to \c datalen bytes at \c data,
+     * kept alive by \c owner (see Buffer(const char*, size_t, std::shared_ptr<const void>))
+     */
+    void assignShared(const char* data, size_t datalen, std::shared_ptr<const void> owner)
+    {
+        if (mBuf && !mSharedOwner)
+            ::free(mBuf);
+        mBuf = const_cast<char*>(data);
+        mDataSize = mBufSize = datalen;
+        mSharedOwner = std::move(owner);
+    }
 
     template <bool withNull>
     Buffer(const std::string& src)
@@ -239,6 +286,12 @@ public:
     }
     void assign(const void* data, size_t datalen)
     {
+        // data may point into the shared storage, keep it alive until it's copied
+        std::shared_ptr<const void> sharedOwner = std::move(mSharedOwner);
+        if (sharedOwner)
+        {
+            zero();
+        }
         if (mBuf)
         {
             if (datalen <= mBufSize)
@@ -264,6 +317,7 @@ public:
     void copyFrom(const StaticBuffer& src) { assign(src.buf(), src.dataSize()); }
     void reserve(size_t size)
     {
+        unshare();
         if (!mBuf)
         {
             mBuf = (char*)::malloc(size);
@@ -293,6 +347,7 @@ public:
     }
     char* writePtr(size_t offset, size_t dataLen)
     {
+        unshare();
         auto reqdSize = offset+dataLen;
         if (reqdSize > mBufSize)
         {
@@ -314,6 +369,7 @@ public:
     {
         if (!data)
             return *this;
+        unshare();
         auto reqdSize = offset+datalen;
         if (reqdSize <= mDataSize)
         {
@@ -358,9 +414,24 @@ public:
     {
         memset(appendPtr(count), value, count);
     }
-    void clear() { mDataSize = 0; }
+    void clear()
+    {
+        if (mSharedOwner)
+        {
+            // nothing to keep, release the shared storage
+            zero();
+            mSharedOwner.reset();
+        }
+        mDataSize = 0;
+    }
     void free()
     {
+        if (mSharedOwner)
+        {
+            zero();
+            mSharedOwner.reset();
+            return;
+        }
         if (!mBuf)
             return;
         ::free(mBuf);
@@ -370,8 +441,188 @@ public:
 
     ~Buffer()
     {
-        if (mBuf)
+        if (mBuf && !mSharedOwner)
             ::free(mBuf);
     }
 };
+
+/** @brief Read-only view of received data that keeps alive the slab it points into.
+ *
+ * Slices of a received buffer share its slab, so parsers can hand out payloads
+ * (see Buffer(const char*, size_t, std::shared_ptr<const void>)) without copying them.
+ * A RecvBuffer without slab is a plain view, and payloads taken from it must be copied.
+ */
+class RecvBuffer: public StaticBuffer
+{
+protected:
+    std::shared_ptr<const void> mSlab;
+public:
+    RecvBuffer(const void* data, size_t datasize, std::shared_ptr<const void> slab = nullptr)
+        :StaticBuffer(data, datasize), mSlab(std::move(slab)) {}
+    const std::shared_ptr<const void>& slab() const { return mSlab; }
+    RecvBuffer slice(size_t offset, size_t len) const
+    {
+        return RecvBuffer(readPtr(offset, len), len, mSlab);
+    }
+    /** @brief Returns a Buffer with the data, which shares the slab if there's one, or a copy otherwise */
+    Buffer share() const
+    {
+        return mSlab ? Buffer(mBuf, mDataSize, mSlab) : Buffer(mBuf, mDataSize);
+    }
+};
+
+/** @brief Packs the data of many small, long-lived buffers into shared chunks.
+ *
+ * A buffer adopted by the arena references a range of the current chunk, in the same way as
+ * received data references its slab (see RecvBuffer), so it's copied out of the arena the first
+ * time it's modified. This avoids a heap block (with its header and rounding slack) per buffer.
+ * A chunk is freed when the last buffer referencing it is released, from any thread, even after
+ * the arena has been destroyed.
+ */
+class BufferArena
+{
+public:
+    enum: size_t
+    {
+        kChunkSize = 16384,         // size of every chunk
+        kMaxAdoptedSize = 1024,     // larger buffers are kept in their own heap block
+        kAlignment = 8              // alignment of the data of adopted buffers
+    };
+
+    BufferArena(): mLiveBytes(std::make_shared<std::atomic<size_t>>(0)) {}
+
+    /** @brief Moves the data of \c buf into the arena. Returns false if \c buf is empty, too
+     * large or already in an arena, in which case it's not moved.
+     *
+     * Data shared with other storage (ie. a slice of a received frame) is copied too, so it
+     * doesn't keep that storage alive. If it's too large for the arena, it's copied to its own
+     * heap block instead.
+     */
+    bool adopt(Buffer& buf)
+    {
+        size_t size = buf.dataSize();
+        if (!size || contains(buf))
+        {
+            return false;
+        }
+
+        if (size > kMaxAdoptedSize)
+        {
+            if (buf.isShared())
+            {
+                buf.assign(buf.buf(), size);
+            }
+            return false;
+        }
+
+        size_t alignedSize = (size + kAlignment - 1) & ~(kAlignment - 1);
+        if (!mChunk || mChunkUsed + alignedSize > kChunkSize)
+        {
+            mChunk.reset(new char[kChunkSize], ChunkDeleter{mLiveBytes});
+            *mLiveBytes += kChunkSize;
+            mChunkUsed = 0;
+        }
+
+        char* data = mChunk.get() + mChunkUsed;
+        memcpy(data, buf.buf(), size);
+        mChunkUsed += alignedSize;
+        buf.assignShared(data, size, mChunk);
+        return true;
+    }
+
+    /** @brief Size in bytes of the chunks of this arena that are still alive */
+    size_t liveBytes() const { return *mLiveBytes; }
+
+    /** @brief Whether the data of \c buf is in a chunk of any arena */
+    static bool contains(const Buffer& buf)
+    {
+        return buf.isShared() && std::get_deleter<ChunkDeleter>(buf.sharedOwner());
+    }
+
+private:
+    struct ChunkDeleter
+    {
+        std::shared_ptr<std::atomic<size_t>> liveBytes;
+        void operator()(char* chunk) const
+        {
+            *liveBytes -= kChunkSize;
+            delete[] chunk;
+        }
+    };
+
+    std::shared_ptr<char> mChunk;
+    size_t mChunkUsed = 0;
+    // shared with the chunks, which may outlive the arena
+    std::shared_ptr<std::atomic<size_t>> mLiveBytes;
+};
+
+/** @brief Pool of slabs used to receive data from the network.
+ *
+ * Slabs are returned to the pool when the last RecvBuffer (or shared Buffer) referencing
+ * them is released, from any thread, even after the pool has been destroyed.
+ */
+class RecvBufferPool: public std::enable_shared_from_this<RecvBufferPool>
+{
+public:
+    enum: size_t
+    {
+        kMaxFreeSlabs = 4,              // max number of slabs kept for reuse
+        kMaxPooledSlabSize = 1 << 20    // larger slabs are freed when released
+    };
+
+    /** @brief Returns an empty slab with room for at least \c size bytes */
+    std::shared_ptr<Buffer> getSlab(size_t size)
+    {
+        Buffer* slab = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            for (auto it = mFree.begin(); it != mFree.end(); it++)
+            {
+                if ((*it)->bufSize() >= size)
+                {
+                    slab = it->release();
+                    mFree.erase(it);
+                    break;
+                }
+            }
+        }
+        if (!slab)
+        {
+            slab = new Buffer(size > (size_t)kMinSlabSize ? size : (size_t)kMinSlabSize);
+        }
+        std::weak_ptr<RecvBufferPool> wptr = shared_from_this();
+        return std::shared_ptr<Buffer>(slab, [wptr](Buffer* released)
+        {
+            std::shared_ptr<RecvBufferPool> pool = wptr.lock();
+            if (pool)
+            {
+                pool->recycle(released);
+            }
+            else
+            {
+                delete released;
+            }
+        });
+    }
+
+private:
+    enum: size_t { kMinSlabSize = 4096 };
+    std::mutex mMutex;
+    std::vector<std::unique_ptr<Buffer>> mFree;
+
+    void recycle(Buffer* slab)
+    {
+        std::unique_ptr<Buffer> owned(slab);
+        if (owned->bufSize() > (size_t)kMaxPooledSlabSize)
+        {
+            return;
+        }
+        owned->clear();
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mFree.size() < kMaxFreeSlabs)
+        {
+            mFree.push_back(std::move(owned));
+        }
+    }
+};
 #endif
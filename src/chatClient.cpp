@@ -29,6 +29,7 @@
 #include <chatdDb.h>
 #include <codecvt> //for nonWhitespaceStr()
 #include <db.h>
+#include <limits>
 #include <locale>
 #include <megaapi_impl.h>
 #include <memory>
@@ -496,6 +497,34 @@ bool Client::openDb(const std::string& sid)
                                getLoggingName(),
                                gDbSchemaVersionSuffix);
             }
+            else if (cachedVersionSuffix == "15" && (strcmp(gDbSchemaVersionSuffix, "16") == 0))
+            {
+                KR_LOG_WARNING("%sUpdating schema of MEGAchat cache...", getLoggingName());
+
+                // Persist the payload length, so the indexes used by hot queries can cover it
+                db.query("ALTER TABLE `history` ADD data_len int not null default 0");
+                db.query("ALTER TABLE `node_history` ADD data_len int not null default 0");
+                db.query("update history set data_len = length(data)");
+                db.query("update node_history set data_len = length(data)");
+
+                // Unread counters are persisted, and counted on demand if unknown
+                db.query("ALTER TABLE `chats` ADD unread_count int default -1");
+                db.query("ALTER TABLE `chats` ADD unread_idx int");
+
+                std::string unreadIndex = "CREATE INDEX history_unread ON history(chatid, idx, userid, updated, data_len, type, is_encrypted)"
+                                          " WHERE " + ChatdSqliteDb::HotQueries::unreadIndexCondition();
+                db.query(unreadIndex.c_str());
+                db.query("CREATE INDEX history_last_text ON history(chatid, idx, type, data_len)");
+                db.query("CREATE INDEX sending_chatid ON sending(chatid)");
+                db.query("CREATE INDEX manual_sending_chatid ON manual_sending(chatid)");
+
+                db.query("update vars set value = ? where name = 'schema_version'", currentVersion);
+                db.commit();
+                ok = true;
+                KR_LOG_WARNING("%sDatabase version has been updated to %s",
+                               getLoggingName(),
+                               gDbSchemaVersionSuffix);
+            }
         }
     }
 
@@ -900,6 +929,29 @@ void Client::heartbeat()
     }
 }
 
+void Client::scheduleDbFlush(unsigned delayMs)
+{
+    if (mDbFlushTimer)
+    {
+        karere::cancelTimeout(mDbFlushTimer, appCtx);
+    }
+
+    auto wptr = weakHandle();
+    mDbFlushTimer = karere::setTimeout([this, wptr]()
+    {
+        if (wptr.deleted())
+        {
+            return;
+        }
+
+        mDbFlushTimer = 0;
+        if (db.isOpen())
+        {
+            db.onFlushTimer();
+        }
+    }, delayMs, appCtx);
+}
+
 Client::~Client()
 {
     assert(isTerminated());
@@ -1599,7 +1651,9 @@ void Client::initWithDbSession(const char* sid)
         mDnsCache.loadFromDb();
         mContactList->loadFromDb();
         mChatdClient.reset(new chatd::Client(this));
+        mInitStats.stageStart(InitStats::kStatsLoadChats);
         chats->loadFromDb();
+        mInitStats.stageEnd(InitStats::kStatsLoadChats);
 
 #if WEBSOCKETS_TLS_SESSION_CACHE_ENABLED
         if (websocketIO && websocketIO->hasSessionCache())
@@ -2425,6 +2479,12 @@ void Client::terminate(bool deleteDb)
         mPresencedClient.disconnect();
     }
 
+    if (mDbFlushTimer)
+    {
+        karere::cancelTimeout(mDbFlushTimer, appCtx);
+        mDbFlushTimer = 0;
+    }
+
     // close or delete MEGAchat's DB file
     try
     {
@@ -2691,6 +2751,69 @@ bool ChatRoom::isChatdChatInitialized()
     return mChat;
 }
 
+void ChatRoom::deferInitWithChatd(std::unique_ptr<ChatSummary> summary, std::function<void()> initWithChatd)
+{
+    assert(!mChat && summary);
+    mChatSummary = std::move(summary);
+    mPendingChatdInit = std::move(initWithChatd);
+}
+
+void ChatRoom::materializeChatdChat()
+{
+    if (!mPendingChatdInit)
+    {
+        return;
+    }
+
+    // it loads the history from db and notifies the app, like the rest of the chatd events
+    assert(parent.mKarereClient.app.isKarereContext());
+
+    // chatd::Chat notifies the room while it's being created, so it must not be pending anymore
+    auto initWithChatd = std::move(mPendingChatdInit);
+    mPendingChatdInit = nullptr;
+    initWithChatd();
+    mChatSummary.reset();
+
+    auto display = roomGui();
+    if (display)
+    {
+        display->onChatdChatCreated();
+    }
+}
+
+chatd::ChatState ChatRoom::chatdOnlineState() const
+{
+    // chatd is only joined after creating the chatd::Chat of every room
+    return isChatdChatPending() ? chatd::kChatStateOffline : chat().onlineState();
+}
+
+uint32_t ChatRoom::getRetentionTime() const
+{
+    // it isn't cached: chatd sends it after joining (see chatd::Chat::onRetentionTimeUpdated)
+    return isChatdChatPending() ? 0 : chat().getRetentionTime();
+}
+
+int ChatRoom::unreadMsgCount() const
+{
+    return isChatdChatPending() ? mChatSummary->unreadCount : chat().unreadMsgCount();
+}
+
+uint8_t ChatRoom::lastTextMessage(chatd::LastTextMsg*& msg)
+{
+    if (!isChatdChatPending())
+    {
+        return chat().lastTextMessage(msg);
+    }
+
+    msg = mChatSummary->lastTextMsg.isValid() ? &mChatSummary->lastTextMsg : nullptr;
+    return mChatSummary->lastTextMsg.state();
+}
+
+uint32_t ChatRoom::lastMessageTs()
+{
+    return isChatdChatPending() ? mChatSummary->lastMsgTs : chat().lastMessageTs();
+}
+
 const char* ChatRoom::getLoggingName() const
 {
     return parent.mKarereClient.getLoggingName();
@@ -2744,7 +2867,7 @@ void PeerChatRoom::initWithChatd()
 
 void PeerChatRoom::connect()
 {
-    mChat->connect();
+    chat().connect();
 }
 
 promise::Promise<void> PeerChatRoom::requesGrantAccessToNodes(mega::MegaNodeList *nodes)
@@ -2846,7 +2969,7 @@ GroupChatRoom::GroupChatRoom(ChatRoomList& parent, const mega::MegaTextChat& aCh
     assert(mChatOptions.isValid());
     bool isPublicChat = aChat.isPublicChat();
     // Save Chatroom into DB
-    auto db = parent.mKarereClient.db;
+    auto& db = parent.mKarereClient.db;
     db.query("insert or replace into chats(chatid, shard, peer, peer_priv, "
              "own_priv, ts_created, archived, mode, meeting, chat_options) values(?,?,-1,0,?,?,?,?,?,?)",
              mChatid, mShardNo, mOwnPriv, aChat.getCreationTime(), aChat.isArchived(), isPublicChat, mMeeting, mChatOptions.value());
@@ -2922,7 +3045,8 @@ GroupChatRoom::GroupChatRoom(ChatRoomList& parent, const mega::MegaTextChat& aCh
 //Resume from cache
 GroupChatRoom::GroupChatRoom(ChatRoomList& parent, const uint64_t& chatid,
     unsigned char aShard, chatd::Priv aOwnPriv, int64_t ts, bool aIsArchived,
-    const std::string& title, int isTitleEncrypted, bool publicChat, std::shared_ptr<std::string> unifiedKey, int isUnifiedKeyEncrypted, bool meeting, mega::ChatOptions_t options)
+    const std::string& title, int isTitleEncrypted, bool publicChat, std::shared_ptr<std::string> unifiedKey, int isUnifiedKeyEncrypted, bool meeting, mega::ChatOptions_t options,
+    std::unique_ptr<ChatSummary> summary)
     : ChatRoom(parent, chatid, true, aShard, aOwnPriv, ts, aIsArchived)
     , mRoomGui(nullptr), mMeeting(meeting), mChatOptions(options)
 {
@@ -2944,7 +3068,18 @@ GroupChatRoom::GroupChatRoom(ChatRoomList& parent, const uint64_t& chatid,
     mMemberNamesResolved = promise::when(promises);
 
     // Initialize chatd::Client (and strongvelope)
-    initWithChatd(publicChat, unifiedKey, isUnifiedKeyEncrypted);
+    if (summary)
+    {
+        summary->publicChat = publicChat;
+        deferInitWithChatd(std::move(summary), [this, publicChat, unifiedKey, isUnifiedKeyEncrypted]()
+        {
+            initWithChatd(publicChat, unifiedKey, isUnifiedKeyEncrypted);
+        });
+    }
+    else
+    {
+        initWithChatd(publicChat, unifiedKey, isUnifiedKeyEncrypted);
+    }
 
     // Initialize title, if any
     initChatTitle(title, isTitleEncrypted);
@@ -2970,7 +3105,7 @@ GroupChatRoom::GroupChatRoom(ChatRoomList& parent, const uint64_t& chatid,
     parent.mKarereClient.setCommitMode(false);
 
     //save to db
-    auto db = parent.mKarereClient.db;
+    auto& db = parent.mKarereClient.db;
     db.query(
         "insert or replace into chats(chatid, shard, peer, peer_priv, "
         "own_priv, ts_created, mode, unified_key, meeting) values(?,?,-1,0,?,?,2,?,?)",
@@ -3010,7 +3145,7 @@ void GroupChatRoom::connect()
     if (chat().onlineState() != chatd::kChatStateOffline)
         return;
 
-    mChat->connect();
+    chat().connect();
 }
 
 promise::Promise<void> GroupChatRoom::memberNamesResolved() const
@@ -3027,14 +3162,21 @@ IApp::IPeerChatListItem* PeerChatRoom::addAppItem()
 //Resume from cache
 PeerChatRoom::PeerChatRoom(ChatRoomList& parent, const uint64_t& chatid,
     unsigned char aShard, chatd::Priv aOwnPriv, const uint64_t& peer,
-    chatd::Priv peerPriv, int64_t ts, bool aIsArchived)
+    chatd::Priv peerPriv, int64_t ts, bool aIsArchived, std::unique_ptr<ChatSummary> summary)
     :ChatRoom(parent, chatid, false, aShard, aOwnPriv, ts, aIsArchived),
     mPeer(peer),
     mPeerPriv(peerPriv),
     mRoomGui(nullptr)
 {
     initContact(peer);
-    initWithChatd();
+    if (summary)
+    {
+        deferInitWithChatd(std::move(summary), [this]() { initWithChatd(); });
+    }
+    else
+    {
+        initWithChatd();
+    }
     mRoomGui = addAppItem();
     mIsInitializing = false;
 }
@@ -3070,7 +3212,7 @@ PeerChatRoom::~PeerChatRoom()
         }
     }
 
-    if (client.mChatdClient)
+    if (client.mChatdClient && !isChatdChatPending())
     {
         client.mChatdClient->leave(mChatid);
     }
@@ -3209,7 +3351,7 @@ bool ChatRoom::syncOwnPriv(chatd::Priv newPriv)
                          karere::Id(chatid()).toString().c_str());
 
             // Join
-            mChat->setPublicHandle(Id::inval());
+            chat().setPublicHandle(Id::inval());
 
             // Remove preview mode flag from DB
             parent.mKarereClient.db.query("update chats set mode = '1' where chatid = ?", mChatid);
@@ -3421,7 +3563,7 @@ ChatRoomList::ChatRoomList(Client& aClient)
 
 void ChatRoomList::loadFromDb()
 {
-    auto db = mKarereClient.db;
+    auto& db = mKarereClient.db;
 
     //We need to ensure that the DB does not contain any record related with a preview
     SqliteStmt stmtPreviews(db, "select chatid from chats where mode = '2'");
@@ -3431,7 +3573,10 @@ void ChatRoomList::loadFromDb()
         deleteRoomFromDb(chatid);
     }
 
-    SqliteStmt stmt(db, "select chatid, ts_created ,shard, own_priv, peer, peer_priv, title, archived, mode, unified_key, meeting, chat_options from chats");
+    SqliteStmt stmt(db, ChatdSqliteDb::hotQueries().chatSummaries);
+    stmt << chatd::Message::kMsgTruncate
+         << chatd::Message::kMsgRevokeAttachment
+         << chatd::Message::kMsgInvalid;
     while(stmt.step())
     {
         auto chatid = stmt.integralCol<uint64_t>(0);
@@ -3453,7 +3598,8 @@ void ChatRoomList::loadFromDb()
                                              peer,
                                              stmt.integralCol<chatd::Priv>(5),
                                              stmt.integralCol<int>(1),
-                                             stmt.integralCol<int>(7));
+                                             stmt.integralCol<int>(7),
+                                             loadChatSummary(stmt));
             room = peerRoom;
             if (peerRoom->isNoteToSelf())
             {
@@ -3492,12 +3638,59 @@ void ChatRoomList::loadFromDb()
                 auxTitle.assign(posTitle, len);
             }
 
-            room = new GroupChatRoom(*this, chatid, stmt.integralCol<unsigned char>(2), stmt.integralCol<chatd::Priv>(3), stmt.integralCol<int>(1), stmt.integralCol<int>(7), auxTitle, isTitleEncrypted, stmt.integralCol<int>(8), unifiedKey, isUnifiedKeyEncrypted, stmt.integralCol<int>(10), stmt.integralCol<mega::ChatOptions_t>(11));
+            room = new GroupChatRoom(*this, chatid, stmt.integralCol<unsigned char>(2), stmt.integralCol<chatd::Priv>(3), stmt.integralCol<int>(1), stmt.integralCol<int>(7), auxTitle, isTitleEncrypted, stmt.integralCol<int>(8), unifiedKey, isUnifiedKeyEncrypted, stmt.integralCol<int>(10), stmt.integralCol<mega::ChatOptions_t>(11), loadChatSummary(stmt));
         }
         emplace(chatid, room);
     }
 }
 
+std::unique_ptr<ChatRoom::ChatSummary> ChatRoomList::loadChatSummary(SqliteStmt& stmt)
+{
+    if (!mKarereClient.lazyChatInit())
+    {
+        return nullptr;
+    }
+
+    // the summary must match what chatd::Chat would load from db, otherwise the chatd::Chat is
+    // created right away (the unread counter is rebuilt then, so next init can be lazy)
+    bool counterKnown = sqlite3_column_type(stmt, 12) != SQLITE_NULL && stmt.integralCol<int>(12) >= 0
+            && sqlite3_column_type(stmt, 13) != SQLITE_NULL;
+    chatd::Idx lastSeenIdx = (sqlite3_column_type(stmt, 14) == SQLITE_NULL)
+            ? CHATD_IDX_INVALID
+            : stmt.integralCol<chatd::Idx>(14);
+    bool haveAllHistory = stmt.integralCol<int>(15);
+    bool hasLastMsg = sqlite3_column_type(stmt, 18) != SQLITE_NULL;
+    if (!counterKnown
+            || stmt.integralCol<chatd::Idx>(13) != lastSeenIdx
+            || stmt.integralCol<int>(16)                    // the last message could be in the send queue
+            || (hasLastMsg && !stmt.integralCol<int>(23))   // RAM and db could disagree about the last message
+            || (!hasLastMsg && !haveAllHistory))            // the last message would be fetched from chatd
+    {
+        return nullptr;
+    }
+
+    std::unique_ptr<ChatRoom::ChatSummary> summary(new ChatRoom::ChatSummary);
+    summary->unreadCount = stmt.integralCol<int>(12);
+    if (lastSeenIdx == CHATD_IDX_INVALID && !haveAllHistory)
+    {
+        summary->unreadCount = -summary->unreadCount;   // there may be more unread messages in server
+    }
+
+    if (hasLastMsg)
+    {
+        Buffer buf;
+        stmt.blobCol(19, buf);
+        summary->lastTextMsg.assign(buf, stmt.integralCol<uint8_t>(17), stmt.integralCol<uint64_t>(20),
+                                    stmt.integralCol<chatd::Idx>(18), stmt.integralCol<uint64_t>(21));
+        summary->lastMsgTs = stmt.integralCol<uint32_t>(22);
+    }
+    else
+    {
+        summary->lastMsgTs = stmt.integralCol<uint32_t>(1);
+    }
+    return summary;
+}
+
 void ChatRoomList::addMissingRoomsFromApi(const mega::MegaTextChatList& rooms, SetOfIds& chatids)
 {
     auto size = rooms.size();
@@ -3682,19 +3875,19 @@ void GroupChatRoom::rejoinChatOwnUser()
 {
     // in case chat-link was invalidated during preview, the room was disabled
     // now, we upgrade from (invalid) previewer to participant --> enable it back
-    if (mChat->isDisabled())
+    if (chat().isDisabled())
     {
         KR_LOG_WARNING("%sEnable chatroom previously in preview mode", getLoggingName());
-        mChat->disable(false);
+        chat().disable(false);
     }
 
     // if already connected, need to send a new JOIN to chatd
     if (parent.mKarereClient.connected())
     {
         KR_LOG_DEBUG("%sConnecting existing room to chatd after re-join...", getLoggingName());
-        if (mChat->onlineState() < ::chatd::ChatState::kChatStateJoining)
+        if (chat().onlineState() < ::chatd::ChatState::kChatStateJoining)
         {
-            mChat->connect();
+            chat().connect();
         }
         else
         {
@@ -3996,7 +4189,7 @@ GroupChatRoom::~GroupChatRoom()
         parent.deleteRoomFromDb(mChatid);
     }
 
-    if (parent.mKarereClient.mChatdClient)
+    if (parent.mKarereClient.mChatdClient && !isChatdChatPending())
     {
         parent.mKarereClient.mChatdClient->leave(mChatid);
     }
@@ -4177,7 +4370,8 @@ bool ChatRoom::setAppChatHandler(IApp::IChatHandler* handler)
 // mAppChatHandler->init() may rely on some events, so we need to set mChatWindow as listener before
 // calling init(). This is safe, as and we will not get any async events before we
 //return to the event loop
-    mChat->setListener(mAppChatHandler);
+    chat().setListener(mAppChatHandler);
+    mChat->setHistoryPinned(true);
     mAppChatHandler->init(*mChat, dummyIntf);
     return true;
 }
@@ -4188,6 +4382,7 @@ void ChatRoom::removeAppChatHandler()
         return;
     mAppChatHandler = nullptr;
     mChat->setListener(this);
+    mChat->setHistoryPinned(false);
 }
 
 bool ChatRoom::hasChatHandler() const
@@ -4498,13 +4693,18 @@ void GroupChatRoom::enablePreview(uint64_t ph)
         mRoomGui->onUserJoin(parent.mKarereClient.myHandle(), mOwnPriv);
     }
 
-    mChat->setPublicHandle(ph);
+    chat().setPublicHandle(ph);
     chat().disable(false);
     connect();
 }
 
 bool GroupChatRoom::publicChat() const
 {
+    if (isChatdChatPending())
+    {
+        return mChatSummary->publicChat;
+    }
+
     assert(mChat);
     if (mChat)
     {
@@ -4518,6 +4718,11 @@ bool GroupChatRoom::publicChat() const
 
 uint64_t GroupChatRoom::getPublicHandle() const
 {
+    if (isChatdChatPending())
+    {
+        return karere::Id::inval();   // previews are never loaded from cache
+    }
+
     assert(mChat);
     if (mChat)
     {
@@ -4530,18 +4735,18 @@ uint64_t GroupChatRoom::getPublicHandle() const
 
 unsigned int GroupChatRoom::getNumPreviewers() const
 {
-    return mChat->getNumPreviewers();
+    return isChatdChatPending() ? 0 : mChat->getNumPreviewers();
 }
 
 // return true if new peer, peer removed or peer's privilege updated
 bool GroupChatRoom::previewMode() const
 {
-    return mChat->previewMode();
+    return isChatdChatPending() ? false : mChat->previewMode();
 }
 
 void ChatRoomList::deleteRoomFromDb(const Id &chatid)
 {
-    auto db = mKarereClient.db;
+    auto& db = mKarereClient.db;
     if (db.isOpen())   // upon karere::Client destruction, DB is already closed
     {
         db.query("delete from chat_peers where chatid = ?", chatid);
@@ -4558,7 +4763,7 @@ void ChatRoomList::deleteRoomFromDb(const Id &chatid)
 
 promise::Promise<std::shared_ptr<std::string>> GroupChatRoom::unifiedKey()
 {
-    return mChat->crypto()->getUnifiedKey();
+    return chat().crypto()->getUnifiedKey();
 }
 // return true if new peer or peer removed. Updates peer privileges as well
 bool GroupChatRoom::syncMembers(const mega::MegaTextChat& chat)
@@ -4580,7 +4785,7 @@ bool GroupChatRoom::syncMembers(const mega::MegaTextChat& chat)
 
     bool peersChanged = false;
     UserPrivMap users = getUserPrivMap(chat);
-    auto db = parent.mKarereClient.db;
+    auto& db = parent.mKarereClient.db;
     auto commitEach = parent.mKarereClient.commitEach() || mAutoJoining;
     parent.mKarereClient.setCommitMode(false);
 
@@ -5252,8 +5457,64 @@ void GroupChatRoom::Member::registerCallBacks(bool fetchIsRequired)
     }
 }
 
+void Client::materializeChats()
+{
+    // creating a chatd::Chat notifies the app, so don't iterate the list while creating them
+    std::vector<karere::Id> pending;
+    for (auto& item: *chats)
+    {
+        if (item.second->isChatdChatPending())
+        {
+            pending.push_back(item.first);
+        }
+    }
+
+    if (pending.empty())
+    {
+        return;
+    }
+
+    mInitStats.stageStart(InitStats::kStatsMaterializeChats);
+    for (const karere::Id& chatid: pending)
+    {
+        auto it = chats->find(chatid);
+        if (it != chats->end())
+        {
+            it->second->materializeChatdChat();
+        }
+    }
+    mInitStats.stageEnd(InitStats::kStatsMaterializeChats);
+
+    KR_LOG_DEBUG("%sInitialized %zu chatrooms loaded lazily from cache", getLoggingName(), pending.size());
+}
+
+void Client::setDbGroupCommit(bool enable)
+{
+    if (enable)
+    {
+        db.setGroupCommit(true, [this](unsigned delayMs) { scheduleDbFlush(delayMs); });
+    }
+    else
+    {
+        db.setGroupCommit(false);
+    }
+}
+
+void Client::setHistoryBudget(size_t maxPerChat, size_t maxTotal)
+{
+    mHistoryBudgetPerChat = maxPerChat;
+    mHistoryBudgetTotal = maxTotal;
+    if (mChatdClient)
+    {
+        mChatdClient->setHistoryBudget(maxPerChat, maxTotal);
+    }
+}
+
 void Client::connectToChatd()
 {
+    // the chatd::Chat of every room is needed to join it
+    materializeChats();
+
     for (auto& item: *chats)
     {
         auto& chat = *item.second;
@@ -6012,6 +6273,8 @@ std::string InitStats::stageToString(uint8_t stage)
         case kStatsPostFetchNodes: return "Post fetch nodes";
         case kStatsConnection: return "Connection";
         case kStatsCreateAccount: return "Create account";
+        case kStatsLoadChats: return "Load chats";
+        case kStatsMaterializeChats: return "Materialize chats";
         default: return "(unknown)";
     }
 }
@@ -6054,7 +6317,10 @@ std::string InitStats::toJson()
         jSonStage.AddMember(rapidjson::Value("tag"), stageTag, jSonDocument.GetAllocator());
 
         // Add stage elapsed time
-        totalElapsed += elapsed;
+        if (stage != kStatsLoadChats && stage != kStatsMaterializeChats)
+        {
+            totalElapsed += elapsed;
+        }
         jsonValue.SetInt64(elapsed);
         jSonStage.AddMember(rapidjson::Value("elap"), jsonValue, jSonDocument.GetAllocator());
         stageArray.PushBack(jSonStage, jSonDocument.GetAllocator());
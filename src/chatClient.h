@@ -84,6 +84,15 @@ class ChatRoom: public chatd::Listener, public DeleteTrackable
 {
     //@cond PRIVATE
 public:
+    /** @brief State of a chatroom loaded lazily from cache, served until its chatd::Chat is created */
+    struct ChatSummary
+    {
+        int unreadCount = 0;
+        chatd::LastTextMsgState lastTextMsg;
+        uint32_t lastMsgTs = 0;
+        bool publicChat = false;
+    };
+
     ChatRoomList& parent;
 protected:
     IApp::IChatHandler* mAppChatHandler = nullptr;
@@ -92,6 +101,8 @@ protected:
     bool mIsGroup;
     chatd::Priv mOwnPriv;
     chatd::Chat* mChat = nullptr;
+    std::function<void()> mPendingChatdInit;        // creates mChat of rooms loaded lazily from cache
+    std::unique_ptr<ChatSummary> mChatSummary;      // only while mPendingChatdInit is set
     bool mIsInitializing = true;
     int64_t mCreationTs;
     bool mIsArchived;
@@ -111,6 +122,7 @@ protected:
     ApiPromise requestGrantAccess(mega::MegaNode *node, mega::MegaHandle userHandle);
     ApiPromise requestRevokeAccess(mega::MegaNode *node, mega::MegaHandle userHandle);
     bool isChatdChatInitialized();
+    void deferInitWithChatd(std::unique_ptr<ChatSummary> summary, std::function<void()> initWithChatd);
 
     // Returns true if own privilege is different than newPriv, otherwise returns false
     bool hasOwnPrivChanged(const chatd::Priv newPriv)
@@ -162,11 +174,38 @@ public:
 
     virtual ~ChatRoom(){}
 
-    /** @brief returns the chatd::Chat chat object associated with the room */
-    chatd::Chat& chat() { return *mChat; }
+    /** @brief returns the chatd::Chat chat object associated with the room
+     * If the room was loaded lazily from cache, the chatd::Chat is created now
+     */
+    chatd::Chat& chat() { materializeChatdChat(); return *mChat; }
+
+    /** @brief returns the chatd::Chat chat object associated with the room
+     * It never creates the chatd::Chat, so it must not be called for rooms whose chatd::Chat is pending
+     */
+    const chatd::Chat& chat() const { assert(!isChatdChatPending()); return *mChat; }
+
+    /** @brief Whether the room was loaded lazily from cache and its chatd::Chat is not created yet */
+    bool isChatdChatPending() const { return static_cast<bool>(mPendingChatdInit); }
 
-    /** @brief returns the chatd::Chat chat object associated with the room */
-    const chatd::Chat& chat() const { return *mChat; }
+    /** @brief Creates the chatd::Chat of a room loaded lazily from cache, if not created yet
+     * It must be called from the karere thread (see IApp::isKarereContext)
+     */
+    void materializeChatdChat();
+
+    /** @brief Number of unread messages, without creating the chatd::Chat if it's pending
+     * @see chatd::Chat::unreadMsgCount()
+     */
+    int unreadMsgCount() const;
+
+    /** @brief Last text message, without creating the chatd::Chat if it's pending
+     * @see chatd::Chat::lastTextMessage()
+     */
+    uint8_t lastTextMessage(chatd::LastTextMsg*& msg);
+
+    /** @brief Timestamp of the last message, without creating the chatd::Chat if it's pending
+     * @see chatd::Chat::lastMessageTs()
+     */
+    uint32_t lastMessageTs();
 
     /** @brief The chatid of the chatroom */
     const uint64_t& chatid() const { return mChatid; }
@@ -194,15 +233,15 @@ public:
     bool isActive() const { return mIsGroup ? (mOwnPriv != chatd::PRIV_RM) : true; }
 
     /** @brief The online state reported by chatd for that chatroom */
-    chatd::ChatState chatdOnlineState() const { return mChat->onlineState(); }
+    chatd::ChatState chatdOnlineState() const;
 
     /** @brief send a notification to the chatroom that the user is typing. */
-    virtual void sendTypingNotification() { mChat->sendTypingNotification(); }
+    virtual void sendTypingNotification() { chat().sendTypingNotification(); }
 
     /** @brief send a notification to the chatroom that the user has stopped typing. */
-    virtual void sendStopTypingNotification() { mChat->sendStopTypingNotification(); }
+    virtual void sendStopTypingNotification() { chat().sendStopTypingNotification(); }
 
-    void sendSync() { mChat->sendSync(); }
+    void sendSync() { chat().sendSync(); }
 
     /** @brief The application-side event handler that receives events from
      * the chatd chatroom and events about title, online status and unread
@@ -237,7 +276,7 @@ public:
     virtual unsigned long numMembers() const = 0;
 
     /** @brief Returns the retention time of the chatroom */
-    uint32_t getRetentionTime() const { return mChat->getRetentionTime();}
+    uint32_t getRetentionTime() const;
 
     //chatd::Listener implementation
     virtual void init(chatd::Chat& messages, chatd::DbInterface *&dbIntf);
@@ -288,10 +327,11 @@ protected:
     friend class ChatRoomList;
     friend class Client;
 
-    //Resume from cache
+    //Resume from cache. If a summary is provided, the chatd::Chat is created on first access
     PeerChatRoom(ChatRoomList& parent, const uint64_t& chatid,
             unsigned char shard, chatd::Priv ownPriv, const uint64_t& peer,
-            chatd::Priv peerPriv, int64_t ts, bool aIsArchived);
+            chatd::Priv peerPriv, int64_t ts, bool aIsArchived,
+            std::unique_ptr<ChatSummary> summary = nullptr);
 
     //Create chat or receive an invitation
     PeerChatRoom(ChatRoomList& parent, const mega::MegaTextChat& room);
@@ -483,10 +523,11 @@ protected:
     //Create chat or receive an invitation
     GroupChatRoom(ChatRoomList& parent, const mega::MegaTextChat& chat);
 
-    //Resume from cache
+    //Resume from cache. If a summary is provided, the chatd::Chat is created on first access
     GroupChatRoom(ChatRoomList& parent, const uint64_t& chatid,
                 unsigned char aShard, chatd::Priv aOwnPriv, int64_t ts,
-                bool aIsArchived, const std::string& title, int isTitleEncrypted, bool publicChat, std::shared_ptr<std::string> unifiedKey, int isUnifiedKeyEncrypted, bool meeting, mega::ChatOptions_t options);
+                bool aIsArchived, const std::string& title, int isTitleEncrypted, bool publicChat, std::shared_ptr<std::string> unifiedKey, int isUnifiedKeyEncrypted, bool meeting, mega::ChatOptions_t options,
+                std::unique_ptr<ChatSummary> summary = nullptr);
 
     //Load chatLink
     GroupChatRoom(ChatRoomList& parent, const uint64_t& chatid,
@@ -640,6 +681,7 @@ public:
     ChatRoomList(Client& aClient);
     ~ChatRoomList();
     void loadFromDb();
+    std::unique_ptr<ChatRoom::ChatSummary> loadChatSummary(SqliteStmt& stmt);
     void deleteRoomFromDb(const Id &chatid);
     void onChatsUpdate(mega::MegaTextChatList& chats, bool checkDeleted = false);
 
@@ -827,8 +869,9 @@ class InitStats
          * - Version 1: Initial version
          * - Version 2: Fix errors and discard atypical values
          * - Version 3: Implement DNS, Chatd and Presenced Ip/Url cache
+         * - Version 4: Add stages to load chatrooms from cache and to create their chatd::Chat lazily
          */
-        const uint32_t INITSTATSVERSION = 3;
+        const uint32_t INITSTATSVERSION = 4;
 
         /** @brief Init states in init stats */
         enum
@@ -849,6 +892,9 @@ class InitStats
             kStatsConnection        = 4,
             kStatsCreateAccount     = 5,
             kStatsEphAccConfirmed   = 6,
+            // the following stages are nested in or overlap the ones above, so they don't add to the total elapsed time
+            kStatsLoadChats         = 7,    // load chatrooms from cache
+            kStatsMaterializeChats  = 8,    // create the chatd::Chat of chatrooms loaded lazily from cache
         };
 
 
@@ -1101,6 +1147,10 @@ protected:
     std::string mPresencedUrl;
 
     megaHandle mHeartbeatTimer = 0;
+    megaHandle mDbFlushTimer = 0;
+    bool mLazyChatInit = false;
+    size_t mHistoryBudgetPerChat = 0;
+    size_t mHistoryBudgetTotal = 0;
     InitStats mInitStats;
 
     // Maps uhBin to user alias encoded in B64
@@ -1261,6 +1311,34 @@ public:
      * offline operation is not possible.
      */
     InitState init(const char* sid, bool waitForFetchnodesToConnect);
+
+    /**
+     * @brief Enables or disables the lazy initialization of the chatrooms loaded from cache
+     *
+     * When enabled, only the chatroom and a summary of its history (last message, unread count
+     * and last ts) are loaded at init, and the chatd::Chat of each chatroom is created on first
+     * access (ie. when it's opened) or before connecting to chatd, whichever happens first.
+     *
+     * It must be called before init() to take effect. It's disabled by default.
+     */
+    void setLazyChatInit(bool enable) { mLazyChatInit = enable; }
+
+    /**
+     * @brief Groups the writes to the db in transactions committed from the event loop
+     * (see SqliteDb::setGroupCommit). It's disabled by default.
+     */
+    void setDbGroupCommit(bool enable);
+    bool lazyChatInit() const { return mLazyChatInit; }
+
+    /**
+     * @brief Sets the max number of messages kept in the RAM history buffers of the chats
+     * (see chatd::Client::setHistoryBudget). The values are kept if the chatd client is
+     * recreated. Zero means unlimited.
+     */
+    void setHistoryBudget(size_t maxPerChat, size_t maxTotal);
+    size_t historyBudgetPerChat() const { return mHistoryBudgetPerChat; }
+    size_t historyBudgetTotal() const { return mHistoryBudgetTotal; }
+
     InitState initState() const { return mInitState; }
     bool hasInitError() const { return mInitState >= kInitErrFirst; }
     bool isTerminated() const { return mInitState == kInitTerminated; }
@@ -1379,8 +1457,12 @@ public:
 
 protected:
     void heartbeat();
+    void scheduleDbFlush(unsigned delayMs);
     void setInitState(InitState newState);
 
+    /** @brief Creates the chatd::Chat of every chatroom loaded lazily from cache that's still pending */
+    void materializeChats();
+
     // db-related methods
     std::string dbPath(const std::string& sid) const;
     bool openDb(const std::string& sid);
@@ -3,8 +3,8 @@
 #include "chatdICrypto.h"
 #include "base64url.h"
 #include <algorithm>
+#include <cstring>
 #include <random>
-#include <regex>
 
 using namespace std;
 using namespace promise;
@@ -134,6 +134,8 @@ Client::Client(karere::Client *aKarereClient) :
     mMyHandle(aKarereClient->myHandle()),
     mRetentionTimer(0),
     mRetentionCheckTs(0),
+    mHistoryBudgetPerChat(aKarereClient->historyBudgetPerChat()),
+    mHistoryBudgetTotal(aKarereClient->historyBudgetTotal()),
     mApi(&aKarereClient->api),
     mKarereClient(aKarereClient)
 {
@@ -467,6 +469,90 @@ void Client::setRetentionTimer()
     }, static_cast<unsigned int> (retentionPeriod * 1000) , mKarereClient->appCtx);
 }
 
+void Client::setHistoryBudget(size_t maxPerChat, size_t maxTotal)
+{
+    CHATD_LOG_DEBUG("%sHistory budget set to %zu messages per chat, %zu in total",
+                    getLoggingName(),
+                    maxPerChat,
+                    maxTotal);
+    mHistoryBudgetPerChat = maxPerChat;
+    mHistoryBudgetTotal = maxTotal;
+    scheduleHistoryEviction();
+}
+
+Client::HistoryMemoryStats Client::historyMemoryStats() const
+{
+    HistoryMemoryStats stats;
+    for (const auto& it: mChatForChatId)
+    {
+        const Chat& chat = *it.second;
+        if (chat.empty())
+        {
+            continue;
+        }
+
+        size_t numMessages = static_cast<size_t>(chat.size());
+        stats.numChats++;
+        stats.numMessages += numMessages;
+        stats.numBytes += chat.historyMemoryUsage();
+        if (chat.isHistoryPinned())
+        {
+            stats.numPinnedChats++;
+            stats.numPinnedMessages += numMessages;
+        }
+    }
+    stats.numEvictedMessages = mEvictedHistoryMsgs;
+    stats.numEvictions = mHistoryEvictions;
+    return stats;
+}
+
+void Client::scheduleHistoryEviction()
+{
+    if (mHistoryEvictionTimer || (!mHistoryBudgetPerChat && !mHistoryBudgetTotal))
+    {
+        return;
+    }
+
+    auto wptr = weakHandle();
+    mHistoryEvictionTimer = karere::setTimeout([this, wptr]()
+    {
+        if (wptr.deleted())
+            return;
+
+        mHistoryEvictionTimer = 0;
+        enforceHistoryBudget();
+    }, 0, mKarereClient->appCtx);
+}
+
+void Client::cancelHistoryEviction()
+{
+    if (mHistoryEvictionTimer)
+    {
+        cancelTimeout(mHistoryEvictionTimer, mKarereClient->appCtx);
+        mHistoryEvictionTimer = 0;
+    }
+}
+
+void Client::enforceHistoryBudget()
+{
+    std::vector<Chat*> chats;
+    chats.reserve(mChatForChatId.size());
+    for (auto& it: mChatForChatId)
+    {
+        chats.push_back(it.second.get());
+    }
+
+    size_t total = enforceHistoryBudget(chats, mHistoryBudgetPerChat, mHistoryBudgetTotal);
+    if (mHistoryBudgetTotal && total > mHistoryBudgetTotal)
+    {
+        CHATD_LOG_DEBUG("%senforceHistoryBudget: %zu messages still in RAM (budget: %zu). "
+                        "The rest is pinned or can't be evicted yet",
+                        getLoggingName(),
+                        total,
+                        mHistoryBudgetTotal);
+    }
+}
+
 void Client::enableChats(const bool enable, const karere::Id& chatId)
 {
     const auto allChats = !chatId.isValid();
@@ -895,6 +981,7 @@ void Connection::setState(State state, const bool avoidReconnect)
             chat.onDisconnect();
         }
 
+        clearBackloggedOutput();
         if (!mSendPromise.done())
         {
             mSendPromise.reject("Failed to send. Socket was closed");
@@ -1513,6 +1600,19 @@ bool Connection::sendBuf(Buffer&& buf)
             });
     }
 
+    // back-pressure: don't let the socket queue grow unbounded, and keep the order of the output
+    if (!mBackloggedOutput.empty() || wsGetSendStats().queuedBytes >= kSendHighWaterMark)
+    {
+        if (mBackloggedOutput.empty())
+        {
+            CHATDS_LOG_WARNING("%sOutput queue above the high-water mark, backlogging output",
+                               mChatdClient.getLoggingName());
+        }
+        mBackloggedBytes += buf.dataSize();
+        mBackloggedOutput.emplace_back(std::move(buf));
+        return true;
+    }
+
     bool rc = wsSendMessage(buf.buf(), buf.dataSize());
     buf.free();
 
@@ -1524,6 +1624,42 @@ bool Connection::sendBuf(Buffer&& buf)
     return rc;
 }
 
+void Connection::flushBackloggedOutput()
+{
+    while (!mBackloggedOutput.empty() && wsGetSendStats().queuedBytes < kSendLowWaterMark)
+    {
+        Buffer& buf = mBackloggedOutput.front();
+        bool rc = wsSendMessage(buf.buf(), buf.dataSize());
+        mBackloggedBytes -= buf.dataSize();
+        mBackloggedOutput.pop_front();
+        if (!rc)
+        {
+            clearBackloggedOutput();
+            if (!mSendPromise.done())
+            {
+                mSendPromise.reject("Socket is not ready");
+            }
+            return;
+        }
+    }
+}
+
+void Connection::clearBackloggedOutput()
+{
+    mBackloggedOutput.clear();
+    mBackloggedBytes = 0;
+}
+
+WebsocketsSendStats Connection::sendStats() const
+{
+    return wsGetSendStats();
+}
+
+size_t Connection::backloggedBytes() const
+{
+    return mBackloggedBytes;
+}
+
 bool Connection::sendCommand(Command&& cmd)
 {
     CHATDS_LOG_DEBUG("%ssend %s", mChatdClient.getLoggingName(), cmd.toString().c_str());
@@ -1966,6 +2102,7 @@ void Chat::onDisconnect()
 
 HistSource Chat::getHistory(unsigned count)
 {
+    mLastHistoryAccess = ++mChatdClient.mHistoryAccessCounter;
     if (isNotifyingOldHistFromServer())
     {
         return kHistSourceServer;
@@ -2287,16 +2424,26 @@ Idx Chat::getHistoryFromDb(unsigned count)
 {
     assert(mHasMoreHistoryInDb); //we are within the db range
     std::vector<Message*> messages;
-    CALL_DB(fetchDbHistory, lownum()-1, count, messages);
+    Idx startIdx = lownum() - 1;
+    CALL_DB(fetchDbHistory, startIdx, count, messages);
+
+    // Load reactions of the whole page from cache at once (messages are sorted from newest to oldest)
+    std::unordered_map<karere::Id, MsgReactions> reactions;
+    if (!messages.empty())
+    {
+        CALL_DB(getReactionsForRange, startIdx - static_cast<Idx>(messages.size()) + 1, startIdx, reactions);
+    }
+
     for (auto msg: messages)
     {
-        // Load msg reactions from cache
-        std::vector<std::pair<std::string, karere::Id>> reactions;
-        CALL_DB(getReactions, msg->id(), reactions);
-        for (auto& reaction : reactions)
+        auto it = reactions.find(msg->id());
+        if (it != reactions.end())
         {
-            // Add reaction to confirmed reactions queue in message
-            msg->addReaction(reaction.first, reaction.second);
+            for (auto& reaction : it->second)
+            {
+                // Add reaction to confirmed reactions queue in message
+                msg->addReaction(reaction.first, reaction.second);
+            }
         }
 
         msgIncoming(false, msg, true); //increments mLastHistFetch/DecryptCount, may reset mHasMoreHistoryInDb if this msgid == mLastKnownMsgid
@@ -2310,13 +2457,18 @@ Idx Chat::getHistoryFromDb(unsigned count)
         mNextHistFetchIdx -= static_cast<Idx>(messages.size());
     }
 
-    // Load all pending reactions stored in cache
-    std::vector<PendingReaction> pendingReactions;
-    CALL_DB(getPendingReactions, pendingReactions);
-    for (auto &auxReaction : pendingReactions)
+    // Load all pending reactions stored in cache. It's done only once, since afterwards
+    // mPendingReactions is updated along with the DB
+    if (!mPendingReactionsLoaded)
     {
-        // Add pending reaction to queue in chat
-        addPendingReaction(auxReaction.mReactionString, auxReaction.mReactionStringEnc, auxReaction.mMsgId, auxReaction.mStatus);
+        std::vector<PendingReaction> pendingReactions;
+        CALL_DB(getPendingReactions, pendingReactions);
+        for (auto &auxReaction : pendingReactions)
+        {
+            // Add pending reaction to queue in chat
+            addPendingReaction(auxReaction.mReactionString, auxReaction.mReactionStringEnc, auxReaction.mMsgId, auxReaction.mStatus);
+        }
+        mPendingReactionsLoaded = true;
     }
 
     CALL_LISTENER_VERBOSE(onHistoryDone, kHistSourceDb);
@@ -2362,16 +2514,21 @@ Idx Chat::getHistoryFromDb(unsigned count)
 #define READ_8(varname, offset)\
     assert(offset==pos-base); uint8_t varname(buf.read<uint8_t>(pos)); pos+=1
 
-void Connection::wsHandleMsgCb(char *data, size_t len)
+void Connection::wsHandleMsgCb(const RecvBuffer& msg)
 {
     mTsLastRecv = time(NULL);
-    execCommand(StaticBuffer(data, len));
+    execCommand(msg);
 }
 
 void Connection::wsSendMsgCb(const char *, size_t)
 {
-    assert(!mSendPromise.done());
-    mSendPromise.resolve();
+    flushBackloggedOutput();
+
+    // several frames may be written for the data sent since the promise was created
+    if (mBackloggedOutput.empty() && !wsGetSendStats().queuedBytes && !mSendPromise.done())
+    {
+        mSendPromise.resolve();
+    }
 }
 
 #if WEBSOCKETS_TLS_SESSION_CACHE_ENABLED
@@ -2385,7 +2542,7 @@ bool Connection::wsSSLsessionUpdateCb(const CachedSession &sess)
 // inbound command processing
 // multiple commands can appear as one WebSocket frame, but commands never cross frame boundaries
 // CHECK: is this assumption correct on all browsers and under all circumstances?
-void Connection::execCommand(const StaticBuffer& buf)
+void Connection::execCommand(const RecvBuffer& buf)
 {
     size_t pos = 0;
 //IMPORTANT: Increment pos before calling the command handler, because the handler may throw, in which
@@ -2455,7 +2612,7 @@ void Connection::execCommand(const StaticBuffer& buf)
                 READ_16(updated, 28);
                 READ_32(keyid, 30);
                 READ_32(msglen, 34);
-                const char* msgdata = buf.readPtr(pos, msglen);
+                RecvBuffer msgdata = buf.slice(pos, msglen);
                 pos += msglen;
 
                 CHATDS_LOG_DEBUG(
@@ -2470,15 +2627,16 @@ void Connection::execCommand(const StaticBuffer& buf)
                     updated);
 
                 Chat& chat = mChatdClient.chats(chatid);
+                // the payload references the received data until the message is decrypted
                 std::unique_ptr<Message> msg(new Message(msgid,
                                                          userid,
                                                          ts,
                                                          updated,
-                                                         msgdata,
-                                                         msglen,
+                                                         msgdata.share(),
                                                          false,
                                                          keyid,
-                                                         chat.isNoteToSelf()));
+                                                         chat.isNoteToSelf(),
+                                                         Message::kMsgInvalid));
                 msg->setEncrypted(Message::kEncryptedPending);
                 if (opcode == OP_MSGUPD)
                 {
@@ -3219,6 +3377,7 @@ void Chat::onHistDone()
         {
             onFetchHistDone();
             handleRetentionTime();
+            mChatdClient.scheduleHistoryEviction();
         }
         if (isJoining())
         {
@@ -3251,21 +3410,16 @@ void Chat::onFetchHistDone()
     bool fetchingOld = (mServerFetchState & kHistOldFlag);
     if (fetchingOld)
     {
-        if (mDecryptOldHaltedAt != CHATD_IDX_INVALID)
-        {
-            mServerFetchState = kHistDecryptingOld;
-        }
-        else
+        mServerFetchState = (mDecryptOldHaltedAt != CHATD_IDX_INVALID)
+            ? kHistDecryptingOld : kHistNotFetching;
+
+        // if app tries to load messages before first join and there's no local history available yet,
+        // they received a `HistSource == kSourceNotLoggedIn`. During login, received messages won't be
+        // notified, but after login the app can attempt to load messages again and should be notified
+        // about messages from the beginning. Messages still being decrypted are already in RAM.
+        if (!mIsFirstJoin)
         {
-            mServerFetchState = kHistNotFetching;
-            // if app tries to load messages before first join and there's no local history available yet,
-            // they received a `HistSource == kSourceNotLoggedIn`. During login, received messages won't be
-            // notified, but after login the app can attempt to load messages again and should be notified
-            // about messages from the beginning
-            if (!mIsFirstJoin)
-            {
-                mNextHistFetchIdx = lownum()-1;
-            }
+            mNextHistFetchIdx = lownum()-1;
         }
 
         assert(mLastServerRequested < 0); // mLastServerRequested is < 0 if we are fetching old hist from server
@@ -3274,23 +3428,14 @@ void Chat::onFetchHistDone()
                 || (mLastServerRequested <= 0 && !allRequestedMsgRecv)) // less messages received than requested
         {
             //server returned zero messages or we have received all history from server
-            assert((mDecryptOldHaltedAt == CHATD_IDX_INVALID) && (mDecryptNewHaltedAt == CHATD_IDX_INVALID));
+            //(the received messages may still be decrypting)
+            assert(mLastServerHistFetchCount
+                   || ((mDecryptOldHaltedAt == CHATD_IDX_INVALID) && (mDecryptNewHaltedAt == CHATD_IDX_INVALID)));
             mHaveAllHistory = true;
             mAttachmentNodes->setHaveAllHistory(true);
             CALL_DB(setHaveAllHistory, true);
             CHATID_LOG_DEBUG("%sStart of history reached", mChatdClient.getLoggingName());
-            //last text msg stuff
-            if (mLastTextMsg.isFetching())
-            {
-                mLastTextMsg.clear();
-                notifyLastTextMsg();
-            }
-
-            if (mLastServerRequested <= 0      // requested old messages
-                    && !allRequestedMsgRecv)   // number of received msg's is smaller than requested
-            {
-                calculateUnreadCount();
-            }
+            // last text msg and unread count are updated once the received messages are decrypted
         }
     }
     else
@@ -3299,9 +3444,35 @@ void Chat::onFetchHistDone()
             ? kHistDecryptingNew : kHistNotFetching;
     }
 
+    mLastServerRequested = 0; // reset LastServerRequested
     if (mServerFetchState == kHistNotFetching) //if not still decrypting
     {
-        if (fetchingOld && mServerOldHistCbEnabled)
+        onFetchHistDecrypted(fetchingOld);
+    }
+}
+
+void Chat::onFetchHistDecrypted(bool fetchingOld)
+{
+    KeyLookupStats stats = mCrypto->keyLookupStats();
+    CHATID_LOG_DEBUG("%sKeys found in memory (hits/misses) so far: send keys %zu/%zu, signing keys %zu/%zu",
+                     mChatdClient.getLoggingName(),
+                     stats.sendKeyHits, stats.sendKeyMisses,
+                     stats.signingKeyHits, stats.signingKeyMisses);
+
+    if (fetchingOld)
+    {
+        if (mHaveAllHistory) // start of history reached
+        {
+            //last text msg stuff
+            if (mLastTextMsg.isFetching())
+            {
+                mLastTextMsg.clear();
+                notifyLastTextMsg();
+            }
+            calculateUnreadCount();
+        }
+
+        if (mServerOldHistCbEnabled)
         {
             //we are forwarding to the app the history we are receiving from
             //server. Tell app that is complete.
@@ -3317,7 +3488,6 @@ void Chat::onFetchHistDone()
                          mChatdClient.getLoggingName());
         getHistory(initialHistoryFetchCount);
     }
-    mLastServerRequested = 0; // reset LastServerRequested
 }
 
 void Chat::loadAndProcessUnsent()
@@ -3722,6 +3892,7 @@ void Chat::initChat()
     mEncryptionHalted = false;
     mDecryptNewHaltedAt = CHATD_IDX_INVALID;
     mDecryptOldHaltedAt = CHATD_IDX_INVALID;
+    mDecryptBatchGeneration.invalidate();
     mRefidToIdxMap.clear();
 
     mHasMoreHistoryInDb = false;
@@ -3734,9 +3905,9 @@ void Chat::requestRichLink(Message &message)
     std::string url;
     if (Message::hasUrl(text, url))
     {
-        std::regex expresion("^(http://|https://)(.+)");
+        // Message::hasUrl() only accepts http and https schemes
         std::string linkRequest = url;
-        if (!regex_match(url, expresion))
+        if (url.find("://") == std::string::npos)
         {
             linkRequest = std::string("http://") + url;
         }
@@ -4857,6 +5028,7 @@ Client::~Client()
 {
     cancelSeenTimers();
     cancelRetentionTimer();
+    cancelHistoryEviction();
     mKarereClient->userAttrCache().removeCb(mRichPrevAttrCbHandle);
 }
 
@@ -5002,6 +5174,7 @@ Idx Chat::msgConfirm(const Id& msgxid, const Id& msgid, uint32_t timestamp)
 
     // add message to history
     push_forward(msg);
+    compactPayload(*msg);
     auto idx = mIdToIndexMap[msgid] = highnum();
     if (msg->type == Message::kMsgAttachment)
     {
@@ -5794,6 +5967,27 @@ bool Chat::hasMoreHistoryInDb() const
 
 void Chat::deleteOlderMessagesIncluding(Idx idx)
 {
+    if (mDecryptOldHaltedAt != CHATD_IDX_INVALID && idx >= lownum())
+    {
+        // Old messages queued for decryption are older than any message in db, so
+        // they are all removed. Discard the decrypt batch in flight, if any
+        assert(idx >= mDecryptOldHaltedAt);
+        mDecryptBatchGeneration.invalidate();
+        mDecryptOldHaltedAt = CHATD_IDX_INVALID;
+        if (mServerFetchState == kHistDecryptingOld)
+        {
+            mServerFetchState = kHistNotFetching;
+            auto wptr = weakHandle();
+            marshallCall([wptr, this]()
+            {
+                if (wptr.deleted())
+                    return;
+
+                onFetchHistDecrypted(true);
+            }, mChatdClient.mKarereClient->appCtx);
+        }
+    }
+
     if (idx >= mForwardStart)
     {
         // clear backward list
@@ -5845,6 +6039,93 @@ void Chat::deleteOlderMessagesIncluding(Idx idx)
     }
 }
 
+Idx Chat::evictOldHistory(Idx count)
+{
+    if (mHistoryPinned || count <= 0
+        || mOldestKnownMsgId.isNull()               // RAM history may not be in db yet
+        || mServerFetchState != kHistNotFetching
+        || mDecryptOldHaltedAt != CHATD_IDX_INVALID
+        || mDecryptNewHaltedAt != CHATD_IDX_INVALID)
+    {
+        return 0;
+    }
+
+    Idx maxCount = size() - static_cast<Idx>(initialHistoryFetchCount);
+    if (count > maxCount)
+    {
+        count = maxCount;
+    }
+
+    // Messages from the app's history cursor and older haven't been notified yet, and
+    // getHistory() resumes from db at lownum()-1, so newer messages must stay in RAM
+    Idx low = lownum();
+    if (mNextHistFetchIdx != CHATD_IDX_INVALID && count > mNextHistFetchIdx - low + 1)
+    {
+        count = mNextHistFetchIdx - low + 1;
+    }
+
+    Idx evicted = 0;
+    for (; evicted < count; evicted++)
+    {
+        const Message& msg = at(low + evicted);
+        if (msg.isPendingToDecrypt() || mMsgsToUpdateWithRichLink.count(msg.id()))
+        {
+            break;
+        }
+    }
+
+    if (evicted <= 0)
+    {
+        return 0;
+    }
+
+    for (Idx i = low; i < low + evicted; i++)
+    {
+        BackRefId backRefId = at(i).backRefId;
+        if (backRefId)
+        {
+            mRefidToIdxMap.erase(backRefId);
+        }
+    }
+
+    deleteOlderMessagesIncluding(low + evicted - 1);
+    mHasMoreHistoryInDb = true;
+    mChatdClient.mEvictedHistoryMsgs += static_cast<uint64_t>(evicted);
+    mChatdClient.mHistoryEvictions++;
+    CHATID_LOG_DEBUG("%sEvicted %d messages from RAM history (%d - %d)",
+                     mChatdClient.getLoggingName(),
+                     evicted,
+                     low,
+                     low + evicted - 1);
+    return evicted;
+}
+
+void Chat::setHistoryPinned(bool pinned)
+{
+    mHistoryPinned = pinned;
+    mLastHistoryAccess = ++mChatdClient.mHistoryAccessCounter;
+    if (!pinned)
+    {
+        mChatdClient.scheduleHistoryEviction();
+    }
+}
+
+size_t Chat::historyMemoryUsage() const
+{
+    // payloads in mPayloadArena are accounted by chunks. The rest, including those still
+    // referencing a received frame (ie. pending to decrypt), count their own size
+    size_t usage = mPayloadArena.liveBytes();
+    for (const auto& msg: mForwardList)
+    {
+        usage += sizeof(Message) + (BufferArena::contains(*msg) ? 0 : msg->bufSize());
+    }
+    for (const auto& msg: mBackwardList)
+    {
+        usage += sizeof(Message) + (BufferArena::contains(*msg) ? 0 : msg->bufSize());
+    }
+    return usage;
+}
+
 Message::Status Chat::getMsgStatus(const Message& msg, Idx idx) const
 {
     assert(idx != CHATD_IDX_INVALID);
@@ -5955,6 +6236,7 @@ Idx Chat::msgIncoming(bool isNew, Message* message, bool isLocal)
     }
     handleLastReceivedSeen(msgid);
     msgIncomingAfterAdd(isNew, isLocal, *message, idx);
+    mChatdClient.scheduleHistoryEviction();
     return idx;
 }
 
@@ -6103,6 +6385,12 @@ bool Chat::msgIncomingAfterAdd(bool isNew, bool isLocal, Message& msg, Idx idx)
             return false;
         }
     }
+    if (!mDecryptBatchBypass && isFetchingFromServer())
+    {
+        queueForDecryptBatch(isNew, idx);
+        return false;
+    }
+
     CHATD_LOG_CRYPTO_CALL("%sCalling ICrypto::decrypt()", mChatdClient.getLoggingName());
     auto pms = mCrypto->msgDecrypt(&msg);
     if (pms.succeeded())
@@ -6214,56 +6502,13 @@ bool Chat::msgIncomingAfterAdd(bool isNew, bool isLocal, Message& msg, Idx idx)
                     assert(mDecryptNewHaltedAt == idx);
                 else
                     assert(mDecryptOldHaltedAt == idx);
+
+                // Local messages are always decrypted, this is handled
+                // at the start of this func
+                assert(isNew || !isLocal);
 #endif
                 msgIncomingAfterDecrypt(isNew, false, *message, idx);
-                if (isNew)
-                {
-                    // Decrypt the rest - try to decrypt immediately (synchromously),
-                    // so that order is guaranteed. Bail out of the loop at the first
-                    // message that can't be decrypted immediately(msgIncomingAfterAdd()
-                    // returns false). Will continue when the delayed decrypt finishes
-
-                    auto first = mDecryptNewHaltedAt + 1;
-                    mDecryptNewHaltedAt = CHATD_IDX_INVALID;
-                    auto last = highnum();
-                    for (Idx i = first; i <= last; i++)
-                    {
-                        if (!msgIncomingAfterAdd(isNew, false, at(i), i))
-                            break;
-                    }
-                    if ((mServerFetchState == kHistDecryptingNew) &&
-                        (mDecryptNewHaltedAt == CHATD_IDX_INVALID)) // all messages decrypted
-                    {
-                        mServerFetchState = kHistNotFetching;
-                    }
-                }
-                else
-                {
-                    // Old history
-                    // Decrypt the rest synchronously, bail out on first that can't
-                    // decrypt synchonously.
-                    // Local messages are always decrypted, this is handled
-                    // at the start of this func
-
-                    assert(!isLocal);
-                    auto first = mDecryptOldHaltedAt - 1;
-                    mDecryptOldHaltedAt = CHATD_IDX_INVALID;
-                    auto last = lownum();
-                    for (Idx i = first; i >= last; i--)
-                    {
-                        if (!msgIncomingAfterAdd(isNew, false, at(i), i))
-                            break;
-                    }
-                    if ((mServerFetchState == kHistDecryptingOld) &&
-                        (mDecryptOldHaltedAt == CHATD_IDX_INVALID))
-                    {
-                        mServerFetchState = kHistNotFetching;
-                        if (mServerOldHistCbEnabled)
-                        {
-                            CALL_LISTENER_VERBOSE(onHistoryDone, kHistSourceServer);
-                        }
-                    }
-                }
+                resumeHaltedDecrypt(isNew);
             })
         .fail(
             [wptr, this, message, lname = std::string{mChatdClient.getLoggingName()}](
@@ -6303,10 +6548,165 @@ bool Chat::msgIncomingAfterAdd(bool isNew, bool isLocal, Message& msg, Idx idx)
     return false; //decrypt was not done immediately
 }
 
+void Chat::resumeHaltedDecrypt(bool isNew)
+{
+    if (isNew)
+    {
+        // Decrypt the rest - try to decrypt immediately (synchromously),
+        // so that order is guaranteed. Bail out of the loop at the first
+        // message that can't be decrypted immediately(msgIncomingAfterAdd()
+        // returns false). Will continue when the delayed decrypt finishes
+
+        auto first = mDecryptNewHaltedAt + 1;
+        mDecryptNewHaltedAt = CHATD_IDX_INVALID;
+        auto last = highnum();
+        for (Idx i = first; i <= last; i++)
+        {
+            if (!msgIncomingAfterAdd(isNew, false, at(i), i))
+                break;
+        }
+        if ((mServerFetchState == kHistDecryptingNew) &&
+            (mDecryptNewHaltedAt == CHATD_IDX_INVALID)) // all messages decrypted
+        {
+            mServerFetchState = kHistNotFetching;
+            onFetchHistDecrypted(false);
+        }
+    }
+    else
+    {
+        // Old history
+        // Decrypt the rest synchronously, bail out on first that can't
+        // decrypt synchonously.
+
+        auto first = mDecryptOldHaltedAt - 1;
+        mDecryptOldHaltedAt = CHATD_IDX_INVALID;
+        auto last = lownum();
+        for (Idx i = first; i >= last; i--)
+        {
+            if (!msgIncomingAfterAdd(isNew, false, at(i), i))
+                break;
+        }
+        if ((mServerFetchState == kHistDecryptingOld) &&
+            (mDecryptOldHaltedAt == CHATD_IDX_INVALID))
+        {
+            mServerFetchState = kHistNotFetching;
+            onFetchHistDecrypted(true);
+        }
+    }
+}
+
+void Chat::queueForDecryptBatch(bool isNew, Idx idx)
+{
+    if (isNew)
+        mDecryptNewHaltedAt = idx;
+    else
+        mDecryptOldHaltedAt = idx;
+
+    // the flush runs after the current burst of messages has been received. The token
+    // isn't valid anymore if the chat has been destroyed by then
+    karere::WorkGeneration::Token generation = mDecryptBatchGeneration.token();
+    marshallCall([this, isNew, generation]()
+    {
+        if (!generation.valid())
+            return;
+
+        flushDecryptBatch(isNew);
+    }, mChatdClient.mKarereClient->appCtx);
+}
+
+void Chat::flushDecryptBatch(bool isNew)
+{
+    Idx haltedAt = isNew ? mDecryptNewHaltedAt : mDecryptOldHaltedAt;
+    if (haltedAt == CHATD_IDX_INVALID)
+    {
+        return;
+    }
+
+    // new messages are processed in ascending order of idx, old ones in descending order
+    Idx step = isNew ? 1 : -1;
+    Idx end = isNew ? highnum() + 1 : lownum() - 1;
+    std::vector<Message*> msgs;
+    for (Idx i = haltedAt; i != end && msgs.size() < kMaxDecryptBatchSize; i += step)
+    {
+        Message& msg = at(i);
+        if (!msg.isPendingToDecrypt())
+        {
+            break;
+        }
+        msgs.push_back(&msg);
+    }
+
+    size_t count = 0;
+    if (!msgs.empty())
+    {
+        auto wptr = weakHandle();
+        karere::WorkGeneration::Token generation = mDecryptBatchGeneration.token();
+        size_t maxCount = msgs.size();
+        CHATD_LOG_CRYPTO_CALL("%sCalling ICrypto::msgDecryptBatch() for %zu messages",
+                              mChatdClient.getLoggingName(), maxCount);
+        count = mCrypto->msgDecryptBatch(msgs,
+            [generation]() -> bool
+            {
+                return generation.valid();
+            },
+            [wptr, this, isNew, haltedAt, step, maxCount]()
+            {
+                if (wptr.deleted())
+                    return;
+
+                assert((isNew ? mDecryptNewHaltedAt : mDecryptOldHaltedAt) == haltedAt);
+                Idx i = haltedAt;
+                for (size_t n = 0; n < maxCount; n++, i += step)
+                {
+                    // the messages accepted by the crypto module are not pending anymore
+                    Message* msg = findOrNull(i);
+                    if (!msg || msg->isPendingToDecrypt())
+                        break;
+
+                    msgIncomingAfterDecrypt(isNew, false, *msg, i);
+                }
+
+                // continue after the last message of the batch
+                if (isNew)
+                    mDecryptNewHaltedAt = i - step;
+                else
+                    mDecryptOldHaltedAt = i - step;
+                resumeHaltedDecrypt(isNew);
+            });
+    }
+
+    if (count)
+    {
+        CHATID_LOG_DEBUG("%sDecrypting %zu messages in worker threads",
+                         mChatdClient.getLoggingName(), count);
+        return;
+    }
+
+    // the first message can't be decrypted in a batch: decrypt it alone, and queue
+    // the next ones again once it's done
+    if (isNew)
+        mDecryptNewHaltedAt = CHATD_IDX_INVALID;
+    else
+        mDecryptOldHaltedAt = CHATD_IDX_INVALID;
+
+    mDecryptBatchBypass = true;
+    bool decrypted = msgIncomingAfterAdd(isNew, false, at(haltedAt), haltedAt);
+    mDecryptBatchBypass = false;
+    if (decrypted)
+    {
+        if (isNew)
+            mDecryptNewHaltedAt = haltedAt;
+        else
+            mDecryptOldHaltedAt = haltedAt;
+        resumeHaltedDecrypt(isNew);
+    }
+}
+
 // Save to history db, handle received and seen pointers, call new/old message user callbacks
 void Chat::msgIncomingAfterDecrypt(bool isNew, bool isLocal, Message& msg, Idx idx)
 {
     assert(idx != CHATD_IDX_INVALID);
+    compactPayload(msg);
     if (!isNew)
     {
         mLastHistDecryptCount++;
@@ -7279,94 +7679,411 @@ const char* Message::statusNames[] =
   "Sending", "SendingManual", "ServerReceived", "ServerRejected", "Delivered", "NotSeen", "Seen"
 };
 
-bool Message::hasUrl(const string &text, string &url)
+namespace
 {
-    std::string::size_type position = 0;
-    std::string partialString;
-    while (position < text.size())
+// Character classes used by Message::hasUrl() and Message::parseUrl()
+enum : uint8_t
+{
+    kUrlToken       = 1 << 0,   // chars that can be part of a candidate url in a text
+    kUrlTrim        = 1 << 1,   // [.,:?!;] removed from both ends of a candidate url
+    kUrlAlnum       = 1 << 2,   // [a-z0-9A-Z]
+    kUrlHost        = 1 << 3,   // [a-z0-9A-Z-._~?#!$&'()*+,;=]
+    kUrlPath        = 1 << 4,   // [a-z0-9A-Z-._~:?#/@!$&'()*+,;=]
+    kUrlMegaLink    = 1 << 5,   // [a-z0-9A-Z-._~:/?#!$&'()*+,;= @]
+    kUrlEmailLocal  = 1 << 6,   // [a-z0-9A-Z._%+-]
+    kUrlEmailDomain = 1 << 7,   // [a-z0-9A-Z.-]
+};
+
+struct UrlCharTable
+{
+    uint8_t mFlags[256] = {};
+
+    constexpr void add(const char* chars, uint8_t flags)
     {
-        char character = text[position];
-        if ((character >= 33 && character <= 126)
-                && character != '"'
-                && character != '\''
-                && character != '\\'
-                && character != '<'
-                && character != '>'
-                && character != '{'
-                && character != '}'
-                && character != '|')
+        for (; *chars; chars++)
         {
-            partialString.push_back(character);
+            mFlags[static_cast<unsigned char>(*chars)] |= flags;
         }
-        else
+    }
+
+    constexpr UrlCharTable()
+    {
+        for (int c = 33; c <= 126; c++)
+        {
+            mFlags[c] |= kUrlToken;
+        }
+        for (const char* c = "\"'\\<>{}|"; *c; c++)
+        {
+            mFlags[static_cast<unsigned char>(*c)] &= static_cast<uint8_t>(~kUrlToken);
+        }
+
+        constexpr uint8_t kAlnumFlags = kUrlAlnum | kUrlHost | kUrlPath | kUrlMegaLink | kUrlEmailLocal | kUrlEmailDomain;
+        for (int c = '0'; c <= '9'; c++) { mFlags[c] |= kAlnumFlags; }
+        for (int c = 'a'; c <= 'z'; c++) { mFlags[c] |= kAlnumFlags; }
+        for (int c = 'A'; c <= 'Z'; c++) { mFlags[c] |= kAlnumFlags; }
+
+        add(".,:?!;", kUrlTrim);
+        add("-._~?#!$&'()*+,;=", kUrlHost | kUrlPath | kUrlMegaLink);
+        add(":/@", kUrlPath | kUrlMegaLink);
+        add(" ", kUrlMegaLink);
+        add("._%+-", kUrlEmailLocal);
+        add(".-", kUrlEmailDomain);
+    }
+
+    constexpr bool is(char c, uint8_t flags) const { return mFlags[static_cast<unsigned char>(c)] & flags; }
+};
+
+constexpr UrlCharTable kUrlChars;
+
+inline bool isUrlDigit(char c) { return c >= '0' && c <= '9'; }
+inline bool isUrlAlpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+
+// Any character, as matched by '.' in an ECMAScript regular expression
+inline bool isUrlAnyChar(char c) { return c != '\n' && c != '\r'; }
+
+bool urlHasPrefix(const char* str, size_t len, size_t pos, const char* prefix)
+{
+    for (; *prefix; prefix++, pos++)
+    {
+        if (pos >= len || str[pos] != *prefix)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** @brief Returns the first index from which every char up to the end has the given flags */
+size_t urlSuffixStart(const char* str, size_t len, uint8_t flags)
+{
+    size_t start = len;
+    while (start > 0 && kUrlChars.is(str[start - 1], flags))
+    {
+        start--;
+    }
+    return start;
+}
+
+/** @brief Equivalent to "^[a-z0-9A-Z._%+-]+@[a-z0-9A-Z.-]+[.][a-zA-Z]{2,6}" */
+bool isUrlEmail(const char* str, size_t len)
+{
+    size_t pos = 0;
+    while (pos < len && kUrlChars.is(str[pos], kUrlEmailLocal))
+    {
+        pos++;
+    }
+    if (pos == 0 || pos >= len || str[pos] != '@')
+    {
+        return false;
+    }
+
+    // the domain can contain dots, but the TLD can't: the last dot splits both
+    size_t domainStart = pos + 1;
+    size_t lastDot = len;
+    for (pos = domainStart; pos < len; pos++)
+    {
+        if (!kUrlChars.is(str[pos], kUrlEmailDomain))
+        {
+            return false;
+        }
+        if (str[pos] == '.')
+        {
+            lastDot = pos;
+        }
+    }
+    if (lastDot == len || lastDot == domainStart)
+    {
+        return false;
+    }
+    size_t tldLen = len - lastDot - 1;
+    if (tldLen < 2 || tldLen > 6)
+    {
+        return false;
+    }
+    for (pos = lastDot + 1; pos < len; pos++)
+    {
+        if (!isUrlAlpha(str[pos]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Equivalent to "((WWW.|www.)?mega.+(nz/|co.nz/)).*((#F!|#!|C!|chat/|file/|folder/)[a-z0-9A-Z-._~:/?#!$&'()*+,;= \\-@]+)$"
+ * @param megaEnd Index right after the "mega" of the candidate
+ */
+bool isMegaLinkFrom(const char* str, size_t len, size_t megaEnd, size_t linkCharsStart)
+{
+    static const char* const kLinkPrefixes[] = { "#F!", "#!", "C!", "chat/", "file/", "folder/" };
+
+    // "mega.+nz/" (the "co.nz/" alternative is already covered by the first one)
+    size_t pos = megaEnd + 1;
+    for (;; pos++)
+    {
+        if (pos > len || !isUrlAnyChar(str[pos - 1]))
+        {
+            return false;
+        }
+        if (urlHasPrefix(str, len, pos, "nz/"))
+        {
+            break;
+        }
+    }
+
+    // ".*" followed by a link prefix and at least one link char up to the end
+    for (pos += 3; pos < len; pos++)
+    {
+        for (const char* prefix: kLinkPrefixes)
         {
-            if (!partialString.empty())
+            if (urlHasPrefix(str, len, pos, prefix))
             {
-                removeUnnecessaryFirstCharacters(partialString);
-                removeUnnecessaryLastCharacters(partialString);
-                if (parseUrl(partialString))
+                size_t linkStart = pos + strlen(prefix);
+                if (linkStart < len && linkStart >= linkCharsStart)
                 {
-                    url = partialString;
                     return true;
                 }
             }
-
-            partialString.clear();
         }
+        if (!isUrlAnyChar(str[pos]))
+        {
+            return false;
+        }
+    }
+    return false;
+}
 
-        position ++;
+bool isMegaLink(const char* str, size_t len)
+{
+    size_t linkCharsStart = urlSuffixStart(str, len, kUrlMegaLink);
+    if (urlHasPrefix(str, len, 0, "mega") && isMegaLinkFrom(str, len, 4, linkCharsStart))
+    {
+        return true;
     }
+    return (urlHasPrefix(str, len, 0, "www") || urlHasPrefix(str, len, 0, "WWW"))
+            && len > 3 && isUrlAnyChar(str[3])
+            && urlHasPrefix(str, len, 4, "mega")
+            && isMegaLinkFrom(str, len, 8, linkCharsStart);
+}
 
-    if (!partialString.empty())
+/** @brief Equivalent to "([:]{1}[0-9]{1,5})?([/]{1}[a-z0-9A-Z-._~:?#/@!$&'()*+,;=]*)?$" from \c pos */
+bool isUrlPortAndPath(const char* str, size_t len, size_t pos, size_t pathCharsStart)
+{
+    if (pos < len && str[pos] == ':')
     {
-        removeUnnecessaryFirstCharacters(partialString);
-        removeUnnecessaryLastCharacters(partialString);
-        if (parseUrl(partialString))
+        size_t digits = 0;
+        for (pos++; pos < len && isUrlDigit(str[pos]); pos++)
         {
-            url = partialString;
-            return true;
+            digits++;
+        }
+        if (digits < 1 || digits > 5)
+        {
+            return false;
         }
     }
+    if (pos == len)
+    {
+        return true;
+    }
+    return str[pos] == '/' && pos + 1 >= pathCharsStart;
+}
 
-    return false;
+/** @brief Equivalent to "^([0-9]{1,3}[.]{1}[0-9]{1,3}[.]{1}[0-9]{1,3}[.]{1}[0-9]{1,3})" plus port and path */
+bool isUrlIpv4(const char* str, size_t len, size_t pathCharsStart)
+{
+    size_t pos = 0;
+    for (int group = 0; group < 4; group++)
+    {
+        if (group > 0)
+        {
+            if (pos >= len || str[pos] != '.')
+            {
+                return false;
+            }
+            pos++;
+        }
+        size_t groupStart = pos;
+        while (pos < len && isUrlDigit(str[pos]))
+        {
+            pos++;
+        }
+        if (pos == groupStart || pos - groupStart > 3)
+        {
+            return false;
+        }
+    }
+    return isUrlPortAndPath(str, len, pos, pathCharsStart);
 }
 
-bool Message::parseUrl(const std::string &url)
+/** @brief Returns true if [end - tldLen - 1, end) matches "[.]{1}[a-zA-Z]{tldLen}" and it starts after \c start */
+bool isUrlTld(const char* str, size_t start, size_t end, size_t tldLen)
 {
-    if (url.find('.') == std::string::npos)
+    if (end < start + tldLen + 1 || str[end - tldLen - 1] != '.')
     {
         return false;
     }
+    for (size_t pos = end - tldLen; pos < end; pos++)
+    {
+        if (!isUrlAlpha(str[pos]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
 
-    if (isValidEmail(url))
+/**
+ * @brief Equivalent to "(^(WWW.|www.))?([a-z0-9A-Z]+)([a-z0-9A-Z-._~?#!$&'()*+,;=])*([a-z0-9A-Z]+)([.]{1}[a-zA-Z]{2,5}){1,2}"
+ * plus port and path, with the host name starting at \c start
+ *
+ * Since [a-z0-9A-Z] is a subset of the host chars, the part before the TLDs is any string of
+ * host chars with at least two chars, starting and ending with an alphanumeric char.
+ */
+bool isUrlHostNameFrom(const char* str, size_t len, size_t start, size_t pathCharsStart)
+{
+    size_t hostCharsEnd = start;
+    while (hostCharsEnd < len && kUrlChars.is(str[hostCharsEnd], kUrlHost))
     {
-        return false;
+        hostCharsEnd++;
     }
 
-    std::string urlToParse = url;
-    std::string::size_type position = urlToParse.find("://");
-    if (position != std::string::npos)
+    auto isName = [str, start, hostCharsEnd](size_t end)
     {
-        std::regex expresion("^(http://|https://)(.+)");
-        if (regex_match(urlToParse, expresion))
+        return end >= start + 2 && end <= hostCharsEnd
+                && kUrlChars.is(str[start], kUrlAlnum)
+                && kUrlChars.is(str[end - 1], kUrlAlnum);
+    };
+
+    for (size_t end = start + 5; end <= len; end++)
+    {
+        if (end < len && str[end] != ':' && str[end] != '/')
         {
-            urlToParse = urlToParse.substr(position + 3);
+            continue;   // port and path can't start here
         }
-        else
+        if (!isUrlPortAndPath(str, len, end, pathCharsStart))
+        {
+            continue;
+        }
+        for (size_t tldLen = 2; tldLen <= 5; tldLen++)
+        {
+            if (!isUrlTld(str, start, end, tldLen))
+            {
+                continue;
+            }
+            size_t tldStart = end - tldLen - 1;
+            if (isName(tldStart))
+            {
+                return true;
+            }
+            for (size_t tld2Len = 2; tld2Len <= 5; tld2Len++)
+            {
+                if (isUrlTld(str, start, tldStart, tld2Len) && isName(tldStart - tld2Len - 1))
+                {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+bool isUrlHost(const char* str, size_t len)
+{
+    size_t pathCharsStart = urlSuffixStart(str, len, kUrlPath);
+    if (isUrlIpv4(str, len, pathCharsStart) || isUrlHostNameFrom(str, len, 0, pathCharsStart))
+    {
+        return true;
+    }
+    return (urlHasPrefix(str, len, 0, "www") || urlHasPrefix(str, len, 0, "WWW"))
+            && len > 3 && isUrlAnyChar(str[3])
+            && isUrlHostNameFrom(str, len, 4, pathCharsStart);
+}
+
+/** @brief Equivalent to "^(http://|https://)(.+)" */
+bool hasHttpScheme(const char* str, size_t len, size_t& schemeLen)
+{
+    schemeLen = urlHasPrefix(str, len, 0, "http://") ? 7
+              : urlHasPrefix(str, len, 0, "https://") ? 8
+              : 0;
+    if (!schemeLen || len <= schemeLen)
+    {
+        return false;
+    }
+    for (size_t pos = schemeLen; pos < len; pos++)
+    {
+        if (!isUrlAnyChar(str[pos]))
         {
             return false;
         }
     }
+    return true;
+}
 
-    std::regex megaUrlExpression("((WWW.|www.)?mega.+(nz/|co.nz/)).*((#F!|#!|C!|chat/|file/|folder/)[a-z0-9A-Z-._~:/?#!$&'()*+,;= \\-@]+)$");
-    if (regex_match(urlToParse, megaUrlExpression))
+bool matchUrl(const char* str, size_t len)
+{
+    if (!memchr(str, '.', len) || isUrlEmail(str, len))
     {
         return false;
     }
 
-    std::regex regularExpresion("((^([0-9]{1,3}[.]{1}[0-9]{1,3}[.]{1}[0-9]{1,3}[.]{1}[0-9]{1,3}))|((^(WWW.|www.))?([a-z0-9A-Z]+)([a-z0-9A-Z-._~?#!$&'()*+,;=])*([a-z0-9A-Z]+)([.]{1}[a-zA-Z]{2,5}){1,2}))([:]{1}[0-9]{1,5})?([/]{1}[a-z0-9A-Z-._~:?#/@!$&'()*+,;=]*)?$");
+    static const char kSchemeSep[] = "://";
+    if (std::search(str, str + len, kSchemeSep, kSchemeSep + 3) != str + len)
+    {
+        size_t schemeLen;
+        if (!hasHttpScheme(str, len, schemeLen))
+        {
+            return false;
+        }
+        str += schemeLen;
+        len -= schemeLen;
+    }
+
+    return !isMegaLink(str, len) && isUrlHost(str, len);
+}
+} // anonymous namespace
+
+bool Message::hasUrl(const string &text, string &url)
+{
+    const char* data = text.data();
+    size_t len = text.size();
+    size_t pos = 0;
+    while (pos < len)
+    {
+        while (pos < len && !kUrlChars.is(data[pos], kUrlToken))
+        {
+            pos++;
+        }
+        size_t start = pos;
+        while (pos < len && kUrlChars.is(data[pos], kUrlToken))
+        {
+            pos++;
+        }
+        size_t end = pos;
+
+        // same as removeUnnecessaryFirstCharacters() and removeUnnecessaryLastCharacters()
+        while (start < end && kUrlChars.is(data[start], kUrlTrim))
+        {
+            start++;
+        }
+        while (end > start && kUrlChars.is(data[end - 1], kUrlTrim))
+        {
+            end--;
+        }
+
+        if (start < end && matchUrl(data + start, end - start))
+        {
+            url.assign(data + start, end - start);
+            return true;
+        }
+    }
 
-    return regex_match(urlToParse, regularExpresion);
+    return false;
+}
+
+bool Message::parseUrl(const std::string &url)
+{
+    return matchUrl(url.data(), url.size());
 }
 
 Chat::SendingItem::SendingItem(uint8_t aOpcode, Message *aMsg, const SetOfIds &aRcpts, uint64_t aRowid)
@@ -7441,8 +8158,7 @@ void Message::removeUnnecessaryFirstCharacters(string &buf)
 
 bool Message::isValidEmail(const string &buf)
 {
-    std::regex regularExpresion("^[a-z0-9A-Z._%+-]+@[a-z0-9A-Z.-]+[.][a-zA-Z]{2,6}");
-    return regex_match(buf, regularExpresion);
+    return isUrlEmail(buf.data(), buf.size());
 }
 
 FilteredHistory::FilteredHistory(DbInterface &db, Chat &chat)
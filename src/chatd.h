@@ -8,9 +8,13 @@
 #include <set>
 #include <list>
 #include <deque>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
 #include <base/promise.h>
 #include <base/timers.hpp>
 #include <base/trackDelete.h>
+#include <base/workerPool.h>
 #include <chatdMsg.h>
 #include <url.h>
 #include <net/websocketsIO.h>
@@ -476,13 +480,25 @@ protected:
     /** This promise is resolved when output data is written to the sockets */
     promise::Promise<void> mSendPromise;
 
+    /** Output kept while the socket has more than kSendHighWaterMark bytes queued */
+    std::deque<Buffer> mBackloggedOutput;
+
+    /** Size in bytes of mBackloggedOutput */
+    size_t mBackloggedBytes = 0;
+
+    /** Bytes queued in the socket above which sendBuf() backlogs the output */
+    static constexpr size_t kSendHighWaterMark = 512 * 1024;
+
+    /** Bytes queued in the socket below which backlogged output is released */
+    static constexpr size_t kSendLowWaterMark = 128 * 1024;
+
     /** Flag to indicate if a fresh URL is being fetched */
     bool mFetchingUrl = false;
 
     // ---- callbacks called from libwebsocketsIO ----
     void wsConnectCb() override;
     void wsCloseCb(int errcode, int errtype, const char *preason, size_t preason_len) override;
-    void wsHandleMsgCb(char *data, size_t len) override;
+    void wsHandleMsgCb(const RecvBuffer& msg) override;
     void wsSendMsgCb(const char *, size_t) override;
 #if WEBSOCKETS_TLS_SESSION_CACHE_ENABLED
     bool wsSSLsessionUpdateCb(const CachedSession &sess) override;
@@ -502,12 +518,14 @@ protected:
     void doConnect();
 // Destroys the buffer content
     bool sendBuf(Buffer&& buf);
+    void flushBackloggedOutput();
+    void clearBackloggedOutput();
     bool rejoinExistingChats();
     void resendPending();
     void join(const karere::Id& chatid);
     void hist(const karere::Id& chatid, long count);
     bool sendCommand(Command&& cmd); // used internally only for OP_HELLO
-    void execCommand(const StaticBuffer& buf);
+    void execCommand(const RecvBuffer& buf);
     promise::Promise<void> sendKeepalive();
     void sendEcho();
 
@@ -535,6 +553,12 @@ public:
     int shardNo() const;
     promise::Promise<void> sendSync();
 
+    /** @brief Returns the metrics of the output queue of the socket */
+    WebsocketsSendStats sendStats() const;
+
+    /** @brief Returns the bytes kept by back-pressure, pending to be queued in the socket */
+    size_t backloggedBytes() const;
+
     promise::Promise<void> connect();
     promise::Promise<void> fetchUrl();
 };
@@ -777,6 +801,7 @@ public:
         uint8_t mStatus;
     };
     typedef std::list<PendingReaction> PendingReactions;
+    typedef std::vector<std::pair<std::string, karere::Id>> MsgReactions;   // (reaction, userid) pairs
 
     Client& mChatdClient;
 
@@ -792,9 +817,13 @@ protected:
     Idx mForwardStart;
     std::vector<std::unique_ptr<Message>> mForwardList;
     std::vector<std::unique_ptr<Message>> mBackwardList;
+    /** Payloads of the messages in the history buffer, see compactPayload() */
+    BufferArena mPayloadArena;
     std::unique_ptr<FilteredHistory> mAttachmentNodes;
     OutputQueue mSending;
     PendingReactions mPendingReactions;
+    /** @brief True once pending reactions have been loaded from DB (they are kept in sync in RAM afterwards) */
+    bool mPendingReactionsLoaded = false;
     OutputQueue::iterator mNextUnsent;
     bool mIsFirstJoin = true;
     std::map<karere::Id, Idx> mIdToIndexMap;
@@ -872,6 +901,14 @@ protected:
      * of new messages may work synchronously and not be delayed.
      */
     Idx mDecryptOldHaltedAt = CHATD_IDX_INVALID;
+    /** Max number of messages passed to ICrypto::msgDecryptBatch() at once */
+    static constexpr size_t kMaxDecryptBatchSize = 256;
+    /** Invalidated when the messages queued for decryption are discarded, so pending
+     * flushes and decrypt batches in flight for them are ignored */
+    karere::WorkGeneration mDecryptBatchGeneration;
+    /** True while a queued message is passed to ICrypto::msgDecrypt() because the crypto
+     * module can't decrypt it in a batch */
+    bool mDecryptBatchBypass = false;
     uint32_t mLastMsgTs;
     bool mIsGroup;
     std::set<karere::Id> mMsgsToUpdateWithRichLink;
@@ -891,6 +928,10 @@ protected:
     karere::Id mReactionSn = karere::Id::inval();
     /** Indicates the retention time for this chat room, after which the previous messages are automatically deleted */
     uint32_t mRetentionTime = 0;
+    /** True while the app has this chat open: its RAM history buffer is never evicted */
+    bool mHistoryPinned = false;
+    /** Value of Client::mHistoryAccessCounter the last time the app used the history of this chat (for LRU eviction) */
+    uint64_t mLastHistoryAccess = 0;
     // ====
     std::map<karere::Id, Message*> mPendingEdits;
     std::map<BackRefId, Idx> mRefidToIdxMap;
@@ -910,6 +951,19 @@ protected:
     Idx msgIncoming(bool isNew, Message* msg, bool isLocal=false);
     bool msgIncomingAfterAdd(bool isNew, bool isLocal, Message& msg, Idx idx);
     void msgIncomingAfterDecrypt(bool isNew, bool isLocal, Message& msg, Idx idx);
+    /** Halts decryption at \c idx and schedules a flushDecryptBatch(), so messages received
+     * from server in the same burst are decrypted together in worker threads */
+    void queueForDecryptBatch(bool isNew, Idx idx);
+    /** Passes the messages queued since decryption was halted to ICrypto::msgDecryptBatch() */
+    void flushDecryptBatch(bool isNew);
+    /** Continues with the messages queued after the one decryption was halted at, once
+     * that one has been processed */
+    void resumeHaltedDecrypt(bool isNew);
+    /** Called when the messages received by a server history fetch have been decrypted */
+    void onFetchHistDecrypted(bool fetchingOld);
+    /** Moves the payload of a message of the history buffer, which is not going to be
+     * modified anymore (except by edits), into mPayloadArena */
+    void compactPayload(Message& msg) { mPayloadArena.adopt(msg); }
     bool msgNodeHistIncoming(Message* msg);
     void onUserJoin(const karere::Id& userid, Priv priv);
     void onUserLeave(const karere::Id& userid);
@@ -960,6 +1014,16 @@ protected:
     void removeMessageReactions(Idx idx, bool cleanPrevious = false);
     void manageRichLinkMessage(Message &message);
     void attachmentHistDone();
+    /**
+     * @brief Removes up to \c count of the oldest messages from the RAM history buffer.
+     *
+     * Evicted messages are still in the db, so they are transparently reloaded by
+     * getHistoryFromDb() when the app requests older history. Eviction stops at
+     * any message that is not yet in the db or still referenced by a pending operation,
+     * and it never leaves less than \c initialHistoryFetchCount messages in RAM.
+     * @return The number of evicted messages
+     */
+    Idx evictOldHistory(Idx count);
     friend class Connection;
     friend class Client;
 /// @endcond PRIVATE
@@ -1192,6 +1256,18 @@ public:
      */
     void resetGetHistory();
 
+    /**
+     * @brief Pins or unpins the RAM history buffer of this chat. Pinned chats (i.e. those
+     * opened by the app) are never affected by the history memory budget of the Client.
+     */
+    void setHistoryPinned(bool pinned);
+
+    /** @brief Whether the RAM history buffer of this chat is pinned */
+    bool isHistoryPinned() const { return mHistoryPinned; }
+
+    /** @brief Estimated amount of memory (in bytes) used by the RAM history buffer */
+    size_t historyMemoryUsage() const;
+
     /**
      * @brief setMessageSeen Move the last-seen-by-us pointer to the message with the
      * specified index.
@@ -1562,6 +1638,33 @@ protected:
     /** Timestamp of the next check of retention history for all chats, or zero (disabled) */
     uint32_t mRetentionCheckTs;
 
+    /** Max number of messages kept in the RAM history buffer of each chat, or zero (unlimited) */
+    size_t mHistoryBudgetPerChat = 0;
+
+    /** Max number of messages kept in the RAM history buffers of all chats, or zero (unlimited) */
+    size_t mHistoryBudgetTotal = 0;
+
+    /** Incremented every time the app uses the history of a chat, to find the least recently used ones */
+    uint64_t mHistoryAccessCounter = 0;
+
+    /** Handler of the timeout that runs enforceHistoryBudget(), if it's scheduled */
+    megaHandle mHistoryEvictionTimer = 0;
+
+    uint64_t mEvictedHistoryMsgs = 0;
+    uint64_t mHistoryEvictions = 0;
+
+    /**
+     * @brief Schedules a call to enforceHistoryBudget(), if there is any budget set.
+     * Messages usually arrive in bursts of events (ie. a history fetch or a batch of decrypted
+     * messages), so the call is deferred to the next iteration of the event loop rather than
+     * marshalled: it runs once after all of them, instead of once after each event.
+     */
+    void scheduleHistoryEviction();
+    void cancelHistoryEviction();
+
+    /** @brief Evicts old messages from RAM history buffers until the budgets are met */
+    void enforceHistoryBudget();
+
 public:
     // Chatd Version:
     // - Version 0: initial version
@@ -1593,6 +1696,17 @@ public:
     Client(karere::Client *aKarereClient);
     ~Client();
 
+    struct HistoryMemoryStats
+    {
+        size_t numChats = 0;            // chats with messages in RAM
+        size_t numPinnedChats = 0;
+        size_t numMessages = 0;         // messages in RAM history buffers
+        size_t numPinnedMessages = 0;   // messages in RAM history buffers of pinned chats
+        size_t numBytes = 0;            // estimated memory used by RAM history buffers
+        uint64_t numEvictedMessages = 0;
+        uint64_t numEvictions = 0;
+    };
+
     enum: uint8_t { kRichLinkNotDefined = 0,  kRichLinkEnabled = 1, kRichLinkDisabled = 2};
 
     MyMegaApi *mApi;
@@ -1698,10 +1812,82 @@ public:
      * will be modified, and a new timer will be set if mRetentionCheckTs > 0
      */
     void setRetentionTimer();
+
+    /**
+     * @brief Sets the max number of messages kept in the RAM history buffers.
+     *
+     * When a budget is exceeded, the oldest messages of the affected chats are evicted
+     * from RAM. They are reloaded from db if the app requests them again. Chats that
+     * are open by the app are pinned and never evicted.
+     *
+     * @param maxPerChat Max number of messages in RAM for every chat. Every chat keeps at
+     * least \c Chat::initialHistoryFetchCount messages regardless of this value.
+     * @param maxTotal Max number of messages in RAM for all chats together.
+     * Zero means unlimited for both values (default).
+     */
+    void setHistoryBudget(size_t maxPerChat, size_t maxTotal);
+
+    /** @brief Returns the current usage of RAM history buffers and eviction counters */
+    HistoryMemoryStats historyMemoryStats() const;
+
+    /**
+     * @brief Evicts old messages from the RAM history buffers of \c chats until the budgets are met.
+     *
+     * First, every chat is trimmed to \c maxPerChat messages. Then, if there are more than
+     * \c maxTotal messages in total, they are evicted from the least recently used chats.
+     * Pinned chats are never evicted. Zero means unlimited for both budgets.
+     *
+     * @return The number of messages left in the RAM history buffers of \c chats
+     */
+    template <typename ChatPtr>
+    static size_t enforceHistoryBudget(const std::vector<ChatPtr>& chats, size_t maxPerChat, size_t maxTotal);
+
     friend class Connection;
     friend class Chat;
 };
 
+template <typename ChatPtr>
+size_t Client::enforceHistoryBudget(const std::vector<ChatPtr>& chats, size_t maxPerChat, size_t maxTotal)
+{
+    size_t total = 0;
+    std::vector<ChatPtr> candidates;
+    for (const ChatPtr& chat: chats)
+    {
+        if (maxPerChat && static_cast<size_t>(chat->size()) > maxPerChat)
+        {
+            chat->evictOldHistory(chat->size() - static_cast<Idx>(maxPerChat));
+        }
+
+        total += static_cast<size_t>(chat->size());
+        if (!chat->isHistoryPinned() && !chat->empty())
+        {
+            candidates.push_back(chat);
+        }
+    }
+
+    if (!maxTotal || total <= maxTotal)
+    {
+        return total;
+    }
+
+    // least recently used chats first
+    std::sort(candidates.begin(), candidates.end(), [](const ChatPtr& a, const ChatPtr& b)
+    {
+        return a->mLastHistoryAccess < b->mLastHistoryAccess;
+    });
+
+    for (const ChatPtr& chat: candidates)
+    {
+        size_t excess = total - maxTotal;
+        total -= static_cast<size_t>(chat->evictOldHistory(static_cast<Idx>(std::min<size_t>(excess, static_cast<size_t>(chat->size())))));
+        if (total <= maxTotal)
+        {
+            break;
+        }
+    }
+    return total;
+}
+
 static inline const char* connStateToStr(Connection::State state)
 {
     switch (state)
@@ -1848,6 +2034,8 @@ public:
     virtual Idx getOldestIdx() = 0;
     virtual uint32_t getOldestMsgTs() = 0;
     virtual Idx getIdxOfMsgidFromHistory(const karere::Id& msgid) = 0;
+    /// count the unread messages after \c idx. Despite being a getter, it writes the row of the chat
+    /// in the chats table: the persisted unread counter is updated to the count after \c idx
     virtual Idx getUnreadMsgCountAfterIdx(Idx idx) = 0;
     virtual void getLastTextMessage(Idx from, chatd::LastTextMsgState& msg, uint32_t& lastTs) = 0;
     virtual void getMessageDelta(const karere::Id& msgid, uint16_t *updated) = 0;
@@ -1870,6 +2058,12 @@ public:
     virtual void delReaction(const karere::Id& msgId, const karere::Id& userId, const std::string &reaction) = 0;
     virtual void delPendingReaction(const karere::Id& msgId, const std::string &reaction) = 0;
     virtual void getReactions(const karere::Id& msgId,std::vector<std::pair<std::string, karere::Id>> &reactions) const = 0;
+
+    /**
+     * @brief Loads the confirmed reactions of all the messages in history within [idxLow, idxHigh]
+     * @param [out] reactions Map of msgid to its reactions, in the same order as returned by \c getReactions
+     */
+    virtual void getReactionsForRange(Idx idxLow, Idx idxHigh, std::unordered_map<karere::Id, Chat::MsgReactions>& reactions) const = 0;
     virtual void getPendingReactions(std::vector<chatd::Chat::PendingReaction>& reactions) const = 0;
     virtual bool hasPendingReactions() = 0;
 
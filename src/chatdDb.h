@@ -3,18 +3,236 @@
 
 #include "db.h"
 #include "chatd.h"
+#include <limits>
 //extern sqlite3* db;
 
+/**
+ * @brief Count of the unread messages of a chat, persisted in the chats table
+ *
+ * Unread messages are counted in the range of idxs (start, end]. The persisted counter is the
+ * count after the unread_idx of the chat (all messages if CHATD_IDX_INVALID), or -1 if unknown.
+ * The writes to history report their changes (see ChatdHistoryWriter), so the counter is only
+ * rebuilt from a full count when unknown.
+ */
+class ChatdUnreadCounter
+{
+public:
+    ChatdUnreadCounter(SqliteDb& db, karere::Id chatid, karere::Id myHandle, bool isNoteToSelf)
+        : mDb(db), mChatid(chatid), mMyHandle(myHandle), mIsNoteToSelf(isNoteToSelf) {}
+
+    /** @brief Returns the unread messages after \c idx, which becomes the idx of the persisted counter */
+    int getCountAfterIdx(chatd::Idx idx);
+
+    /** @brief To be called after adding \c msg to history */
+    void onMessageAdded(const chatd::Message& msg, chatd::Idx idx);
+
+    /** @brief Returns true if the message in history with \c msgid is unread, setting its \c idx */
+    bool isUnreadInHistory(karere::Id msgid, chatd::Idx& idx);
+
+    /** @brief To be called after updating a message in history, with the result of isUnreadInHistory() before the update */
+    void onMessageUpdated(const chatd::Message& msg, chatd::Idx idx, bool wasUnread);
+
+    /** @brief To be called after removing messages from history, up to \c idx (all of them if CHATD_IDX_INVALID) */
+    void onMessagesRemoved(chatd::Idx idx);
+
+protected:
+    static constexpr int64_t kRangeEnd = std::numeric_limits<int64_t>::max();
+    static int64_t rangeStart(chatd::Idx idx)
+    {
+        return (idx == CHATD_IDX_INVALID) ? std::numeric_limits<int64_t>::min() : idx;
+    }
+
+    int countInRange(int64_t start, int64_t end);
+    bool load(int& count, chatd::Idx& idx);
+    void save(int count, chatd::Idx idx);
+    void update(chatd::Idx idx, int delta);
+
+    SqliteDb& mDb;
+    karere::Id mChatid;
+    karere::Id mMyHandle;
+    bool mIsNoteToSelf;
+};
+
+/**
+ * @brief Writes to the history table of a chat, keeping its persisted unread counter up to date
+ *
+ * ChatdSqliteDb writes history only through this class, so no write can be missed by the counter.
+ */
+class ChatdHistoryWriter
+{
+public:
+    ChatdHistoryWriter(SqliteDb& db, karere::Id chatid, karere::Id myHandle, bool isNoteToSelf)
+        : mDb(db), mChatid(chatid), mUnreadCounter(db, chatid, myHandle, isNoteToSelf) {}
+
+    void addMessage(const chatd::Message& msg, chatd::Idx idx);
+
+    /** @brief Replaces the message with \c msgid, returning the number of updated rows */
+    int updateMessage(karere::Id msgid, const chatd::Message& msg);
+
+    /** @brief Removes the messages up to \c idx, or all of them if CHATD_IDX_INVALID */
+    void removeMessages(chatd::Idx idx);
+
+    /** @brief See ChatdUnreadCounter::getCountAfterIdx. It updates the counter in the chats table */
+    int getUnreadCountAfterIdx(chatd::Idx idx) { return mUnreadCounter.getCountAfterIdx(idx); }
+
+protected:
+    SqliteDb& mDb;
+    karere::Id mChatid;
+    ChatdUnreadCounter mUnreadCounter;
+};
+
 class ChatdSqliteDb: public chatd::DbInterface
 {
+public:
+    // Queries that depend on the table name are composed only once, so the same sql text
+    // is used on every call and the prepared statement can be reused from SqliteDb's cache
+    struct TableQueries
+    {
+        std::string addMessage;
+        std::string checkRange;
+        std::string idxOfMsgid;
+        std::string msgidOfIdx;
+        std::string loadMessages;
+
+        explicit TableQueries(const std::string& table)
+            : addMessage("insert into " + table + " (idx, chatid, msgid, keyid, type, userid, ts, updated, data, backrefid, is_encrypted, data_len) "
+                         "values(?,?,?,?,?,?,?,?,?,?,?,?)")
+            , checkRange("select min(idx), max(idx), count(*) from " + table + " where chatid = ?")
+            , idxOfMsgid("select idx from " + table + " where chatid = ? and msgid = ?")
+            , msgidOfIdx("select msgid from " + table + " where chatid=?1 and idx=?2")
+            , loadMessages("select msgid, userid, ts, type, data, idx, keyid, backrefid, updated, is_encrypted from " + table +
+                           " where chatid = ?1 and idx <= ?2 order by idx desc limit ?3")
+        {}
+    };
+
 protected:
     SqliteDb& mDb;
     chatd::Chat& mChat;
     std::string mSendingTblName;
     std::string mHistTblName;
+    TableQueries mHistQueries;
+    TableQueries mNodeHistQueries;
+    ChatdHistoryWriter mHistory;
+
+    const TableQueries& queries(const std::string& table) const
+    {
+        return (table == "node_history") ? mNodeHistQueries : mHistQueries;
+    }
+
 public:
+    /**
+     * Queries run for every chat or message. Their plans are checked by tests so they don't
+     * scan whole tables: keep them in sync with the indexes in dbSchema.sql
+     */
+    struct HotQueries
+    {
+        // the constant conditions are the WHERE of the partial index history_unread (see
+        // unreadIndexCondition()), and must match the ones in Message::isValidUnread()
+        std::string unreadCountInRange;
+        std::string endCallMsgsInRange;
+        std::string unreadCounter;
+        std::string unreadCandidate;
+        std::string lastTextMsg;
+        std::string loadSendQueue;
+        std::string loadManualSendItems;
+        std::string reactionsForRange;
+        std::string chatSummaries;  // reads the whole chats table, so it's not part of all()
+
+        HotQueries()
+            : unreadCountInRange("select count(*) from history where chatid = ?1 and userid != ?2"
+                                 " and not (updated != 0 and data_len = 0)"
+                                 " and " + unreadIndexCondition() +
+                                 " and idx > ?3 and idx <= ?4")
+            , endCallMsgsInRange("select data from history where chatid = ?1 and userid != ?2 and ts > ?3 and type = ?4"
+                                 " and idx > ?5 and idx <= ?6")
+            , unreadCounter("select unread_count, unread_idx from chats where chatid = ?")
+            , unreadCandidate("select idx, userid, keyid, type, ts, updated, is_encrypted, data from history"
+                              " where chatid = ? and msgid = ?")
+            , lastTextMsg("select type, idx, data, msgid, userid, ts from history where chatid = ?1"
+                          " and (data_len > 0 or type = ?2) and type != ?3 and type != ?4 and idx <= ?5"
+                          " order by idx desc limit 1")
+            , loadSendQueue("select rowid, opcode, msgid, keyid, msg, type, ts, updated, backrefid, backrefs,"
+                            " recipients, msg_cmd, key_cmd from sending where chatid = ? order by rowid asc")
+            , loadManualSendItems("select rowid, msgid, type, ts, updated, msg, opcode, reason"
+                                  " from manual_sending where chatid = ? order by rowid asc")
+            , reactionsForRange("select r.msgid, r.reaction, r.userid from history h join chat_reactions r"
+                                " on r.chatid = h.chatid and r.msgid = h.msgid"
+                                " where h.chatid = ?1 and h.idx >= ?2 and h.idx <= ?3 order by r.`_rowid_` asc")
+              // the last-message candidate is the newest message that could be picked either from RAM
+              // (Message::isValidLastMessage()) or from db (lastTextMsg). The last column tells whether
+              // both would pick it, which is the only case where it can be served without loading history
+            , chatSummaries("select c.chatid, c.ts_created, c.shard, c.own_priv, c.peer, c.peer_priv, c.title,"
+                            " c.archived, c.mode, c.unified_key, c.meeting, c.chat_options, c.unread_count, c.unread_idx,"
+                            " (select idx from history where chatid = c.chatid and msgid = c.last_seen),"
+                            " exists(select 1 from chat_vars where chatid = c.chatid and name = 'have_all_history'"
+                            " and value = '1'),"
+                            " exists(select 1 from sending where chatid = c.chatid),"
+                            " h.type, h.idx, h.data, h.msgid, h.userid, h.ts,"
+                            " (h.data_len > 0 or h.type = ?1) and h.is_encrypted in (" + sqlList({chatd::Message::kNotEncrypted,
+                                                                                                  chatd::Message::kEncryptedSignature,
+                                                                                                  chatd::Message::kEncryptedMalformed}) + ")"
+                            " from chats c left join history h on h.chatid = c.chatid and h.idx ="
+                            " (select idx from history where chatid = c.chatid and type != ?2 and type != ?3"
+                            " and (data_len > 0 or type = ?1"
+                            " or (updated = 0 and is_encrypted in (" + sqlList({chatd::Message::kNotEncrypted,
+                                                                                chatd::Message::kEncryptedSignature,
+                                                                                chatd::Message::kEncryptedMalformed}) + ")))"
+                            " order by idx desc limit 1)")
+        {}
+
+        /** @brief Returns every hot query, including the ones that depend on the history table */
+        std::vector<std::string> all() const
+        {
+            std::vector<std::string> queries = { unreadCountInRange, endCallMsgsInRange, unreadCounter,
+                                                 unreadCandidate, lastTextMsg, loadSendQueue,
+                                                 loadManualSendItems, reactionsForRange };
+            for (const char* table: { "history", "node_history" })
+            {
+                TableQueries tableQueries(table);
+                queries.insert(queries.end(), { tableQueries.checkRange, tableQueries.idxOfMsgid,
+                                                tableQueries.msgidOfIdx, tableQueries.loadMessages });
+            }
+            return queries;
+        }
+
+        /**
+         * @brief Returns the WHERE of the partial index history_unread. The index is created by
+         * dbSchema.sql, which can't refer to the enums: tests check that both are the same
+         */
+        static std::string unreadIndexCondition()
+        {
+            return "type IN (" + sqlList({chatd::Message::kMsgNormal,
+                                          chatd::Message::kMsgAttachment,
+                                          chatd::Message::kMsgContact,
+                                          chatd::Message::kMsgContainsMeta,
+                                          chatd::Message::kMsgVoiceClip}) + ")"
+                   " AND is_encrypted IN (" + sqlList({chatd::Message::kNotEncrypted,
+                                                       chatd::Message::kEncryptedSignature,
+                                                       chatd::Message::kEncryptedMalformed}) + ")";
+        }
+
+    private:
+        static std::string sqlList(std::initializer_list<int> values)
+        {
+            std::string list;
+            for (int value: values)
+            {
+                list.append(list.empty() ? "" : ", ").append(std::to_string(value));
+            }
+            return list;
+        }
+    };
+
+    static const HotQueries& hotQueries()
+    {
+        static const HotQueries queries;
+        return queries;
+    }
+
     ChatdSqliteDb(chatd::Chat& chat, SqliteDb& db, const std::string& sendingTblName="sending", const std::string& histTblName="history")
-        :mDb(db), mChat(chat), mSendingTblName(sendingTblName), mHistTblName(histTblName){}
+        :mDb(db), mChat(chat), mSendingTblName(sendingTblName), mHistTblName(histTblName),
+          mHistQueries(histTblName), mNodeHistQueries("node_history"),
+          mHistory(db, chat.chatId(), chat.client().myHandle(), chat.isNoteToSelf()){}
     void getHistoryInfo(chatd::ChatDbInfo& info) override
     {
         SqliteStmt stmt(mDb, "select min(idx), max(idx) from history where chatid=?1");
@@ -27,7 +245,7 @@ public:
             return;
         }
         info.setOldestDbIdx(minIdx);
-        SqliteStmt stmt2(mDb, "select msgid from "+mHistTblName+" where chatid=?1 and idx=?2");
+        SqliteStmt stmt2(mDb, mHistQueries.msgidOfIdx);
         stmt2 << mChat.chatId() << minIdx;
         stmt2.stepMustHaveData();
         info.setOldestDbId(stmt2.integralCol<uint64_t>(0));
@@ -50,7 +268,10 @@ public:
     }
     void assertAffectedRowCount(int count, const char* opname=nullptr)
     {
-        auto actual = sqlite3_changes(mDb);
+        assertAffectedRowCount(count, sqlite3_changes(mDb), opname);
+    }
+    void assertAffectedRowCount(int count, int actual, const char* opname)
+    {
         if (actual == count)
             return;
         std::string msg;
@@ -62,11 +283,10 @@ public:
         throw std::runtime_error(msg);
     }
 
-    void addMessage(const chatd::Message& msg, chatd::Idx idx, const std::string& table)
+    void checkAdjacentIdx(const chatd::Message& msg, chatd::Idx idx, const std::string& table)
     {
 #ifndef NDEBUG
-        std::string checkQuery = "select min(idx), max(idx), count(*) from " + table + " where chatid = ?";
-        SqliteStmt stmt(mDb, checkQuery.c_str());
+        SqliteStmt stmt(mDb, queries(table).checkRange);
         stmt << mChat.chatId();
         stmt.step();
         int low = stmt.integralCol<int>(0);
@@ -87,11 +307,11 @@ public:
                             count);
             assert(false);
         }
+#else
+        (void)msg;
+        (void)idx;
+        (void)table;
 #endif
-        std::string query = "insert into " + table + " (idx, chatid, msgid, keyid, type, userid, ts, updated, data, backrefid, is_encrypted) " +
-                                                     "values(?,?,?,?,?,?,?,?,?,?,?)";
-        mDb.query(query.c_str(), idx, mChat.chatId(), msg.id(), msg.keyid,
-            msg.type, msg.userid, msg.ts, msg.updated, msg, msg.backRefId, msg.isEncrypted());
     }
 
     void addSendingItem(chatd::Chat::SendingItem& item) override
@@ -114,6 +334,9 @@ public:
 
         // assign the given rowid to the SendingItem
         item.rowid = sqlite3_last_insert_rowid(mDb);
+
+        // a message accepted for sending must survive a crash: don't wait for the grouped commit
+        mDb.flush();
     }
 
     int updateSendingItemsKeyid(chatd::KeyId localkeyid, chatd::KeyId keyid) override
@@ -158,21 +381,12 @@ public:
     }
     void addMsgToHistory(const chatd::Message& msg, chatd::Idx idx) override
     {
-        addMessage(msg, idx, "history");
+        checkAdjacentIdx(msg, idx, "history");
+        mHistory.addMessage(msg, idx);
     }
     void updateMsgInHistory(karere::Id msgid, const chatd::Message& msg) override
     {
-        if (msg.type == chatd::Message::kMsgTruncate)
-        {
-            mDb.query("update history set type = ?, data = ?, ts = ?, updated = 0, userid = ?, keyid = ? where chatid = ? and msgid = ?",
-                msg.type, msg, msg.ts, msg.userid, msg.keyid, mChat.chatId(), msgid);
-        }
-        else    // "updated" instead of "ts"
-        {
-            mDb.query("update history set type = ?, data = ?, updated = ?, userid = ?, is_encrypted = ? where chatid = ? and msgid = ?",
-                msg.type, msg, msg.updated, msg.userid, msg.isEncrypted(), mChat.chatId(), msgid);
-        }
-        assertAffectedRowCount(1, "updateMsgInHistory");
+        assertAffectedRowCount(1, mHistory.updateMessage(msgid, msg), "updateMsgInHistory");
     }
 
     void getMessageDelta(const karere::Id& msgid, uint16_t *updated) override
@@ -185,8 +399,8 @@ public:
 
     void getMessageUserKeyId(const karere::Id &msgid, karere::Id &userid, uint32_t &keyid) override
     {
-        SqliteStmt stmt(mDb, "select userid, keyid from history where msgid = ?");
-        stmt << msgid;
+        SqliteStmt stmt(mDb, "select userid, keyid from history where chatid = ? and msgid = ?");
+        stmt << mChat.chatId() << msgid;
         stmt.stepMustHaveData("getMessageUserKeyId");
         userid = stmt.integralCol<uint64_t>(0);
         keyid = stmt.integralCol<uint32_t>(1);
@@ -194,9 +408,7 @@ public:
 
     void loadSendQueue(chatd::Chat::OutputQueue& queue) override
     {
-        SqliteStmt stmt(mDb, "select rowid, opcode, msgid, keyid, msg, type, "
-            "ts, updated, backrefid, backrefs, recipients, msg_cmd, key_cmd "
-            "from sending where chatid=? order by rowid asc");
+        SqliteStmt stmt(mDb, hotQueries().loadSendQueue);
         stmt << mChat.chatId();
 
         // Fill the sending queue with SendingItems from DB
@@ -277,8 +489,7 @@ public:
 
     virtual chatd::Idx getIdxOfMsgid(karere::Id msgid, const std::string &table)
     {
-        std::string query = "select idx from " + table + " where chatid = ? and msgid = ?";
-        SqliteStmt stmt(mDb, query.c_str());
+        SqliteStmt stmt(mDb, queries(table).idxOfMsgid);
         stmt << mChat.chatId() << msgid;
         return (stmt.step()) ? stmt.integralCol<chatd::Idx>(0) : CHATD_IDX_INVALID;
     }
@@ -289,57 +500,9 @@ public:
     }
     chatd::Idx getUnreadMsgCountAfterIdx(chatd::Idx idx) override
     {
-        // get the unread messages count --> conditions should match the ones in Message::isValidUnread()
-        std::string sql = "select count(*) from history where (chatid = ?1)"
-                "and (userid != ?2)"
-                "and not (updated != 0 and length(data) = 0)"
-                "and (is_encrypted = ?3 or is_encrypted = ?4 or is_encrypted = ?5)"
-                "and (type = ?6 or type = ?7 or type = ?8 or type = ?9 or type = ?10)";
-        if (idx != CHATD_IDX_INVALID)
-            sql+=" and (idx > ?11)";
-
-        SqliteStmt stmt(mDb, sql);
-        stmt << mChat.chatId() << mChat.client().myHandle()   // skip own messages
-             << chatd::Message::kNotEncrypted               // include decrypted messages
-             << chatd::Message::kEncryptedMalformed         // include encrypted messages due to malformed payload
-             << chatd::Message::kEncryptedSignature         // include encrypted messages due to invalid signature
-             << chatd::Message::kMsgNormal                  // include only known type of messages
-             << chatd::Message::kMsgAttachment
-             << chatd::Message::kMsgContact
-             << chatd::Message::kMsgContainsMeta
-             << chatd::Message::kMsgVoiceClip;
-        if (idx != CHATD_IDX_INVALID)
-            stmt << idx;
-        stmt.stepMustHaveData("get peer msg count");
-        int32_t unReadCount = stmt.integralCol<int32_t>(0);
-
-        sql = "select data from history where (chatid = ?1)"
-                "and (userid != ?2 )"
-                "and (ts > ?3)"
-                "and (type = ?4)";
-        if (idx != CHATD_IDX_INVALID)
-            sql+=" and (idx > ?5)";
-
-        SqliteStmt stmtEndCAll(mDb, sql);
-        stmtEndCAll << mChat.chatId() << mChat.client().myHandle() // skip own messages
-                    << chatd::kTsMissingCallUnread // skip messages older than kTsMissingCallUnread
-                    << chatd::Message::kMsgCallEnd;                // include only End call messages
-        if (idx != CHATD_IDX_INVALID)
-            stmtEndCAll << idx;
-
-        while(stmtEndCAll.step())
-        {
-            Buffer buffer;
-            stmtEndCAll.blobCol(0, buffer);
-            uint8_t termCode = chatd::Message::extractTermCodeEndCall(buffer);
-            if (termCode == chatd::CallDataReason::kNoAnswer || termCode == chatd::CallDataReason::kCancelled)
-            {
-                unReadCount ++;
-            }
-        }
-
-        return unReadCount;
+        return mHistory.getUnreadCountAfterIdx(idx);
     }
+
     void saveItemToManualSending(const chatd::Chat::SendingItem& item, int reason) override
     {
         auto& msg = *item.msg;
@@ -347,11 +510,12 @@ public:
             "ts, updated, msg, opcode, reason) values(?,?,?,?,?,?,?,?,?)",
             mChat.chatId(), item.rowid, item.msg->id(), msg.type, msg.ts,
             msg.updated, msg, item.opcode(), reason);
+        // the message has been removed from the sending queue, don't lose it in a crash
+        mDb.flushGroupedWrites();
     }
     void loadManualSendItems(std::vector<chatd::Chat::ManualSendItem>& items) override
     {
-        SqliteStmt stmt(mDb, "select rowid, msgid, type, ts, updated, msg, opcode, "
-            "reason from manual_sending where chatid=? order by rowid asc");
+        SqliteStmt stmt(mDb, hotQueries().loadManualSendItems);
         stmt << mChat.chatId();
         while(stmt.step())
         {
@@ -405,7 +569,7 @@ public:
         auto idx = getIdxOfMsgidFromHistory(msg.id());
         if (idx == CHATD_IDX_INVALID)
             throw std::runtime_error("dbInterface::truncateHistory: msgid "+msg.id().toString()+" does not exist in db");
-        mDb.query("delete from history where chatid = ? and idx < ?", mChat.chatId(), idx);
+        mHistory.removeMessages(idx - 1);
 
         cleanReactions(msg.id());
         cleanPendingReactions(msg.id());
@@ -438,11 +602,14 @@ public:
     {
         mDb.query("update chats set last_seen=? where chatid=?", msgid, mChat.chatId());
         assertAffectedRowCount(1, "setLastSeen");
+        // keep the seen pointer in sync with chatd after a crash
+        mDb.flushGroupedWrites();
     }
     void setLastReceived(const karere::Id& msgid) override
     {
         mDb.query("update chats set last_recv=? where chatid=?", msgid, mChat.chatId());
         assertAffectedRowCount(1);
+        mDb.flushGroupedWrites();
     }
 
     void setHaveAllHistory(bool haveAllHistory) override
@@ -462,10 +629,7 @@ public:
 
     void getLastTextMessage(chatd::Idx from, chatd::LastTextMsgState& msg, uint32_t& lastTs) override
     {
-        SqliteStmt stmt(mDb,
-            "select type, idx, data, msgid, userid, ts from history where chatid=?1 and "
-            "(length(data) > 0 OR type = ?2) and type != ?3  and type != ?4 and (idx <= ?5)"
-            "order by idx desc limit 1");
+        SqliteStmt stmt(mDb, hotQueries().lastTextMsg);
         stmt << mChat.chatId()
              << chatd::Message::kMsgTruncate
              << chatd::Message::kMsgRevokeAttachment
@@ -524,7 +688,7 @@ public:
 
     void clearHistory() override
     {
-        mDb.query("delete from history where chatid = ?", mChat.chatId());
+        mHistory.removeMessages(CHATD_IDX_INVALID);
         setHaveAllHistory(false);
     }
 
@@ -533,7 +697,10 @@ public:
         chatd::Idx idxOnDb = getIdxOfMsgid(msg.id(), "node_history");
         if (idxOnDb == CHATD_IDX_INVALID)
         {
-            addMessage(msg, idx, "node_history");
+            checkAdjacentIdx(msg, idx, "node_history");
+            mDb.query(mNodeHistQueries.addMessage.c_str(), idx, mChat.chatId(), msg.id(), msg.keyid,
+                msg.type, msg.userid, msg.ts, msg.updated, msg, msg.backRefId, msg.isEncrypted(),
+                static_cast<uint32_t>(msg.dataSize()));
             assertAffectedRowCount(1, "addMsgToNodeHistory");
         }
         else
@@ -544,15 +711,15 @@ public:
 
     void deleteMsgFromNodeHistory(const chatd::Message& msg) override
     {
-        mDb.query("update node_history set data = ?, updated = ?, type = ? where chatid = ? and msgid = ?",
-                  msg, msg.updated, msg.type, mChat.chatId(), msg.id());
+        mDb.query("update node_history set data = ?, data_len = ?, updated = ?, type = ? where chatid = ? and msgid = ?",
+                  msg, static_cast<uint32_t>(msg.dataSize()), msg.updated, msg.type, mChat.chatId(), msg.id());
         assertAffectedRowCount(1, "deleteMsgFromNodeHistory");
     }
 
     bool isValidReactedMessage(const karere::Id &msgid, chatd::Idx &idx) override
     {
-        SqliteStmt stmt(mDb, "select type, userid, keyid, idx from history where msgid = ?");
-        stmt << msgid;
+        SqliteStmt stmt(mDb, "select type, userid, keyid, idx from history where chatid = ? and msgid = ?");
+        stmt << mChat.chatId() << msgid;
         if (!stmt.step())
         {
             idx = CHATD_IDX_INVALID;
@@ -599,10 +766,7 @@ public:
 
     void loadMessages(int count, chatd::Idx idx, std::vector<chatd::Message*>& messages, const std::string &table)
     {
-        std::string query = "select msgid, userid, ts, type, data, idx, keyid, backrefid, updated, is_encrypted from " + table +
-                            " where chatid = ?1 and idx <= ?2 order by idx desc limit ?3";
-
-        SqliteStmt stmt(mDb, query.c_str());
+        SqliteStmt stmt(mDb, queries(table).loadMessages);
         stmt << mChat.chatId() << idx << count;
         while(stmt.step())
         {
@@ -701,6 +865,17 @@ public:
         }
     }
 
+    void getReactionsForRange(chatd::Idx idxLow, chatd::Idx idxHigh, std::unordered_map<karere::Id, chatd::Chat::MsgReactions>& reactions) const override
+    {
+        // history is looked up through an index on (chatid, idx) and chat_reactions through UNIQUE(chatid, msgid, ...)
+        SqliteStmt stmt(mDb, hotQueries().reactionsForRange);
+        stmt << mChat.chatId() << idxLow << idxHigh;
+        while (stmt.step())
+        {
+            reactions[karere::Id(stmt.integralCol<uint64_t>(0))].emplace_back(stmt.stringCol(1), karere::Id(stmt.integralCol<uint64_t>(2)));
+        }
+    }
+
     void getPendingReactions(std::vector<chatd::Chat::PendingReaction>& reactions) const override
     {
         SqliteStmt stmt(mDb, "select _rowid_, reaction, encReaction, msgid, status from chat_pending_reactions where chatid = ? ORDER BY `_rowid_` ASC");
@@ -732,9 +907,179 @@ public:
         if (idx != CHATD_IDX_INVALID)
         {
             // reactions and pending reactions in DB are removed along with messages (FK delete on cascade)
-            mDb.query("delete from history where chatid = ? and idx <= ?", mChat.chatId(), idx);
+            mHistory.removeMessages(idx);
         }
     }
 };
 
+inline int ChatdUnreadCounter::getCountAfterIdx(chatd::Idx idx)
+{
+    // serve the persisted counter, updating it with the messages between both last-seen idxs if needed
+    int count;
+    chatd::Idx counterIdx;
+    if (!load(count, counterIdx))
+    {
+        count = countInRange(rangeStart(idx), kRangeEnd);
+    }
+    else if (rangeStart(idx) > rangeStart(counterIdx))
+    {
+        count -= countInRange(rangeStart(counterIdx), rangeStart(idx));
+    }
+    else if (rangeStart(idx) < rangeStart(counterIdx))
+    {
+        count += countInRange(rangeStart(idx), rangeStart(counterIdx));
+    }
+    else
+    {
+        return count;
+    }
+
+    save(count, idx);
+    return count;
+}
+
+inline void ChatdUnreadCounter::onMessageAdded(const chatd::Message& msg, chatd::Idx idx)
+{
+    if (msg.isValidUnread(mMyHandle))
+    {
+        update(idx, 1);
+    }
+}
+
+inline bool ChatdUnreadCounter::isUnreadInHistory(karere::Id msgid, chatd::Idx& idx)
+{
+    SqliteStmt stmt(mDb, ChatdSqliteDb::hotQueries().unreadCandidate);
+    stmt << mChatid << msgid;
+    if (!stmt.step())
+    {
+        idx = CHATD_IDX_INVALID;
+        return false;
+    }
+    idx = stmt.integralCol<chatd::Idx>(0);
+    Buffer buf;
+    stmt.blobCol(7, buf);
+    chatd::Message msg(msgid, stmt.integralCol<uint64_t>(1), stmt.integralCol<uint32_t>(4),
+                       stmt.integralCol<uint16_t>(5), std::move(buf), false,
+                       stmt.integralCol<chatd::KeyId>(2), mIsNoteToSelf,
+                       stmt.integralCol<chatd::Message::Type>(3));
+    msg.setEncrypted(stmt.integralCol<uint8_t>(6));
+    return msg.isValidUnread(mMyHandle);
+}
+
+inline void ChatdUnreadCounter::onMessageUpdated(const chatd::Message& msg, chatd::Idx idx, bool wasUnread)
+{
+    bool isUnread = msg.isValidUnread(mMyHandle);
+    if (isUnread != wasUnread)
+    {
+        update(idx, isUnread ? 1 : -1);
+    }
+}
+
+inline void ChatdUnreadCounter::onMessagesRemoved(chatd::Idx idx)
+{
+    // forget the counter if it counts any of the removed messages
+    mDb.query("update chats set unread_count = -1 where chatid = ? and (unread_idx = ? or unread_idx < ?)",
+              mChatid, CHATD_IDX_INVALID, idx);
+}
+
+// conditions should match the ones in Message::isValidUnread()
+// (the known types and decrypted/undecryptable states are constants in the query, see HotQueries)
+inline int ChatdUnreadCounter::countInRange(int64_t start, int64_t end)
+{
+    const ChatdSqliteDb::HotQueries& sql = ChatdSqliteDb::hotQueries();
+    SqliteStmt stmt(mDb, sql.unreadCountInRange);
+    stmt << mChatid << mMyHandle   // skip own messages
+         << start << end;
+    stmt.stepMustHaveData("get peer msg count");
+    int count = stmt.integralCol<int>(0);
+
+    SqliteStmt stmtEndCall(mDb, sql.endCallMsgsInRange);
+    stmtEndCall << mChatid << mMyHandle // skip own messages
+                << chatd::kTsMissingCallUnread // skip messages older than kTsMissingCallUnread
+                << chatd::Message::kMsgCallEnd                 // include only End call messages
+                << start << end;
+    while (stmtEndCall.step())
+    {
+        Buffer buffer;
+        stmtEndCall.blobCol(0, buffer);
+        uint8_t termCode = chatd::Message::extractTermCodeEndCall(buffer);
+        if (termCode == chatd::CallDataReason::kNoAnswer || termCode == chatd::CallDataReason::kCancelled)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+inline bool ChatdUnreadCounter::load(int& count, chatd::Idx& idx)
+{
+    SqliteStmt stmt(mDb, ChatdSqliteDb::hotQueries().unreadCounter);
+    stmt << mChatid;
+    if (!stmt.step() || sqlite3_column_type(stmt, 0) == SQLITE_NULL || stmt.integralCol<int>(0) < 0)
+    {
+        return false;
+    }
+    count = stmt.integralCol<int>(0);
+    idx = stmt.integralCol<chatd::Idx>(1);
+    return true;
+}
+
+inline void ChatdUnreadCounter::save(int count, chatd::Idx idx)
+{
+    mDb.query("update chats set unread_count = ?, unread_idx = ? where chatid = ?", count, idx, mChatid);
+}
+
+/** Adds \c delta to the persisted counter, if it's known and counts the message at \c idx */
+inline void ChatdUnreadCounter::update(chatd::Idx idx, int delta)
+{
+    mDb.query("update chats set unread_count = unread_count + ? where chatid = ? and unread_count >= 0"
+              " and (unread_idx = ? or unread_idx < ?)",
+              delta, mChatid, CHATD_IDX_INVALID, idx);
+}
+
+inline void ChatdHistoryWriter::addMessage(const chatd::Message& msg, chatd::Idx idx)
+{
+    static const ChatdSqliteDb::TableQueries queries("history");
+    mDb.query(queries.addMessage.c_str(), idx, mChatid, msg.id(), msg.keyid,
+        msg.type, msg.userid, msg.ts, msg.updated, msg, msg.backRefId, msg.isEncrypted(),
+        static_cast<uint32_t>(msg.dataSize()));
+    mUnreadCounter.onMessageAdded(msg, idx);
+}
+
+inline int ChatdHistoryWriter::updateMessage(karere::Id msgid, const chatd::Message& msg)
+{
+    chatd::Idx idx;
+    bool wasUnread = mUnreadCounter.isUnreadInHistory(msgid, idx);
+    if (msg.type == chatd::Message::kMsgTruncate)
+    {
+        mDb.query("update history set type = ?, data = ?, data_len = ?, ts = ?, updated = 0, userid = ?, keyid = ? where chatid = ? and msgid = ?",
+            msg.type, msg, static_cast<uint32_t>(msg.dataSize()), msg.ts, msg.userid, msg.keyid, mChatid, msgid);
+    }
+    else    // "updated" instead of "ts"
+    {
+        mDb.query("update history set type = ?, data = ?, data_len = ?, updated = ?, userid = ?, is_encrypted = ? where chatid = ? and msgid = ?",
+            msg.type, msg, static_cast<uint32_t>(msg.dataSize()), msg.updated, msg.userid, msg.isEncrypted(), mChatid, msgid);
+    }
+
+    int changes = sqlite3_changes(mDb);
+    if (changes)
+    {
+        mUnreadCounter.onMessageUpdated(msg, idx, wasUnread);
+    }
+    return changes;
+}
+
+inline void ChatdHistoryWriter::removeMessages(chatd::Idx idx)
+{
+    if (idx == CHATD_IDX_INVALID)
+    {
+        mDb.query("delete from history where chatid = ?", mChatid);
+    }
+    else
+    {
+        mDb.query("delete from history where chatid = ? and idx <= ?", mChatid, idx);
+    }
+    mUnreadCounter.onMessagesRemoved(idx);
+}
+
 #endif
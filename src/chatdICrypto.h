@@ -17,6 +17,15 @@ enum
     SVCRYPTO_EMALFORMED = 6         ///< Failed to parse message, invalid format or corrupted data
 };
 
+/** @brief Counters of the lookups of keys done to decrypt received messages */
+struct KeyLookupStats
+{
+    size_t sendKeyHits = 0;         ///< send key was already decrypted in memory
+    size_t sendKeyMisses = 0;       ///< send key had to be awaited (or wasn't found)
+    size_t signingKeyHits = 0;      ///< sender's Ed25519 key was already in the user attribute cache
+    size_t signingKeyMisses = 0;    ///< sender's Ed25519 key had to be fetched
+};
+
 class Chat;
 class ICrypto
 {
@@ -77,6 +86,33 @@ public:
      */
     virtual promise::Promise<Message*> msgDecrypt(Message* src) = 0;
 
+    /**
+     * @brief Decrypts a range of received messages in worker threads, instead of one by one
+     * by \c msgDecrypt() in the app thread
+     *
+     * Only the leading messages of \c msgs that can be decrypted right away are accepted
+     * (i.e. their keys and their sender's signing key are already known). The rest must be
+     * passed to \c msgDecrypt(). Once the accepted messages are decrypted, or marked as
+     * undecryptable, \c onComplete is called from the app thread.
+     *
+     * @param msgs Messages to decrypt, which must remain alive until the batch completes
+     * @param canApply Called from the app thread right before the results are written to the
+     * messages. If it returns false (i.e. some messages were removed from history), the batch
+     * is discarded and \c onComplete is not called.
+     * @param onComplete Called after all the accepted messages were processed. It is not called
+     * if the history is reloaded or the crypto module is destroyed in the meantime.
+     * @return The number of leading messages accepted. If it is zero, no callback is called.
+     */
+    virtual size_t msgDecryptBatch(const std::vector<Message*>& /*msgs*/,
+                                   std::function<bool()> /*canApply*/,
+                                   std::function<void()> /*onComplete*/)
+    {
+        return 0;
+    }
+
+    /** @brief Returns the counters of key lookups done by \c msgDecrypt() and \c msgDecryptBatch() */
+    virtual KeyLookupStats keyLookupStats() const { return KeyLookupStats(); }
+
     /**
      * @brief The chatroom connection (to the chatd server shard) state state has changed.
      */
@@ -1078,30 +1078,40 @@ public:
         }
     };
 
+    // The fields used by most operations (id, userid, ts, keyid, updated, type and flags) are
+    // declared together, right after the payload pointer and size of the Buffer, without padding
+    // between them. Containers and rarely used fields go last.
 private:
     //avoid setting the id and flag pairs one by one by making them accessible only by setId(Id,bool)
     karere::Id mId;
-    bool mIdIsXid = false;
-
-    /* Reactions must be ordered in the same order as they were added,
-    so we need a sequence container */
-    std::vector<Reaction> mReactions;
-
-protected:
-    uint8_t mIsEncrypted = kNotEncrypted;
 
 public:
     karere::Id userid;
     uint32_t ts;
-    uint16_t updated;
     KeyId keyid;
+    uint16_t updated;
     Type type;
+
+protected:
+    uint8_t mIsEncrypted = kNotEncrypted;
+
+private:
+    bool mIdIsXid = false;
+
+public:
     bool isNoteToSelf;
-    BackRefId backRefId = 0;
-    std::vector<BackRefId> backRefs;
-    mutable void* userp;
     mutable uint8_t userFlags = 0;
     bool richLinkRemoved = 0;
+    BackRefId backRefId = 0;
+    mutable void* userp;
+
+private:
+    /* Reactions must be ordered in the same order as they were added,
+    so we need a sequence container */
+    std::vector<Reaction> mReactions;
+
+public:
+    std::vector<BackRefId> backRefs;
 
     const karere::Id& id() const { return mId; }
     void setId(const karere::Id& aId, bool isXid) { mId = aId; mIdIsXid = isXid; }
@@ -1113,7 +1123,15 @@ public:
     bool isPendingToDecrypt() const { return (mIsEncrypted == kEncryptedPending); }
     // true if message is valid, but permanently undecryptable (not transient like unknown types or keyid not found)
     bool isUndecryptable() const { return (mIsEncrypted == kEncryptedMalformed || mIsEncrypted == kEncryptedSignature); }
-    void setEncrypted(uint8_t encrypted) { mIsEncrypted = encrypted; }
+    void setEncrypted(uint8_t encrypted)
+    {
+        mIsEncrypted = encrypted;
+        if (encrypted != kEncryptedPending)
+        {
+            // only messages pending to be decrypted can reference received data (see RecvBuffer)
+            unshare();
+        }
+    }
 
     explicit Message(const karere::Id& aMsgid,
                      const karere::Id& aUserid,
@@ -1127,12 +1145,12 @@ public:
                      void* aUserp = nullptr):
         Buffer(std::forward<Buffer>(buf)),
         mId(aMsgid),
-        mIdIsXid(aIsSending),
         userid(aUserid),
         ts(aTs),
-        updated(aUpdated),
         keyid(aKeyid),
+        updated(aUpdated),
         type(aType),
+        mIdIsXid(aIsSending),
         isNoteToSelf(aIsNoteToSelf),
         userp(aUserp)
     {}
@@ -1152,34 +1170,34 @@ public:
                      std::vector<BackRefId> aBackRefs = std::vector<BackRefId>()):
         Buffer(msg, msglen),
         mId(aMsgid),
-        mIdIsXid(aIsSending),
         userid(aUserid),
         ts(aTs),
-        updated(aUpdated),
         keyid(aKeyid),
+        updated(aUpdated),
         type(aType),
+        mIdIsXid(aIsSending),
         isNoteToSelf(aIsNoteToSelf),
         backRefId(aBackRefId),
-        backRefs(aBackRefs),
-        userp(aUserp)
+        userp(aUserp),
+        backRefs(aBackRefs)
     {}
 
     Message(const Message& msg):
         Buffer(msg.buf(), msg.dataSize()),
         mId(msg.id()),
-        mIdIsXid(msg.mIdIsXid),
-        mIsEncrypted(msg.mIsEncrypted),
         userid(msg.userid),
         ts(msg.ts),
-        updated(msg.updated),
         keyid(msg.keyid),
+        updated(msg.updated),
         type(msg.type),
+        mIsEncrypted(msg.mIsEncrypted),
+        mIdIsXid(msg.mIdIsXid),
         isNoteToSelf(msg.isNoteToSelf),
+        userFlags(msg.userFlags),
+        richLinkRemoved(msg.richLinkRemoved),
         backRefId(msg.backRefId),
-        backRefs(msg.backRefs),
         userp(msg.userp),
-        userFlags(msg.userFlags),
-        richLinkRemoved(msg.richLinkRemoved)
+        backRefs(msg.backRefs)
     {}
 
     /** @brief Returns the ManagementInfo structure contained within the message
@@ -1264,7 +1282,7 @@ public:
                     || isUndecryptable()));         // or undecryptable messages due to permantent error
     }
     // conditions to consider unread messages should match the
-    // ones in ChatdSqliteDb::getUnreadMsgCountAfterIdx()
+    // ones in ChatdUnreadCounter::countInRange()
     bool isValidUnread(const karere::Id& myHandle) const
     {
         return (!isOwnMessage(myHandle)             // exclude own messages
@@ -3,6 +3,12 @@
 
 #include <sqlite3.h>
 #include <assert.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
 #include "buffer.h"
 #include "karereCommon.h"
 
@@ -26,15 +32,210 @@ class SqliteStmt;
 
 class SqliteDb
 {
+public:
+    /** Default max number of prepared statements kept per connection */
+    static constexpr size_t kStmtCacheDefaultSize = 64;
+
+    struct StmtCacheStats
+    {
+        uint64_t hits = 0;       // statement was reused from the cache
+        uint64_t misses = 0;     // statement had to be prepared
+        uint64_t evictions = 0;  // statement was finalized to make room for a new one
+    };
+
+    /**
+     * Triggers to commit the writes grouped in a transaction when not using explicit transactions
+     * (see setCommitMode()). The latency and idle triggers rely on the scheduler set by setGroupCommit().
+     */
+    struct GroupCommitPolicy
+    {
+        size_t maxPendingWrites = 256;  // commit when this number of writes is pending
+        unsigned maxLatencyMs = 500;    // commit when the grouped transaction is this old
+        unsigned idleMs = 100;          // commit when there are no writes during this time
+    };
+
+    struct GroupCommitStats
+    {
+        uint64_t writes = 0;     // write statements executed in a grouped transaction
+        uint64_t commits = 0;    // grouped transactions committed
+        uint64_t barriers = 0;   // commits requested by flush()
+    };
+
+    /** Schedules a call to onFlushTimer() after the given time (ms) */
+    typedef std::function<void(unsigned)> FlushScheduler;
+
 protected:
     friend class SqliteStmt;
+
+    struct CachedStmt
+    {
+        std::string sql;
+        sqlite3_stmt* stmt;
+        bool inUse;
+    };
+    typedef std::list<CachedStmt> StmtLruList;   // most recently used first
+
     karere::IApp &mApp;
     sqlite3* mDb = nullptr;
     bool mCommitEach = true;
     bool mHasOpenTransaction = false;
     uint16_t mCommitInterval = 20;
     time_t mLastCommitTs = 0;
+    StmtLruList mStmtLru;
+    std::unordered_map<std::string, StmtLruList::iterator> mStmtCache;
+    size_t mStmtCacheSize = kStmtCacheDefaultSize;
+    StmtCacheStats mStmtCacheStats;
+    bool mGroupCommit = false;
+    GroupCommitPolicy mGroupCommitPolicy;
+    GroupCommitStats mGroupCommitStats;
+    FlushScheduler mFlushScheduler;
+    bool mFlushScheduled = false;
+    size_t mPendingWrites = 0;
+    std::chrono::steady_clock::time_point mFirstPendingWriteTs;
+    std::chrono::steady_clock::time_point mLastWriteTs;
     inline int step(SqliteStmt& stmt);
+
+    /** True if writes are grouped in a transaction opened on demand, instead of autocommitted */
+    bool isGroupingWrites() const { return mCommitEach && mGroupCommit; }
+
+    void beforeWrite()
+    {
+        if (!isGroupingWrites())
+        {
+            return;
+        }
+
+        mLastWriteTs = std::chrono::steady_clock::now();
+        if (!mHasOpenTransaction)
+        {
+            beginTransaction();
+            mFirstPendingWriteTs = mLastWriteTs;
+        }
+
+        // scheduled even if the write fails, so the transaction is not kept open
+        if (!mFlushScheduled && mFlushScheduler)
+        {
+            mFlushScheduled = true;
+            mFlushScheduler(mGroupCommitPolicy.idleMs);
+        }
+    }
+
+    void afterWrite()
+    {
+        if (!isGroupingWrites() || !mHasOpenTransaction)
+        {
+            return;
+        }
+
+        mPendingWrites++;
+        mGroupCommitStats.writes++;
+        if (mPendingWrites >= mGroupCommitPolicy.maxPendingWrites)
+        {
+            commitGroup();
+        }
+    }
+
+    void commitGroup()
+    {
+        if (commitTransaction())
+        {
+            mGroupCommitStats.commits++;
+        }
+        mPendingWrites = 0;
+    }
+
+    /**
+     * @brief Returns a prepared statement for \c sql, reusing a cached one when available.
+     *
+     * If the cached statement for that sql is already being used (i.e. nested queries), a
+     * new uncached statement is prepared, which will be finalized when released.
+     *
+     * @param sql The sql text, which is also the key in the cache
+     * @param entry [out] The cache entry of the returned statement, or nullptr if it is not
+     * cached. It must be passed to releaseStmt(), and stays valid until then, since entries in
+     * use are never evicted
+     * @return The prepared statement, or nullptr if sqlite3_prepare_v2 failed
+     */
+    sqlite3_stmt* acquireStmt(const char* sql, CachedStmt*& entry)
+    {
+        entry = nullptr;
+        auto it = mStmtCache.find(sql);
+        if (it != mStmtCache.end())
+        {
+            CachedStmt& cachedEntry = *it->second;
+            if (!cachedEntry.inUse)
+            {
+                mStmtLru.splice(mStmtLru.begin(), mStmtLru, it->second);
+                cachedEntry.inUse = true;
+                entry = &cachedEntry;
+                mStmtCacheStats.hits++;
+                return cachedEntry.stmt;
+            }
+        }
+
+        mStmtCacheStats.misses++;
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(mDb, sql, -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            sqlite3_finalize(stmt);
+            return nullptr;
+        }
+
+        if (it != mStmtCache.end() || !mStmtCacheSize || !stmt)
+        {
+            return stmt;    // a statement for this sql is in use, or cache disabled
+        }
+
+        evictStmts(mStmtCacheSize - 1);
+        mStmtLru.push_front(CachedStmt{sql, stmt, true});
+        mStmtCache.emplace(mStmtLru.front().sql, mStmtLru.begin());
+        entry = &mStmtLru.front();
+        return stmt;
+    }
+
+    /** Returns a statement obtained from acquireStmt() to the cache, or finalizes it if not cached */
+    void releaseStmt(sqlite3_stmt* stmt, CachedStmt* entry)
+    {
+        if (!entry)
+        {
+            sqlite3_finalize(stmt);
+            return;
+        }
+
+        assert(entry->stmt == stmt && entry->inUse);
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+        entry->inUse = false;
+    }
+
+    /** Finalizes the least recently used statements not in use, until the cache has at most \c maxSize */
+    void evictStmts(size_t maxSize)
+    {
+        auto it = mStmtLru.end();
+        while (mStmtCache.size() > maxSize && it != mStmtLru.begin())
+        {
+            --it;
+            if (it->inUse)
+            {
+                continue;
+            }
+            sqlite3_finalize(it->stmt);
+            mStmtCache.erase(it->sql);
+            it = mStmtLru.erase(it);
+            mStmtCacheStats.evictions++;
+        }
+    }
+
+    void clearStmtCache()
+    {
+        for (CachedStmt& entry: mStmtLru)
+        {
+            assert(!entry.inUse);
+            sqlite3_finalize(entry.stmt);
+        }
+        mStmtLru.clear();
+        mStmtCache.clear();
+    }
     void beginTransaction()
     {
         assert(!mHasOpenTransaction);
@@ -71,6 +272,10 @@ public:
     SqliteDb(karere::IApp &app)
         : mApp(app)
     {}
+    // copies would share the connection and its open transaction, and the cached statements,
+    // which hold iterators into the LRU list and would never be finalized
+    SqliteDb(const SqliteDb&) = delete;
+    SqliteDb& operator=(const SqliteDb&) = delete;
     bool open(const char* fname, bool commitEach=true)
     {
         assert(!mDb);
@@ -120,8 +325,14 @@ public:
     {
         if (!mDb)
             return;
-        if (!mCommitEach)
-            commitTransaction();
+        commitTransaction();    // explicit or grouped transaction
+        mPendingWrites = 0;
+        mFlushScheduled = false;
+        KR_LOG_DEBUG("Karere log debug: db statement cache: %zu hits, %zu misses, %zu evictions",
+                     static_cast<size_t>(mStmtCacheStats.hits),
+                     static_cast<size_t>(mStmtCacheStats.misses),
+                     static_cast<size_t>(mStmtCacheStats.evictions));
+        clearStmtCache();
         if (int err = sqlite3_close(mDb); err)
         {
             KR_LOG_ERROR("sqlite3_close error: %d", err);
@@ -135,6 +346,7 @@ public:
         if (commitEach == mCommitEach)
             return;
         mCommitEach = commitEach;
+        mPendingWrites = 0;
         if (commitEach)
         {
             // there was an open transaction --> commit
@@ -144,10 +356,103 @@ public:
         {
             beginTransaction();
         }
+        // else --> the grouped transaction becomes the explicit one
     }
     bool commitEach() { return mCommitEach; }   // false for transactional
     void setCommitInterval(uint16_t sec) { mCommitInterval = sec; }
     bool hasOpenTransaction() const { return !mHasOpenTransaction; }
+    /** Sets the max number of prepared statements to keep in cache (0 disables the cache) */
+    void setStmtCacheSize(size_t size)
+    {
+        mStmtCacheSize = size;
+        evictStmts(size);
+    }
+    size_t stmtCacheSize() const { return mStmtCacheSize; }
+    const StmtCacheStats& stmtCacheStats() const { return mStmtCacheStats; }
+
+    /**
+     * @brief Enables or disables grouping writes when not using explicit transactions
+     *
+     * When enabled, instead of committing each write statement, a transaction is opened on the
+     * first write and committed on the triggers of \c policy. Reads on this connection see the
+     * pending writes. Operations that need durability must call flush().
+     *
+     * @note Writes are not durable until committed: on a crash, the writes of up to one flush
+     * window (GroupCommitPolicy::maxLatencyMs, 500 ms by default) are lost. Messages being sent
+     * are not, since addSendingItem() flushes, nor the writes followed by flushGroupedWrites().
+     *
+     * @param scheduler Schedules a call to onFlushTimer(), from the thread that uses the db
+     */
+    void setGroupCommit(bool enabled, FlushScheduler scheduler, const GroupCommitPolicy& policy)
+    {
+        if (!enabled && isGroupingWrites())
+        {
+            commitGroup();
+        }
+        mGroupCommit = enabled;
+        mFlushScheduler = std::move(scheduler);
+        mGroupCommitPolicy = policy;
+    }
+    // GroupCommitPolicy() can't be a default argument: its initializers aren't parsed until the class is complete
+    void setGroupCommit(bool enabled, FlushScheduler scheduler = nullptr)
+    {
+        setGroupCommit(enabled, std::move(scheduler), GroupCommitPolicy());
+    }
+    const GroupCommitStats& groupCommitStats() const { return mGroupCommitStats; }
+    size_t pendingWrites() const { return mPendingWrites; }
+
+    /** @brief Durability barrier: commits the pending writes, whatever the commit mode */
+    void flush()
+    {
+        if (!mDb)
+            return;
+        mGroupCommitStats.barriers++;
+        if (mCommitEach)
+        {
+            commitGroup();
+        }
+        else
+        {
+            commit();
+        }
+    }
+
+    /** @brief Commits the grouped writes, if any. Unlike flush(), an explicit transaction is kept open */
+    void flushGroupedWrites()
+    {
+        if (!mDb || !isGroupingWrites())
+            return;
+        mGroupCommitStats.barriers++;
+        commitGroup();
+    }
+
+    /** @brief Called by the scheduler set by setGroupCommit() to check the latency and idle triggers */
+    void onFlushTimer()
+    {
+        mFlushScheduled = false;
+        if (!mDb || !isGroupingWrites() || !mHasOpenTransaction)
+            return;
+
+        auto now = std::chrono::steady_clock::now();
+        auto elapsedMs = [&now](std::chrono::steady_clock::time_point ts)
+        {
+            return static_cast<unsigned>(std::chrono::duration_cast<std::chrono::milliseconds>(now - ts).count());
+        };
+        unsigned idleMs = elapsedMs(mLastWriteTs);
+        unsigned latencyMs = elapsedMs(mFirstPendingWriteTs);
+        if (idleMs >= mGroupCommitPolicy.idleMs || latencyMs >= mGroupCommitPolicy.maxLatencyMs)
+        {
+            commitGroup();
+            return;
+        }
+
+        if (mFlushScheduler)
+        {
+            mFlushScheduled = true;
+            mFlushScheduler(std::min(mGroupCommitPolicy.idleMs - idleMs,
+                                     mGroupCommitPolicy.maxLatencyMs - latencyMs));
+        }
+    }
     operator sqlite3*() { return mDb; }
     operator const sqlite3*() const { return mDb; }
     template <class... Args>
@@ -156,7 +461,11 @@ public:
     void commit()
     {
         if (mCommitEach)
+        {
+            // nothing to do unless writes are grouped
+            commitGroup();
             return;
+        }
 
         if (commitTransaction())
         {
@@ -183,6 +492,7 @@ protected:
     sqlite3_stmt* mStmt;
     SqliteDb& mDb;
     int mLastBindCol = 0;
+    SqliteDb::CachedStmt* mCacheEntry = nullptr;   // entry in the cache of mDb, if cached
     void retCheck(int code, const char* opname)
     {
         if (code != SQLITE_OK)
@@ -209,7 +519,8 @@ protected:
 public:
     SqliteStmt(SqliteDb& db, const char* sql):mDb(db)
     {
-        if (sqlite3_prepare_v2(db, sql, -1, &mStmt, nullptr) != SQLITE_OK)
+        mStmt = db.acquireStmt(sql, mCacheEntry);
+        if (!mStmt)
         {
             const char* errMsg = sqlite3_errmsg(mDb);
             if (!errMsg)
@@ -221,10 +532,12 @@ public:
     }
     SqliteStmt(SqliteDb& db, const std::string& sql)
         :SqliteStmt(db, sql.c_str()){}
+    SqliteStmt(const SqliteStmt&) = delete;
+    SqliteStmt& operator=(const SqliteStmt&) = delete;
     ~SqliteStmt()
     {
         if (mStmt)
-            sqlite3_finalize(mStmt);
+            mDb.releaseStmt(mStmt, mCacheEntry);
     }
     operator sqlite3_stmt*() { return mStmt; }
     operator const sqlite3_stmt*() const {return mStmt; }
@@ -370,9 +683,18 @@ inline bool SqliteDb::query(const char* sql, Args&&... args)
 
 inline int SqliteDb::step(SqliteStmt& stmt)
 {
+    bool isWrite = !sqlite3_stmt_readonly(stmt);
+    if (isWrite)
+    {
+        beforeWrite();
+    }
     auto ret = sqlite3_step(stmt);
     if (ret == SQLITE_DONE)
     {
+        if (isWrite)
+        {
+            afterWrite();
+        }
         timedCommit();
     }
     return ret;
@@ -3,17 +3,22 @@ CREATE TABLE sending(rowid integer primary key autoincrement, msgid int64, keyid
     opcode smallint not null, msg_cmd blob, key_cmd blob, recipients blob not null,
     backrefid int64 not null, backrefs blob);
 
+CREATE INDEX sending_chatid ON sending(chatid);
+
 CREATE TABLE manual_sending(rowid integer primary key autoincrement, msgid int64,
     chatid int64 not null, type tinyint, ts int, updated smallint, msg blob,
     opcode smallint not null, reason smallint not null);
 
+CREATE INDEX manual_sending_chatid ON manual_sending(chatid);
+
 CREATE TABLE vars(name text not null primary key, value blob);
 
 CREATE TABLE chats(chatid int64 unique primary key, shard tinyint,
     own_priv tinyint, peer int64 default -1, peer_priv tinyint default 0,
     title text, ts_created int64 not null default 0,
     last_seen int64 default 0, last_recv int64 default 0, archived tinyint default 0,
-    mode tinyint default 0, unified_key blob, rsn blob, meeting tinyint default 0, chat_options tinyint default 0);
+    mode tinyint default 0, unified_key blob, rsn blob, meeting tinyint default 0, chat_options tinyint default 0,
+    unread_count int default -1, unread_idx int);
 
 CREATE TABLE contacts(userid int64 PRIMARY KEY, email text, visibility int,
     since int64 not null default 0);
@@ -30,14 +35,21 @@ CREATE TABLE chat_vars(chatid int64 not null, name text not null, value text,
 
 CREATE TABLE history(idx int not null, chatid int64 not null, msgid int64 not null,
     userid int64, keyid int not null, type tinyint, updated smallint, ts int,
-    is_encrypted tinyint, data blob, backrefid int64 not null, UNIQUE(chatid,msgid), UNIQUE(chatid,idx));
+    is_encrypted tinyint, data blob, backrefid int64 not null, data_len int not null default 0,
+    UNIQUE(chatid,msgid), UNIQUE(chatid,idx));
+
+CREATE INDEX history_unread ON history(chatid, idx, userid, updated, data_len, type, is_encrypted)
+    WHERE type IN (1, 101, 103, 104, 105) AND is_encrypted IN (0, 3, 4);
+
+CREATE INDEX history_last_text ON history(chatid, idx, type, data_len);
 
 CREATE TABLE sendkeys(chatid int64 not null, userid int64 not null, keyid int32 not null, key blob not null,
     ts int not null, UNIQUE(chatid, userid, keyid));
 
 CREATE TABLE node_history(idx int not null, chatid int64 not null, msgid int64 not null,
     userid int64, keyid int not null, type tinyint, updated smallint, ts int,
-    is_encrypted tinyint, data blob, backrefid int64 not null, UNIQUE(chatid,msgid), UNIQUE(chatid,idx));
+    is_encrypted tinyint, data blob, backrefid int64 not null, data_len int not null default 0,
+    UNIQUE(chatid,msgid), UNIQUE(chatid,idx));
 
 CREATE TABLE dns_cache(shard tinyint primary key, url text, ipv4 text, ipv6 text, sess_data blob);
 
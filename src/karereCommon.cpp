@@ -2,7 +2,6 @@
 #include "stringUtils.h"
 #include "base/timers.hpp"
 #include "megachatapi_impl.h"
-#include "waiter/libuvWaiter.h"
 
 #ifndef KARERE_DISABLE_WEBRTC
 namespace rtcModule {void globalCleanup(); }
@@ -14,7 +13,7 @@ namespace rtcModule {void globalCleanup(); }
 
 namespace karere
 {
-const char* gDbSchemaVersionSuffix = "15";
+const char* gDbSchemaVersionSuffix = "16";
 /*
     2 --> +3: invalidate cached chats to reload history (so call-history msgs are fetched)
     3 --> +4: invalidate both caches, SDK + MEGAchat, if there's at least one chat (so deleted chats are re-fetched from API)
@@ -30,6 +29,7 @@ const char* gDbSchemaVersionSuffix = "15";
     12 -> +13: modify chats table to add new meeting flag
     13 -> +14: modify chats table to add chat_options field
     14 -> +15: add scheduledMeetings and scheduledMeetingsOccurr tables
+    15 -> +16: add data_len to history and node_history, indexes for the hot queries and persisted unread counters
 */
 
 bool gCatchException = true;
@@ -41,8 +41,8 @@ void globalCleanup()
 #endif
 }
 
-void init_uv_timer(void *ctx, uv_timer_t *timer)
+TimerWheel* timerWheel(void *ctx)
 {
-    uv_timer_init(((::mega::LibuvWaiter *)(((megachat::MegaChatApiImpl *)ctx)->waiter))->eventloop(), timer);
+    return ((megachat::MegaChatApiImpl *)ctx)->timerWheel;
 }
 }
@@ -759,6 +759,11 @@ MegaChatListItemList* MegaChatApi::getChatListItems(const int mask, const int fi
     return pImpl->getChatListItems(mask, filter);
 }
 
+MegaChatListItemList* MegaChatApi::getChatListItemsPage(const int mask, const int filter, unsigned int pageSize, const MegaChatListItem* after) const
+{
+    return pImpl->getChatListItemsPage(mask, filter, pageSize, after);
+}
+
 MegaChatListItemList* MegaChatApi::getChatListItems()
 {
     return pImpl->getChatListItems();
@@ -1490,9 +1495,9 @@ void MegaChatApi::removeSchedMeetingListener(MegaChatScheduledMeetingListener* l
     pImpl->removeSchedMeetingListener(listener);
 }
 
-void MegaChatApi::addChatLocalVideoListener(MegaChatHandle chatid, MegaChatVideoListener *listener)
+void MegaChatApi::addChatLocalVideoListener(MegaChatHandle chatid, MegaChatVideoListener *listener, int format)
 {
-    pImpl->addChatVideoListener(chatid, LOCAL_CLIENT_ID_FOR_VIDEO, rtcModule::VideoResolution::kHiRes, TYPE_CAPTURER_VIDEO, listener);
+    pImpl->addChatVideoListener(chatid, LOCAL_CLIENT_ID_FOR_VIDEO, rtcModule::VideoResolution::kHiRes, TYPE_CAPTURER_VIDEO, listener, format);
 }
 
 void MegaChatApi::removeChatLocalVideoListener(MegaChatHandle chatid, MegaChatVideoListener *listener)
@@ -1500,9 +1505,9 @@ void MegaChatApi::removeChatLocalVideoListener(MegaChatHandle chatid, MegaChatVi
     pImpl->removeChatVideoListener(chatid, LOCAL_CLIENT_ID_FOR_VIDEO, rtcModule::VideoResolution::kHiRes, TYPE_CAPTURER_VIDEO, listener);
 }
 
-void MegaChatApi::addChatLocalScreenVideoListener(MegaChatHandle chatid, MegaChatVideoListener *listener)
+void MegaChatApi::addChatLocalScreenVideoListener(MegaChatHandle chatid, MegaChatVideoListener *listener, int format)
 {
-    pImpl->addChatVideoListener(chatid, LOCAL_CLIENT_ID_FOR_VIDEO, rtcModule::VideoResolution::kHiRes, TYPE_CAPTURER_SCREEN, listener);
+    pImpl->addChatVideoListener(chatid, LOCAL_CLIENT_ID_FOR_VIDEO, rtcModule::VideoResolution::kHiRes, TYPE_CAPTURER_SCREEN, listener, format);
 }
 
 void MegaChatApi::removeChatLocalScreenVideoListener(MegaChatHandle chatid, MegaChatVideoListener *listener)
@@ -1510,9 +1515,9 @@ void MegaChatApi::removeChatLocalScreenVideoListener(MegaChatHandle chatid, Mega
     pImpl->removeChatVideoListener(chatid, LOCAL_CLIENT_ID_FOR_VIDEO, rtcModule::VideoResolution::kHiRes, TYPE_CAPTURER_SCREEN, listener);
 }
 
-void MegaChatApi::addChatRemoteVideoListener(MegaChatHandle chatid, MegaChatHandle clientId, bool hiRes, MegaChatVideoListener *listener)
+void MegaChatApi::addChatRemoteVideoListener(MegaChatHandle chatid, MegaChatHandle clientId, bool hiRes, MegaChatVideoListener *listener, int format)
 {
-    pImpl->addChatVideoListener(chatid, clientId, hiRes ? rtcModule::VideoResolution::kHiRes : rtcModule::VideoResolution::kLowRes, TYPE_CAPTURER_UNKNOWN, listener);
+    pImpl->addChatVideoListener(chatid, clientId, hiRes ? rtcModule::VideoResolution::kHiRes : rtcModule::VideoResolution::kLowRes, TYPE_CAPTURER_UNKNOWN, listener, format);
 }
 
 void MegaChatApi::removeChatRemoteVideoListener(MegaChatHandle chatid, MegaChatHandle clientId, bool hiRes, MegaChatVideoListener *listener)
@@ -1534,6 +1539,11 @@ bool MegaChatApi::setCurrentInputVideoTracksLimit(const int numInputVideoTracks)
 {
     return pImpl->setCurrentInputVideoTracksLimit(numInputVideoTracks);
 }
+
+void MegaChatApi::setVideoFramesInWorkerThreads(bool enable)
+{
+    MegaChatApiImpl::setVideoFramesInWorkerThreads(enable);
+}
 #endif
 
 void MegaChatApi::setCatchException(bool enable)
@@ -1651,6 +1661,31 @@ void MegaChatApi::setPublicKeyPinning(bool enable)
     pImpl->setPublicKeyPinning(enable);
 }
 
+void MegaChatApi::setDbGroupCommit(bool enable)
+{
+    pImpl->setDbGroupCommit(enable);
+}
+
+void MegaChatApi::setLazyChatroomInit(bool enable)
+{
+    pImpl->setLazyChatroomInit(enable);
+}
+
+void MegaChatApi::setHistoryMemoryBudget(unsigned int maxMessagesPerChat, unsigned int maxMessages)
+{
+    pImpl->setHistoryMemoryBudget(maxMessagesPerChat, maxMessages);
+}
+
+void MegaChatApi::setNotificationCoalescing(bool enable, unsigned int windowMs)
+{
+    pImpl->setNotificationCoalescing(enable, windowMs);
+}
+
+::mega::MegaStringMap *MegaChatApi::getHistoryMemoryStats()
+{
+    return pImpl->getHistoryMemoryStats();
+}
+
 MegaChatRequest::~MegaChatRequest() { }
 MegaChatRequest *MegaChatRequest::copy()
 {
@@ -1994,6 +2029,15 @@ void MegaChatVideoListener::onChatVideoData(MegaChatApi * /*api*/, MegaChatHandl
 
 }
 
+void MegaChatVideoListener::onChatVideoFrame(MegaChatApi *api, MegaChatHandle chatid, MegaChatVideoFrame *frame)
+{
+    // YUV frames can't be passed as a single ARGB buffer: listeners registered for them override this method
+    if (frame->getFormat() == MegaChatVideoFrame::FORMAT_ARGB)
+    {
+        onChatVideoData(api, chatid, frame->getWidth(), frame->getHeight(), frame->getBuffer(), frame->getSize());
+    }
+}
+
 
 void MegaChatCallListener::onChatCallUpdate(MegaChatApi * /*api*/, MegaChatCall * /*call*/)
 {
@@ -2210,6 +2254,11 @@ void MegaChatRoomListener::onHistoryTruncatedByRetentionTime(MegaChatApi* /*api*
 
 }
 
+void MegaChatRoomListener::onMessagesSeen(MegaChatApi* /*api*/, MegaChatHandle /*oldestMsgid*/, MegaChatHandle /*newestMsgid*/, unsigned int /*count*/)
+{
+
+}
+
 MegaChatMessage *MegaChatMessage::copy() const
 {
     return NULL;
@@ -60,6 +60,7 @@ class MegaChatRoomListener;
 class MegaChatCall;
 class MegaChatCallListener;
 class MegaChatVideoListener;
+class MegaChatVideoFrame;
 class MegaChatListener;
 class MegaChatNotificationListener;
 class MegaChatListItem;
@@ -1400,6 +1401,108 @@ public:
     virtual const ::mega::MegaHandleList* getSpeakRequestsList() const;
 };
 
+/**
+ * @brief Video frame received from a local or remote device
+ *
+ * By default, the image is stored in a buffer in format ARGB: 4 bytes per pixel (total size: width * height * 4).
+ * Listeners registered with MegaChatVideoFrame::FORMAT_I420 or MegaChatVideoFrame::FORMAT_NV12 receive
+ * the YUV planes of the decoded image instead, without colour conversion. See MegaChatVideoFrame::getPlane.
+ *
+ * The buffer is refcounted: MegaChatVideoFrame::copy returns a new reference to the same
+ * buffer without copying the image, and the buffer is recycled by the SDK once every
+ * reference has been deleted.
+ *
+ * Frames are received by MegaChatVideoListener::onChatVideoFrame.
+ */
+class MegaChatVideoFrame
+{
+public:
+    enum
+    {
+        FORMAT_ARGB = 0,    // 4 bytes per pixel, in a single buffer
+        FORMAT_I420 = 1,    // 3 planes: Y, U and V. U and V have half the width and height of Y
+        FORMAT_NV12 = 2,    // 2 planes: Y and interleaved UV. UV has half the height of Y
+    };
+
+    virtual ~MegaChatVideoFrame()                       { }
+
+    /**
+     * @brief Returns a new reference to this frame
+     *
+     * The image is not copied, so this method is cheap and the returned object can be kept
+     * after MegaChatVideoListener::onChatVideoFrame returns (ie. to render it from another thread).
+     * The buffer must be treated as read-only while it's shared.
+     *
+     * You take the ownership of the returned object
+     *
+     * @return A new reference to this frame
+     */
+    virtual MegaChatVideoFrame* copy() const            { return NULL; }
+
+    /**
+     * @brief Returns the width of the image
+     * @return Size in pixels
+     */
+    virtual int getWidth() const                        { return 0; }
+
+    /**
+     * @brief Returns the height of the image
+     * @return Size in pixels
+     */
+    virtual int getHeight() const                       { return 0; }
+
+    /**
+     * @brief Returns the pixel format of the frame
+     *
+     * Valid values are:
+     *  - MegaChatVideoFrame::FORMAT_ARGB = 0
+     *  - MegaChatVideoFrame::FORMAT_I420 = 1
+     *  - MegaChatVideoFrame::FORMAT_NV12 = 2
+     *
+     * @return The format requested when the listener was registered
+     */
+    virtual int getFormat() const                       { return FORMAT_ARGB; }
+
+    /**
+     * @brief Returns the data buffer in format ARGB: 4 bytes per pixel
+     *
+     * The MegaChatVideoFrame retains the ownership of the buffer.
+     *
+     * @return Data buffer of the image, or NULL if the format isn't MegaChatVideoFrame::FORMAT_ARGB
+     */
+    virtual char* getBuffer() const                     { return NULL; }
+
+    /**
+     * @brief Returns the size of the buffer
+     * @return Buffer size in bytes (width * height * 4), or 0 if the format isn't MegaChatVideoFrame::FORMAT_ARGB
+     */
+    virtual size_t getSize() const                      { return 0; }
+
+    /**
+     * @brief Returns the number of planes of the image
+     * @return 1 for MegaChatVideoFrame::FORMAT_ARGB, 3 for FORMAT_I420 and 2 for FORMAT_NV12
+     */
+    virtual int getNumPlanes() const                    { return 0; }
+
+    /**
+     * @brief Returns a plane of the image
+     *
+     * Rows of a plane can be padded, so they must be traversed with MegaChatVideoFrame::getStride.
+     * The MegaChatVideoFrame retains the ownership of the planes, which must be treated as read-only.
+     *
+     * @param index Index of the plane, from 0 to MegaChatVideoFrame::getNumPlanes() - 1
+     * @return Data of the plane, or NULL if the index is invalid
+     */
+    virtual const char* getPlane(int /*index*/) const   { return NULL; }
+
+    /**
+     * @brief Returns the size in bytes of a row of a plane, including padding
+     * @param index Index of the plane, from 0 to MegaChatVideoFrame::getNumPlanes() - 1
+     * @return Stride of the plane, or 0 if the index is invalid
+     */
+    virtual int getStride(int /*index*/) const          { return 0; }
+};
+
 /**
  * @brief Interface to get video frames from calls
  *
@@ -1414,6 +1517,30 @@ class MegaChatVideoListener
 public:
     virtual ~MegaChatVideoListener() {}
 
+    /**
+     * @brief This function is called when a new frame from a local or remote device is available
+     *
+     * The default implementation calls MegaChatVideoListener::onChatVideoData with the
+     * content of the frame. Override it to keep a reference to the frame with
+     * MegaChatVideoFrame::copy instead of copying the buffer inside onChatVideoData.
+     *
+     * @note Listeners registered with MegaChatVideoFrame::FORMAT_I420 or FORMAT_NV12 must override
+     * this function: the default implementation ignores YUV frames, since they don't have an ARGB buffer.
+     *
+     * The SDK retains the ownership of the MegaChatVideoFrame. It's only valid until this
+     * function returns.
+     *
+     * This function is called from the thread of the other callbacks, unless video frames are
+     * delivered from worker threads (see MegaChatApi::setVideoFramesInWorkerThreads). In that case,
+     * calls for the same MegaChatApi are still serialized. Avoid blocking it, since frames are
+     * dropped while it doesn't return.
+     *
+     * @param api MegaChatApi connected to the account
+     * @param chatid MegaChatHandle that provides the video
+     * @param frame MegaChatVideoFrame with the image
+     */
+    virtual void onChatVideoFrame(MegaChatApi *api, MegaChatHandle chatid, MegaChatVideoFrame *frame);
+
     /**
      * @brief This function is called when a new image from a local or remote device is available
      *
@@ -1425,6 +1552,9 @@ public:
      * @param size Buffer size in bytes
      *
      *  The MegaChatVideoListener retains the ownership of the buffer.
+     *
+     * As MegaChatVideoListener::onChatVideoFrame, this function is called from worker threads
+     * if enabled by MegaChatApi::setVideoFramesInWorkerThreads.
      */
     virtual void onChatVideoData(MegaChatApi *api, MegaChatHandle chatid, int width, int height, char *buffer, size_t size);
 };
@@ -4335,6 +4465,42 @@ public:
      */
     MegaChatListItemList* getChatListItems(const int mask, const int filter) const;
 
+    /**
+     * @brief Get a page of chatrooms with limited information, sorted by last activity
+     *
+     * It is needed to have successfully called \c MegaChatApi::init (the initialization
+     * state should be \c MegaChatApi::INIT_OFFLINE_SESSION or \c MegaChatApi::INIT_ONLINE_SESSION)
+     * before calling this function.
+     *
+     * Chatrooms are sorted by MegaChatListItem::getLastTimestamp, the most recent first. Chatrooms
+     * with the same timestamp are sorted by chatid. The first page is obtained by passing NULL
+     * in the param \c after, and the following ones by passing the last item of the previous page.
+     *
+     * Chatrooms are sorted by their activity when this function is called, so a chatroom with new
+     * activity after a page was obtained is not returned by the following pages. The app can
+     * get the changes from MegaChatListener::onChatListItemUpdate.
+     *
+     * This function is more efficient than sorting the result of \c getChatListItems, and it
+     * can be called from any thread without waiting for the chat engine.
+     *
+     * You take the ownership of the returned value
+     *
+     * @param mask represents what filters to apply to the list of chats, as in \c getChatListItems
+     * CHAT_FILTER_BY_NO_FILTER mask should be used alone and it will ignore any value in the param filter
+     * @param filter represents the values to apply in the filter, as in \c getChatListItems
+     * @param pageSize Maximum number of chatrooms to return
+     * @param after Last item of the previous page, or NULL to get the first page. Only its
+     * chatid and last timestamp are used, so the item can be kept after the list is deleted
+     * by copying it with MegaChatListItem::copy
+     *
+     * In case you provide an invalid filter (i.e. combination of mask and filter params), this function
+     * returns an empty list
+     *
+     * @return List of MegaChatListItem objects, with \c pageSize chatrooms at maximum. If it has
+     * less than \c pageSize chatrooms, there are no more pages.
+     */
+    MegaChatListItemList* getChatListItemsPage(const int mask, const int filter, unsigned int pageSize, const MegaChatListItem* after = NULL) const;
+
     /**
      * @brief Get all chatrooms (1on1 and groupal) with limited information
      *
@@ -7800,6 +7966,109 @@ public:
      */
     void setPublicKeyPinning(bool enable);
 
+    /**
+     * @brief Enable / disable grouping the writes to the local cache in transactions
+     *
+     * By default, every change to the local cache is written to disk as soon as it happens. When
+     * enabled, the changes are grouped in a transaction that is written after 256 changes, 500 ms
+     * since the first one, or 100 ms without changes, whichever happens first. This reduces the
+     * disk writes (and the battery usage) when many messages are received in a row, ie. while
+     * fetching history or catching up after a reconnection.
+     *
+     * The trade-off is durability: if the app crashes or is killed, up to 500 ms of changes to the
+     * local cache are lost. They are received again from the servers on the next connection.
+     * Messages accepted for sending, messages that couldn't be sent, the seen and received
+     * pointers and the keys of the messages are always written to disk right away.
+     *
+     * Grouping of writes is disabled by default. This method can be called at any time. When
+     * disabled, the pending changes are written right away.
+     *
+     * @param enable true to group the writes to the local cache, false to write every change
+     */
+    void setDbGroupCommit(bool enable);
+
+    /**
+     * @brief Enable / disable the lazy initialization of chatrooms loaded from the local cache
+     *
+     * When enabled, MegaChatApi::init only loads from the local cache a summary of every chatroom
+     * (last message, unread count and timestamp of the last message), which is enough to provide
+     * the MegaChatListItem of every chatroom. The history and the rest of the state of a chatroom
+     * are loaded on first access (ie. when the chatroom is opened) or before connecting to the
+     * chat servers, whichever happens first. This reduces the time required by MegaChatApi::init
+     * for accounts with many chatrooms.
+     *
+     * Lazy initialization is disabled by default. It must be enabled before calling
+     * MegaChatApi::init in order to take effect.
+     *
+     * @param enable true to enable the lazy initialization of chatrooms, false to disable it
+     */
+    void setLazyChatroomInit(bool enable);
+
+    /**
+     * @brief Limit the number of messages kept in memory for the history of the chatrooms
+     *
+     * When a limit is exceeded, the oldest messages loaded in memory are released. They are still
+     * stored in the local cache, so they will be loaded again if the app requests them through
+     * MegaChatApi::loadMessages. The chatrooms that are open (see MegaChatApi::openChatRoom) are
+     * never affected by these limits. When the limit of all chatrooms together is exceeded, messages
+     * are released first from the chatrooms whose history was accessed least recently.
+     *
+     * Every chatroom keeps a minimum of 32 messages in memory regardless of the limits.
+     *
+     * This method can be called at any time. By default, there is no limit.
+     *
+     * @param maxMessagesPerChat Max number of messages in memory for every chatroom, or 0 for no limit
+     * @param maxMessages Max number of messages in memory for all chatrooms, or 0 for no limit
+     */
+    void setHistoryMemoryBudget(unsigned int maxMessagesPerChat, unsigned int maxMessages);
+
+    /**
+     * @brief Returns statistics about the memory used by the history of the chatrooms
+     *
+     * The returned map contains the following keys, with numeric values:
+     *  - "chats": number of chatrooms with messages loaded in memory
+     *  - "pinnedChats": number of open chatrooms with messages loaded in memory
+     *  - "messages": number of messages loaded in memory
+     *  - "pinnedMessages": number of messages loaded in memory for open chatrooms
+     *  - "bytes": estimated size in bytes of the messages loaded in memory
+     *  - "evictedMessages": number of messages released from memory due to MegaChatApi::setHistoryMemoryBudget
+     *  - "evictions": number of times that messages have been released from memory
+     *
+     * You take the ownership of the returned value.
+     *
+     * @return Map with the statistics, or NULL if MegaChatApi::init has not been called yet
+     */
+    ::mega::MegaStringMap* getHistoryMemoryStats();
+
+    /**
+     * @brief Enable / disable the coalescing of notifications
+     *
+     * When enabled, the updates of the same item are merged into a single callback, with the
+     * changes of all of them, instead of calling the listener for every update. This reduces the
+     * number of callbacks during the initial load and the reconnections, when chatrooms and
+     * messages are updated several times in a row. The following callbacks are coalesced:
+     *  - MegaChatListener::onChatListItemUpdate, for the updates of the same chatroom
+     *  - MegaChatRoomListener::onMessageUpdate, for the updates of the same message, except
+     *  the ones of messages that are still being sent (they don't have a MegaChatMessage::getMsgId)
+     *  - Messages that change to MegaChatMessage::STATUS_SEEN, which are notified as a range by
+     *  MegaChatRoomListener::onMessagesSeen
+     *
+     * The coalesced callbacks are called when the current batch of events is processed, or when
+     * \c windowMs milliseconds have elapsed since the first held update. Any other callback of the
+     * same listener calls the held updates first, so the order of the notifications is kept.
+     *
+     * Every callback receives the latest state of the item, and MegaChatListItem::getChanges or
+     * MegaChatMessage::getChanges return the changes of all the merged updates.
+     *
+     * Coalescing of notifications is disabled by default. This method can be called at any time.
+     * When disabled, the held updates are notified right away.
+     *
+     * @param enable true to enable the coalescing of notifications, false to disable it
+     * @param windowMs Max time in milliseconds to hold an update, or 0 to hold it only until the
+     * current batch of events is processed
+     */
+    void setNotificationCoalescing(bool enable, unsigned int windowMs = 0);
+
 #ifndef KARERE_DISABLE_WEBRTC
     /**
      * @brief Register a listener to receive all events about calls
@@ -7847,8 +8116,12 @@ public:
      *
      * @param chatid MegaChatHandle that identifies the chat room
      * @param listener MegaChatVideoListener that will receive local video
+     * @param format Pixel format of the frames received by the listener (MegaChatVideoFrame::FORMAT_ARGB
+     * by default). With MegaChatVideoFrame::FORMAT_I420 or FORMAT_NV12, frames are received by
+     * MegaChatVideoListener::onChatVideoFrame without colour conversion, and the listener must
+     * override it, since MegaChatVideoListener::onChatVideoData is only called for ARGB frames.
      */
-    void addChatLocalVideoListener(MegaChatHandle chatid, MegaChatVideoListener *listener);
+    void addChatLocalVideoListener(MegaChatHandle chatid, MegaChatVideoListener *listener, int format = MegaChatVideoFrame::FORMAT_ARGB);
 
     /**
      * @brief Unregister a local MegaChatVideoListener for camera frames
@@ -7869,8 +8142,12 @@ public:
      *
      * @param chatid MegaChatHandle that identifies the chat room
      * @param listener MegaChatVideoListener that will receive local video
+     * @param format Pixel format of the frames received by the listener (MegaChatVideoFrame::FORMAT_ARGB
+     * by default). With MegaChatVideoFrame::FORMAT_I420 or FORMAT_NV12, frames are received by
+     * MegaChatVideoListener::onChatVideoFrame without colour conversion, and the listener must
+     * override it, since MegaChatVideoListener::onChatVideoData is only called for ARGB frames.
      */
-    void addChatLocalScreenVideoListener(MegaChatHandle chatid, MegaChatVideoListener *listener);
+    void addChatLocalScreenVideoListener(MegaChatHandle chatid, MegaChatVideoListener *listener, int format = MegaChatVideoFrame::FORMAT_ARGB);
 
     /**
      * @brief Unregister a local MegaChatVideoListener to stop receiving video from local screen device for an specific chat room
@@ -7891,8 +8168,12 @@ public:
      * @param clientId MegaChatHandle that identifies the client
      * @param hiRes boolean that identify if video is high resolution or low resolution
      * @param listener MegaChatVideoListener that will receive remote video
+     * @param format Pixel format of the frames received by the listener (MegaChatVideoFrame::FORMAT_ARGB
+     * by default). With MegaChatVideoFrame::FORMAT_I420 or FORMAT_NV12, frames are received by
+     * MegaChatVideoListener::onChatVideoFrame without colour conversion, and the listener must
+     * override it, since MegaChatVideoListener::onChatVideoData is only called for ARGB frames.
      */
-    void addChatRemoteVideoListener(MegaChatHandle chatid, MegaChatHandle clientId, bool hiRes, MegaChatVideoListener *listener);
+    void addChatRemoteVideoListener(MegaChatHandle chatid, MegaChatHandle clientId, bool hiRes, MegaChatVideoListener *listener, int format = MegaChatVideoFrame::FORMAT_ARGB);
 
     /**
      * @brief Unregister a MegaChatVideoListener
@@ -7906,6 +8187,25 @@ public:
      */
     void removeChatRemoteVideoListener(MegaChatHandle chatid, MegaChatHandle clientId, bool hiRes, MegaChatVideoListener *listener);
 
+    /**
+     * @brief Enable / disable the delivery of video frames from worker threads
+     *
+     * By default, video frames are converted and delivered to the MegaChatVideoListener from the
+     * thread of the other callbacks, so they wait for the chat and database work of the SDK.
+     *
+     * When enabled, the conversion and the calls to MegaChatVideoListener::onChatVideoFrame and
+     * MegaChatVideoListener::onChatVideoData run in worker threads of the SDK instead. The
+     * listeners must then be safe to call from another thread than the rest of callbacks. Calls
+     * for the same MegaChatApi are still serialized.
+     *
+     * Delivery from worker threads is disabled by default. This method affects all the instances
+     * of MegaChatApi, and it can be called at any time.
+     *
+     * @param enable true to deliver video frames from worker threads, false to deliver them
+     * from the thread of the other callbacks
+     */
+    static void setVideoFramesInWorkerThreads(bool enable);
+
     /**
      * @brief Change the SFU id
      *
@@ -8049,6 +8349,7 @@ public:
 
 private:
     MegaChatApiImpl *pImpl;
+    friend class MegaChatApiTestAccess;
 };
 
 /**
@@ -8823,6 +9124,25 @@ public:
      * @param msg Most recent message whose timestamp has exceeded retention time
      */
     virtual void onHistoryTruncatedByRetentionTime(MegaChatApi* /*api*/, MegaChatMessage* /*msg*/);
+
+    /**
+     * @brief This function is called when several messages from other users have been seen at once
+     *
+     * It's only called when the coalescing of notifications is enabled (see
+     * MegaChatApi::setNotificationCoalescing). In that case, the messages that change to
+     * MegaChatMessage::STATUS_SEEN together are notified by a single call to this function,
+     * instead of calling MegaChatRoomListener::onMessageUpdate for every message. When only one
+     * message changes to seen, it's notified by MegaChatRoomListener::onMessageUpdate.
+     *
+     * All the messages from other users from \c oldestMsgid to \c newestMsgid, both included,
+     * have changed to MegaChatMessage::STATUS_SEEN.
+     *
+     * @param api MegaChatApi connected to the account
+     * @param oldestMsgid MegaChatHandle that identifies the oldest message that has been seen
+     * @param newestMsgid MegaChatHandle that identifies the newest message that has been seen
+     * @param count Number of messages that have been seen
+     */
+    virtual void onMessagesSeen(MegaChatApi* api, MegaChatHandle oldestMsgid, MegaChatHandle newestMsgid, unsigned int count);
 };
 
 /**
@@ -139,10 +139,13 @@ void *MegaChatApiImpl::threadEntryPoint(void *param)
 #endif
 
     MegaChatApiImpl *chatApiImpl = (MegaChatApiImpl *)param;
+    chatApiImpl->mKarereThreadId = std::this_thread::get_id();
 
     // Init event-loop and websockets, then sync with main thread
     thread_local MegaChatWaiter chatWaiter;
     chatApiImpl->waiter = &chatWaiter;
+    thread_local karere::TimerWheel chatTimers(chatWaiter.eventloop(), chatApiImpl->sdkMutex, chatApiImpl);
+    chatApiImpl->timerWheel = &chatTimers;
     thread_local MegaWebsocketsIO chatWebsockets(chatApiImpl->sdkMutex,
                                                  chatApiImpl->waiter,
                                                  chatApiImpl->mMegaApi,
@@ -167,14 +170,42 @@ void MegaChatApiImpl::loop()
 
         sdkMutex.lock();
 
-        sendPendingEvents();
+        auto start = std::chrono::steady_clock::now();
+        size_t queueDepth = eventQueue.size();
+        if (!sendPendingEvents())
+        {
+            // remaining events are processed in next iteration, after polling the sockets
+            waiter->notify();
+        }
         sendPendingRequests();
+        refreshChatListSnapshot();
+        if (!mCoalesceNotifications || !mCoalescingWindowMs)
+        {
+            flushHeldNotifications();
+        }
+        if (mLoopIterationObserver)
+        {
+            mLoopIterationObserver();
+        }
+        updateLoopStats(queueDepth, std::chrono::steady_clock::now() - start);
 
         if (threadExit)
         {
             // There must be only one pending events, at maximum: the logout marshall call to delete the client
             assert(eventQueue.isEmpty() || (eventQueue.size() == 1));
-            sendPendingEvents();
+            // process it, and the few events it may queue in turn. Bounded, since other threads
+            // may still be pushing events, which would keep this thread from exiting
+            static constexpr int kMaxExitEventRounds = 16;
+            int rounds = 0;
+            while (!sendPendingEvents() && ++rounds < kMaxExitEventRounds)
+            {
+                std::this_thread::yield();  // a producer is in the middle of a push
+            }
+            if (!eventQueue.isEmpty())
+            {
+                API_LOG_WARNING("%sKarere thread exits with %zu events not processed",
+                                getLoggingName(), eventQueue.size());
+            }
 
             sdkMutex.unlock();
             break;
@@ -184,6 +215,133 @@ void MegaChatApiImpl::loop()
     globalCleanup();
 }
 
+void MegaChatApiImpl::updateLoopStats(size_t queueDepth, std::chrono::steady_clock::duration elapsed)
+{
+    static constexpr std::chrono::milliseconds kSlowIteration{200};
+    static constexpr std::chrono::seconds kReportInterval{60};
+
+    long long elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+    if (elapsed >= kSlowIteration)
+    {
+        API_LOG_WARNING("%sKarere loop iteration took %lld ms (%zu queued events)",
+                        getLoggingName(), elapsedMs, queueDepth);
+    }
+
+    mLoopStats.iterations++;
+    mLoopStats.maxQueueDepth = std::max(mLoopStats.maxQueueDepth, queueDepth);
+    mLoopStats.maxIterationTime = std::max(mLoopStats.maxIterationTime, elapsed);
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - mLoopStats.lastReport < kReportInterval)
+    {
+        return;
+    }
+
+    API_LOG_DEBUG("%sKarere loop: %zu iterations, %zu events, max queue depth %zu, max iteration time %lld ms",
+                  getLoggingName(), mLoopStats.iterations, mLoopStats.events, mLoopStats.maxQueueDepth,
+                  static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(mLoopStats.maxIterationTime).count()));
+    mLoopStats = LoopStats();
+    mLoopStats.lastReport = now;
+}
+
+void MegaChatApiImpl::refreshChatListSnapshot()
+{
+    // some properties change without a notification of the list item (ie. the participation in
+    // a call, or those read from the chatd::Chat once it's created), so the items of the chats
+    // that may have changed are compared with their chatroom
+    for (MegaChatHandle chatid : mChatListStale)
+    {
+        ChatRoom *chatRoom = findChatRoom(chatid);
+        ChatListSnapshot::EntryPtr entry = mChatListSnapshot.find(chatid);
+        if (!chatRoom || !entry)
+        {
+            continue;   // removed from the list
+        }
+
+        MegaChatListItemPrivate item(*chatRoom);
+        if (ChatListSnapshot::differingProperty(entry->item, item))
+        {
+            mChatListSnapshot.update(item);
+        }
+
+        ChatListSnapshot::Peers peers = ChatListSnapshot::Entry::peersOf(*chatRoom);
+        if (*peers != *entry->peers)
+        {
+            mChatListSnapshot.updatePeers(chatid, std::move(peers));
+        }
+    }
+    mChatListStale.clear();
+}
+
+void MegaChatApiImpl::onMessageUpdatesHeld(MegaChatHandle chatid)
+{
+    mChatsWithHeldUpdates.insert(chatid);
+    scheduleHeldNotifications();
+}
+
+void MegaChatApiImpl::scheduleHeldNotifications()
+{
+    // without a window, held notifications are fired at the end of the loop iteration
+    if (!mCoalescingWindowMs)
+    {
+        if (!isKarereThread())
+        {
+            waiter->notify();   // held by a call from the app, e.g. MegaChatApi::loadMessages
+        }
+        return;
+    }
+
+    if (mCoalescingTimer)
+    {
+        return;
+    }
+
+    mCoalescingTimer = karere::setTimeout([this]()
+    {
+        mCoalescingTimer = 0;
+        flushHeldNotifications();
+    }, mCoalescingWindowMs, this);
+}
+
+void MegaChatApiImpl::flushChatListItemUpdates()
+{
+    if (mHeldChatListItems.empty())
+    {
+        return;
+    }
+
+    std::vector<std::unique_ptr<MegaChatListItemPrivate>> items;
+    items.swap(mHeldChatListItems);
+    mHeldChatListItemPos.clear();
+    for (auto& item : items)
+    {
+        notifyChatListItemUpdate(item.release());
+    }
+}
+
+void MegaChatApiImpl::flushHeldNotifications()
+{
+    if (mCoalescingTimer)
+    {
+        karere::cancelTimeout(mCoalescingTimer, this);
+        mCoalescingTimer = 0;
+    }
+
+    flushChatListItemUpdates();
+
+    std::set<MegaChatHandle> chats;
+    chats.swap(mChatsWithHeldUpdates);
+    for (MegaChatHandle chatid : chats)
+    {
+        // the updates are discarded if the app closed the chatroom
+        auto it = chatRoomHandler.find(chatid);
+        if (it != chatRoomHandler.end())
+        {
+            it->second->flushMessageUpdates();
+        }
+    }
+}
+
 void MegaChatApiImpl::megaApiPostMessage(megaMessage* msg, void* ctx)
 {
     MegaChatApiImpl *megaChatApi = (MegaChatApiImpl *)ctx;
@@ -203,8 +361,11 @@ void MegaChatApiImpl::megaApiPostMessage(megaMessage* msg, void* ctx)
 
 void MegaChatApiImpl::postMessage(megaMessage* msg)
 {
-    eventQueue.push(msg);
-    waiter->notify();
+    // if the queue wasn't empty, the karere thread has already been woken up
+    if (eventQueue.push(msg))
+    {
+        waiter->notify();
+    }
 }
 
 void MegaChatApiImpl::sendPendingRequests()
@@ -353,6 +514,8 @@ int MegaChatApiImpl::performRequest_logout(MegaChatRequestPrivate *request)
             bool deleteDb = request->getFlag();
             cleanChatHandlers();
             mTerminating = true;
+            mChatListSnapshot.clear();
+            mChatListStale.clear();
             mClient->terminate(deleteDb);
 
             API_LOG_INFO("%sChat engine is logged out!", getLoggingName());
@@ -377,6 +540,8 @@ int MegaChatApiImpl::performRequest_delete(MegaChatRequestPrivate */*request*/)
             if (mClient && !mTerminating)
             {
                 cleanChatHandlers();
+                mChatListSnapshot.clear();
+                mChatListStale.clear();
                 mClient->terminate();
                 API_LOG_INFO("%sChat engine closed!", getLoggingName());
 
@@ -3969,13 +4134,22 @@ int MegaChatApiImpl::performRequest_updateScheduledMeeting(MegaChatRequestPrivat
         }
 }
 
-void MegaChatApiImpl::sendPendingEvents()
+bool MegaChatApiImpl::sendPendingEvents()
 {
+    // process a bounded batch, so a burst of events doesn't delay sockets and requests
+    static constexpr size_t kMaxEventsPerIteration = 512;
+
+    size_t processed = 0;
     megaMessage* msg;
-    while ((msg = eventQueue.pop()))
+    while (processed < kMaxEventsPerIteration && (msg = eventQueue.pop()))
     {
         megaProcessMessage(msg);
+        processed++;
     }
+    mLoopStats.events += processed;
+
+    // if the queue is not empty, but pop() returned NULL, a producer is in the middle of a push
+    return eventQueue.isEmpty();
 }
 
 int MegaChatApiImpl::getInternalMaxLogLevel()
@@ -4131,6 +4305,9 @@ void MegaChatApiImpl::createKarereClient()
         mClient = new karere::Client(*mMegaApi, mWebsocketsIO, *this, *mScheduledMeetingHandler, mMegaApi->getBasePath(), caps, this);
 #endif
         API_LOG_DEBUG("%screateKarereClient: karere client instance created", getLoggingName());
+        mClient->setDbGroupCommit(mDbGroupCommit);
+        mClient->setLazyChatInit(mLazyChatInit);
+        mClient->setHistoryBudget(mHistoryBudgetPerChat, mHistoryBudgetTotal);
         mTerminating = false;
     }
 }
@@ -4546,6 +4723,8 @@ void MegaChatApiImpl::fireOnChatCallUpdate(MegaChatCallPrivate *call)
         return;
     }
 
+    // the list item tells whether we participate in the call, which isn't notified at that level
+    markChatListItemStale(call->getChatid());
     for (set<MegaChatCallListener *>::iterator it = callListeners.begin(); it != callListeners.end() ; it++)
     {
         (*it)->onChatCallUpdate(mChatApi, call);
@@ -4582,8 +4761,9 @@ void MegaChatApiImpl::fireOnChatSessionUpdate(MegaChatHandle chatid, MegaChatHan
     session->removeChanges();
 }
 
-void MegaChatApiImpl::fireOnChatVideoData(MegaChatHandle chatid, uint32_t clientId, int width, int height, int sourceType, char *buffer, rtcModule::VideoResolution videoResolution)
+void MegaChatApiImpl::fireOnChatVideoData(MegaChatHandle chatid, uint32_t clientId, MegaChatVideoFramePrivate* frame, rtcModule::VideoResolution videoResolution)
 {
+    int sourceType = frame->getSourceType();
     std::map<MegaChatHandle, MegaChatPeerVideoListener_map>::iterator it;
     std::map<MegaChatHandle, MegaChatPeerVideoListener_map>::iterator itEnd;
     assert(videoResolution != rtcModule::VideoResolution::kUndefined);
@@ -4605,7 +4785,10 @@ void MegaChatApiImpl::fireOnChatVideoData(MegaChatHandle chatid, uint32_t client
 
         for (const auto& listener: listeners)
         {
-            listener->onChatVideoData(mChatApi, chatid, width, height, buffer, width * height * 4);
+            if (listener.second == frame->getFormat())
+            {
+                listener.first->onChatVideoFrame(mChatApi, chatid, frame);
+            }
         }
 
         return;
@@ -4637,11 +4820,11 @@ void MegaChatApiImpl::fireOnChatVideoData(MegaChatHandle chatid, uint32_t client
         MegaChatPeerVideoListener_map::iterator peerVideoIterator = it->second.find(clientId);
         if (peerVideoIterator != it->second.end())
         {
-            for( MegaChatVideoListener_set::iterator videoListenerIterator = peerVideoIterator->second.begin();
+            for( MegaChatVideoListener_map::iterator videoListenerIterator = peerVideoIterator->second.begin();
                  videoListenerIterator != peerVideoIterator->second.end();
                  videoListenerIterator++)
             {
-                if (*videoListenerIterator == nullptr)
+                if (videoListenerIterator->first == nullptr)
                 {
                     API_LOG_WARNING("%sremote videoListener with CID %u does not exists ",
                                     getLoggingName(),
@@ -4649,15 +4832,83 @@ void MegaChatApiImpl::fireOnChatVideoData(MegaChatHandle chatid, uint32_t client
                     continue;
                 }
 
-                (*videoListenerIterator)->onChatVideoData(mChatApi, chatid, width, height, buffer, width * height * 4);
+                if (videoListenerIterator->second == frame->getFormat())
+                {
+                    videoListenerIterator->first->onChatVideoFrame(mChatApi, chatid, frame);
+                }
             }
         }
     }
 }
 
+int MegaChatApiImpl::getVideoListenersFormats(MegaChatHandle chatid, uint32_t clientId, int sourceType, rtcModule::VideoResolution videoResolution)
+{
+    const MegaChatVideoListener_map* listeners = nullptr;
+    if (clientId == 0)
+    {
+        const auto& localListeners = sourceType == MegaChatApi::TYPE_VIDEO_SOURCE_LOCAL_CAMERA
+                ? mLocalCameraVideoListeners
+                : mLocalScreenVideoListeners;
+        auto it = localListeners.find(chatid);
+        listeners = it != localListeners.end() ? &it->second : nullptr;
+    }
+    else
+    {
+        const auto& remoteListeners = videoResolution == rtcModule::VideoResolution::kHiRes
+                ? mVideoListenersHiRes
+                : mVideoListenersLowRes;
+        auto it = remoteListeners.find(chatid);
+        if (it != remoteListeners.end())
+        {
+            auto peerIt = it->second.find(clientId);
+            listeners = peerIt != it->second.end() ? &peerIt->second : nullptr;
+        }
+    }
+
+    int formats = 0;
+    if (listeners)
+    {
+        for (const auto& listener : *listeners)
+        {
+            formats |= MegaChatVideoFramePrivate::toPixelFormat(listener.second);
+        }
+    }
+    return formats;
+}
+
 #endif  // webrtc
 
 void MegaChatApiImpl::fireOnChatListItemUpdate(MegaChatListItem *item)
+{
+    // update the snapshot before notifying, so app threads woken up by listeners find the change
+    if (mClient && !mTerminating)
+    {
+        mChatListSnapshot.update(*item);
+        markChatListItemStale(item->getChatId());
+    }
+
+    if (!mCoalesceNotifications)
+    {
+        notifyChatListItemUpdate(item);
+        return;
+    }
+
+    std::unique_ptr<MegaChatListItemPrivate> held(static_cast<MegaChatListItemPrivate *>(item));
+    auto it = mHeldChatListItemPos.find(held->getChatId());
+    if (it != mHeldChatListItemPos.end())
+    {
+        held->mergeChanges(*mHeldChatListItems[it->second]);
+        mHeldChatListItems[it->second] = std::move(held);
+    }
+    else
+    {
+        mHeldChatListItemPos[held->getChatId()] = mHeldChatListItems.size();
+        mHeldChatListItems.push_back(std::move(held));
+    }
+    scheduleHeldNotifications();
+}
+
+void MegaChatApiImpl::notifyChatListItemUpdate(MegaChatListItem *item)
 {
     for(set<MegaChatListener *>::iterator it = listeners.begin(); it != listeners.end() ; it++)
     {
@@ -4669,6 +4920,7 @@ void MegaChatApiImpl::fireOnChatListItemUpdate(MegaChatListItem *item)
 
 void MegaChatApiImpl::fireOnChatInitStateUpdate(int newState)
 {
+    flushChatListItemUpdates();
     for(set<MegaChatListener *>::iterator it = listeners.begin(); it != listeners.end() ; it++)
     {
         (*it)->onChatInitStateUpdate(mChatApi, newState);
@@ -4677,6 +4929,7 @@ void MegaChatApiImpl::fireOnChatInitStateUpdate(int newState)
 
 void MegaChatApiImpl::fireOnChatOnlineStatusUpdate(MegaChatHandle userhandle, int status, bool inProgress)
 {
+    flushChatListItemUpdates();
     for(set<MegaChatListener *>::iterator it = listeners.begin(); it != listeners.end() ; it++)
     {
         (*it)->onChatOnlineStatusUpdate(mChatApi, userhandle, status, inProgress);
@@ -4685,6 +4938,7 @@ void MegaChatApiImpl::fireOnChatOnlineStatusUpdate(MegaChatHandle userhandle, in
 
 void MegaChatApiImpl::fireOnChatPresenceConfigUpdate(MegaChatPresenceConfig *config)
 {
+    flushChatListItemUpdates();
     for(set<MegaChatListener *>::iterator it = listeners.begin(); it != listeners.end() ; it++)
     {
         (*it)->onChatPresenceConfigUpdate(mChatApi, config);
@@ -4695,6 +4949,7 @@ void MegaChatApiImpl::fireOnChatPresenceConfigUpdate(MegaChatPresenceConfig *con
 
 void MegaChatApiImpl::fireOnChatPresenceLastGreenUpdated(MegaChatHandle userhandle, int lastGreen)
 {
+    flushChatListItemUpdates();
     for(set<MegaChatListener *>::iterator it = listeners.begin(); it != listeners.end() ; it++)
     {
         (*it)->onChatPresenceLastGreen(mChatApi, userhandle, lastGreen);
@@ -4703,6 +4958,7 @@ void MegaChatApiImpl::fireOnChatPresenceLastGreenUpdated(MegaChatHandle userhand
 
 void MegaChatApiImpl::fireOnChatConnectionStateUpdate(MegaChatHandle chatid, int newState)
 {
+    flushChatListItemUpdates();
     bool allConnected = (newState == MegaChatApi::CHAT_CONNECTION_ONLINE) ? mClient->mChatdClient->areAllChatsLoggedIn() : false;
 
     for(set<MegaChatListener *>::iterator it = listeners.begin(); it != listeners.end() ; it++)
@@ -4718,6 +4974,7 @@ void MegaChatApiImpl::fireOnChatConnectionStateUpdate(MegaChatHandle chatid, int
 
 void MegaChatApiImpl::fireOnDbError(int error, const char *msg)
 {
+    flushChatListItemUpdates();
     for(set<MegaChatListener *>::iterator it = listeners.begin(); it != listeners.end() ; it++)
     {
         (*it)->onDbError(mChatApi, error, msg);
@@ -5279,127 +5536,99 @@ MegaChatRoom *MegaChatApiImpl::getChatRoomByUser(MegaChatHandle userhandle)
     return chat;
 }
 
+template <typename F>
+void MegaChatApiImpl::forEachChatListEntry(ChatListSnapshot::Indexes indexes, F&& f) const
+{
+    if (!isKarereThread())
+    {
+        mChatListSnapshot.forEach(indexes, f);
+        return;
+    }
+
+    SdkMutexGuard g(sdkMutex);
+    if (mClient && !mTerminating)
+    {
+        for (const auto& [chatid, chatRoom] : *(mClient->chats))
+        {
+            MegaChatListItemPrivate item(*chatRoom);
+            auto entry = std::make_shared<const ChatListSnapshot::Entry>(item, ChatListSnapshot::Entry::peersOf(*chatRoom));
+            if ((entry->indexes & indexes) == indexes)
+            {
+                f(entry);
+            }
+        }
+    }
+}
+
 MegaChatListItemList* MegaChatApiImpl::getChatListItems(const int mask, const int filter) const
 {
     LOG_verbose << "MegaChatApiImpl::getChatListItems with mask " << mask << " and filter " << filter;
 
+    auto items = new MegaChatListItemListPrivate();
     if (mask < 0 || filter < 0)
     {
         LOG_warn << "getChatListItems: invalid arguments";
-        return new MegaChatListItemListPrivate();
+        return items;
     }
 
-    enum BitOrder
-    {
-        IndivOrGroup = 0,
-        PubOrPriv,
-        MeetingsOrNon,
-        ArchivedOrNon,
-        ActiveOrNon,
-        ReadOrUnread,
-        TotalBits
-    };
-    constexpr std::size_t bsSize = BitOrder::TotalBits;
-    const std::bitset<bsSize> bsMask {static_cast<unsigned long long>(mask)};
-    const std::bitset<bsSize> bsFilter {static_cast<unsigned long long>(filter)};
-
-    const auto passFilter = [this, &bsMask, &bsFilter](ChatRoom* cr) -> bool
+    forEachChatListEntry(ChatListSnapshot::indexesOf(mask, filter), [items](const ChatListSnapshot::EntryPtr& entry)
     {
-        const bool individualRequested = bsFilter[BitOrder::IndivOrGroup];
-        if (bsMask[BitOrder::IndivOrGroup] &&
-            !isChatroomFromType(*cr, individualRequested ? MegaChatApi::CHAT_TYPE_INDIVIDUAL : MegaChatApi::CHAT_TYPE_GROUP))
-        { return false; }
-
-        const bool publicRequested = bsFilter[BitOrder::PubOrPriv];
-        if (bsMask[BitOrder::PubOrPriv] &&
-            !isChatroomFromType(*cr, publicRequested ? MegaChatApi::CHAT_TYPE_GROUP_PUBLIC : MegaChatApi::CHAT_TYPE_GROUP_PRIVATE))
-        { return false; }
-
-        const bool meetingsRequested = bsFilter[BitOrder::MeetingsOrNon];
-        if (bsMask[BitOrder::MeetingsOrNon] &&
-            !isChatroomFromType(*cr, meetingsRequested ? MegaChatApi::CHAT_TYPE_MEETING_ROOM : MegaChatApi::CHAT_TYPE_NON_MEETING))
-        { return false; }
-
-        const bool archivedRequested = bsFilter[BitOrder::ArchivedOrNon];
-        if (bsMask[BitOrder::ArchivedOrNon] && archivedRequested != cr->isArchived())
-        { return false; }
-
-        const bool activeRequested = bsFilter[BitOrder::ActiveOrNon];
-        if (bsMask[BitOrder::ActiveOrNon] && activeRequested != cr->isActive())
-        { return false; }
+        items->addChatListItem(ChatListSnapshot::itemOf(entry));
+    });
 
-        const bool readRequested = bsFilter[BitOrder::ReadOrUnread];
-        if (bsMask[BitOrder::ReadOrUnread] && readRequested == static_cast<bool>(cr->chat().unreadMsgCount()))
-        { return false; }
+    return items;
+}
 
-        return true;
-    };
+MegaChatListItemList* MegaChatApiImpl::getChatListItemsPage(const int mask, const int filter, unsigned int pageSize, const MegaChatListItem* after) const
+{
+    LOG_verbose << "MegaChatApiImpl::getChatListItemsPage with mask " << mask << ", filter " << filter << " and page size " << pageSize;
 
-    auto ret = new MegaChatListItemListPrivate();
-    std::lock_guard<std::recursive_mutex> g {sdkMutex};
+    auto items = new MegaChatListItemListPrivate();
+    if (mask < 0 || filter < 0)
+    {
+        LOG_warn << "getChatListItemsPage: invalid arguments";
+        return items;
+    }
 
-    if (mClient && !mTerminating)
+    // the order of activity is kept by the snapshot only, which the karere thread reads too, since
+    // it's updated before notifying any change
+    ChatListSnapshot::ActivityKey cursor{};
+    if (after)
     {
-        for (const auto& [crId, cr] : *(mClient->chats))
-        {
-            if (passFilter(cr)) { ret->addChatListItem(new MegaChatListItemPrivate(*cr)); }
-        }
+        cursor = ChatListSnapshot::activityKeyOf(*after);
+    }
+    for (const ChatListSnapshot::EntryPtr& entry : mChatListSnapshot.page(ChatListSnapshot::indexesOf(mask, filter),
+                                                                          after ? &cursor : nullptr, pageSize))
+    {
+        items->addChatListItem(ChatListSnapshot::itemOf(entry));
     }
 
-    return ret;
+    return items;
 }
 
 MegaChatListItemList *MegaChatApiImpl::getChatListItems() const
 {
-    MegaChatListItemListPrivate *items = new MegaChatListItemListPrivate();
-
-    sdkMutex.lock();
-
-    if (mClient && !mTerminating)
-    {
-        ChatRoomList::iterator it;
-        for (it = mClient->chats->begin(); it != mClient->chats->end(); it++)
-        {
-            if (!it->second->isArchived())
-            {
-                items->addChatListItem(new MegaChatListItemPrivate(*it->second));
-            }
-        }
-    }
-
-    sdkMutex.unlock();
-
-    return items;
+    return getChatListItems(MegaChatApi::CHAT_FILTER_BY_ARCHIVED_OR_NON_ARCHIVED, MegaChatApi::CHAT_GET_NON_ARCHIVED);
 }
 
 MegaChatListItemList* MegaChatApiImpl::getChatListItemsByType(int type)
 {
     MegaChatListItemListPrivate* items = new MegaChatListItemListPrivate();
-    SdkMutexGuard g(sdkMutex);
     if (type < MegaChatApi::CHAT_TYPE_FIRST || type > MegaChatApi::CHAT_TYPE_LAST)
     {
         return items;
     }
 
-    if (!mClient || mTerminating)
-    {
-        return items;
-    }
-    if (type == MegaChatApi::CHAT_TYPE_SELF)
+    // the note-to-self chat is returned even if it's archived
+    ChatListSnapshot::Indexes indexes = (type == MegaChatApi::CHAT_TYPE_SELF)
+            ? 0 : ChatListSnapshot::indexesOf(MegaChatApi::CHAT_FILTER_BY_ARCHIVED_OR_NON_ARCHIVED, MegaChatApi::CHAT_GET_NON_ARCHIVED);
+    forEachChatListEntry(indexes, [items, type](const ChatListSnapshot::EntryPtr& entry)
     {
-        if (auto chat = mClient->chats->selfChat())
+        if (ChatListSnapshot::isOfType(entry->item, type))
         {
-            items->addChatListItem(new MegaChatListItemPrivate(*chat));
+            items->addChatListItem(ChatListSnapshot::itemOf(entry));
         }
-        return items;
-    }
-    for (auto& chat: *mClient->chats)
-    {
-        if (!chat.second->isArchived() && isChatroomFromType(*chat.second, type))
-        {
-            items->addChatListItem(new MegaChatListItemPrivate(*chat.second));
-        }
-    }
+    });
     return items;
 }
 
@@ -5407,61 +5636,46 @@ MegaChatListItemList *MegaChatApiImpl::getChatListItemsByPeers(MegaChatPeerList
 {
     MegaChatListItemListPrivate *items = new MegaChatListItemListPrivate();
 
-    sdkMutex.lock();
-
-    if (mClient && !mTerminating)
+    forEachChatListEntry(0, [items, peers](const ChatListSnapshot::EntryPtr& entry)
     {
-        ChatRoomList::iterator it;
-        for (it = mClient->chats->begin(); it != mClient->chats->end(); it++)
+        if (entry->item.isGroup())
         {
-            bool sameParticipants = true;
-            if (it->second->isGroup())
+            if ((int)entry->peers->size() != peers->size())
             {
-                GroupChatRoom *chatroom = (GroupChatRoom*) it->second;
-                if ((int)chatroom->peers().size() != peers->size())
-                {
-                    continue;
-                }
+                return;
+            }
 
-                for (int i = 0; i < peers->size(); i++)
-                {
-                    // if the peer in the list is part of the members in the chatroom...
-                    MegaChatHandle uh = peers->getPeerHandle(i);
-                    if (chatroom->peers().find(uh) == chatroom->peers().end())
-                    {
-                        sameParticipants = false;
-                        break;
-                    }
-                }
-                if (sameParticipants == true)
+            for (int i = 0; i < peers->size(); i++)
+            {
+                // if the peer in the list is part of the members in the chatroom...
+                MegaChatHandle uh = peers->getPeerHandle(i);
+                if (!std::binary_search(entry->peers->begin(), entry->peers->end(), uh))
                 {
-                    items->addChatListItem(new MegaChatListItemPrivate(*it->second));
+                    return;
                 }
-
             }
-            else    // 1on1
+            items->addChatListItem(ChatListSnapshot::itemOf(entry));
+        }
+        else    // 1on1
+        {
+            if (peers->size() == 1 && entry->item.getPeerHandle() == peers->getPeerHandle(0))
             {
-                if (peers->size() != 1)
-                {
-                    continue;
-                }
-
-                PeerChatRoom *chatroom = (PeerChatRoom*) it->second;
-                if (chatroom->peer() == peers->getPeerHandle(0))
-                {
-                    items->addChatListItem(new MegaChatListItemPrivate(*it->second));
-                }
+                items->addChatListItem(ChatListSnapshot::itemOf(entry));
             }
         }
-    }
-
-    sdkMutex.unlock();
+    });
 
     return items;
 }
 
 MegaChatListItem *MegaChatApiImpl::getChatListItem(MegaChatHandle chatid)
 {
+    if (!isKarereThread())
+    {
+        ChatListSnapshot::EntryPtr entry = mChatListSnapshot.find(chatid);
+        return entry ? entry->item.copy() : NULL;
+    }
+
     MegaChatListItemPrivate *item = NULL;
 
     sdkMutex.lock();
@@ -5481,127 +5695,51 @@ int MegaChatApiImpl::getUnreadChats()
 {
     int count = 0;
 
-    sdkMutex.lock();
-
-    if (mClient && !mTerminating)
+    ChatListSnapshot::Indexes indexes = ChatListSnapshot::indexesOf(MegaChatApi::CHAT_FILTER_BY_ARCHIVED_OR_NON_ARCHIVED
+                                                                    | MegaChatApi::CHAT_FILTER_BY_READ_OR_UNREAD,
+                                                                    MegaChatApi::CHAT_GET_NON_ARCHIVED | MegaChatApi::CHAT_GET_UNREAD);
+    forEachChatListEntry(indexes, [&count](const ChatListSnapshot::EntryPtr& entry)
     {
-        ChatRoomList::iterator it;
-        for (it = mClient->chats->begin(); it != mClient->chats->end(); it++)
+        if (!entry->item.isPreview())
         {
-            ChatRoom *room = it->second;
-            if (!room->isArchived() && !room->previewMode() && room->chat().unreadMsgCount())
-            {
-                count++;
-            }
+            count++;
         }
-    }
-
-    sdkMutex.unlock();
+    });
 
     return count;
 }
 
 MegaChatListItemList *MegaChatApiImpl::getActiveChatListItems()
 {
-    MegaChatListItemListPrivate *items = new MegaChatListItemListPrivate();
-
-    sdkMutex.lock();
+    return getChatListItems(MegaChatApi::CHAT_FILTER_BY_ARCHIVED_OR_NON_ARCHIVED | MegaChatApi::CHAT_FILTER_BY_ACTIVE_OR_NON_ACTIVE,
+                            MegaChatApi::CHAT_GET_NON_ARCHIVED | MegaChatApi::CHAT_GET_ACTIVE);
+}
 
-    if (mClient && !mTerminating)
-    {
-        ChatRoomList::iterator it;
-        for (it = mClient->chats->begin(); it != mClient->chats->end(); it++)
-        {
-            if (!it->second->isArchived() && it->second->isActive())
-            {
-                items->addChatListItem(new MegaChatListItemPrivate(*it->second));
-            }
-        }
-    }
+MegaChatListItemList *MegaChatApiImpl::getInactiveChatListItems()
+{
+    return getChatListItems(MegaChatApi::CHAT_FILTER_BY_ARCHIVED_OR_NON_ARCHIVED | MegaChatApi::CHAT_FILTER_BY_ACTIVE_OR_NON_ACTIVE,
+                            MegaChatApi::CHAT_GET_NON_ARCHIVED | MegaChatApi::CHAT_GET_NON_ACTIVE);
+}
 
-    sdkMutex.unlock();
+MegaChatListItemList *MegaChatApiImpl::getArchivedChatListItems()
+{
+    return getChatListItems(MegaChatApi::CHAT_FILTER_BY_ARCHIVED_OR_NON_ARCHIVED, MegaChatApi::CHAT_GET_ARCHIVED);
+}
 
-    return items;
+MegaChatListItemList *MegaChatApiImpl::getUnreadChatListItems()
+{
+    return getChatListItems(MegaChatApi::CHAT_FILTER_BY_ARCHIVED_OR_NON_ARCHIVED | MegaChatApi::CHAT_FILTER_BY_READ_OR_UNREAD,
+                            MegaChatApi::CHAT_GET_NON_ARCHIVED | MegaChatApi::CHAT_GET_UNREAD);
 }
 
-MegaChatListItemList *MegaChatApiImpl::getInactiveChatListItems()
+MegaChatHandle MegaChatApiImpl::getChatHandleByUser(MegaChatHandle userhandle)
 {
-    MegaChatListItemListPrivate *items = new MegaChatListItemListPrivate();
+    MegaChatHandle chatid = MEGACHAT_INVALID_HANDLE;
 
     sdkMutex.lock();
 
-    if (mClient && !mTerminating)
-    {
-        ChatRoomList::iterator it;
-        for (it = mClient->chats->begin(); it != mClient->chats->end(); it++)
-        {
-            if (!it->second->isArchived() && !it->second->isActive())
-            {
-                items->addChatListItem(new MegaChatListItemPrivate(*it->second));
-            }
-        }
-    }
-
-    sdkMutex.unlock();
-
-    return items;
-}
-
-MegaChatListItemList *MegaChatApiImpl::getArchivedChatListItems()
-{
-    MegaChatListItemListPrivate *items = new MegaChatListItemListPrivate();
-
-    sdkMutex.lock();
-
-    if (mClient && !mTerminating)
-    {
-        ChatRoomList::iterator it;
-        for (it = mClient->chats->begin(); it != mClient->chats->end(); it++)
-        {
-            if (it->second->isArchived())
-            {
-                items->addChatListItem(new MegaChatListItemPrivate(*it->second));
-            }
-        }
-    }
-
-    sdkMutex.unlock();
-
-    return items;
-}
-
-MegaChatListItemList *MegaChatApiImpl::getUnreadChatListItems()
-{
-    MegaChatListItemListPrivate *items = new MegaChatListItemListPrivate();
-
-    sdkMutex.lock();
-
-    if (mClient && !mTerminating)
-    {
-        ChatRoomList::iterator it;
-        for (it = mClient->chats->begin(); it != mClient->chats->end(); it++)
-        {
-            ChatRoom *room = it->second;
-            if (!room->isArchived() && room->chat().unreadMsgCount())
-            {
-                items->addChatListItem(new MegaChatListItemPrivate(*it->second));
-            }
-        }
-    }
-
-    sdkMutex.unlock();
-
-    return items;
-}
-
-MegaChatHandle MegaChatApiImpl::getChatHandleByUser(MegaChatHandle userhandle)
-{
-    MegaChatHandle chatid = MEGACHAT_INVALID_HANDLE;
-
-    sdkMutex.lock();
-
-    ChatRoom *chatRoom = findChatRoomByUser(userhandle);
-    if (chatRoom)
+    ChatRoom *chatRoom = findChatRoomByUser(userhandle);
+    if (chatRoom)
     {
         chatid = chatRoom->chatid();
     }
@@ -7540,12 +7678,22 @@ void MegaChatApiImpl::addChatVideoListener(MegaChatHandle chatid,
                                            MegaChatHandle clientId,
                                            rtcModule::VideoResolution videoResolution,
                                            const int capturerType,
-                                           MegaChatVideoListener* listener)
+                                           MegaChatVideoListener* listener,
+                                           int format)
 {
     if (!listener)
     {
         return;
     }
+    if (format != MegaChatVideoFrame::FORMAT_ARGB &&
+        format != MegaChatVideoFrame::FORMAT_I420 &&
+        format != MegaChatVideoFrame::FORMAT_NV12)
+    {
+        API_LOG_ERROR("%saddChatVideoListener: Invalid video format: %i",
+                      getLoggingName(),
+                      format);
+        return;
+    }
     if (clientId == MegaChatApi::LOCAL_CLIENT_ID_FOR_VIDEO &&
         (capturerType != MegaChatApi::TYPE_CAPTURER_SCREEN &&
          capturerType != MegaChatApi::TYPE_CAPTURER_VIDEO))
@@ -7554,16 +7702,16 @@ void MegaChatApiImpl::addChatVideoListener(MegaChatHandle chatid,
     }
 
     assert(videoResolution != rtcModule::VideoResolution::kUndefined);
-    SdkMutexGuard g(videoMutex);
+    std::unique_lock<std::recursive_mutex> g(videoMutex);
     if (clientId == MegaChatApi::LOCAL_CLIENT_ID_FOR_VIDEO)
     {
         if (capturerType == MegaChatApi::TYPE_CAPTURER_VIDEO)
         {
-            mLocalCameraVideoListeners[chatid].insert(listener);
+            mLocalCameraVideoListeners[chatid][listener] = format;
         }
         else if (capturerType == MegaChatApi::TYPE_CAPTURER_SCREEN)
         {
-            mLocalScreenVideoListeners[chatid].insert(listener);
+            mLocalScreenVideoListeners[chatid][listener] = format;
         }
         else
         {
@@ -7614,11 +7762,11 @@ void MegaChatApiImpl::addChatVideoListener(MegaChatHandle chatid,
     }
     else if (videoResolution == rtcModule::VideoResolution::kHiRes)
     {
-        mVideoListenersHiRes[chatid][static_cast<uint32_t>(clientId)].insert(listener);
+        mVideoListenersHiRes[chatid][static_cast<uint32_t>(clientId)][listener] = format;
     }
     else if (videoResolution == rtcModule::VideoResolution::kLowRes)
     {
-        mVideoListenersLowRes[chatid][static_cast<uint32_t>(clientId)].insert(listener);
+        mVideoListenersLowRes[chatid][static_cast<uint32_t>(clientId)][listener] = format;
     }
 
 }
@@ -7644,7 +7792,7 @@ void MegaChatApiImpl::removeChatVideoListener(MegaChatHandle chatid,
     }
 
     assert(videoResolution != rtcModule::VideoResolution::kUndefined);
-    SdkMutexGuard g(videoMutex);
+    std::unique_lock<std::recursive_mutex> g(videoMutex);
     if (clientId == MegaChatApi::LOCAL_CLIENT_ID_FOR_VIDEO)
     {
         auto& listeners = capturerType == MegaChatApi::TYPE_CAPTURER_VIDEO
@@ -7654,7 +7802,7 @@ void MegaChatApiImpl::removeChatVideoListener(MegaChatHandle chatid,
         if (auto it = listeners.find(chatid);
             it != listeners.end())
         {
-            MegaChatVideoListener_set& videoListenersSet = it->second;
+            MegaChatVideoListener_map& videoListenersSet = it->second;
             videoListenersSet.erase(listener);
             if (videoListenersSet.empty())
             {
@@ -7686,12 +7834,12 @@ void MegaChatApiImpl::removeChatVideoListener(MegaChatHandle chatid,
             auto auxit = videoListenersMap.find(static_cast<Cid_t>(clientId));
             if (auxit != videoListenersMap.end())
             {
-                // remove listener from MegaChatVideoListener_set
-                MegaChatVideoListener_set& videoListener_set = auxit->second;
+                // remove listener from MegaChatVideoListener_map
+                MegaChatVideoListener_map& videoListener_set = auxit->second;
                 videoListener_set.erase(listener);
                 if (videoListener_set.empty())
                 {
-                    // if MegaChatVideoListener_set is empty, remove entry from
+                    // if MegaChatVideoListener_map is empty, remove entry from
                     // MegaChatPeerVideoListener_map
                     videoListenersMap.erase(static_cast<Cid_t>(clientId));
                 }
@@ -7911,6 +8059,69 @@ void MegaChatApiImpl::setPublicKeyPinning(bool enable)
     ::WebsocketsClient::publicKeyPinning = enable;
 }
 
+void MegaChatApiImpl::setDbGroupCommit(bool enable)
+{
+    SdkMutexGuard g(sdkMutex);
+    mDbGroupCommit = enable;
+    if (mClient)
+    {
+        mClient->setDbGroupCommit(enable);
+    }
+}
+
+void MegaChatApiImpl::setLazyChatroomInit(bool enable)
+{
+    SdkMutexGuard g(sdkMutex);
+    mLazyChatInit = enable;
+    if (mClient)
+    {
+        mClient->setLazyChatInit(enable);
+    }
+}
+
+void MegaChatApiImpl::setHistoryMemoryBudget(unsigned int maxMessagesPerChat, unsigned int maxMessages)
+{
+    SdkMutexGuard g(sdkMutex);
+    mHistoryBudgetPerChat = maxMessagesPerChat;
+    mHistoryBudgetTotal = maxMessages;
+    if (mClient)
+    {
+        mClient->setHistoryBudget(maxMessagesPerChat, maxMessages);
+    }
+}
+
+void MegaChatApiImpl::setNotificationCoalescing(bool enable, unsigned int windowMs)
+{
+    SdkMutexGuard g(sdkMutex);
+    mCoalesceNotifications = enable;
+    mCoalescingWindowMs = windowMs;
+    if (!enable)
+    {
+        // held notifications are fired by the karere thread
+        waiter->notify();
+    }
+}
+
+MegaStringMap *MegaChatApiImpl::getHistoryMemoryStats()
+{
+    SdkMutexGuard g(sdkMutex);
+    if (!mClient || !mClient->mChatdClient)
+    {
+        return nullptr;
+    }
+
+    chatd::Client::HistoryMemoryStats stats = mClient->mChatdClient->historyMemoryStats();
+    auto result = new MegaStringMapPrivate();
+    result->set("chats", std::to_string(stats.numChats).c_str());
+    result->set("pinnedChats", std::to_string(stats.numPinnedChats).c_str());
+    result->set("messages", std::to_string(stats.numMessages).c_str());
+    result->set("pinnedMessages", std::to_string(stats.numPinnedMessages).c_str());
+    result->set("bytes", std::to_string(stats.numBytes).c_str());
+    result->set("evictedMessages", std::to_string(stats.numEvictedMessages).c_str());
+    result->set("evictions", std::to_string(stats.numEvictions).c_str());
+    return result;
+}
+
 IApp::IChatHandler *MegaChatApiImpl::createChatHandler(ChatRoom &room)
 {
     return getChatRoomHandler(room.chatid());
@@ -8009,10 +8220,17 @@ bool MegaChatApiImpl::setCurrentInputVideoTracksLimit(const int numInputVideoTra
     mClient->rtc->setNumInputVideoTracks(auxNumInputVideoTracks);
     return true;
 }
+
+void MegaChatApiImpl::setVideoFramesInWorkerThreads(bool enable)
+{
+    rtcModule::setVideoConversionInWorkers(enable);
+}
 #endif
 
 void MegaChatApiImpl::cleanChatHandlers()
 {
+    flushHeldNotifications();
+
 #ifndef KARERE_DISABLE_WEBRTC
     cleanCalls();
 #endif
@@ -8061,6 +8279,17 @@ void MegaChatApiImpl::onInitStateChange(int newState)
     }
 }
 
+bool MegaChatApiImpl::isKarereThread() const
+{
+    return std::this_thread::get_id() == mKarereThreadId;
+}
+
+bool MegaChatApiImpl::isKarereContext() const
+{
+    // synchronous calls from app threads hold the sdkMutex, so the karere thread waits for them
+    return isKarereThread() || sdkMutex.isHeldByThisThread();
+}
+
 void MegaChatApiImpl::onChatNotification(karere::Id chatid, const Message &msg, Message::Status status, Idx idx)
 {
     if (mMegaApi->isChatNotifiable(chatid)   // filtering based on push-notification settings
@@ -8169,6 +8398,14 @@ bool MegaChatApiImpl::isChatroomFromType(const ChatRoom& chat, int type) const
     return false;
 }
 
+void MegaChatApiImpl::markChatListItemStale(MegaChatHandle chatid)
+{
+    if (mClient && !mTerminating)
+    {
+        mChatListStale.insert(chatid);
+    }
+}
+
 IApp::IGroupChatListItem *MegaChatApiImpl::addGroupChatItem(GroupChatRoom &chat)
 {
     MegaChatGroupListItemHandler *itemHandler = new MegaChatGroupListItemHandler(*this, chat);
@@ -8201,6 +8438,7 @@ void MegaChatApiImpl::removeGroupChatItem(IGroupChatListItem &item)
         IGroupChatListItem *itemHandler = (*it);
         if (itemHandler == &item)
         {
+            mChatListSnapshot.remove((*it)->getChatId());
             delete itemHandler;
             chatGroupListItemHandler.erase(it);
             return;
@@ -8218,6 +8456,7 @@ void MegaChatApiImpl::removePeerChatItem(IPeerChatListItem &item)
         IPeerChatListItem *itemHandler = (*it);
         if (itemHandler == &item)
         {
+            mChatListSnapshot.remove((*it)->getChatId());
             delete (itemHandler);
             chatPeerListItemHandler.erase(it);
             return;
@@ -8298,55 +8537,488 @@ void ChatRequestQueue::removeListener(MegaChatRequestListener *listener)
     mutex.unlock();
 }
 
-void EventQueue::push(megaMessage* transfer)
+EventQueue::EventQueue()
+    : mHead(&mStub), mTail(&mStub), mStub(nullptr)
 {
-    mutex.lock();
-    events.push_back(transfer);
-    mutex.unlock();
 }
 
-void EventQueue::push_front(megaMessage* event)
+void EventQueue::link(megaMessage* event)
 {
-    mutex.lock();
-    events.push_front(event);
-    mutex.unlock();
+    event->next.store(nullptr, std::memory_order_relaxed);
+    megaMessage* prev = mHead.exchange(event, std::memory_order_acq_rel);
+    // until this store, the consumer can't reach this event nor any pushed after it
+    prev->next.store(event, std::memory_order_release);
+}
+
+bool EventQueue::push(megaMessage* event)
+{
+    link(event);
+    // counted after being linked: a consumer that finds it empty (<= 0) and goes to sleep,
+    // is woken up by the push that takes it from 0 to 1
+    return mSize.fetch_add(1, std::memory_order_acq_rel) == 0;
 }
 
 megaMessage* EventQueue::pop()
 {
-    mutex.lock();
-    if(events.empty())
+    megaMessage* tail = mTail;
+    megaMessage* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &mStub)
     {
-        mutex.unlock();
-        return NULL;
+        if (!next)
+        {
+            return NULL;
+        }
+        mTail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
     }
 
-    megaMessage* event = events.front();
-    events.pop_front();
-    mutex.unlock();
-    return event;
+    if (!next)
+    {
+        if (tail != mHead.load(std::memory_order_acquire))
+        {
+            return NULL; // a push is in progress
+        }
+
+        // the last event can't be unlinked without a successor, put the stub back
+        link(&mStub);
+        next = tail->next.load(std::memory_order_acquire);
+        if (!next)
+        {
+            return NULL; // a push is in progress
+        }
+    }
+
+    mTail = next;
+    mSize.fetch_sub(1, std::memory_order_acq_rel);
+    return tail;
 }
 
 bool EventQueue::isEmpty()
 {
-    bool ret;
+    return mSize.load(std::memory_order_acquire) <= 0;
+}
 
-    mutex.lock();
-    ret = events.empty();
-    mutex.unlock();
+size_t EventQueue::size()
+{
+    int64_t size = mSize.load(std::memory_order_acquire);
+    return size > 0 ? static_cast<size_t>(size) : 0;
+}
 
-    return ret;
+ChatListSnapshot::Entry::Entry(const MegaChatListItem& aItem, Peers aPeers)
+    : item(&aItem), peers(std::move(aPeers)), indexes(indexesOf(aItem))
+{
+    item.removeChanges();
 }
 
-size_t EventQueue::size()
+ChatListSnapshot::Peers ChatListSnapshot::Entry::peersOf(const ChatRoom& room)
 {
-    size_t ret;
+    auto peers = std::make_shared<std::vector<MegaChatHandle>>();
+    if (room.isGroup())
+    {
+        const GroupChatRoom::MemberMap& members = static_cast<const GroupChatRoom&>(room).peers();
+        peers->reserve(members.size());
+        for (const auto& member : members)
+        {
+            peers->push_back(member.first);   // already sorted
+        }
+    }
+    return peers;
+}
 
-    mutex.lock();
-    ret = events.size();
-    mutex.unlock();
+const char* ChatListSnapshot::differingProperty(const MegaChatListItem& a, const MegaChatListItem& b)
+{
+#define CHECK_PROPERTY(getter) if (a.getter() != b.getter()) return #getter
+    CHECK_PROPERTY(getChatId);
+    CHECK_PROPERTY(getOwnPrivilege);
+    CHECK_PROPERTY(getUnreadCount);
+    CHECK_PROPERTY(getLastMessageId);
+    CHECK_PROPERTY(getLastMessageType);
+    CHECK_PROPERTY(getLastMessageSender);
+    CHECK_PROPERTY(getLastTimestamp);
+    CHECK_PROPERTY(isGroup);
+    CHECK_PROPERTY(isPublic);
+    CHECK_PROPERTY(isPreview);
+    CHECK_PROPERTY(isActive);
+    CHECK_PROPERTY(isArchived);
+    CHECK_PROPERTY(isDeleted);
+    CHECK_PROPERTY(isCallInProgress);
+    CHECK_PROPERTY(getPeerHandle);
+    CHECK_PROPERTY(getLastMessagePriv);
+    CHECK_PROPERTY(getLastMessageHandle);
+    CHECK_PROPERTY(getNumPreviewers);
+    CHECK_PROPERTY(isMeeting);
+#undef CHECK_PROPERTY
 
-    return ret;
+    auto differ = [](const char* x, const char* y) { return (x && y) ? strcmp(x, y) != 0 : x != y; };
+    if (differ(a.getTitle(), b.getTitle()))
+    {
+        return "getTitle";
+    }
+    if (differ(a.getLastMessage(), b.getLastMessage()))
+    {
+        return "getLastMessage";
+    }
+    return NULL;
+}
+
+bool ChatListSnapshot::isOfType(const MegaChatListItem& item, int type)
+{
+    switch (type)
+    {
+        case MegaChatApi::CHAT_TYPE_ALL:
+            return true;
+        case MegaChatApi::CHAT_TYPE_INDIVIDUAL:
+            return !item.isGroup();
+        case MegaChatApi::CHAT_TYPE_GROUP:
+            return item.isGroup() && !item.isMeeting();
+        case MegaChatApi::CHAT_TYPE_GROUP_PRIVATE:
+            // private groupchats can't be meeting rooms
+            return item.isGroup() && !item.isPublic();
+        case MegaChatApi::CHAT_TYPE_GROUP_PUBLIC:
+            return item.isGroup() && item.isPublic() && !item.isMeeting();
+        case MegaChatApi::CHAT_TYPE_MEETING_ROOM:
+            return item.isMeeting();
+        case MegaChatApi::CHAT_TYPE_NON_MEETING:
+            return !item.isMeeting();
+        case MegaChatApi::CHAT_TYPE_SELF:
+            return item.isNoteToSelf();
+    }
+    return false;
+}
+
+ChatListSnapshot::Indexes ChatListSnapshot::indexesOf(const MegaChatListItem& item)
+{
+    // for every filter, whether the item matches the values 0 and 1 (see MegaChatApi::CHAT_GET_*)
+    const std::pair<bool, bool> matches[kNumFilters] =
+    {
+        { isOfType(item, MegaChatApi::CHAT_TYPE_GROUP), isOfType(item, MegaChatApi::CHAT_TYPE_INDIVIDUAL) },
+        { isOfType(item, MegaChatApi::CHAT_TYPE_GROUP_PRIVATE), isOfType(item, MegaChatApi::CHAT_TYPE_GROUP_PUBLIC) },
+        { isOfType(item, MegaChatApi::CHAT_TYPE_NON_MEETING), isOfType(item, MegaChatApi::CHAT_TYPE_MEETING_ROOM) },
+        { !item.isArchived(), item.isArchived() },
+        { !item.isActive(), item.isActive() },
+        { item.getUnreadCount() != 0, item.getUnreadCount() == 0 }
+    };
+
+    Indexes indexes = 0;
+    for (unsigned i = 0; i < kNumFilters; i++)
+    {
+        indexes |= static_cast<Indexes>((matches[i].first << (2 * i)) | (matches[i].second << (2 * i + 1)));
+    }
+    return indexes;
+}
+
+ChatListSnapshot::Indexes ChatListSnapshot::indexesOf(int mask, int filter)
+{
+    Indexes indexes = 0;
+    for (unsigned i = 0; i < kNumFilters; i++)
+    {
+        if (mask & (1 << i))
+        {
+            indexes |= static_cast<Indexes>(1 << (2 * i + ((filter >> i) & 1)));
+        }
+    }
+    return indexes;
+}
+
+std::shared_ptr<const MegaChatListItem> ChatListSnapshot::itemOf(const EntryPtr& entry)
+{
+    return std::shared_ptr<const MegaChatListItem>(entry, &entry->item);
+}
+
+ChatListSnapshot::Part::Part(Slots aSlots)
+    : slots(std::move(aSlots))
+    , words((slots.size() + 63) / 64)
+    , bits(new std::atomic<uint64_t>[kNumIndexes * words])
+{
+    for (size_t i = 0; i < kNumIndexes * words; i++)
+    {
+        bits[i].store(0, std::memory_order_relaxed);
+    }
+    for (size_t pos = 0; pos < slots.size(); pos++)
+    {
+        setIndexes(pos, 0, slots[pos]->entry()->indexes);
+    }
+}
+
+std::vector<size_t> ChatListSnapshot::Part::find(Indexes indexes) const
+{
+    std::vector<size_t> positions;
+    for (size_t w = 0; w < words; w++)
+    {
+        uint64_t word = (w + 1 < words || slots.size() % 64 == 0) ? ~uint64_t(0) : (uint64_t(1) << (slots.size() % 64)) - 1;
+        for (unsigned i = 0; i < kNumIndexes && word; i++)
+        {
+            if (indexes & (1 << i))
+            {
+                word &= bits[i * words + w].load(std::memory_order_relaxed);
+            }
+        }
+        for (size_t pos = w * 64; word; pos++, word >>= 1)
+        {
+            if (word & 1)
+            {
+                positions.push_back(pos);
+            }
+        }
+    }
+    return positions;
+}
+
+void ChatListSnapshot::Part::setIndexes(size_t pos, Indexes oldIndexes, Indexes newIndexes) const
+{
+    const uint64_t mask = uint64_t(1) << (pos % 64);
+    for (unsigned i = 0; i < kNumIndexes; i++)
+    {
+        bool wasSet = oldIndexes & (1 << i);
+        bool isSet = newIndexes & (1 << i);
+        if (wasSet != isSet)
+        {
+            std::atomic<uint64_t>& word = bits[i * words + pos / 64];
+            if (isSet)
+            {
+                word.fetch_or(mask, std::memory_order_relaxed);
+            }
+            else
+            {
+                word.fetch_and(~mask, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+ChatListSnapshot::Slots::const_iterator ChatListSnapshot::Part::lowerBound(MegaChatHandle chatid) const
+{
+    return std::lower_bound(slots.begin(), slots.end(), chatid,
+                            [](const std::shared_ptr<Slot>& slot, MegaChatHandle id) { return slot->chatid < id; });
+}
+
+std::pair<const ChatListSnapshot::Part*, size_t> ChatListSnapshot::findSlot(const Table& table, MegaChatHandle chatid)
+{
+    for (const Part* part : {table.base.get(), table.recent.get()})
+    {
+        auto it = part->lowerBound(chatid);
+        if (it != part->slots.end() && (*it)->chatid == chatid)
+        {
+            return std::make_pair(part, static_cast<size_t>(it - part->slots.begin()));
+        }
+    }
+    return std::make_pair(nullptr, 0);
+}
+
+ChatListSnapshot::EntryPtr ChatListSnapshot::find(MegaChatHandle chatid) const
+{
+    std::shared_ptr<const Table> table = std::atomic_load(&mTable);
+    auto found = findSlot(*table, chatid);
+    return found.first ? found.first->slots[found.second]->entry() : nullptr;
+}
+
+size_t ChatListSnapshot::size() const
+{
+    std::shared_ptr<const Table> table = std::atomic_load(&mTable);
+    return table->base->slots.size() + table->recent->slots.size();
+}
+
+void ChatListSnapshot::update(const MegaChatListItem& item)
+{
+    MegaChatHandle chatid = item.getChatId();
+    std::shared_ptr<const Table> table = std::atomic_load(&mTable);
+    auto found = findSlot(*table, chatid);
+    if (found.first)
+    {
+        const Part& part = *found.first;
+        const std::shared_ptr<Slot>& slot = part.slots[found.second];
+        EntryPtr oldEntry = slot->entry();
+        auto entry = std::make_shared<const Entry>(item, oldEntry->peers);
+        Indexes indexes = entry->indexes;
+        slot->setEntry(std::move(entry));
+        part.setIndexes(found.second, oldEntry->indexes, indexes);
+
+        ActivityKey oldKey = activityKeyOf(oldEntry->item);
+        ActivityKey newKey = activityKeyOf(item);
+        if (oldKey.ts != newKey.ts)
+        {
+            updateActivity(&oldKey, &newKey);
+        }
+        return;
+    }
+
+    auto slot = std::make_shared<Slot>(chatid);
+    slot->setEntry(std::make_shared<const Entry>(item, std::make_shared<const std::vector<MegaChatHandle>>()));
+
+    Slots recent = table->recent->slots;
+    recent.insert(recent.begin() + (table->recent->lowerBound(chatid) - table->recent->slots.begin()), slot);
+    auto newTable = std::make_shared<Table>();
+    if (recent.size() <= kMaxRecent)
+    {
+        newTable->base = table->base;
+        newTable->recent = std::make_shared<const Part>(std::move(recent));
+    }
+    else
+    {
+        Slots base;
+        base.reserve(table->base->slots.size() + recent.size());
+        std::merge(table->base->slots.begin(), table->base->slots.end(), recent.begin(), recent.end(),
+                   std::back_inserter(base),
+                   [](const std::shared_ptr<Slot>& a, const std::shared_ptr<Slot>& b) { return a->chatid < b->chatid; });
+        newTable->base = std::make_shared<const Part>(std::move(base));
+    }
+    std::atomic_store(&mTable, std::shared_ptr<const Table>(std::move(newTable)));
+
+    ActivityKey key = activityKeyOf(item);
+    updateActivity(nullptr, &key);
+}
+
+void ChatListSnapshot::updatePeers(MegaChatHandle chatid, Peers peers)
+{
+    std::shared_ptr<const Table> table = std::atomic_load(&mTable);
+    auto found = findSlot(*table, chatid);
+    if (found.first)
+    {
+        const std::shared_ptr<Slot>& slot = found.first->slots[found.second];
+        slot->setEntry(std::make_shared<const Entry>(slot->entry()->item, std::move(peers)));
+    }
+}
+
+void ChatListSnapshot::remove(MegaChatHandle chatid)
+{
+    std::shared_ptr<const Table> table = std::atomic_load(&mTable);
+    auto found = findSlot(*table, chatid);
+    if (!found.first)
+    {
+        return;
+    }
+
+    ActivityKey key = activityKeyOf(found.first->slots[found.second]->entry()->item);
+    updateActivity(&key, nullptr);
+
+    Slots base;
+    base.reserve(table->base->slots.size() + table->recent->slots.size());
+    std::merge(table->base->slots.begin(), table->base->slots.end(), table->recent->slots.begin(), table->recent->slots.end(),
+               std::back_inserter(base),
+               [](const std::shared_ptr<Slot>& a, const std::shared_ptr<Slot>& b) { return a->chatid < b->chatid; });
+    base.erase(std::find_if(base.begin(), base.end(), [chatid](const std::shared_ptr<Slot>& slot) { return slot->chatid == chatid; }));
+
+    auto newTable = std::make_shared<Table>();
+    newTable->base = std::make_shared<const Part>(std::move(base));
+    std::atomic_store(&mTable, std::shared_ptr<const Table>(std::move(newTable)));
+}
+
+void ChatListSnapshot::clear()
+{
+    std::atomic_store(&mTable, std::make_shared<const Table>());
+    std::atomic_store(&mActivity, std::make_shared<const Activity>());
+}
+
+ChatListSnapshot::ActivityKey ChatListSnapshot::activityKeyOf(const MegaChatListItem& item)
+{
+    return ActivityKey{item.getLastTimestamp(), item.getChatId()};
+}
+
+std::vector<ChatListSnapshot::EntryPtr> ChatListSnapshot::page(Indexes indexes, const ActivityKey* after, size_t count) const
+{
+    // the order is loaded first, so the table has at least the chats in it
+    std::shared_ptr<const Activity> activity = std::atomic_load(&mActivity);
+    std::shared_ptr<const Table> table = std::atomic_load(&mTable);
+
+    auto itChunk = activity->begin();
+    if (after)
+    {
+        itChunk = std::upper_bound(activity->begin(), activity->end(), *after,
+                                   [](const ActivityKey& key, const std::shared_ptr<const Chunk>& chunk) { return key < chunk->back(); });
+    }
+
+    std::vector<EntryPtr> entries;
+    for (bool first = true; itChunk != activity->end() && entries.size() < count; ++itChunk, first = false)
+    {
+        const Chunk& chunk = **itChunk;
+        auto it = (after && first) ? std::upper_bound(chunk.begin(), chunk.end(), *after) : chunk.begin();
+        for (; it != chunk.end() && entries.size() < count; ++it)
+        {
+            auto found = findSlot(*table, it->chatid);
+            if (!found.first)
+            {
+                continue;   // removed after the order was loaded
+            }
+
+            EntryPtr entry = found.first->slots[found.second]->entry();
+            if ((entry->indexes & indexes) == indexes)
+            {
+                entries.push_back(std::move(entry));
+            }
+        }
+    }
+    return entries;
+}
+
+ChatListSnapshot::Activity::iterator ChatListSnapshot::chunkOf(Activity& activity, const ActivityKey& key)
+{
+    return std::lower_bound(activity.begin(), activity.end(), key,
+                            [](const std::shared_ptr<const Chunk>& chunk, const ActivityKey& k) { return chunk->back() < k; });
+}
+
+void ChatListSnapshot::updateActivity(const ActivityKey* oldKey, const ActivityKey* newKey)
+{
+    auto activity = std::make_shared<Activity>(*std::atomic_load(&mActivity));
+    if (oldKey)
+    {
+        auto it = chunkOf(*activity, *oldKey);
+        assert(it != activity->end());
+        auto chunk = std::make_shared<Chunk>(**it);
+        auto itKey = std::lower_bound(chunk->begin(), chunk->end(), *oldKey);
+        assert(itKey != chunk->end() && itKey->chatid == oldKey->chatid);
+        chunk->erase(itKey);
+
+        // merge small chunks with the next one, so updates don't end up copying many pointers
+        auto itNext = std::next(it);
+        if (chunk->size() < kMaxChunk / 4 && itNext != activity->end() && chunk->size() + (*itNext)->size() <= kMaxChunk)
+        {
+            chunk->insert(chunk->end(), (*itNext)->begin(), (*itNext)->end());
+            activity->erase(itNext);
+        }
+
+        if (chunk->empty())
+        {
+            activity->erase(it);
+        }
+        else
+        {
+            *it = std::move(chunk);
+        }
+    }
+
+    if (newKey)
+    {
+        auto it = chunkOf(*activity, *newKey);
+        if (it == activity->end() && it != activity->begin())
+        {
+            --it;   // goes after all the chats
+        }
+
+        if (it == activity->end())
+        {
+            activity->push_back(std::make_shared<const Chunk>(1, *newKey));
+        }
+        else
+        {
+            auto chunk = std::make_shared<Chunk>(**it);
+            chunk->insert(std::lower_bound(chunk->begin(), chunk->end(), *newKey), *newKey);
+            if (chunk->size() > kMaxChunk)
+            {
+                auto half = chunk->begin() + static_cast<std::ptrdiff_t>(chunk->size() / 2);
+                auto second = std::make_shared<const Chunk>(half, chunk->end());
+                chunk->erase(half, chunk->end());
+                *it = std::move(chunk);
+                activity->insert(std::next(it), std::move(second));
+            }
+            else
+            {
+                *it = std::move(chunk);
+            }
+        }
+    }
+
+    std::atomic_store(&mActivity, std::shared_ptr<const Activity>(std::move(activity)));
 }
 
 MegaChatRequestPrivate::MegaChatRequestPrivate(int type, MegaChatRequestListener *listener)
@@ -9698,7 +10370,151 @@ void MegaChatCallPrivate::setOnHold(bool onHold)
     mChanged |= MegaChatCall::CHANGE_TYPE_CALL_ON_HOLD;
 }
 
+MegaChatVideoBufferPool::Buffer MegaChatVideoBufferPool::getBuffer(size_t size)
+{
+    std::unique_ptr<::mega::byte[]> buffer;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (size != mBufferSize)
+        {
+            // resolution has changed, free buffers can't be reused anymore
+            mFreeBuffers.clear();
+            mBufferSize = size;
+        }
+        else if (!mFreeBuffers.empty())
+        {
+            buffer = std::move(mFreeBuffers.back());
+            mFreeBuffers.pop_back();
+        }
+    }
+
+    if (!buffer)
+    {
+        buffer.reset(new ::mega::byte[size]);
+    }
+
+    std::weak_ptr<MegaChatVideoBufferPool> wptr = weak_from_this();
+    return Buffer(buffer.release(), [wptr, size](::mega::byte* data)
+    {
+        std::shared_ptr<MegaChatVideoBufferPool> pool = wptr.lock();
+        if (pool)
+        {
+            pool->recycle(data, size);
+        }
+        else
+        {
+            delete [] data;
+        }
+    });
+}
+
+void MegaChatVideoBufferPool::trim()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFreeBuffers.clear();
+}
+
+void MegaChatVideoBufferPool::recycle(::mega::byte* buffer, size_t size)
+{
+    std::unique_ptr<::mega::byte[]> data(buffer);
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (size == mBufferSize && mFreeBuffers.size() < kMaxFreeBuffers)
+    {
+        mFreeBuffers.emplace_back(std::move(data));
+    }
+}
+
+MegaChatVideoFramePrivate::MegaChatVideoFramePrivate(MegaChatVideoBufferPool::Buffer buffer, int width, int height, int sourceType)
+    : mNumPlanes(1)
+    , mFormat(FORMAT_ARGB)
+    , mWidth(width)
+    , mHeight(height)
+    , mSourceType(sourceType)
+{
+    mPlanes[0] = buffer.get();
+    mStrides[0] = width * 4;
+    mOwner = std::move(buffer);
+}
+
+MegaChatVideoFramePrivate::MegaChatVideoFramePrivate(const rtcModule::VideoFramePlanes& planes, int sourceType)
+    : mOwner(planes.owner)
+    , mNumPlanes(planes.numPlanes)
+    , mFormat(planes.format == rtcModule::IVideoRenderer::kPixelFormatNv12 ? FORMAT_NV12 : FORMAT_I420)
+    , mWidth(planes.width)
+    , mHeight(planes.height)
+    , mSourceType(sourceType)
+{
+    assert(mNumPlanes > 0 && mNumPlanes <= 3);
+    for (int i = 0; i < mNumPlanes; i++)
+    {
+        mPlanes[i] = planes.data[i];
+        mStrides[i] = planes.stride[i];
+    }
+}
+
+MegaChatVideoFrame* MegaChatVideoFramePrivate::copy() const
+{
+    return new MegaChatVideoFramePrivate(*this);
+}
+
+int MegaChatVideoFramePrivate::getWidth() const
+{
+    return mWidth;
+}
+
+int MegaChatVideoFramePrivate::getHeight() const
+{
+    return mHeight;
+}
+
+int MegaChatVideoFramePrivate::getFormat() const
+{
+    return mFormat;
+}
+
+char* MegaChatVideoFramePrivate::getBuffer() const
+{
+    // the ARGB buffer belongs to the pool of the receiver (YUV planes belong to webrtc)
+    return mFormat == FORMAT_ARGB ? reinterpret_cast<char*>(const_cast<::mega::byte*>(mPlanes[0])) : nullptr;
+}
+
+size_t MegaChatVideoFramePrivate::getSize() const
+{
+    return mFormat == FORMAT_ARGB ? static_cast<size_t>(mWidth) * static_cast<size_t>(mHeight) * 4 : 0;
+}
+
+int MegaChatVideoFramePrivate::getNumPlanes() const
+{
+    return mNumPlanes;
+}
+
+const char* MegaChatVideoFramePrivate::getPlane(int index) const
+{
+    return index >= 0 && index < mNumPlanes ? reinterpret_cast<const char*>(mPlanes[index]) : nullptr;
+}
+
+int MegaChatVideoFramePrivate::getStride(int index) const
+{
+    return index >= 0 && index < mNumPlanes ? mStrides[index] : 0;
+}
+
+int MegaChatVideoFramePrivate::getSourceType() const
+{
+    return mSourceType;
+}
+
+int MegaChatVideoFramePrivate::toPixelFormat(int format)
+{
+    switch (format)
+    {
+        case FORMAT_I420: return rtcModule::IVideoRenderer::kPixelFormatI420;
+        case FORMAT_NV12: return rtcModule::IVideoRenderer::kPixelFormatNv12;
+        default:          return rtcModule::IVideoRenderer::kPixelFormatArgb;
+    }
+}
+
 MegaChatVideoReceiver::MegaChatVideoReceiver(MegaChatApiImpl *chatApi, const karere::Id& chatid, rtcModule::VideoResolution videoResolution, uint32_t clientId)
+    : mBufferPool(std::make_shared<MegaChatVideoBufferPool>())
 {
     mChatApi = chatApi;
     mChatid = chatid;
@@ -9712,23 +10528,32 @@ MegaChatVideoReceiver::~MegaChatVideoReceiver()
 
 void* MegaChatVideoReceiver::getImageBuffer(unsigned short width, unsigned short height, int sourceType, void*& userData)
 {
-    MegaChatVideoFrame *frame = new MegaChatVideoFrame;
-    frame->width = width;
-    frame->height = height;
-    frame->sourceType = sourceType;
-    frame->buffer = new ::mega::byte[width * height * 4];  // in format ARGB: 4 bytes per pixel
+    size_t size = static_cast<size_t>(width) * height * 4;  // in format ARGB: 4 bytes per pixel
+    MegaChatVideoFramePrivate *frame = new MegaChatVideoFramePrivate(mBufferPool->getBuffer(size), width, height, sourceType);
     userData = frame;
-    return frame->buffer;
+    return frame->getBuffer();
 }
 
 void MegaChatVideoReceiver::frameComplete(void *userData)
 {
     mChatApi->videoMutex.lock();
-    MegaChatVideoFrame *frame = (MegaChatVideoFrame *)userData;
-    mChatApi->fireOnChatVideoData(mChatid, mClientId, frame->width, frame->height, frame->sourceType, (char *)frame->buffer, mClientId ? mVideoResolution : rtcModule::VideoResolution::kHiRes);
+    MegaChatVideoFramePrivate *frame = static_cast<MegaChatVideoFramePrivate *>(userData);
+    mChatApi->fireOnChatVideoData(mChatid, mClientId, frame, mClientId ? mVideoResolution : rtcModule::VideoResolution::kHiRes);
     mChatApi->videoMutex.unlock();
-    delete [] frame->buffer;
-    delete frame;
+    delete frame;   // the buffer returns to the pool unless the app kept a copy of the frame
+}
+
+int MegaChatVideoReceiver::getPixelFormats(int sourceType)
+{
+    std::lock_guard<std::recursive_mutex> g(mChatApi->videoMutex);
+    return mChatApi->getVideoListenersFormats(mChatid, mClientId, sourceType, mClientId ? mVideoResolution : rtcModule::VideoResolution::kHiRes);
+}
+
+void MegaChatVideoReceiver::framePlanesComplete(const rtcModule::VideoFramePlanes& planes, int sourceType)
+{
+    MegaChatVideoFramePrivate frame(planes, sourceType);
+    std::lock_guard<std::recursive_mutex> g(mChatApi->videoMutex);
+    mChatApi->fireOnChatVideoData(mChatid, mClientId, &frame, mClientId ? mVideoResolution : rtcModule::VideoResolution::kHiRes);
 }
 
 void MegaChatVideoReceiver::onVideoAttach()
@@ -9737,6 +10562,7 @@ void MegaChatVideoReceiver::onVideoAttach()
 
 void MegaChatVideoReceiver::onVideoDetach()
 {
+    mBufferPool->trim();
 }
 
 void MegaChatVideoReceiver::clearViewport()
@@ -9772,6 +10598,7 @@ void MegaChatRoomHandler::removeChatRoomListener(MegaChatRoomListener *listener)
 
 void MegaChatRoomHandler::fireOnChatRoomUpdate(MegaChatRoom *chat)
 {
+    flushMessageUpdates();
     for(set<MegaChatRoomListener *>::iterator it = roomListeners.begin(); it != roomListeners.end() ; it++)
     {
         (*it)->onChatRoomUpdate(mChatApi, chat);
@@ -9782,6 +10609,7 @@ void MegaChatRoomHandler::fireOnChatRoomUpdate(MegaChatRoom *chat)
 
 void MegaChatRoomHandler::fireOnMessageLoaded(MegaChatMessage *msg)
 {
+    flushMessageUpdates();
     for(set<MegaChatRoomListener *>::iterator it = roomListeners.begin(); it != roomListeners.end(); it++)
     {
         (*it)->onMessageLoaded(mChatApi, msg);
@@ -9792,6 +10620,7 @@ void MegaChatRoomHandler::fireOnMessageLoaded(MegaChatMessage *msg)
 
 void MegaChatRoomHandler::fireOnHistoryTruncatedByRetentionTime(MegaChatMessage *msg)
 {
+    flushMessageUpdates();
     for(set<MegaChatRoomListener *>::iterator it = roomListeners.begin(); it != roomListeners.end() ; it++)
     {
         (*it)->onHistoryTruncatedByRetentionTime(mChatApi, msg);
@@ -9802,6 +10631,7 @@ void MegaChatRoomHandler::fireOnHistoryTruncatedByRetentionTime(MegaChatMessage
 
 void MegaChatRoomHandler::fireOnMessageReceived(MegaChatMessage *msg)
 {
+    flushMessageUpdates();
     for(set<MegaChatRoomListener *>::iterator it = roomListeners.begin(); it != roomListeners.end() ; it++)
     {
         (*it)->onMessageReceived(mChatApi, msg);
@@ -9812,6 +10642,7 @@ void MegaChatRoomHandler::fireOnMessageReceived(MegaChatMessage *msg)
 
 void MegaChatRoomHandler::fireOnReactionUpdate(MegaChatHandle msgid, const char *reaction, int count)
 {
+    flushMessageUpdates();
     for (set<MegaChatRoomListener *>::iterator it = roomListeners.begin(); it != roomListeners.end(); it++)
     {
         (*it)->onReactionUpdate(mChatApi, msgid, reaction, count);
@@ -9819,6 +10650,20 @@ void MegaChatRoomHandler::fireOnReactionUpdate(MegaChatHandle msgid, const char
 }
 
 void MegaChatRoomHandler::fireOnMessageUpdate(MegaChatMessage *msg)
+{
+    // messages being sent are identified by their temporal id until they are confirmed
+    if (mChatApiImpl->isCoalescingNotifications()
+            && msg->getMsgId() != MEGACHAT_INVALID_HANDLE && msg->getTempId() == MEGACHAT_INVALID_HANDLE)
+    {
+        holdMessageUpdate(static_cast<MegaChatMessagePrivate *>(msg));
+        return;
+    }
+
+    flushMessageUpdates();
+    notifyMessageUpdate(msg);
+}
+
+void MegaChatRoomHandler::notifyMessageUpdate(MegaChatMessage *msg)
 {
     for(set<MegaChatRoomListener *>::iterator it = roomListeners.begin(); it != roomListeners.end() ; it++)
     {
@@ -9828,8 +10673,71 @@ void MegaChatRoomHandler::fireOnMessageUpdate(MegaChatMessage *msg)
     delete msg;
 }
 
+void MegaChatRoomHandler::holdMessageUpdate(MegaChatMessagePrivate *msg)
+{
+    std::unique_ptr<MegaChatMessagePrivate> held(msg);
+    auto it = mHeldUpdatePos.find(held->getMsgId());
+    if (it != mHeldUpdatePos.end())
+    {
+        held->mergeChanges(*mHeldUpdates[it->second].msg);
+        mHeldUpdates[it->second].msg = std::move(held);
+        return;
+    }
+
+    mHeldUpdatePos[held->getMsgId()] = mHeldUpdates.size();
+    mHeldUpdates.emplace_back();
+    mHeldUpdates.back().msg = std::move(held);
+    mChatApiImpl->onMessageUpdatesHeld(mChatid);
+}
+
+void MegaChatRoomHandler::holdMessageSeen(const Message &msg, Idx idx)
+{
+    if (!mHeldUpdates.empty() && mHeldUpdates.back().seenCount)
+    {
+        // seen messages are notified in order, so the range only has to be extended
+        mHeldUpdates.back().newestSeen = msg.id();
+        mHeldUpdates.back().seenCount++;
+        return;
+    }
+
+    HeldUpdate range;
+    range.msg.reset(new MegaChatMessagePrivate(msg, Message::kSeen, idx));
+    range.msg->setStatus(Message::kSeen);
+    range.newestSeen = msg.id();
+    range.seenCount = 1;
+    mHeldUpdates.push_back(std::move(range));
+    mChatApiImpl->onMessageUpdatesHeld(mChatid);
+}
+
+void MegaChatRoomHandler::flushMessageUpdates()
+{
+    if (mHeldUpdates.empty())
+    {
+        return;
+    }
+
+    std::vector<HeldUpdate> updates;
+    updates.swap(mHeldUpdates);
+    mHeldUpdatePos.clear();
+    for (HeldUpdate& update : updates)
+    {
+        if (update.seenCount > 1)
+        {
+            for (set<MegaChatRoomListener *>::iterator it = roomListeners.begin(); it != roomListeners.end(); it++)
+            {
+                (*it)->onMessagesSeen(mChatApi, update.msg->getMsgId(), update.newestSeen, update.seenCount);
+            }
+        }
+        else
+        {
+            notifyMessageUpdate(update.msg.release());
+        }
+    }
+}
+
 void MegaChatRoomHandler::fireOnHistoryReloaded(MegaChatRoom *chat)
 {
+    flushMessageUpdates();
     for(set<MegaChatRoomListener *>::iterator it = roomListeners.begin(); it != roomListeners.end() ; it++)
     {
         (*it)->onHistoryReloaded(mChatApi, chat);
@@ -10153,9 +11061,16 @@ void MegaChatRoomHandler::onMessageRejected(const Message &msg, uint8_t reason)
 
 void MegaChatRoomHandler::onMessageStatusChange(Idx idx, Message::Status status, const Message &msg)
 {
-    MegaChatMessagePrivate *message = new MegaChatMessagePrivate(msg, status, idx);
-    message->setStatus(status);
-    fireOnMessageUpdate(message);
+    if (status == chatd::Message::kSeen && mChatApiImpl->isCoalescingNotifications())
+    {
+        holdMessageSeen(msg, idx);
+    }
+    else
+    {
+        MegaChatMessagePrivate *message = new MegaChatMessagePrivate(msg, status, idx);
+        message->setStatus(status);
+        fireOnMessageUpdate(message);
+    }
 
     if (mMegaApi->isChatNotifiable(mChatid)
             && msg.userid != mChatApi->getMyUserHandle()
@@ -10891,11 +11806,11 @@ MegaChatRoomPrivate::MegaChatRoomPrivate(const ChatRoom &chat)
     assert(!chat.previewMode() || (chat.previewMode() && mAuthToken.isValid()));
     mTitle = chat.titleString();
     mHasCustomTitle = chat.isGroup() ? ((GroupChatRoom*)&chat)->hasTitle() : false;
-    unreadCount = chat.chat().unreadMsgCount();
+    unreadCount = chat.unreadMsgCount();
     active = chat.isActive();
     mArchived = chat.isArchived();
     mUh = MEGACHAT_INVALID_HANDLE;
-    mNumPreviewers = chat.chat().getNumPreviewers();
+    mNumPreviewers = chat.getNumPreviewers();
     mRetentionTime = chat.getRetentionTime();
     mCreationTs = chat.getCreationTs();
     mMeeting = chat.isMeeting();
@@ -11330,12 +12245,17 @@ MegaChatListItemHandler::MegaChatListItemHandler(MegaChatApiImpl &chatApi, ChatR
 {
 }
 
+MegaChatHandle MegaChatListItemHandler::getChatId() const
+{
+    return mRoom.chatid();
+}
+
 MegaChatListItemPrivate::MegaChatListItemPrivate(ChatRoom &chatroom)
     : MegaChatListItem()
 {
     chatid = chatroom.chatid();
     mTitle = chatroom.titleString();
-    unreadCount = chatroom.chat().unreadMsgCount();
+    unreadCount = chatroom.unreadMsgCount();
     group = chatroom.isGroup();
     mPublicChat = chatroom.publicChat();
     mPreviewMode = chatroom.previewMode();
@@ -11354,7 +12274,7 @@ MegaChatListItemPrivate::MegaChatListItemPrivate(ChatRoom &chatroom)
     LastTextMsg tmp;
     LastTextMsg *message = &tmp;
     LastTextMsg *&msg = message;
-    uint8_t lastMsgStatus = chatroom.chat().lastTextMessage(msg);
+    uint8_t lastMsgStatus = chatroom.lastTextMessage(msg);
     if (lastMsgStatus == LastTextMsgState::kHave)
     {
         lastMsgSender = msg->sender();
@@ -11430,7 +12350,7 @@ MegaChatListItemPrivate::MegaChatListItemPrivate(ChatRoom &chatroom)
         mLastMsgId = MEGACHAT_INVALID_HANDLE;
     }
 
-    lastTs = chatroom.chat().lastMessageTs();
+    lastTs = chatroom.lastMessageTs();
 }
 
 MegaChatListItemPrivate::MegaChatListItemPrivate(const MegaChatListItem *item)
@@ -11660,6 +12580,17 @@ void MegaChatListItemPrivate::setChatMode(bool mode)
     mChanged |= MegaChatListItem::CHANGE_TYPE_CHAT_MODE;
 }
 
+void MegaChatListItemPrivate::removeChanges()
+{
+    mChanged = 0;
+}
+
+void MegaChatListItemPrivate::mergeChanges(const MegaChatListItemPrivate& older)
+{
+    mChanged |= older.mChanged;
+    mDeleted |= older.mDeleted;    // not part of the state of the chatroom
+}
+
 MegaChatGroupListItemHandler::MegaChatGroupListItemHandler(MegaChatApiImpl &chatApi, ChatRoom &room)
     : MegaChatListItemHandler(chatApi, room)
 {
@@ -11668,6 +12599,7 @@ MegaChatGroupListItemHandler::MegaChatGroupListItemHandler(MegaChatApiImpl &chat
 
 void MegaChatGroupListItemHandler::onUserJoin(uint64_t userid, Priv priv)
 {
+    chatApi.markChatListItemStale(mRoom.chatid());
     bool ownChange = (userid == chatApi.getMyUserHandle());
 
     // avoid to notify if own user doesn't participate or isn't online and it's a public chat (for large chat-links, for performance)
@@ -11691,6 +12623,7 @@ void MegaChatGroupListItemHandler::onUserJoin(uint64_t userid, Priv priv)
 
 void MegaChatGroupListItemHandler::onUserLeave(uint64_t )
 {
+    chatApi.markChatListItemStale(mRoom.chatid());
     if (mRoom.publicChat() && mRoom.chat().getOwnprivilege() == chatd::Priv::PRIV_RM)
     {
         return;
@@ -11743,6 +12676,11 @@ void MegaChatListItemHandler::onChatArchived(bool archived)
     chatApi.fireOnChatListItemUpdate(item);
 }
 
+void MegaChatListItemHandler::onChatdChatCreated()
+{
+    chatApi.markChatListItemStale(mRoom.chatid());
+}
+
 void MegaChatListItemHandler::onChatDeleted() const
 {
     MegaChatListItemPrivate *item = new MegaChatListItemPrivate(mRoom);
@@ -12151,6 +13089,11 @@ void MegaChatMessagePrivate::setTsUpdated()
     changed |= MegaChatMessage::CHANGE_TYPE_TIMESTAMP;
 }
 
+void MegaChatMessagePrivate::mergeChanges(const MegaChatMessagePrivate& older)
+{
+    changed |= older.changed;
+}
+
 int MegaChatMessagePrivate::convertEndCallTermCodeToUI(const Message::CallEndedInfo  &callEndInfo)
 {
     int code;
@@ -12703,24 +13646,11 @@ MegaChatListItemListPrivate::MegaChatListItemListPrivate()
 
 MegaChatListItemListPrivate::~MegaChatListItemListPrivate()
 {
-    for (unsigned int i = 0; i < mList.size(); i++)
-    {
-        delete mList[i];
-        mList[i] = NULL;
-    }
-
-    mList.clear();
 }
 
 MegaChatListItemListPrivate::MegaChatListItemListPrivate(const MegaChatListItemListPrivate *list)
+    : mList(list->mList)
 {
-    MegaChatListItemPrivate *item;
-
-    for (unsigned int i = 0; i < list->size(); i++)
-    {
-        item = new MegaChatListItemPrivate(list->get(i));
-        mList.push_back(item);
-    }
 }
 
 MegaChatListItemListPrivate *MegaChatListItemListPrivate::copy() const
@@ -12736,7 +13666,7 @@ const MegaChatListItem *MegaChatListItemListPrivate::get(unsigned int i) const
     }
     else
     {
-        return mList.at(i);
+        return mList.at(i).get();
     }
 }
 
@@ -12747,7 +13677,12 @@ unsigned int MegaChatListItemListPrivate::size() const
 
 void MegaChatListItemListPrivate::addChatListItem(MegaChatListItem *item)
 {
-    mList.push_back(item);
+    mList.emplace_back(item);
+}
+
+void MegaChatListItemListPrivate::addChatListItem(std::shared_ptr<const MegaChatListItem> item)
+{
+    mList.push_back(std::move(item));
 }
 
 MegaChatPresenceConfigPrivate::MegaChatPresenceConfigPrivate(const MegaChatPresenceConfigPrivate &config)
@@ -39,13 +39,18 @@
 
 #include <chatClient.h>
 #include <chatd.h>
+#include <base/sdkMutex.h>
 #include <sdkApi.h>
 #include <karereCommon.h>
 #include <logger.h>
 #include <stdint.h>
 #include "net/libwebsocketsIO.h"
 #include "waiter/libuvWaiter.h"
+#include <atomic>
 #include <bitset>
+#include <chrono>
+#include <memory>
+#include <thread>
 
 #ifdef _WIN32
 #pragma warning(push)
@@ -65,8 +70,9 @@ typedef ::mega::LibuvWaiter MegaChatWaiter;
 namespace megachat
 {
 
-typedef std::set<MegaChatVideoListener *> MegaChatVideoListener_set;
-typedef std::map<Cid_t, MegaChatVideoListener_set> MegaChatPeerVideoListener_map;
+// video listener -> pixel format of its frames (MegaChatVideoFrame::FORMAT_*)
+typedef std::map<MegaChatVideoListener *, int> MegaChatVideoListener_map;
+typedef std::map<Cid_t, MegaChatVideoListener_map> MegaChatPeerVideoListener_map;
 
 #ifdef _WIN32
 #pragma warning(push)
@@ -425,13 +431,62 @@ private:
     std::unique_ptr<rtcModule::KarereWaitingRoom> mWaitingRoomUsers;
 };
 
-class MegaChatVideoFrame
+/**
+ * @brief Pool of ARGB frame buffers of a video track
+ *
+ * Buffers are recycled while the resolution doesn't change. When it changes, the free buffers
+ * of the previous resolution are released. Buffers still referenced by frames kept by the app
+ * are freed when their last reference is deleted, even if the pool has been destroyed.
+ */
+class MegaChatVideoBufferPool : public std::enable_shared_from_this<MegaChatVideoBufferPool>
+{
+public:
+    typedef std::shared_ptr<::mega::byte> Buffer;
+
+    // free buffers kept for reuse (frames being rendered + frames kept by the app)
+    static constexpr size_t kMaxFreeBuffers = 3;
+
+    Buffer getBuffer(size_t size);
+    void trim();
+
+private:
+    void recycle(::mega::byte* buffer, size_t size);
+
+    std::mutex mMutex;
+    size_t mBufferSize = 0;
+    std::vector<std::unique_ptr<::mega::byte[]>> mFreeBuffers;
+};
+
+class MegaChatVideoFramePrivate : public MegaChatVideoFrame
 {
 public:
-    unsigned char *buffer;
-    int width;
-    int height;
-    int sourceType;
+    // ARGB frame
+    MegaChatVideoFramePrivate(MegaChatVideoBufferPool::Buffer buffer, int width, int height, int sourceType);
+    // YUV frame, it references the planes of the decoded image
+    MegaChatVideoFramePrivate(const rtcModule::VideoFramePlanes& planes, int sourceType);
+
+    MegaChatVideoFrame* copy() const override;
+    int getWidth() const override;
+    int getHeight() const override;
+    int getFormat() const override;
+    char* getBuffer() const override;
+    size_t getSize() const override;
+    int getNumPlanes() const override;
+    const char* getPlane(int index) const override;
+    int getStride(int index) const override;
+    int getSourceType() const;
+
+    static int toPixelFormat(int format);
+
+private:
+    std::shared_ptr<const void> mOwner;
+    const ::mega::byte* mPlanes[3] = {};
+    int mStrides[3] = {};
+    int mNumPlanes = 0;
+    int mFormat;
+    int mWidth;
+    int mHeight;
+    int mSourceType;
 };
 
 class MegaChatVideoReceiver : public rtcModule::IVideoRenderer
@@ -447,6 +502,8 @@ public:
     // rtcModule::IVideoRenderer implementation
     virtual void* getImageBuffer(unsigned short width, unsigned short height, int sourceType, void*& userData);
     virtual void frameComplete(void* userData);
+    virtual int getPixelFormats(int sourceType);
+    virtual void framePlanesComplete(const rtcModule::VideoFramePlanes& planes, int sourceType);
     virtual void onVideoAttach();
     virtual void onVideoDetach();
     virtual void clearViewport();
@@ -457,6 +514,7 @@ protected:
     MegaChatHandle mChatid;
     rtcModule::VideoResolution mVideoResolution;
     uint32_t mClientId;
+    std::shared_ptr<MegaChatVideoBufferPool> mBufferPool;
 };
 
 #endif
@@ -543,12 +601,17 @@ public:
      */
     void setLastMessage();
     void setChatMode(bool mode);
+    void removeChanges();
+
+    // Adds the changes of an older update of the chat, since this one has the latest state
+    void mergeChanges(const MegaChatListItemPrivate& older);
 };
 
 class MegaChatListItemHandler :public virtual karere::IApp::IChatListItem
 {
 public:
     MegaChatListItemHandler(MegaChatApiImpl&, karere::ChatRoom&);
+    MegaChatHandle getChatId() const;
 
     // karere::IApp::IListItem::ITitleHandler implementation
     void onTitleChanged(const std::string& title) override;
@@ -565,6 +628,7 @@ public:
     void onChatDeleted() const override;
     void onPreviewersCountUpdate(uint32_t numPrev) override;
     void onPreviewClosed() override;
+    void onChatdChatCreated() override;
 
 protected:
     MegaChatApiImpl &chatApi;
@@ -591,6 +655,8 @@ public:
     MegaChatPeerListItemHandler(MegaChatApiImpl &, karere::ChatRoom&);
 };
 
+class MegaChatMessagePrivate;
+
 class MegaChatRoomHandler :public karere::IApp::IChatHandler
 {
 public:
@@ -607,6 +673,10 @@ public:
     void fireOnMessageUpdate(MegaChatMessage *msg);
     void fireOnHistoryReloaded(MegaChatRoom *chat);
     void fireOnReactionUpdate(MegaChatHandle msgid, const char *reaction, int count);
+
+    // Fires the updates of messages held while coalescing notifications
+    void flushMessageUpdates();
+
     // karere::IApp::IChatHandler implementation
     virtual void onMemberNameChanged(uint64_t userid, const std::string &newName) override;
     virtual void onChatArchived(bool archived) override;
@@ -674,6 +744,20 @@ private:
     // nodes with granted/revoked access from loaded messsages
     std::map<MegaChatHandle, bool> attachmentsAccess;  // handle, access
     std::map<MegaChatHandle, std::set<MegaChatHandle>> attachmentsIds;    // nodehandle, msgids
+
+    // Updates of messages held while coalescing notifications, in order of arrival. Messages that
+    // change to seen one after another are held as a range
+    struct HeldUpdate
+    {
+        std::unique_ptr<MegaChatMessagePrivate> msg;            // the oldest message, for a range
+        MegaChatHandle newestSeen = MEGACHAT_INVALID_HANDLE;    // only for a range
+        unsigned int seenCount = 0;                             // 0 if it's not a range
+    };
+    std::vector<HeldUpdate> mHeldUpdates;
+    std::map<MegaChatHandle, size_t> mHeldUpdatePos;    // msgid -> position in mHeldUpdates, except ranges
+    void holdMessageUpdate(MegaChatMessagePrivate *msg);
+    void holdMessageSeen(const chatd::Message &msg, chatd::Idx idx);
+    void notifyMessageUpdate(MegaChatMessage *msg);
 };
 
 class MegaChatNodeHistoryHandler : public chatd::FilteredHistoryHandler
@@ -848,10 +932,11 @@ public:
     virtual unsigned int size() const;
 
     void addChatListItem(MegaChatListItem*);
+    void addChatListItem(std::shared_ptr<const MegaChatListItem> item);
 
 private:
     MegaChatListItemListPrivate(const MegaChatListItemListPrivate *list);
-    std::vector<MegaChatListItem*> mList;
+    std::vector<std::shared_ptr<const MegaChatListItem>> mList;   // items are immutable, so they can be shared
 };
 
 class MegaChatRoomPrivate : public MegaChatRoom
@@ -1251,6 +1336,9 @@ public:
     void setAccess();
     void setTsUpdated();
 
+    // Adds the changes of an older update of the message, since this one has the latest state
+    void mergeChanges(const MegaChatMessagePrivate& older);
+
     static int convertEndCallTermCodeToUI(const chatd::Message::CallEndedInfo &callEndInfo);
 
 private:
@@ -1297,21 +1385,185 @@ class ChatRequestQueue
         void removeListener(MegaChatRequestListener *listener);
 };
 
-//Thread safe transfer queue
+// Thread safe queue of marshalled calls: lock-free, multiple producers and a single consumer
+// (the karere thread). The messages are linked through megaMessage::next, so no allocation
+// or locking is needed to post a message
 class EventQueue
 {
 protected:
-    std::deque<megaMessage*> events;
-    std::mutex mutex;
+    std::atomic<megaMessage*> mHead;    // last pushed message (producers)
+    megaMessage* mTail;                 // next message to pop (consumer)
+    megaMessage mStub;                  // placeholder that keeps the list non-empty
+    std::atomic<int64_t> mSize{0};      // incremented after a message is linked, so it may be transiently negative
+
+    void link(megaMessage* event);
 
 public:
-    void push(megaMessage* event);
-    void push_front(megaMessage* event);
+    EventQueue();
+    EventQueue(const EventQueue&) = delete;
+    EventQueue& operator=(const EventQueue&) = delete;
+
+    // Returns true if the queue was empty, so the consumer has to be woken up
+    bool push(megaMessage* event);
+
+    // Must be called only from the consumer thread. It may return NULL while size() is not zero,
+    // if a producer is in the middle of a push()
     megaMessage *pop();
     bool isEmpty();
     size_t size();
 };
 
+// Copy of the chat list items that app threads can read without taking the sdkMutex.
+// The karere thread replaces the entry of a chat as soon as a change of its list item is
+// notified, so readers see the same state than the MegaChatListener. Entries are replaced
+// atomically, while the set of chats is copied on write when a chat is added or removed.
+// New chats are kept apart until there are kMaxRecent of them, so loading the chat list
+// doesn't copy the whole set for every chat added.
+// For every value of every filter of MegaChatApi::getChatListItems(mask, filter), a bitset
+// indexes the chats that match it, so a filtered listing doesn't need to visit every chat
+class ChatListSnapshot
+{
+public:
+    typedef std::shared_ptr<const std::vector<MegaChatHandle>> Peers;   // sorted, empty for 1on1 chats
+
+    // Index of the chats matching the value \c v of the filter at bit \c b of the mask
+    // (MegaChatApi::CHAT_FILTER_BY_*) is 2 * b + v
+    static constexpr unsigned kNumFilters = 6;
+    static constexpr unsigned kNumIndexes = 2 * kNumFilters;
+    typedef uint16_t Indexes;   // bitmask of indexes
+
+    struct Entry
+    {
+        Entry(const MegaChatListItem& aItem, Peers aPeers);
+        static Peers peersOf(const karere::ChatRoom& room);
+
+        MegaChatListItemPrivate item;   // with no changes, it's shared by the lists returned to the app
+        Peers peers;
+        Indexes indexes;                // indexes the chat belongs to
+    };
+    typedef std::shared_ptr<const Entry> EntryPtr;
+
+    class Slot
+    {
+    public:
+        explicit Slot(MegaChatHandle aChatid) : chatid(aChatid) {}
+        EntryPtr entry() const { return std::atomic_load(&mEntry); }
+        void setEntry(EntryPtr entry) { std::atomic_store(&mEntry, std::move(entry)); }
+
+        const MegaChatHandle chatid;
+
+    private:
+        EntryPtr mEntry;
+    };
+    typedef std::vector<std::shared_ptr<Slot>> Slots;   // sorted by chatid
+
+    static bool isOfType(const MegaChatListItem& item, int type);
+    static Indexes indexesOf(const MegaChatListItem& item);
+    static Indexes indexesOf(int mask, int filter);
+
+    // Returns the name of the first property that differs between the items, or NULL if they're equal
+    static const char* differingProperty(const MegaChatListItem& a, const MegaChatListItem& b);
+
+    // Returns the item of the entry, sharing its ownership
+    static std::shared_ptr<const MegaChatListItem> itemOf(const EntryPtr& entry);
+
+    // Can be called from any thread. Visits in order of chatid the entries that belong
+    // to all the \c indexes (all of them if it's zero)
+    template <typename F>
+    void forEach(Indexes indexes, F&& f) const
+    {
+        std::shared_ptr<const Table> table = std::atomic_load(&mTable);
+        std::vector<size_t> base = table->base->find(indexes);
+        std::vector<size_t> recent = table->recent->find(indexes);
+        auto it = base.begin();
+        auto itRecent = recent.begin();
+        while (it != base.end() || itRecent != recent.end())
+        {
+            const Slot* slot;
+            if (itRecent == recent.end()
+                    || (it != base.end() && table->base->slots[*it]->chatid < table->recent->slots[*itRecent]->chatid))
+            {
+                slot = table->base->slots[*it++].get();
+            }
+            else
+            {
+                slot = table->recent->slots[*itRecent++].get();
+            }
+
+            // the bits of an index may be updated after the entry was replaced
+            EntryPtr entry = slot->entry();
+            if ((entry->indexes & indexes) == indexes)
+            {
+                f(entry);
+            }
+        }
+    }
+    EntryPtr find(MegaChatHandle chatid) const;
+    size_t size() const;
+
+    // Position of a chat in the order of last activity: the most recent first, then by chatid
+    struct ActivityKey
+    {
+        int64_t ts;
+        MegaChatHandle chatid;
+        bool operator<(const ActivityKey& other) const
+        {
+            return ts > other.ts || (ts == other.ts && chatid < other.chatid);
+        }
+    };
+    static ActivityKey activityKeyOf(const MegaChatListItem& item);
+
+    // Can be called from any thread. Returns, in order of last activity, up to \c count entries
+    // that belong to all the \c indexes, following the position \c after (from the start if null)
+    std::vector<EntryPtr> page(Indexes indexes, const ActivityKey* after, size_t count) const;
+
+    // Must be called from the karere thread only
+    void update(const MegaChatListItem& item);
+    void updatePeers(MegaChatHandle chatid, Peers peers);
+    void remove(MegaChatHandle chatid);
+    void clear();
+
+private:
+    static constexpr size_t kMaxRecent = 64;
+
+    // A sorted set of chats and its indexes. The set is never modified, but the bits of the
+    // indexes are updated when an entry changes
+    struct Part
+    {
+        explicit Part(Slots aSlots = Slots());
+        std::vector<size_t> find(Indexes indexes) const;
+        void setIndexes(size_t pos, Indexes oldIndexes, Indexes newIndexes) const;
+        Slots::const_iterator lowerBound(MegaChatHandle chatid) const;
+
+        const Slots slots;
+        const size_t words;
+        std::unique_ptr<std::atomic<uint64_t>[]> bits;  // kNumIndexes blocks of words
+    };
+
+    struct Table
+    {
+        std::shared_ptr<const Part> base = std::make_shared<const Part>();
+        std::shared_ptr<const Part> recent = std::make_shared<const Part>();   // chats added after base was built
+    };
+    std::shared_ptr<const Table> mTable = std::make_shared<const Table>();  // accessed with std::atomic_load/store
+
+    // Returns the part and position of the chat, if found
+    static std::pair<const Part*, size_t> findSlot(const Table& table, MegaChatHandle chatid);
+
+    // Order of last activity, split in chunks so an update copies a chunk and the pointers to
+    // the chunks, instead of all the keys
+    static constexpr size_t kMaxChunk = 128;
+    typedef std::vector<ActivityKey> Chunk;                         // sorted, never empty
+    typedef std::vector<std::shared_ptr<const Chunk>> Activity;     // sorted
+    std::shared_ptr<const Activity> mActivity = std::make_shared<const Activity>();  // accessed with std::atomic_load/store
+
+    // Returns the first chunk that may contain the key, or the end if it goes after all of them
+    static Activity::iterator chunkOf(Activity& activity, const ActivityKey& key);
+    void updateActivity(const ActivityKey* oldKey, const ActivityKey* newKey);
+};
+
+using karere::SdkMutex;
+
 class MegaChatApiImpl :
         public karere::IApp,
         public karere::IApp::IChatListHandler
@@ -1321,22 +1573,63 @@ public:
     MegaChatApiImpl(MegaChatApi *chatApi, mega::MegaApi *megaApi);
     virtual ~MegaChatApiImpl();
 
-    using SdkMutexGuard = std::unique_lock<std::recursive_mutex>;   // (equivalent to typedef)
-    mutable std::recursive_mutex sdkMutex;
+    using SdkMutexGuard = std::unique_lock<SdkMutex>;   // (equivalent to typedef)
+    mutable SdkMutex sdkMutex;
     std::recursive_mutex videoMutex;
     mega::Waiter *waiter;
+    karere::TimerWheel *timerWheel = nullptr;
 private:
     MegaChatApi *mChatApi;
     mega::MegaApi *mMegaApi;
     WebsocketsIO* mWebsocketsIO{nullptr};
     karere::Client *mClient;
     bool mTerminating;
+    bool mDbGroupCommit = false;
+    bool mLazyChatInit = false;
+    unsigned int mHistoryBudgetPerChat = 0;
+    unsigned int mHistoryBudgetTotal = 0;
+
+    // Notifications held to merge the updates of the same item (see MegaChatApi::setNotificationCoalescing)
+    bool mCoalesceNotifications = false;
+    unsigned int mCoalescingWindowMs = 0;
+    megaHandle mCoalescingTimer = 0;
+    std::vector<std::unique_ptr<MegaChatListItemPrivate>> mHeldChatListItems;  // in order of first update
+    std::map<MegaChatHandle, size_t> mHeldChatListItemPos;                      // chatid -> position in mHeldChatListItems
+    std::set<MegaChatHandle> mChatsWithHeldUpdates;                              // chats whose handler holds message updates
+    void scheduleHeldNotifications();
+    void flushChatListItemUpdates();     // before any other MegaChatListener callback, to keep the order
+    void flushHeldNotifications();
+    void notifyChatListItemUpdate(MegaChatListItem *item);
 
     mega::MegaThread thread;
     std::promise<void> mThreadSpecificInit;
     int threadExit;
+    std::thread::id mKarereThreadId;
     static void *threadEntryPoint(void *param);
     void loop();
+    bool isKarereThread() const;
+
+    // Health of the karere loop, to detect when it's backed up
+    struct LoopStats
+    {
+        size_t iterations = 0;
+        size_t events = 0;
+        size_t maxQueueDepth = 0;
+        std::chrono::steady_clock::duration maxIterationTime{};
+        std::chrono::steady_clock::time_point lastReport = std::chrono::steady_clock::now();
+    };
+    LoopStats mLoopStats;
+    void updateLoopStats(size_t queueDepth, std::chrono::steady_clock::duration elapsed);
+
+    // chat list getters called by app threads are served from the snapshot, while the karere
+    // thread (i.e. from listeners) reads the chatrooms directly, since it already holds the sdkMutex
+    ChatListSnapshot mChatListSnapshot;
+    std::set<MegaChatHandle> mChatListStale;    // chats whose entry is refreshed from the chatroom after the loop iteration
+    template <typename F>
+    void forEachChatListEntry(ChatListSnapshot::Indexes indexes, F&& f) const;
+    void refreshChatListSnapshot();
+    std::function<void()> mLoopIterationObserver;   // called after every iteration of the loop, for tests
+    friend class MegaChatApiTestAccess;
 
     void init(MegaChatApi *chatApi, mega::MegaApi *megaApi);
 
@@ -1361,8 +1654,8 @@ private:
     std::set<MegaChatCallListener *> callListeners;
     std::map<MegaChatHandle, MegaChatPeerVideoListener_map> mVideoListenersHiRes;
     std::map<MegaChatHandle, MegaChatPeerVideoListener_map> mVideoListenersLowRes;
-    std::map<MegaChatHandle, MegaChatVideoListener_set> mLocalCameraVideoListeners;
-    std::map<MegaChatHandle, MegaChatVideoListener_set> mLocalScreenVideoListeners;
+    std::map<MegaChatHandle, MegaChatVideoListener_map> mLocalCameraVideoListeners;
+    std::map<MegaChatHandle, MegaChatVideoListener_map> mLocalScreenVideoListeners;
 
     mega::MegaStringList *getChatInDevices(const std::set<std::string> &devices);
     void cleanCalls();
@@ -1443,7 +1736,8 @@ public:
     void postMessage(megaMessage *msg);
 
     void sendPendingRequests();
-    void sendPendingEvents();
+    // Returns false if there are still events to be processed
+    bool sendPendingEvents();
 
     static int getInternalMaxLogLevel();
     static bool setInternalMaxLogLevel(const unsigned int logLevel);
@@ -1480,6 +1774,7 @@ public:
     rtcModule::ICall* findCall(MegaChatHandle chatid);
     int getCurrentInputVideoTracksLimit() const;
     bool setCurrentInputVideoTracksLimit(const int numInputVideoTracks);
+    static void setVideoFramesInWorkerThreads(bool enable);
 #endif
 
     static void setCatchException(bool enable);
@@ -1505,12 +1800,19 @@ public:
     mega::MegaStringList* getMessageReactions(MegaChatHandle chatid, MegaChatHandle msgid);
     mega::MegaHandleList* getReactionUsers(MegaChatHandle chatid, MegaChatHandle msgid, const char *reaction);
     void setPublicKeyPinning(bool enable);
+    void setDbGroupCommit(bool enable);
+    void setLazyChatroomInit(bool enable);
+    void setHistoryMemoryBudget(unsigned int maxMessagesPerChat, unsigned int maxMessages);
+    mega::MegaStringMap* getHistoryMemoryStats();
+    void setNotificationCoalescing(bool enable, unsigned int windowMs);
+    bool isCoalescingNotifications() const { return mCoalesceNotifications; }
+    void onMessageUpdatesHeld(MegaChatHandle chatid);
 #ifndef KARERE_DISABLE_WEBRTC
     void addChatCallListener(MegaChatCallListener *listener);
     void addSchedMeetingListener(MegaChatScheduledMeetingListener* listener);
     void removeChatCallListener(MegaChatCallListener *listener);
     void removeSchedMeetingListener(MegaChatScheduledMeetingListener* listener);
-    void addChatVideoListener(MegaChatHandle chatid, MegaChatHandle clientId, rtcModule::VideoResolution videoResolution, const int capturerType, MegaChatVideoListener *listener);
+    void addChatVideoListener(MegaChatHandle chatid, MegaChatHandle clientId, rtcModule::VideoResolution videoResolution, const int capturerType, MegaChatVideoListener *listener, int format);
     void removeChatVideoListener(MegaChatHandle chatid, MegaChatHandle clientId, rtcModule::VideoResolution videoResolution, const int capturerType, MegaChatVideoListener *listener);
     void setSFUid(int sfuid);
 #endif
@@ -1531,11 +1833,16 @@ public:
     void fireOnChatSessionUpdate(MegaChatHandle chatid, MegaChatHandle callid, MegaChatSessionPrivate *session);
 
     // MegaChatVideoListener callbacks
-    void fireOnChatVideoData(MegaChatHandle chatid, uint32_t clientId, int width, int height, int sourceType, char*buffer, rtcModule::VideoResolution videoResolution);
+    void fireOnChatVideoData(MegaChatHandle chatid, uint32_t clientId, MegaChatVideoFramePrivate* frame, rtcModule::VideoResolution videoResolution);
+
+    // returns the formats (rtcModule::IVideoRenderer::kPixelFormat* bitmask) requested by the video listeners of a track
+    int getVideoListenersFormats(MegaChatHandle chatid, uint32_t clientId, int sourceType, rtcModule::VideoResolution videoResolution);
 #endif
 
     // MegaChatListener callbacks (specific ones)
     void fireOnChatListItemUpdate(MegaChatListItem *item);
+    // the snapshot entry of the chat is refreshed from its chatroom after the loop iteration
+    void markChatListItemStale(MegaChatHandle chatid);
     void fireOnChatInitStateUpdate(int newState);
     void fireOnChatOnlineStatusUpdate(MegaChatHandle userhandle, int status, bool inProgress);
     void fireOnChatPresenceConfigUpdate(MegaChatPresenceConfig *config);
@@ -1597,6 +1904,7 @@ public:
     MegaChatRoom* getChatRoom(MegaChatHandle chatid);
     MegaChatRoom *getChatRoomByUser(MegaChatHandle userhandle);
     MegaChatListItemList* getChatListItems(const int mask, const int filter) const;
+    MegaChatListItemList* getChatListItemsPage(const int mask, const int filter, unsigned int pageSize, const MegaChatListItem* after) const;
     MegaChatListItemList *getChatListItems() const;
     MegaChatListItemList* getChatListItemsByType(int type);
     MegaChatListItemList *getChatListItemsByPeers(MegaChatPeerList *peers);
@@ -1758,6 +2066,7 @@ public:
     void onPresenceConfigChanged(const presenced::Config& state, bool pending) override;
     void onPresenceLastGreenUpdated(karere::Id userid, uint16_t lastGreen) override;
     void onInitStateChange(int newState) override;
+    bool isKarereContext() const override;
     void onChatNotification(karere::Id chatid, const chatd::Message &msg, chatd::Message::Status status, chatd::Idx idx) override;
     void onDbError(int error, const std::string &msg) override;
 
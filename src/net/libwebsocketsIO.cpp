@@ -205,6 +205,7 @@ int LibwebsocketsIO::wsGetNoNameErrorCode()
 
 LibwebsocketsClient::LibwebsocketsClient(WebsocketsIO::Mutex& mutex, WebsocketsClient* client):
     WebsocketsClientImpl(mutex, client),
+    mRecvPool(std::make_shared<RecvBufferPool>()),
     wsi{nullptr}
 {}
 
@@ -221,35 +222,31 @@ void LibwebsocketsClient::verifyLwsThread() const
 void LibwebsocketsClient::appendMessageFragment(char *data, size_t len, size_t remaining)
 {
     verifyLwsThread();
-    if (!recbuffer.size() && remaining)
+    if (!mRecvSlab)
     {
-        recbuffer.reserve(len + remaining);
+        mRecvSlab = mRecvPool->getSlab(len + remaining);
     }
-    recbuffer.append(data, len);
+    mRecvSlab->append(data, len);
 }
 
 bool LibwebsocketsClient::hasFragments()
 {
     verifyLwsThread();
-    return recbuffer.size();
+    return mRecvSlab && mRecvSlab->dataSize();
 }
 
-const char *LibwebsocketsClient::getMessage()
+RecvBuffer LibwebsocketsClient::getMessage()
 {
     verifyLwsThread();
-    return recbuffer.data();
-}
-
-size_t LibwebsocketsClient::getMessageLength()
-{
-    verifyLwsThread();
-    return recbuffer.size();
+    // parsers may keep slices of the message after it has been handled, instead of copying them
+    return RecvBuffer(mRecvSlab->buf(), mRecvSlab->dataSize(), mRecvSlab);
 }
 
 void LibwebsocketsClient::resetMessage()
 {
     verifyLwsThread();
-    recbuffer.clear();
+    // the slab goes back to the pool once all the slices taken from it are released
+    mRecvSlab.reset();
 }
 
 bool LibwebsocketsClient::wsSendMessage(char *msg, size_t len)
@@ -264,12 +261,29 @@ bool LibwebsocketsClient::wsSendMessage(char *msg, size_t len)
         return false;
     }
 
-    if (!sendbuffer.size())
+    // chatd and presenced (binary) accept several commands in a frame, while SFU (text) doesn't
+    if (client->isWriteBinary()
+            && !mSendQueue.empty()
+            && mSendQueue.back().size() - LWS_PRE + len <= kMaxCoalescedFrameSize)
     {
-        sendbuffer.reserve(LWS_PRE + len);
-        sendbuffer.resize(LWS_PRE);
+        mSendQueue.back().append(msg, len);
+        mSendStats.coalescedMsgs++;
+    }
+    else
+    {
+        if (mSendQueue.empty())
+        {
+            mSendQueueTs = std::chrono::steady_clock::now();
+        }
+        mSendQueue.emplace_back();
+        std::string& frame = mSendQueue.back();
+        frame.reserve(LWS_PRE + len);
+        frame.resize(LWS_PRE);
+        frame.append(msg, len);
+        mSendStats.queuedFrames++;
     }
-    sendbuffer.append(msg, len);
+    mSendStats.queuedBytes += len;
+    mSendStats.maxQueuedBytes = std::max(mSendStats.maxQueuedBytes, mSendStats.queuedBytes);
 
     if (lws_callback_on_writable(wsi) <= 0)
     {
@@ -355,22 +369,60 @@ void LibwebsocketsClient::removeConnection()
     WEBSOCKETS_LOG_DEBUG("Pointer detached from libwebsockets");
 }
 
-const char *LibwebsocketsClient::getOutputBuffer()
+bool LibwebsocketsClient::writeNextFrame()
 {
     verifyLwsThread();
-    return sendbuffer.size() ? sendbuffer.data() + LWS_PRE : NULL;
-}
+    if (lws_partial_buffered(wsi))
+    {
+        // lws has not finished writing the previous frame yet
+        lws_callback_on_writable(wsi);
+        return true;
+    }
 
-size_t LibwebsocketsClient::getOutputBufferLength()
-{
-    verifyLwsThread();
-    return sendbuffer.size() ? sendbuffer.size() - LWS_PRE : 0;
+    if (mSendQueue.empty())
+    {
+        return true;
+    }
+
+    std::string frame = std::move(mSendQueue.front());
+    mSendQueue.pop_front();
+    char* data = &frame[LWS_PRE];
+    size_t len = frame.size() - LWS_PRE;
+    mSendStats.queuedBytes -= len;
+    mSendStats.queuedFrames--;
+
+    // only one lws_write() is allowed per writable callback. If the socket doesn't accept the
+    // whole frame, lws keeps the rest and completes it before the next writable callback
+    enum lws_write_protocol writeProtocol = client->isWriteBinary() ? LWS_WRITE_BINARY : LWS_WRITE_TEXT;
+    int written = lws_write(wsi, reinterpret_cast<unsigned char*>(data), len, writeProtocol);
+    if (written < 0 || static_cast<size_t>(written) < len)
+    {
+        WEBSOCKETS_LOG_ERROR("lws_write() failed: %d of %lu bytes written", written, len);
+        return false;
+    }
+
+    if (mSendQueue.empty())
+    {
+        auto drainTime = std::chrono::steady_clock::now() - mSendQueueTs;
+        mSendStats.lastDrainTimeUs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(drainTime).count());
+        mSendStats.maxDrainTimeUs = std::max(mSendStats.maxDrainTimeUs, mSendStats.lastDrainTimeUs);
+    }
+    else
+    {
+        lws_callback_on_writable(wsi);
+    }
+
+    wsSendMsgCb(data, len);
+
+    // This cb will only be implemented in those clients that require messages to be sent individually
+    wsProcessNextMsgCb();
+    return true;
 }
 
-void LibwebsocketsClient::resetOutputBuffer()
+WebsocketsSendStats LibwebsocketsClient::wsGetSendStats() const
 {
     verifyLwsThread();
-    sendbuffer.clear();
+    return mSendStats;
 }
 
 #if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined (LIBRESSL_VERSION_NUMBER)
@@ -551,11 +603,13 @@ int LibwebsocketsClient::wsCallback(struct lws *wsi, enum lws_callback_reasons r
                 {
                     WEBSOCKETS_LOG_DEBUG("Fragmented data completed");
                     client->appendMessageFragment((char *)data, len, 0);
-                    data = (void *)client->getMessage();
-                    len = client->getMessageLength();
+                    client->wsHandleMsgCb(client->getMessage());
+                }
+                else
+                {
+                    // data is owned by lws: parsers must copy whatever they keep from it
+                    client->wsHandleMsgCb(RecvBuffer(data, len));
                 }
-                
-                client->wsHandleMsgCb((char *)data, len);
                 client->resetMessage();
             }
             else
@@ -574,19 +628,9 @@ int LibwebsocketsClient::wsCallback(struct lws *wsi, enum lws_callback_reasons r
                 return -1;
             }
 
-            data = (void *)client->getOutputBuffer();
-            len = client->getOutputBufferLength();
-            if (len && data)
+            if (!client->writeNextFrame())
             {
-                enum lws_write_protocol writeProtocol = client->client->isWriteBinary() ?
-                            LWS_WRITE_BINARY : LWS_WRITE_TEXT;
-
-                lws_write(wsi, (unsigned char *)data, len, writeProtocol);
-                client->wsSendMsgCb((const char *)data, len);
-                client->resetOutputBuffer();
-
-                // This cb will only be implemented in those clients that require messages to be sent individually
-                client->wsProcessNextMsgCb();
+                return -1;
             }
             break;
         }
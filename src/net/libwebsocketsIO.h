@@ -3,6 +3,8 @@
 
 #include <libwebsockets.h>
 #include <openssl/ssl.h>
+#include <chrono>
+#include <deque>
 #include <iostream>
 #include <functional>
 
@@ -64,21 +66,28 @@ public:
 private:
     void verifyLwsThread() const;
     std::thread::id mLwsThread;
-    std::string recbuffer;
-    std::string sendbuffer;
+    std::shared_ptr<RecvBufferPool> mRecvPool;
+    std::shared_ptr<Buffer> mRecvSlab;  // fragments of the message being received
+
+    // Frames pending to be written, each one preceded by LWS_PRE bytes of headroom required by lws
+    std::deque<std::string> mSendQueue;
+    WebsocketsSendStats mSendStats;
+    std::chrono::steady_clock::time_point mSendQueueTs;    // when the queue stopped being empty
+
+    // Binary messages are appended to the last queued frame up to this size
+    static constexpr size_t kMaxCoalescedFrameSize = 64 * 1024;
 
     void appendMessageFragment(char *data, size_t len, size_t remaining);
     bool hasFragments();
-    const char *getMessage();
-    size_t getMessageLength();
+    RecvBuffer getMessage();
     void resetMessage();
-    const char *getOutputBuffer();
-    size_t getOutputBufferLength();
-    void resetOutputBuffer();
-    
+    // Writes the next queued frame, returns false if the connection can't be used anymore
+    bool writeNextFrame();
+
     bool wsSendMessage(char *msg, size_t len) override;
     void wsDisconnect() override;
     bool wsIsConnected() override;
+    WebsocketsSendStats wsGetSendStats() const override;
     
 public:
     static int wsCallback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *data, size_t len);
@@ -38,11 +38,11 @@ void WebsocketsClientImpl::wsCloseCb(int errcode, int errtype, const char *preas
     client->wsCloseCbPrivate(errcode, errtype, preason, reason_len);
 }
 
-void WebsocketsClientImpl::wsHandleMsgCb(char *data, size_t len)
+void WebsocketsClientImpl::wsHandleMsgCb(const RecvBuffer& msg)
 {
     WebsocketsIO::MutexGuard lock(this->mutex);
-    WEBSOCKETS_LOG_VERBOSE("Received %lu bytes", len);
-    client->wsHandleMsgCb(data, len);
+    WEBSOCKETS_LOG_VERBOSE("Received %lu bytes", msg.dataSize());
+    client->wsHandleMsgCb(msg);
 }
 
 void WebsocketsClientImpl::wsSendMsgCb(const char *data, size_t len)
@@ -172,6 +172,18 @@ void WebsocketsClient::wsCloseCbPrivate(int errcode, int errtype, const char *pr
     wsCloseCb(errcode, errtype, preason, reason_len);
 }
 
+WebsocketsSendStats WebsocketsClient::wsGetSendStats() const
+{
+    if (!ctx)
+    {
+        return WebsocketsSendStats();
+    }
+
+    assert(thread_id == std::this_thread::get_id());
+
+    return ctx->wsGetSendStats();
+}
+
 bool WebsocketsClient::isWriteBinary() const
 {
     return mWriteBinary;
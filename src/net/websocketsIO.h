@@ -8,6 +8,7 @@
 #include <mega/waiter.h>
 #include <mega/thread.h>
 #include "base/logger.h"
+#include "base/sdkMutex.h"
 #include "sdkApi.h"
 #include "buffer.h"
 #include "db.h"
@@ -155,7 +156,7 @@ private:
 class WebsocketsIO : public ::mega::EventTrigger
 {
 public:
-    using Mutex = std::recursive_mutex;
+    using Mutex = karere::SdkMutex;
     using MutexGuard = std::lock_guard<Mutex>;
 
     WebsocketsIO(Mutex &mutex, ::mega::MegaApi *megaApi, void *ctx);
@@ -197,6 +198,17 @@ protected:
 };
 
 
+// Metrics of the output queue of a websocket connection
+struct WebsocketsSendStats
+{
+    size_t queuedBytes = 0;         // bytes pending to be written to the socket
+    size_t queuedFrames = 0;        // frames pending to be written to the socket
+    size_t maxQueuedBytes = 0;      // highest value reached by queuedBytes
+    size_t coalescedMsgs = 0;       // messages appended to a frame that was already queued
+    uint64_t lastDrainTimeUs = 0;   // time the queue took to drain the last time it became empty
+    uint64_t maxDrainTimeUs = 0;    // highest value reached by lastDrainTimeUs
+};
+
 // Abstract class that allows to manage a websocket connection.
 // It's needed to subclass this class in order to receive callbacks
 
@@ -216,16 +228,19 @@ public:
     bool wsConnect(WebsocketsIO *websocketIO, const char *ip,
                    const char *host, int port, const char *path, bool ssl);
     int wsGetNoNameErrorCode(WebsocketsIO *websocketIO);
-    bool wsSendMessage(char *msg, size_t len);  // returns true on success, false if error
+    // returns true on success, false if error. Binary messages may be coalesced into a single frame
+    bool wsSendMessage(char *msg, size_t len);
     void wsDisconnect();
     bool wsIsConnected();
+    WebsocketsSendStats wsGetSendStats() const;
     void wsCloseCbPrivate(int errcode, int errtype, const char *preason, size_t reason_len);
 
     bool isWriteBinary() const;
 
     virtual void wsConnectCb() = 0;
     virtual void wsCloseCb(int errcode, int errtype, const char *preason, size_t reason_len) = 0;
-    virtual void wsHandleMsgCb(char *data, size_t len) = 0;
+    // msg is valid only during the call, unless its slab is retained (see RecvBuffer)
+    virtual void wsHandleMsgCb(const RecvBuffer& msg) = 0;
     virtual void wsSendMsgCb(const char *data, size_t len) = 0;
 
     // Called after sending a message through the socket
@@ -250,7 +265,7 @@ public:
     virtual ~WebsocketsClientImpl();
     void wsConnectCb();
     void wsCloseCb(int errcode, int errtype, const char *preason, size_t reason_len);
-    void wsHandleMsgCb(char *data, size_t len);
+    void wsHandleMsgCb(const RecvBuffer& msg);
     void wsSendMsgCb(const char *data, size_t len);
     void wsProcessNextMsgCb();
 #if WEBSOCKETS_TLS_SESSION_CACHE_ENABLED
@@ -260,6 +275,7 @@ public:
     virtual bool wsSendMessage(char *msg, size_t len) = 0;
     virtual void wsDisconnect() = 0;
     virtual bool wsIsConnected() = 0;
+    virtual WebsocketsSendStats wsGetSendStats() const { return WebsocketsSendStats(); }
 };
 
 #endif /* websocketsIO_h */
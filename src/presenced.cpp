@@ -1367,11 +1367,11 @@ Client::~Client()
 #define READ_8(varname, offset)\
     assert(offset==pos-base); uint8_t varname(buf.read<uint8_t>(pos)); pos+=1
 
-void Client::wsHandleMsgCb(char *data, size_t len)
+void Client::wsHandleMsgCb(const RecvBuffer& msg)
 {
     mTsLastRecv = time(NULL);
     mTsLastPingSent = 0;
-    handleMessage(StaticBuffer(data, len));
+    handleMessage(msg);
 }
 
 // inbound command processing
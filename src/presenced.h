@@ -420,7 +420,7 @@ protected:
 
     void wsConnectCb() override;
     void wsCloseCb(int errcode, int errtype, const char *preason, size_t preason_len) override;
-    void wsHandleMsgCb(char *data, size_t len) override;
+    void wsHandleMsgCb(const RecvBuffer& msg) override;
     void wsSendMsgCb(const char *, size_t) override {}
 #if WEBSOCKETS_TLS_SESSION_CACHE_ENABLED
     bool wsSSLsessionUpdateCb(const CachedSession &sess) override;
@@ -109,7 +109,7 @@ RtcCryptoMeetings::verifyKeySignature(const std::string& msg, const std::string&
     if (it != mClient.chats->end())
     {
        const ChatRoom* chatroom = it->second;
-       return mClient.userAttrCache().getAttr(peer, ::mega::MegaApi::USER_ATTR_ED25519_PUBLIC_KEY, chatroom->chat().getPublicHandle())
+       return mClient.userAttrCache().getAttr(peer, ::mega::MegaApi::USER_ATTR_ED25519_PUBLIC_KEY, chatroom->getPublicHandle())
        .then([ recvsignature, msg](Buffer* key) -> bool
        {
            std::string signatureBin =  mega::Base64::atob(recvsignature);
@@ -1,7 +1,25 @@
 #ifndef IVIDEORENDERER_H
 #define IVIDEORENDERER_H
+
+#include <cstdint>
+#include <memory>
+
 namespace rtcModule
 {
+/**
+ * @brief Planes of a YUV frame delivered without colour conversion by \c IVideoRenderer::framePlanesComplete()
+ */
+struct VideoFramePlanes
+{
+    int format = 0;                 // IVideoRenderer::kPixelFormatI420 or IVideoRenderer::kPixelFormatNv12
+    unsigned short width = 0;
+    unsigned short height = 0;
+    int numPlanes = 0;              // 3 for I420 (Y, U, V), 2 for NV12 (Y, UV)
+    const uint8_t* data[3] = {};
+    int stride[3] = {};
+    std::shared_ptr<const void> owner;  // keeps the planes alive while it's referenced
+};
+
 /**
  * @brief This is the interface that is used to pass frames from the webrtc module to the
  * application for rendering in the GUI, or other purposes. For each frame, getImageBuffer()
@@ -17,6 +35,13 @@ namespace rtcModule
 class IVideoRenderer
 {
 public:
+    enum
+    {
+        kPixelFormatArgb = 1 << 0,  // 4 bytes per pixel, written to the buffer of getImageBuffer()
+        kPixelFormatI420 = 1 << 1,  // Y, U and V planes, chroma subsampled 2x2
+        kPixelFormatNv12 = 1 << 2,  // Y plane and interleaved UV plane, chroma subsampled 2x2
+    };
+
     /**
      * @brief getImageBuffer Called by _a worker thread_ to get a buffer where to write
      * frame image data. The size of the buffer must be width*height*4. The image is
@@ -37,6 +62,24 @@ public:
      */
     virtual void frameComplete(void* userData) = 0;
 
+    /**
+     * @brief getPixelFormats Called _by a worker thread_ for every frame, to know the formats
+     * in which it has to be delivered. The ARGB format is delivered through \c getImageBuffer()
+     * and \c frameComplete(). YUV formats are delivered by \c framePlanesComplete().
+     * @param sourceType The source of the frame
+     * @return Bitmask of kPixelFormat* values. No frame is delivered if it's 0
+     */
+    virtual int getPixelFormats(int /*sourceType*/) { return kPixelFormatArgb; }
+
+    /**
+     * @brief framePlanesComplete Called _by a worker thread_ with the YUV planes of a frame
+     * (without colour conversion) when a YUV format is requested by \c getPixelFormats().
+     * The planes remain valid as long as \c planes.owner is referenced.
+     * @param planes The planes of the frame
+     * @param sourceType The source of the frame
+     */
+    virtual void framePlanesComplete(const VideoFramePlanes& /*planes*/, int /*sourceType*/) {}
+
     /**
      * @brief onVideoAttach Called when a video stream is attached to the player component
      * Frames can be expected after that point
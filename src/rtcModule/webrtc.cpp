@@ -4,8 +4,11 @@
 #include <rtcmPrivate.h>
 #include <webrtcPrivate.h>
 #include <api/video/i420_buffer.h>
+#include <api/video/nv12_buffer.h>
 #include <libyuv/convert.h>
+#include <libyuv/convert_from.h>
 
+#include <chrono>
 #include <memory>
 
 
@@ -4731,34 +4734,32 @@ void RtcModuleSfu::releaseScreenDevice()
 
 bool RtcModuleSfu::hasLocalCameraRenderer(const karere::Id &chatid) const
 {
-    auto it = mCameraVideoSink.mRenderers.find(chatid);
-    return it != mCameraVideoSink.mRenderers.end() && it->second;
+    return mCameraVideoSink.hasRenderer(chatid);
 }
 
 bool RtcModuleSfu::hasLocalScreenRenderer(const karere::Id &chatid) const
 {
-    auto it = mScreenVideoSink.mRenderers.find(chatid);
-    return it != mScreenVideoSink.mRenderers.end() && it->second;
+    return mScreenVideoSink.hasRenderer(chatid);
 }
 
 void RtcModuleSfu::addLocalCameraRenderer(const karere::Id &chatid, IVideoRenderer *videoRederer)
 {
-    mCameraVideoSink.mRenderers[chatid] = std::unique_ptr<IVideoRenderer>(videoRederer);
+    mCameraVideoSink.addRenderer(chatid, videoRederer);
 }
 
 void RtcModuleSfu::removeLocalCameraRenderer(const karere::Id &chatid)
 {
-    mCameraVideoSink.mRenderers.erase(chatid);
+    mCameraVideoSink.removeRenderer(chatid);
 }
 
 void RtcModuleSfu::addLocalScreenRenderer(const karere::Id &chatid, IVideoRenderer *videoRederer)
 {
-    mScreenVideoSink.mRenderers[chatid] = std::unique_ptr<IVideoRenderer>(videoRederer);
+    mScreenVideoSink.addRenderer(chatid, videoRederer);
 }
 
 void RtcModuleSfu::removeLocalScreenRenderer(const karere::Id &chatid)
 {
-    mScreenVideoSink.mRenderers.erase(chatid);
+    mScreenVideoSink.removeRenderer(chatid);
 }
 
 void RtcModuleSfu::onMediaKeyDecryptionFailed(const std::string& err)
@@ -4929,32 +4930,62 @@ std::vector<uint64_t> KarereWaitingRoom::getUsers() const
     return users;
 }
 
-void RtcCameraVideoSink::OnFrame(const webrtc::VideoFrame &frame)
+RtcLocalVideoSink::RtcLocalVideoSink(void *appCtx, const RtcModuleSfu& moduleSfu, int sourceType)
+    : VideoSink(appCtx)
+    , mModuleSfu(moduleSfu)
+    , mSourceType(sourceType)
+    , mAppCtx(appCtx)
 {
-    auto wptr = weakHandle();
-    karere::marshallCall([wptr, this, frame]()
+}
+
+RtcLocalVideoSink::~RtcLocalVideoSink()
+{
+    for (auto& render : mRenderers)
     {
-        if (wptr.deleted())
-        {
-            return;
-        }
+        render.second->close();
+    }
+}
 
-        for (auto& render : mRenderers)
-        {
-            ICall* call = mModuleSfu.findCallByChatid(render.first);
-            if ((call && call->getLocalAvFlags().camera() && !call->getLocalAvFlags().has(karere::AvFlags::kOnHold)) || !call)
-            {
-                processFrame(frame, render.second, VideoSink::Rtc_Type_Video_source_Local_Camera);
-            }
-        }
-    }, mAppCtx);
+void RtcLocalVideoSink::addRenderer(const karere::Id &chatid, IVideoRenderer *videoRenderer)
+{
+    std::shared_ptr<VideoFrameQueue>& queue = mRenderers[chatid];
+    if (!queue)
+    {
+        queue = std::make_shared<VideoFrameQueue>(mSourceType, mAppCtx);
+    }
+    queue->setRenderer(videoRenderer);
+}
+
+void RtcLocalVideoSink::removeRenderer(const karere::Id &chatid)
+{
+    auto it = mRenderers.find(chatid);
+    if (it == mRenderers.end())
+    {
+        return;
+    }
 
+    it->second->close();
+    mRenderers.erase(it);
 }
 
-void RtcScreenVideoSink::OnFrame(const webrtc::VideoFrame &frame)
+bool RtcLocalVideoSink::hasRenderer(const karere::Id &chatid) const
+{
+    auto it = mRenderers.find(chatid);
+    return it != mRenderers.end() && it->second->hasRenderer();
+}
+
+VideoFrameStats RtcLocalVideoSink::getFrameStats(const karere::Id &chatid) const
+{
+    auto it = mRenderers.find(chatid);
+    return it != mRenderers.end() ? it->second->getStats() : VideoFrameStats();
+}
+
+void RtcLocalVideoSink::onLocalFrame(const webrtc::VideoFrame &frame, bool (*isSending)(const karere::AvFlags&))
 {
+    // the call state can only be checked from karere thread. The frame is refcounted and
+    // its conversion is done by VideoFrameConverter, so the app thread just enqueues it
     auto wptr = weakHandle();
-    karere::marshallCall([wptr, this, frame]()
+    karere::marshallCall([wptr, this, frame, isSending]()
     {
         if (wptr.deleted())
         {
@@ -4964,14 +4995,24 @@ void RtcScreenVideoSink::OnFrame(const webrtc::VideoFrame &frame)
         for (auto& render : mRenderers)
         {
             ICall* call = mModuleSfu.findCallByChatid(render.first);
-            if ((call && call->getLocalAvFlags().screenShare() && !call->getLocalAvFlags().has(karere::AvFlags::kOnHold)) || !call)
+            if (!call || (isSending(call->getLocalAvFlags()) && !call->getLocalAvFlags().has(karere::AvFlags::kOnHold)))
             {
-               processFrame(frame, render.second, VideoSink::Rtc_Type_Video_source_Local_Screen);
+                enqueueFrame(render.second, frame);
             }
         }
     }, mAppCtx);
 }
 
+void RtcCameraVideoSink::OnFrame(const webrtc::VideoFrame &frame)
+{
+    onLocalFrame(frame, [](const karere::AvFlags& flags) { return flags.camera(); });
+}
+
+void RtcScreenVideoSink::OnFrame(const webrtc::VideoFrame &frame)
+{
+    onLocalFrame(frame, [](const karere::AvFlags& flags) { return flags.screenShare(); });
+}
+
 artc::VideoCapturerManager *RtcModuleSfu::getCameraDevice()
 {
     return mCameraCapturerDevice.get();
@@ -5330,23 +5371,270 @@ RemoteVideoSlot::~RemoteVideoSlot()
 {
 }
 
-VideoSink::VideoSink(void* appCtx) :mAppCtx(appCtx)
+VideoFrameQueue::VideoFrameQueue(int sourceType, void* appCtx, size_t maxFrames)
+    : mSourceType(sourceType)
+    , mAppCtx(appCtx)
+    , mMaxFrames(maxFrames)
 {
+    assert(mMaxFrames > 0);
+}
 
+namespace
+{
+// renderers handed over to the workers, which are still in use by a conversion
+std::mutex gRetiredMutex;
+std::condition_variable gRetiredCondition;
+size_t gRetiredRenderers = 0;
 }
 
-VideoSink::~VideoSink()
+void VideoFrameQueue::setRenderer(IVideoRenderer *renderer)
 {
+    std::unique_ptr<IVideoRenderer> previous;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        previous = std::move(mRenderer);
+        mRenderer.reset(renderer);
+        if (!mRenderer)
+        {
+            mFrames.clear();
+        }
 
+        // Waiting for the conversion here could deadlock: the caller usually holds sdkMutex, which
+        // the app may need to return from onChatVideoData. Hand the renderer over to the worker
+        if (mConverting && !mRetiredRenderer && previous)
+        {
+            std::lock_guard<std::mutex> retiredLock(gRetiredMutex);
+            gRetiredRenderers++;
+            mRetiredRenderer = std::move(previous);
+        }
+    }
+    // a renderer not in use by a worker is destroyed out of the lock, in the calling thread
+}
+
+bool VideoFrameQueue::hasRenderer() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mRenderer != nullptr;
+}
+
+void VideoFrameQueue::close()
+{
+    setRenderer(nullptr);
+    VideoFrameStats stats = getStats();
+    if (stats.convertedFrames)
+    {
+        RTCM_LOG_DEBUG("VideoFrameQueue closed (source: %d). Converted: %s, dropped: %s, avg conversion: %s us, max conversion: %s us",
+                       mSourceType, std::to_string(stats.convertedFrames).c_str(), std::to_string(stats.droppedFrames).c_str(),
+                       std::to_string(stats.totalConversionUs / stats.convertedFrames).c_str(),
+                       std::to_string(stats.maxConversionUs).c_str());
+    }
+}
+
+void VideoFrameQueue::waitRetiredRenderers()
+{
+    std::unique_lock<std::mutex> lock(gRetiredMutex);
+    gRetiredCondition.wait(lock, []() { return gRetiredRenderers == 0; });
+}
+
+bool VideoFrameQueue::push(const webrtc::VideoFrame &frame)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mRenderer)
+    {
+        return false;
+    }
+
+    if (mFrames.size() >= mMaxFrames)
+    {
+        mFrames.pop_front();
+        mStats.droppedFrames++;
+    }
+    mFrames.push_back(frame);
+
+    if (mScheduled)
+    {
+        return false;  // a worker will pick the frame up
+    }
+    mScheduled = true;
+    return true;
+}
+
+VideoFrameStats VideoFrameQueue::getStats() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    VideoFrameStats stats = mStats;
+    stats.queueDepth = mFrames.size();
+    return stats;
+}
+
+std::optional<webrtc::VideoFrame> VideoFrameQueue::popFrame(IVideoRenderer*& renderer)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    assert(mScheduled && !mConverting);
+    if (mFrames.empty() || !mRenderer)
+    {
+        mScheduled = false;
+        return std::nullopt;
+    }
+
+    std::optional<webrtc::VideoFrame> frame(std::move(mFrames.front()));
+    mFrames.pop_front();
+    renderer = mRenderer.get();
+    mConverting = true;
+    return frame;
+}
+
+bool VideoFrameQueue::onFrameConverted(uint64_t elapsedUs, std::unique_ptr<IVideoRenderer>& retired)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mConverting = false;
+    mStats.convertedFrames++;
+    mStats.totalConversionUs += elapsedUs;
+    mStats.maxConversionUs = std::max(mStats.maxConversionUs, elapsedUs);
+    retired = std::move(mRetiredRenderer);
+
+    if (mFrames.empty() || !mRenderer)
+    {
+        mScheduled = false;
+        return false;
+    }
+    return true;
+}
+
+std::atomic<bool> VideoFrameConverter::sInWorkers(false);
+
+karere::WorkerPool& VideoFrameConverter::pool()
+{
+    static karere::WorkerPool pool(karere::WorkerPool::defaultNumThreads());
+    return pool;
+}
+
+void VideoFrameConverter::setInWorkers(bool enable)
+{
+    sInWorkers = enable;
+}
+
+void VideoFrameConverter::schedule(const std::shared_ptr<VideoFrameQueue>& queue)
+{
+    std::weak_ptr<VideoFrameQueue> wqueue = queue;
+    auto convertNext = [wqueue]()
+    {
+        convert(wqueue);
+    };
+
+    if (sInWorkers)
+    {
+        pool().schedule(convertNext);
+    }
+    else
+    {
+        // the renderers of the app are called from the thread of the other callbacks
+        karere::marshallCall(convertNext, queue->mAppCtx);
+    }
+}
+
+void VideoFrameConverter::convert(const std::weak_ptr<VideoFrameQueue>& wqueue)
+{
+    std::shared_ptr<VideoFrameQueue> queue = wqueue.lock();
+    if (!queue)
+    {
+        return;   // the sink has been destroyed
+    }
+
+    IVideoRenderer* renderer = nullptr;
+    std::optional<webrtc::VideoFrame> frame = queue->popFrame(renderer);
+    if (!frame)
+    {
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    VideoSink::processFrame(*frame, renderer, queue->mSourceType);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    frame.reset();
+
+    // process one frame per turn, so a busy track doesn't starve the others
+    std::unique_ptr<IVideoRenderer> retired;
+    if (queue->onFrameConverted(static_cast<uint64_t>(elapsed.count()), retired))
+    {
+        schedule(queue);
+    }
+
+    if (retired)
+    {
+        retired.reset();
+        {
+            std::lock_guard<std::mutex> lock(gRetiredMutex);
+            gRetiredRenderers--;
+        }
+        gRetiredCondition.notify_all();
+    }
+}
+
+VideoSink::VideoSink(void* appCtx)
+    : mFrameQueue(std::make_shared<VideoFrameQueue>(VideoSink::Rtc_Type_Video_source_Remote, appCtx))
+    , mAppCtx(appCtx)
+{
+
+}
+
+VideoSink::~VideoSink()
+{
+    mFrameQueue->close();
 }
 
 void VideoSink::setVideoRender(IVideoRenderer *videoRenderer)
 {
-    mRenderer = std::unique_ptr<IVideoRenderer>(videoRenderer);
+    mFrameQueue->setRenderer(videoRenderer);
+}
+
+VideoFrameStats VideoSink::getFrameStats() const
+{
+    return mFrameQueue->getStats();
+}
+
+void VideoSink::enqueueFrame(const std::shared_ptr<VideoFrameQueue> &queue, const webrtc::VideoFrame &frame)
+{
+    if (queue->push(frame))
+    {
+        VideoFrameConverter::schedule(queue);
+    }
+}
+
+VideoFramePlanes VideoSink::getI420Planes(const rtc::scoped_refptr<webrtc::I420BufferInterface>& buffer)
+{
+    VideoFramePlanes planes;
+    planes.format = IVideoRenderer::kPixelFormatI420;
+    planes.width = static_cast<unsigned short>(buffer->width());
+    planes.height = static_cast<unsigned short>(buffer->height());
+    planes.numPlanes = 3;
+    planes.data[0] = buffer->DataY();
+    planes.data[1] = buffer->DataU();
+    planes.data[2] = buffer->DataV();
+    planes.stride[0] = buffer->StrideY();
+    planes.stride[1] = buffer->StrideU();
+    planes.stride[2] = buffer->StrideV();
+    planes.owner = std::shared_ptr<const void>(std::make_shared<rtc::scoped_refptr<webrtc::I420BufferInterface>>(buffer), buffer.get());
+    return planes;
+}
+
+VideoFramePlanes VideoSink::getNv12Planes(const rtc::scoped_refptr<const webrtc::NV12BufferInterface>& buffer)
+{
+    VideoFramePlanes planes;
+    planes.format = IVideoRenderer::kPixelFormatNv12;
+    planes.width = static_cast<unsigned short>(buffer->width());
+    planes.height = static_cast<unsigned short>(buffer->height());
+    planes.numPlanes = 2;
+    planes.data[0] = buffer->DataY();
+    planes.data[1] = buffer->DataUV();
+    planes.stride[0] = buffer->StrideY();
+    planes.stride[1] = buffer->StrideUV();
+    planes.owner = std::shared_ptr<const void>(std::make_shared<rtc::scoped_refptr<const webrtc::NV12BufferInterface>>(buffer), buffer.get());
+    return planes;
 }
 
 void VideoSink::processFrame(const webrtc::VideoFrame& frame,
-                             const std::unique_ptr<IVideoRenderer>& render,
+                             IVideoRenderer* render,
                              const int sourceType)
 {
     if (!render)
@@ -5356,14 +5644,63 @@ void VideoSink::processFrame(const webrtc::VideoFrame& frame,
     }
 
     assert(render != nullptr);
-    void* userData = NULL;
-    auto buffer = frame.video_frame_buffer()->ToI420(); // smart ptr type changed
+    int formats = render->getPixelFormats(sourceType);
+    if (!formats)
+    {
+        return;
+    }
+
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> frameBuffer = frame.video_frame_buffer();
+    if ((formats & IVideoRenderer::kPixelFormatNv12)
+            && frameBuffer->type() == webrtc::VideoFrameBuffer::Type::kNV12
+            && frame.rotation() == webrtc::kVideoRotation_0)
+    {
+        // native NV12 frame (ie. from hardware decoders/capturers), no conversion at all
+        render->framePlanesComplete(getNv12Planes(rtc::scoped_refptr<const webrtc::NV12BufferInterface>(frameBuffer->GetNV12())), sourceType);
+        formats &= ~IVideoRenderer::kPixelFormatNv12;
+        if (!formats)
+        {
+            return;
+        }
+    }
+
+    auto buffer = frameBuffer->ToI420(); // smart ptr type changed (no conversion if it's already I420)
     if (frame.rotation() != webrtc::kVideoRotation_0)
     {
         buffer = webrtc::I420Buffer::Rotate(*buffer, frame.rotation());
     }
     unsigned short width = (unsigned short)buffer->width();
     unsigned short height = (unsigned short)buffer->height();
+
+    if (formats & IVideoRenderer::kPixelFormatI420)
+    {
+        render->framePlanesComplete(getI420Planes(buffer), sourceType);
+    }
+
+    if (formats & IVideoRenderer::kPixelFormatNv12)
+    {
+        rtc::scoped_refptr<webrtc::NV12Buffer> nv12Buffer = webrtc::NV12Buffer::Create(width, height);
+        libyuv::I420ToNV12(buffer->DataY(),
+                           buffer->StrideY(),
+                           buffer->DataU(),
+                           buffer->StrideU(),
+                           buffer->DataV(),
+                           buffer->StrideV(),
+                           nv12Buffer->MutableDataY(),
+                           nv12Buffer->StrideY(),
+                           nv12Buffer->MutableDataUV(),
+                           nv12Buffer->StrideUV(),
+                           width,
+                           height);
+        render->framePlanesComplete(getNv12Planes(nv12Buffer), sourceType);
+    }
+
+    if (!(formats & IVideoRenderer::kPixelFormatArgb))
+    {
+        return;
+    }
+
+    void* userData = NULL;
     void* frameBuf = render->getImageBuffer(width, height, sourceType, userData);
     if (!frameBuf) // image is frozen or app is minimized/covered
     {
@@ -5385,19 +5722,8 @@ void VideoSink::processFrame(const webrtc::VideoFrame& frame,
 
 void VideoSink::OnFrame(const webrtc::VideoFrame &frame)
 {
-    auto wptr = weakHandle();
-    karere::marshallCall([wptr, this, frame]()
-    {
-        if (wptr.deleted())
-        {
-            return;
-        }
-
-        if (mRenderer)
-        {
-            processFrame(frame, mRenderer, VideoSink::Rtc_Type_Video_source_Remote);
-        }
-    }, mAppCtx);
+    // called from webrtc decoding thread. Conversion is done by VideoFrameConverter
+    enqueueFrame(mFrameQueue, frame);
 }
 
 void RemoteVideoSlot::assignVideoSlot(Cid_t cid, IvStatic_t iv, VideoResolution videoResolution)
@@ -5509,7 +5835,16 @@ void RemoteAudioSlot::release()
     }
 }
 
-void globalCleanup() {}
+void setVideoConversionInWorkers(bool enable)
+{
+    VideoFrameConverter::setInWorkers(enable);
+}
+
+void globalCleanup()
+{
+    // renderers retired by the module being destroyed may still refer to the MegaChatApi
+    VideoFrameQueue::waitRetiredRenderers();
+}
 
 Session::Session(const sfu::Peer& peer)
     : mPeer(peer)
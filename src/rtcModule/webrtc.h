@@ -405,6 +405,9 @@ static const int kAudioThreshold = 100;             // Threshold to consider a u
 RtcModule* createRtcModule(MyMegaApi& megaApi, CallHandler &callhandler, DNScache &dnsCache,
                            WebsocketsIO& websocketIO, void *appCtx,
                            rtcModule::RtcCryptoMeetings* rRtcCryptoMeetings);
+
+// Converts video frames and calls the renderers in worker threads, instead of in the karere thread (default)
+void setVideoConversionInWorkers(bool enable);
 #endif
 
 }
@@ -539,10 +539,42 @@ RtcCipher::RtcCipher(const sfu::Peer &peer, std::shared_ptr<rtcModule::IRtcCrypt
 
 }
 
-void RtcCipher::setKey(const std::string &key)
+bool RtcCipher::armKey(Keyid_t keyId)
 {
-    const unsigned char *newKey = reinterpret_cast<const unsigned char*>(key.data());
-    mSymCipher.setkey(newKey);
+    byte key[kKeyLength];
+    if (!mPeer.copyKey(keyId, key, sizeof(key)))
+    {
+        return false;
+    }
+
+    auto it = std::find_if(mCachedKeys.begin(), mCachedKeys.end(), [keyId, &key](const CachedKey& cached)
+    {
+        return cached.keyId == keyId && !memcmp(cached.key, key, sizeof(key));
+    });
+
+    if (it == mCachedKeys.end())
+    {
+        // expand the key (AES key schedule and GCM tables) only once, frames just resynchronize the IV
+        static const byte zeroIv[FRAME_IV_LENGTH] = {};
+        CachedKey cached;
+        cached.keyId = keyId;
+        memcpy(cached.key, key, sizeof(key));
+        cached.cipher = createCipher();
+        cached.cipher->SetKeyWithIV(key, sizeof(key), zeroIv, sizeof(zeroIv));
+
+        if (mCachedKeys.size() >= kMaxCachedKeys)
+        {
+            mCachedKeys.pop_back();
+        }
+        mCachedKeys.insert(mCachedKeys.begin(), std::move(cached));
+    }
+    else if (it != mCachedKeys.begin())
+    {
+        std::rotate(mCachedKeys.begin(), it, it + 1);
+    }
+
+    mCipher = mCachedKeys.front().cipher.get();
+    return true;
 }
 
 void RtcCipher::setTerminating()
@@ -551,12 +583,10 @@ void RtcCipher::setTerminating()
 }
 
 /* frame IV format: <frameIv.12> = <frameCtr.4> <staticIv.8> */
-std::unique_ptr<byte []> RtcCipher::generateFrameIV()
+void RtcCipher::generateFrameIV(byte* iv) const
 {
-    std::unique_ptr<byte []> iv(new byte[FRAME_IV_LENGTH]);
-    memcpy(iv.get(), &mCtr, FRAME_CTR_LENGTH);
-    memcpy(iv.get() + FRAME_CTR_LENGTH, &mIv, FRAME_IV_LENGTH - FRAME_CTR_LENGTH);
-    return iv;
+    memcpy(iv, &mCtr, FRAME_CTR_LENGTH);
+    memcpy(iv + FRAME_CTR_LENGTH, &mIv, FRAME_IV_LENGTH - FRAME_CTR_LENGTH);
 }
 
 MegaEncryptor::MegaEncryptor(const sfu::Peer& peer, std::shared_ptr<::rtcModule::IRtcCryptoMeetings>cryptoMeetings, IvStatic_t iv, uint32_t mid)
@@ -568,6 +598,11 @@ MegaEncryptor::~MegaEncryptor()
 {
 }
 
+std::unique_ptr<CryptoPP::AuthenticatedSymmetricCipher> MegaEncryptor::createCipher() const
+{
+    return std::make_unique<CryptoPP::GCM<CryptoPP::AES>::Encryption>();
+}
+
 void MegaEncryptor::incrementPacketCtr()
 {
     (mCtr < UINT32_MAX)
@@ -608,61 +643,57 @@ int MegaEncryptor::Encrypt(cricket::MediaType media_type, uint32_t /*ssrc*/, rtc
         return kRecoverable;
     }
 
+    if (encrypted_frame.size() < GetMaxCiphertextByteSize(media_type, frame.size()))
+    {
+        RTCM_LOG_WARNING("Encrypt: Frame size: %lu is smaller than expected size: %lu MyCid: %u, MyPeerId: %s, KeyId: %u, frameCtr: %u",
+                         encrypted_frame.size(), GetMaxCiphertextByteSize(media_type, frame.size()),
+                         mPeer.getCid(), mPeer.getPeerid().toString().c_str(), mKeyId, mCtr);
+        return kRecoverable;
+    }
+
     // get keyId for peer
     Keyid_t currentKeyId = mPeer.getCurrentKeyId();
     if (currentKeyId != mKeyId || !mInitialized)
     {
-        // If there's no key armed in SymCipher or keyId doesn't match with current one
-        mKeyId = currentKeyId;
-        std::string encryptionKey = mPeer.getKey(currentKeyId);
-        if (encryptionKey.empty())
+        // If there's no key armed in cipher or keyId doesn't match with current one
+        if (!armKey(currentKeyId))
         {
-
             RTCM_LOG_WARNING("Encrypt: key doesn't found with keyId: %u, MyCid %u, MyPeerid: %s, frameCtr: %u",
                              currentKeyId, mPeer.getCid(), mPeer.getPeerid().toString().c_str(), mCtr);
             return kRecoverable;
         }
-        setKey(encryptionKey);
 
-        if (!mInitialized)
-        {
-            mInitialized = true;
-        }
+        mKeyId = currentKeyId;
+        mInitialized = true;
     }
 
     // generate frame iv
-    mega::unique_ptr<byte []> iv = generateFrameIV();
+    byte iv[FRAME_IV_LENGTH];
+    generateFrameIV(iv);
 
     // generate header and store in encrypted_frame
     generateHeader(encrypted_frame.data());
 
-    // encrypt frame and store it in encrypted_frame
-    std::string encryptedFrame;
-    size_t encSize = encrypted_frame.size()-FRAME_HEADER_LENGTH;
-    bool result = mSymCipher.gcm_encrypt_add(frame.data(), frame.size(),
-                                           encrypted_frame.data(), FRAME_HEADER_LENGTH,
-                                           iv.get(), FRAME_IV_LENGTH,
-                                           FRAME_GCM_TAG_LENGTH, encryptedFrame, encSize);
-
-    if (!result || encryptedFrame.size() != encSize)
+    // encrypt frame straight into encrypted_frame (header is the additional authenticated data)
+    byte* ciphertext = encrypted_frame.data() + FRAME_HEADER_LENGTH;
+    try
     {
-        RTCM_LOG_WARNING("Failed gcm_encrypt_aad encryption with additional authenticated data: MyCid: %u, MyPeerId: %s, KeyId: %u, frameCtr: %u",
-                         mPeer.getCid(), mPeer.getPeerid().toString().c_str(), mKeyId, mCtr - 1);
-        return kRecoverable;
+        mCipher->EncryptAndAuthenticate(ciphertext,
+                                        ciphertext + frame.size(), FRAME_GCM_TAG_LENGTH,
+                                        iv, FRAME_IV_LENGTH,
+                                        encrypted_frame.data(), FRAME_HEADER_LENGTH,
+                                        frame.data(), frame.size());
     }
-    memcpy(encrypted_frame.data() + FRAME_HEADER_LENGTH, encryptedFrame.data(), encSize);
-
-    // set bytes_written to the number of bytes, written in encrypted_frame
-    assert(GetMaxCiphertextByteSize(media_type, frame.size()) == encrypted_frame.size());
-    *bytes_written = encrypted_frame.size();
-    size_t expectedSize = GetMaxCiphertextByteSize(media_type, frame.size());
-    if (expectedSize != *bytes_written)
+    catch (const CryptoPP::Exception& e)
     {
-        RTCM_LOG_WARNING("Encrypt: Frame size: %lu doesn't match with expected size: %lu MyCid: %u, MyPeerId: %s, KeyId: %u, frameCtr: %u",
-                         *bytes_written, expectedSize, mPeer.getCid(), mPeer.getPeerid().toString().c_str(), mKeyId, mCtr - 1);
+        RTCM_LOG_WARNING("Failed gcm_encrypt_aad encryption with additional authenticated data: MyCid: %u, MyPeerId: %s, KeyId: %u, frameCtr: %u, error: %s",
+                         mPeer.getCid(), mPeer.getPeerid().toString().c_str(), mKeyId, mCtr, e.what());
         return kRecoverable;
     }
 
+    // set bytes_written to the number of bytes, written in encrypted_frame
+    *bytes_written = GetMaxCiphertextByteSize(media_type, frame.size());
+
     // increment packetCtr, if encryption process has succeeded
     incrementPacketCtr();
     return kOk;
@@ -683,6 +714,11 @@ MegaDecryptor::~MegaDecryptor()
 {
 }
 
+std::unique_ptr<CryptoPP::AuthenticatedSymmetricCipher> MegaDecryptor::createCipher() const
+{
+    return std::make_unique<CryptoPP::GCM<CryptoPP::AES>::Decryption>();
+}
+
 
 /*
  * header format: <header.8> = <keyId.1> <cid.3> <packetCTR.4>
@@ -716,9 +752,8 @@ int MegaDecryptor::validateAndProcessHeader(rtc::ArrayView<const uint8_t> header
 
     if (auxKeyId != mKeyId || !mInitialized)
     {
-        // If there's no key armed in SymCipher or keyId doesn't match with current one
-        std::string decryptionKey = mPeer.getKey(auxKeyId);
-        if (decryptionKey.empty())
+        // If there's no key armed in cipher or keyId doesn't match with current one
+        if (!armKey(auxKeyId))
         {
             RTCM_LOG_WARNING("validateAndProcessHeader: key doesn't found with Frame keyId: %u, mid: %u, peercid: %u, peerid: %s, frameCtr: %u",
                              auxKeyId, mMid, peerCid, mPeer.getPeerid().toString().c_str(), mCtr);
@@ -726,12 +761,7 @@ int MegaDecryptor::validateAndProcessHeader(rtc::ArrayView<const uint8_t> header
         }
 
         mKeyId = auxKeyId;
-        setKey(decryptionKey);
-
-        if (!mInitialized)
-        {
-            mInitialized = true;
-        }
+        mInitialized = true;
     }
 
     return static_cast<int>(Status::kOk);
@@ -747,13 +777,22 @@ webrtc::FrameDecryptorInterface::Result MegaDecryptor::Decrypt(cricket::MediaTyp
         return Result(Status::kRecoverable, 0);
     }
 
-    if (encrypted_frame.empty())
+    if (encrypted_frame.size() < FRAME_HEADER_LENGTH + FRAME_GCM_TAG_LENGTH)
     {
         // error with the given frame, don't pass to the decoder, but the receive stream is still decryptable
-        RTCM_LOG_WARNING("Decrypt: received frame to be decrypted is empty");
+        RTCM_LOG_WARNING("Decrypt: received frame to be decrypted is empty or truncated: %lu", encrypted_frame.size());
         return Result(Status::kRecoverable, 0);
     }
 
+    // check if frame size is the expected one for the decrypted frame
+    size_t expectedFrameSize = GetMaxPlaintextByteSize(media_type, encrypted_frame.size());
+    if (expectedFrameSize > frame.size())
+    {
+        RTCM_LOG_WARNING("Decrypt: Decrypted frame size: %lu doesn't match with expected size: %lu Cid: %u, PeerId: %s, KeyId: %u, frameCtr: %u",
+                               frame.size(), expectedFrameSize, mPeer.getCid(), mPeer.getPeerid().toString().c_str(), mKeyId, mCtr);
+        return Result(Status::kRecoverable, 0); // don't pass to the decoder
+    }
+
     // extract header, encrypted frame data, and gcmTag(message hash or MAC) from encrypted_frame
     rtc::ArrayView<const byte> header = encrypted_frame.subview(0, FRAME_HEADER_LENGTH);
     rtc::ArrayView<const byte> data   = encrypted_frame.subview(FRAME_HEADER_LENGTH, encrypted_frame.size() - FRAME_HEADER_LENGTH - FRAME_GCM_TAG_LENGTH);
@@ -769,30 +808,33 @@ webrtc::FrameDecryptorInterface::Result MegaDecryptor::Decrypt(cricket::MediaTyp
     }
 
     // re-build frame iv with staticIv and frame CTR
-    std::unique_ptr<byte []> iv = generateFrameIV();
+    byte iv[FRAME_IV_LENGTH];
+    generateFrameIV(iv);
 
-    // decrypt frame and store it in frame
-    if (!mSymCipher.gcm_decrypt_aad(data.data(), static_cast<unsigned int>(data.size()),
-                                     header.data(), FRAME_HEADER_LENGTH,
-                                     gcmTag.data(), FRAME_GCM_TAG_LENGTH,
-                                     iv.get(), FRAME_IV_LENGTH,
-                                     frame.data(), frame.size()))
+    // decrypt frame straight into frame
+    bool verified = false;
+    try
     {
-        RTCM_LOG_WARNING("Failed gcm_decrypt_aad decryption with additional authenticated data: mid: %u Cid: %u, PeerId: %s, KeyId: %u, frameCtr: %u",
-                         mMid, mPeer.getCid(), mPeer.getPeerid().toString().c_str(), mKeyId, mCtr);
-        return Result(Status::kRecoverable, 0); // decryption error, don't pass to the decoder
+        verified = mCipher->DecryptAndVerify(frame.data(),
+                                             gcmTag.data(), FRAME_GCM_TAG_LENGTH,
+                                             iv, FRAME_IV_LENGTH,
+                                             header.data(), FRAME_HEADER_LENGTH,
+                                             data.data(), data.size());
+    }
+    catch (const CryptoPP::Exception& e)
+    {
+        RTCM_LOG_WARNING("Decrypt: exception: %s", e.what());
     }
 
-    // check if decrypted frame size is the expected one
-    assert(GetMaxPlaintextByteSize(media_type, encrypted_frame.size()) == frame.size());
-    size_t expectedFrameSize = GetMaxPlaintextByteSize(media_type, encrypted_frame.size());
-    if (expectedFrameSize != frame.size())
+    if (!verified)
     {
-        RTCM_LOG_WARNING("Decrypt: Decrypted frame size: %lu doesn't match with expected size: %lu Cid: %u, PeerId: %s, KeyId: %u, frameCtr: %u",
-                               frame.size(), expectedFrameSize, mPeer.getCid(), mPeer.getPeerid().toString().c_str(), mKeyId, mCtr);
+        RTCM_LOG_WARNING("Failed gcm_decrypt_aad decryption with additional authenticated data: mid: %u Cid: %u, PeerId: %s, KeyId: %u, frameCtr: %u",
+                         mMid, mPeer.getCid(), mPeer.getPeerid().toString().c_str(), mKeyId, mCtr);
         return Result(Status::kRecoverable, 0); // decryption error, don't pass to the decoder
     }
-    return Result(Status::kOk, frame.size());
+
+    assert(expectedFrameSize == data.size());
+    return Result(Status::kOk, expectedFrameSize);
 }
 
 size_t MegaDecryptor::GetMaxPlaintextByteSize(cricket::MediaType /*media_type*/, size_t encrypted_frame_size)
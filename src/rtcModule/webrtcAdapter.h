@@ -31,6 +31,8 @@
 #pragma GCC diagnostic pop
 #endif
 #include "sfu.h"
+#include <cryptopp/aes.h>
+#include <cryptopp/gcm.h>
 
 
 #ifdef __OBJC__
@@ -363,20 +365,39 @@ public:
 class RtcCipher
 {
 public:
+    // length of the frame keys (AES-128)
+    static constexpr size_t kKeyLength = 16;
+
+    // max number of expanded keys kept, so switching between recent keys (ie. upon key rotation) doesn't re-expand them
+    static constexpr size_t kMaxCachedKeys = 4;
+
     RtcCipher(const sfu::Peer& peer, std::shared_ptr<::rtcModule::IRtcCryptoMeetings> cryptoMeetings, IvStatic_t iv, uint32_t mid);
     virtual ~RtcCipher() {}
 
-    // set a key for SymmCipher
-    void setKey(const std::string &key);
+    // arms the key with keyId of mPeer in the cipher. Returns false if the peer doesn't have that key
+    bool armKey(Keyid_t keyId);
 
-    // generates an IV for a new frame
-    std::unique_ptr<byte []> generateFrameIV();
+    // generates the IV for the current frame into iv (FRAME_IV_LENGTH bytes)
+    void generateFrameIV(byte* iv) const;
 
     void setTerminating();
 
 protected:
-    // symmetric cipher
-    mega::SymmCipher mSymCipher;
+    struct CachedKey
+    {
+        Keyid_t keyId;
+        byte key[kKeyLength];
+        std::unique_ptr<CryptoPP::AuthenticatedSymmetricCipher> cipher;
+    };
+
+    // creates a cipher for encryption or decryption, whose key schedule is kept in mCachedKeys
+    virtual std::unique_ptr<CryptoPP::AuthenticatedSymmetricCipher> createCipher() const = 0;
+
+    // AES-GCM cipher with the key armed (owned by mCachedKeys)
+    CryptoPP::AuthenticatedSymmetricCipher* mCipher = nullptr;
+
+    // expanded keys, most recently used first
+    std::vector<CachedKey> mCachedKeys;
 
     // sequential number of the packet
     Ctr_t mCtr = 0;
@@ -427,6 +448,9 @@ public:
                         size_t* bytes_written) override;
     // returns the encrypted_frame size for a given frame
     size_t GetMaxCiphertextByteSize(cricket::MediaType media_type, size_t frame_size) override;
+
+protected:
+    std::unique_ptr<CryptoPP::AuthenticatedSymmetricCipher> createCipher() const override;
 };
 
 class MegaDecryptor
@@ -450,6 +474,9 @@ public:
                    rtc::ArrayView<uint8_t> frame) override;
     // returns the plain_frame size for a given encrypted frame
     size_t GetMaxPlaintextByteSize(cricket::MediaType media_type, size_t encrypted_frame_size) override;
+
+protected:
+    std::unique_ptr<CryptoPP::AuthenticatedSymmetricCipher> createCipher() const override;
 };
 
 class LocalStreamHandle
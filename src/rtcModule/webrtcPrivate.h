@@ -8,9 +8,15 @@
 #include <rtcModule/webrtcAdapter.h>
 
 #include <logger.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <sfu.h>
+#include <workerPool.h>
 #include <variant>
 
 namespace rtcModule
@@ -96,6 +102,91 @@ private:
     void enableTrack(bool enable, TrackDirection direction);
 };
 
+/**
+ * @brief Per-track counters of the video frame conversion pipeline
+ */
+struct VideoFrameStats
+{
+    size_t queueDepth = 0;              // frames waiting to be converted
+    uint64_t droppedFrames = 0;         // stale frames discarded because the queue was full
+    uint64_t convertedFrames = 0;       // frames delivered to the renderer
+    uint64_t totalConversionUs = 0;     // accumulated time spent converting frames
+    uint64_t maxConversionUs = 0;       // slowest conversion of a single frame
+};
+
+/**
+ * @brief Bounded queue of decoded frames pending conversion for a single renderer
+ *
+ * Frames are pushed from webrtc (or karere) threads and converted by VideoFrameConverter,
+ * either in the karere thread or in its workers. When the queue is full, the oldest frame
+ * is dropped since it would be stale by the time it's rendered. A queue is processed by one
+ * thread at a time, so frames reach the renderer in order.
+ */
+class VideoFrameQueue
+{
+public:
+    static constexpr size_t kDefaultMaxFrames = 2;
+
+    VideoFrameQueue(int sourceType, void* appCtx, size_t maxFrames = kDefaultMaxFrames);
+
+    // Replaces the renderer. It doesn't wait for an ongoing conversion to the previous renderer,
+    // which may be blocked in the app (ie. waiting for sdkMutex): the worker destroys it instead
+    void setRenderer(IVideoRenderer* renderer);
+    bool hasRenderer() const;
+
+    // Discards pending frames and the renderer. No conversion is started after this returns
+    void close();
+
+    // Waits until the workers have destroyed the renderers handed over by setRenderer.
+    // It must not be called while holding sdkMutex
+    static void waitRetiredRenderers();
+
+    // Returns false if the frame has been discarded because there's no renderer
+    bool push(const webrtc::VideoFrame& frame);
+    VideoFrameStats getStats() const;
+
+private:
+    friend class VideoFrameConverter;
+
+    std::optional<webrtc::VideoFrame> popFrame(IVideoRenderer*& renderer);
+
+    // Returns true if more frames are pending and the queue has to be processed again.
+    // The renderer replaced during the conversion, if any, is moved to retired
+    bool onFrameConverted(uint64_t elapsedUs, std::unique_ptr<IVideoRenderer>& retired);
+
+    const int mSourceType;
+    void* const mAppCtx;
+    const size_t mMaxFrames;
+    mutable std::mutex mMutex;
+    std::deque<webrtc::VideoFrame> mFrames;
+    std::unique_ptr<IVideoRenderer> mRenderer;
+    std::unique_ptr<IVideoRenderer> mRetiredRenderer;   // replaced while a worker was converting to it
+    bool mScheduled = false;    // queued in the converter or being processed by a worker
+    bool mConverting = false;   // a worker is converting a frame to mRenderer
+    VideoFrameStats mStats;
+};
+
+/**
+ * @brief Converts the frames of the queues in the karere thread, or in a karere::WorkerPool
+ * of its own if enabled by setInWorkers()
+ *
+ * The renderers of the app are called while converting, so they must not delay the
+ * decryption of messages, which runs in karere::WorkerPool::getInstance().
+ */
+class VideoFrameConverter
+{
+public:
+    static void schedule(const std::shared_ptr<VideoFrameQueue>& queue);
+    static void setInWorkers(bool enable);
+
+private:
+    static karere::WorkerPool& pool();
+    static std::atomic<bool> sInWorkers;
+
+    // Converts the next frame of the queue, if it still exists
+    static void convert(const std::weak_ptr<VideoFrameQueue>& wqueue);
+};
+
 class VideoSink : public rtc::VideoSinkInterface<webrtc::VideoFrame>, public karere::DeleteTrackable
 {
 public:
@@ -110,12 +201,22 @@ public:
     VideoSink(void* appCtx);
     virtual ~VideoSink();
     void setVideoRender(IVideoRenderer* videoRenderer);
+    VideoFrameStats getFrameStats() const;
+    // converts the frame to the formats requested by the renderer and delivers it
     static void processFrame(const webrtc::VideoFrame& frame,
-                             const std::unique_ptr<IVideoRenderer>& render,
+                             IVideoRenderer* render,
                              const int sourceType);
     virtual void OnFrame(const webrtc::VideoFrame& frame) override;
+
+protected:
+    static VideoFramePlanes getI420Planes(const rtc::scoped_refptr<webrtc::I420BufferInterface>& buffer);
+    static VideoFramePlanes getNv12Planes(const rtc::scoped_refptr<const webrtc::NV12BufferInterface>& buffer);
+
+    // pushes the frame to the queue and schedules its conversion
+    static void enqueueFrame(const std::shared_ptr<VideoFrameQueue>& queue, const webrtc::VideoFrame& frame);
+
 private:
-    std::unique_ptr<IVideoRenderer> mRenderer;
+    std::shared_ptr<VideoFrameQueue> mFrameQueue;
     void* mAppCtx;
 };
 
@@ -818,28 +919,45 @@ protected:
 
 class RtcModuleSfu;
 
-class RtcCameraVideoSink : public VideoSink
+/**
+ * @brief Base class for the sinks of local capture devices, whose frames are rendered once per chat
+ */
+class RtcLocalVideoSink : public VideoSink
 {
 public:
-    std::map<karere::Id, std::unique_ptr<IVideoRenderer>> mRenderers;
+    // frame queue (and renderer) for every chat
+    std::map<karere::Id, std::shared_ptr<VideoFrameQueue>> mRenderers;
+
+    RtcLocalVideoSink(void *appCtx, const RtcModuleSfu& moduleSfu, int sourceType);
+    ~RtcLocalVideoSink();
+    void addRenderer(const karere::Id& chatid, IVideoRenderer* videoRenderer);
+    void removeRenderer(const karere::Id& chatid);
+    bool hasRenderer(const karere::Id& chatid) const;
+    VideoFrameStats getFrameStats(const karere::Id& chatid) const;
+
+protected:
+    // enqueues the frame for the renderers of the chats whose call is sending this source
+    void onLocalFrame(const webrtc::VideoFrame& frame, bool (*isSending)(const karere::AvFlags&));
 
-    RtcCameraVideoSink(void *appCtx, const RtcModuleSfu& moduleSfu): VideoSink(appCtx), mModuleSfu(moduleSfu), mAppCtx(appCtx) {}
-    void OnFrame(const webrtc::VideoFrame& frame) override;
-private:
     const RtcModuleSfu& mModuleSfu;
+    const int mSourceType;
     void* mAppCtx;
 };
 
-class RtcScreenVideoSink : public VideoSink
+class RtcCameraVideoSink : public RtcLocalVideoSink
 {
 public:
-    std::map<karere::Id, std::unique_ptr<IVideoRenderer>> mRenderers;
+    RtcCameraVideoSink(void *appCtx, const RtcModuleSfu& moduleSfu)
+        : RtcLocalVideoSink(appCtx, moduleSfu, VideoSink::Rtc_Type_Video_source_Local_Camera) {}
+    void OnFrame(const webrtc::VideoFrame& frame) override;
+};
 
-    RtcScreenVideoSink(void *appCtx, const RtcModuleSfu& moduleSfu): VideoSink(appCtx), mModuleSfu(moduleSfu), mAppCtx(appCtx) {}
+class RtcScreenVideoSink : public RtcLocalVideoSink
+{
+public:
+    RtcScreenVideoSink(void *appCtx, const RtcModuleSfu& moduleSfu)
+        : RtcLocalVideoSink(appCtx, moduleSfu, VideoSink::Rtc_Type_Video_source_Local_Screen) {}
     void OnFrame(const webrtc::VideoFrame& frame) override;
-private:
-    const RtcModuleSfu& mModuleSfu;
-    void* mAppCtx;
 };
 
 class RtcModuleSfu : public RtcModule, public karere::DeleteTrackable
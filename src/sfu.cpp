@@ -6,6 +6,8 @@
 
 #include <rapidjson/writer.h>
 
+#include <algorithm>
+#include <iterator>
 #include <memory>
 
 
@@ -77,31 +79,151 @@ const std::string SfuConnection::CSFU_SETLIMIT          = "SETLIM";         // C
 const std::string SfuConnection::CSFU_RHAND_ADD       = "RHAND";            // Command sent to raise hand to speak (no speak permission involved in this command)
 const std::string SfuConnection::CSFU_RHAND_DEL       = "RHAND_DEL";        // Command sent to lower hand to speak (no speak permission involved in this command)
 
-CommandsQueue::CommandsQueue():
-    isSending(false)
+CommandsQueue::CommandsQueue()
 {
 }
 
-bool CommandsQueue::sending()
+bool CommandsQueue::empty() const
 {
-    return isSending;
+    return mItems.empty();
 }
 
-void CommandsQueue::setSending(bool sending)
+size_t CommandsQueue::size() const
 {
-    isSending = sending;
+    return mItems.size();
 }
 
-std::string CommandsQueue::pop()
+void CommandsQueue::clear()
 {
-    if (empty())
+    mItems.clear();
+    mInFlight = 0;
+    mBarrierInFlight = false;
+}
+
+void CommandsQueue::push(Item&& item)
+{
+    if (item.mergeType != kNoMerge && !item.barrier)
     {
-        return std::string();
+        // a removal cancels the pending additions of the same CIDs. Only the queued commands after
+        // the last non-mergeable one are considered, so the order with respect to it is kept
+        MergeType cancelled = item.mergeType == kDelVthumbs ? kGetVthumbs
+                            : item.mergeType == kDelHiRes ? kGetHiRes
+                            : kNoMerge;
+        auto runStart = mItems.end();
+        while (runStart != mItems.begin() && std::prev(runStart)->mergeType != kNoMerge)
+        {
+            --runStart;
+        }
+
+        std::vector<Cid_t> cancelledCids;
+        for (auto it = runStart; cancelled != kNoMerge && it != mItems.end();)
+        {
+            if (it->mergeType == cancelled)
+            {
+                auto removed = std::remove_if(it->cids.begin(), it->cids.end(), [&item](Cid_t cid)
+                {
+                    return std::find(item.cids.begin(), item.cids.end(), cid) != item.cids.end();
+                });
+                if (removed != it->cids.end())
+                {
+                    cancelledCids.insert(cancelledCids.end(), removed, it->cids.end());
+                    it->cids.erase(removed, it->cids.end());
+                    if (it->cids.empty())
+                    {
+                        it = mItems.erase(it);
+                        mMergedCommands++;
+                        continue;
+                    }
+                }
+            }
+            ++it;
+        }
+
+        // the SFU never received the cancelled additions, so there's nothing to remove for those CIDs
+        if (!cancelledCids.empty())
+        {
+            item.cids.erase(std::remove_if(item.cids.begin(), item.cids.end(), [&cancelledCids](Cid_t cid)
+            {
+                return std::find(cancelledCids.begin(), cancelledCids.end(), cid) != cancelledCids.end();
+            }), item.cids.end());
+            if (item.cids.empty())
+            {
+                mMergedCommands++;
+                return;
+            }
+        }
+
+        // GET_HIRES carries per-CID parameters, so it's never merged
+        if (item.mergeType != kGetHiRes && !mItems.empty() && mItems.back().mergeType == item.mergeType)
+        {
+            std::vector<Cid_t>& cids = mItems.back().cids;
+            for (Cid_t cid : item.cids)
+            {
+                if (std::find(cids.begin(), cids.end(), cid) == cids.end())
+                {
+                    cids.push_back(cid);
+                }
+            }
+            mMergedCommands++;
+            return;
+        }
+    }
+
+    mItems.push_back(std::move(item));
+}
+
+bool CommandsQueue::canSendNext() const
+{
+    if (mItems.empty() || mBarrierInFlight)
+    {
+        return false;
     }
 
-    std::string command = std::move(front());
-    pop_front();
-    return command;
+    return mItems.front().barrier ? !mInFlight : mInFlight < mWindow;
+}
+
+CommandsQueue::Item CommandsQueue::pop()
+{
+    assert(!mItems.empty());
+    Item item = std::move(mItems.front());
+    mItems.pop_front();
+    mInFlight++;
+    mBarrierInFlight = item.barrier;
+    return item;
+}
+
+void CommandsQueue::onCommandSent()
+{
+    assert(mInFlight);
+    if (mInFlight)
+    {
+        mInFlight--;
+    }
+
+    if (!mInFlight)
+    {
+        mBarrierInFlight = false;
+    }
+}
+
+unsigned CommandsQueue::inFlight() const
+{
+    return mInFlight;
+}
+
+unsigned CommandsQueue::window() const
+{
+    return mWindow;
+}
+
+void CommandsQueue::setWindow(unsigned window)
+{
+    mWindow = std::max(window, 1u);
+}
+
+size_t CommandsQueue::mergedCommands() const
+{
+    return mMergedCommands;
 }
 
 Peer::Peer(const karere::Id& peerid, const sfu::SfuProtocol sfuProtoVersion, const unsigned avFlags, const std::vector<std::string>* ivs, const Cid_t cid, const bool isModerator)
@@ -166,6 +288,18 @@ std::string Peer::getKey(Keyid_t keyid) const
     return key;
 }
 
+bool Peer::copyKey(Keyid_t keyid, uint8_t* key, size_t keyLength) const
+{
+    auto it = mKeyMap.find(keyid);
+    if (it == mKeyMap.end() || it->second.size() != keyLength)
+    {
+        return false;
+    }
+
+    memcpy(key, it->second.data(), keyLength);
+    return true;
+}
+
 void Peer::addKey(Keyid_t keyid, const std::string &key)
 {
     mCurrentkeyId = keyid;
@@ -1618,6 +1752,13 @@ void SfuConnection::retryPendingConnection(bool disconnect)
 }
 
 bool SfuConnection::sendCommand(const std::string &command)
+{
+    CommandsQueue::Item item;
+    item.command = command;
+    return sendCommand(std::move(item));
+}
+
+bool SfuConnection::sendCommand(CommandsQueue::Item&& item)
 {
     if (!isOnline())
         return false;
@@ -1636,69 +1777,72 @@ bool SfuConnection::sendCommand(const std::string &command)
         });
     }
 
-    addNewCommand(command);
+    addNewCommand(std::move(item));
     return true;
 }
 
-void SfuConnection::addNewCommand(const std::string &command)
+void SfuConnection::addNewCommand(CommandsQueue::Item&& item)
 {
     checkThreadId();    // Check that commandsQueue is always accessed from a single thread
 
-    mCommandsQueue.push_back(command);   // push command in the queue
+    mCommandsQueue.push(std::move(item));   // push command in the queue (it may be merged with queued ones)
     processNextCommand();
 }
 
-void SfuConnection::processNextCommand(bool resetSending)
+void SfuConnection::processNextCommand(bool commandSent)
 {
     checkThreadId(); // Check that commandsQueue is always accessed from a single thread
 
-    if (resetSending)
+    if (commandSent)
     {
-        // upon wsSendMsgCb we need to reset isSending flag
-        mCommandsQueue.setSending(false);
+        // upon wsProcessNextMsgCb a command in flight has been written to the socket
+        mCommandsQueue.onCommandSent();
         if (isSendingByeCommand())
         {
+            // BYE is sent alone, so it's the command that has been written
             mCall.onByeCommandSent();
             return; // we have sent BYE command to SFU, following commands will be ignored
         }
     }
 
-    if (mCommandsQueue.empty() || mCommandsQueue.sending())
+    if (!mCommandsQueue.canSendNext())
     {
         std::string msg = "processNextCommand: skip processing next command";
         if (mCommandsQueue.empty())     { msg.append(", mCommandsQueue is empty"); }
-        if (mCommandsQueue.sending())   { msg.append(", sending is true"); }
+        if (mCommandsQueue.inFlight())  { msg.append(", commands in flight: " + std::to_string(mCommandsQueue.inFlight())); }
         SFU_LOG_DEBUG("%s", msg.c_str());
         return;
     }
 
-    mCommandsQueue.setSending(true);
-    std::string command = mCommandsQueue.pop();
-
-    // mCommandsQueue is a sequencial queue, so new commands just can be processed if previous commands have already been sent
-    if (command.find("{\"a\":\"BYE\",\"rsn\":") != std::string::npos)
+    while (mCommandsQueue.canSendNext())
     {
-        // set mIsSendingBye flag true, to indicate that we are going to send BYE command
-        setIsSendingBye(true);
-    }
+        CommandsQueue::Item item = mCommandsQueue.pop();
+        std::string command = serializeCommand(item);
+
+        // barrier commands are sent alone, so once BYE is popped, following commands won't be sent
+        if (item.barrier && command.find("{\"a\":\"BYE\",\"rsn\":") != std::string::npos)
+        {
+            // set mIsSendingBye flag true, to indicate that we are going to send BYE command
+            setIsSendingBye(true);
+        }
 
-    assert(!command.empty());
-    SFU_LOG_DEBUG("Send command: %s", command.c_str());
-    std::unique_ptr<char[]> buffer(mega::MegaApi::strdup(command.c_str()));
-    bool rc = wsSendMessage(buffer.get(), command.length());
+        assert(!command.empty());
+        SFU_LOG_DEBUG("Send command: %s", command.c_str());
+        std::unique_ptr<char[]> buffer(mega::MegaApi::strdup(command.c_str()));
+        bool rc = wsSendMessage(buffer.get(), command.length());
 
-    if (!rc)
-    {
-        mSendPromise.reject("Socket is not ready");
-        if (isSendingByeCommand())
+        if (!rc)
         {
-             // if wsSendMessage failed inmediately trying to send BYE command, call onSendByeCommand in order to
-             // execute the expected action (retry, remove or disconnect call) that triggered the BYE command sent
-             mCommandsQueue.setSending(false);
-             mCall.onByeCommandSent();
-             return;
+            mSendPromise.reject("Socket is not ready");
+            mCommandsQueue.onCommandSent();
+            if (isSendingByeCommand())
+            {
+                 // if wsSendMessage failed inmediately trying to send BYE command, call onSendByeCommand in order to
+                 // execute the expected action (retry, remove or disconnect call) that triggered the BYE command sent
+                 mCall.onByeCommandSent();
+                 return;
+            }
         }
-        processNextCommand(true);
     }
 }
 
@@ -1708,7 +1852,44 @@ void SfuConnection::clearCommandsQueue()
     SFU_LOG_WARNING("SfuConnection: clearing commands queue");
     setIsSendingBye(false);
     mCommandsQueue.clear();
-    mCommandsQueue.setSending(false);
+}
+
+void SfuConnection::setCommandsWindow(unsigned window)
+{
+    checkThreadId(); // Check that commandsQueue is always accessed from a single thread
+    mCommandsQueue.setWindow(window);
+}
+
+std::string SfuConnection::serializeCommand(const CommandsQueue::Item& item) const
+{
+    if (!item.command.empty())
+    {
+        return item.command;
+    }
+
+    const std::string& commandName = item.mergeType == CommandsQueue::kGetVthumbs ? CSFU_GET_VTHUMBS
+                                   : item.mergeType == CommandsQueue::kDelVthumbs ? CSFU_DEL_VTHUMBS
+                                   : CSFU_DEL_HIRES;
+    assert(item.mergeType == CommandsQueue::kGetVthumbs
+           || item.mergeType == CommandsQueue::kDelVthumbs
+           || item.mergeType == CommandsQueue::kDelHiRes);
+
+    rapidjson::Document json(rapidjson::kObjectType);
+    rapidjson::Value cmdValue(rapidjson::kStringType);
+    cmdValue.SetString(commandName.c_str(), json.GetAllocator());
+    json.AddMember(rapidjson::Value(Command::COMMAND_IDENTIFIER.c_str(), static_cast<rapidjson::SizeType>(Command::COMMAND_IDENTIFIER.length())), cmdValue, json.GetAllocator());
+
+    rapidjson::Value cidsValue(rapidjson::kArrayType);
+    for(Cid_t cid : item.cids)
+    {
+        cidsValue.PushBack(rapidjson::Value(cid), json.GetAllocator());
+    }
+    json.AddMember("cids", cidsValue, json.GetAllocator());
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    json.Accept(writer);
+    return std::string(buffer.GetString(), buffer.GetSize());
 }
 
 void SfuConnection::checkThreadId()
@@ -1996,11 +2177,13 @@ bool SfuConnection::joinSfu(const Sdp& sdp,
     rapidjson::StringBuffer buffer;
     rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
     json.Accept(writer);
-    std::string command(buffer.GetString(), buffer.GetSize());
+    CommandsQueue::Item item;
+    item.command.assign(buffer.GetString(), buffer.GetSize());
+    item.barrier = true;
 
     setConnState(SfuConnection::kJoining);
 
-    return sendCommand(command);
+    return sendCommand(std::move(item));
 }
 
 bool SfuConnection::sendKey(Keyid_t id, const std::map<Cid_t, std::string>& keys)
@@ -2058,46 +2241,19 @@ bool SfuConnection::sendAv(unsigned av)
 
 bool SfuConnection::sendGetVtumbs(const std::vector<Cid_t> &cids)
 {
-    rapidjson::Document json(rapidjson::kObjectType);
-    rapidjson::Value cmdValue(rapidjson::kStringType);
-    cmdValue.SetString(SfuConnection::CSFU_GET_VTHUMBS.c_str(), json.GetAllocator());
-    json.AddMember(rapidjson::Value(Command::COMMAND_IDENTIFIER.c_str(), static_cast<rapidjson::SizeType>(Command::COMMAND_IDENTIFIER.length())), cmdValue, json.GetAllocator());
-
-    rapidjson::Value cidsValue(rapidjson::kArrayType);
-    for(Cid_t cid : cids)
-    {
-        cidsValue.PushBack(rapidjson::Value(cid), json.GetAllocator());
-    }
-
-    json.AddMember("cids", cidsValue, json.GetAllocator());
-
-    rapidjson::StringBuffer buffer;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-    json.Accept(writer);
-    std::string command(buffer.GetString(), buffer.GetSize());
-    return sendCommand(command);
+    // serialized when it's sent, so later vthumb requests for the same CIDs can be merged
+    CommandsQueue::Item item;
+    item.mergeType = CommandsQueue::kGetVthumbs;
+    item.cids = cids;
+    return sendCommand(std::move(item));
 }
 
 bool SfuConnection::sendDelVthumbs(const std::vector<Cid_t> &cids)
 {
-    rapidjson::Document json(rapidjson::kObjectType);
-    rapidjson::Value cmdValue(rapidjson::kStringType);
-    cmdValue.SetString(SfuConnection::CSFU_DEL_VTHUMBS.c_str(), json.GetAllocator());
-    json.AddMember(rapidjson::Value(Command::COMMAND_IDENTIFIER.c_str(), static_cast<rapidjson::SizeType>(Command::COMMAND_IDENTIFIER.length())), cmdValue, json.GetAllocator());
-
-    rapidjson::Value cidsValue(rapidjson::kArrayType);
-    for(Cid_t cid : cids)
-    {
-        cidsValue.PushBack(rapidjson::Value(cid), json.GetAllocator());
-    }
-
-    json.AddMember("cids", cidsValue, json.GetAllocator());
-
-    rapidjson::StringBuffer buffer;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-    json.Accept(writer);
-    std::string command(buffer.GetString(), buffer.GetSize());
-    return sendCommand(command);
+    CommandsQueue::Item item;
+    item.mergeType = CommandsQueue::kDelVthumbs;
+    item.cids = cids;
+    return sendCommand(std::move(item));
 }
 
 bool SfuConnection::sendGetHiRes(Cid_t cid, int r, int lo)
@@ -2118,29 +2274,21 @@ bool SfuConnection::sendGetHiRes(Cid_t cid, int r, int lo)
     rapidjson::StringBuffer buffer;
     rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
     json.Accept(writer);
-    std::string command(buffer.GetString(), buffer.GetSize());
-    return sendCommand(command);
+
+    // a DEL_HIRES for the same CID queued later cancels it
+    CommandsQueue::Item item;
+    item.command.assign(buffer.GetString(), buffer.GetSize());
+    item.mergeType = CommandsQueue::kGetHiRes;
+    item.cids.push_back(cid);
+    return sendCommand(std::move(item));
 }
 
 bool SfuConnection::sendDelHiRes(const std::vector<Cid_t> &cids)
 {
-    rapidjson::Document json(rapidjson::kObjectType);
-    rapidjson::Value cmdValue(rapidjson::kStringType);
-    cmdValue.SetString(SfuConnection::CSFU_DEL_HIRES.c_str(), json.GetAllocator());
-    json.AddMember(rapidjson::Value(Command::COMMAND_IDENTIFIER.c_str(), static_cast<rapidjson::SizeType>(Command::COMMAND_IDENTIFIER.length())), cmdValue, json.GetAllocator());
-
-    rapidjson::Value cidsValue(rapidjson::kArrayType);
-    for(Cid_t cid : cids)
-    {
-        cidsValue.PushBack(rapidjson::Value(cid), json.GetAllocator());
-    }
-    json.AddMember("cids", cidsValue, json.GetAllocator());
-
-    rapidjson::StringBuffer buffer;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-    json.Accept(writer);
-    std::string command(buffer.GetString(), buffer.GetSize());
-    return sendCommand(command);
+    CommandsQueue::Item item;
+    item.mergeType = CommandsQueue::kDelHiRes;
+    item.cids = cids;
+    return sendCommand(std::move(item));
 }
 
 bool SfuConnection::sendHiResSetLo(Cid_t cid, int lo)
@@ -2250,8 +2398,11 @@ bool SfuConnection::sendBye(int termCode)
     rapidjson::StringBuffer buffer;
     rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
     json.Accept(writer);
-    std::string command(buffer.GetString(), buffer.GetSize());
-    return sendCommand(command);
+
+    CommandsQueue::Item item;
+    item.command.assign(buffer.GetString(), buffer.GetSize());
+    item.barrier = true;
+    return sendCommand(std::move(item));
 }
 
 void SfuConnection::clearInitialBackoff()       { mInitialBackoff = 0; }
@@ -2509,9 +2660,9 @@ void SfuConnection::wsCloseCb(int errcode, int errtype, const char *preason, siz
     onSocketClose(errcode, errtype, reason);
 }
 
-void SfuConnection::wsHandleMsgCb(char *data, size_t len)
+void SfuConnection::wsHandleMsgCb(const RecvBuffer& msg)
 {
-    handleIncomingData(data, len);
+    handleIncomingData(msg.buf(), msg.dataSize());
 }
 
 void SfuConnection::wsSendMsgCb(const char *, size_t)
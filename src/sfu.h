@@ -81,16 +81,52 @@ static constexpr int kCallLimitDisabled = -1;
 // The classes that instantiates it, are responsible to ensure that.
 // In case we need to access to it from another thread, we would need to implement
 // a synchronization mechanism (like a mutex).
-class CommandsQueue : public std::deque<std::string>
+//
+// Up to window() commands can be in flight (handed to the socket, but not written yet).
+// Barrier commands (JOIN/BYE) are sent alone: they wait for the commands in flight before them,
+// and the following commands wait for them.
+class CommandsQueue
 {
-protected:
-    bool isSending = false;
-
 public:
+    // Commands for a list of CIDs that can be merged while queued, if there's no other command between them
+    enum MergeType: uint8_t
+    {
+        kNoMerge = 0,
+        kGetVthumbs,    // merged with GET_VTHUMBS, removed by DEL_VTHUMBS for the same CIDs
+        kDelVthumbs,    // merged with DEL_VTHUMBS, not sent for the CIDs whose GET_VTHUMBS it removed
+        kGetHiRes,      // removed by DEL_HIRES for the same CID
+        kDelHiRes,      // merged with DEL_HIRES, not sent for the CIDs whose GET_HIRES it removed
+    };
+
+    struct Item
+    {
+        std::string command;        // serialized command (empty for merge types serialized when popped)
+        MergeType mergeType = kNoMerge;
+        std::vector<Cid_t> cids;
+        bool barrier = false;
+    };
+
+    static constexpr unsigned kDefaultWindow = 8;
+
     CommandsQueue();
-    bool sending();
-    void setSending(bool sending);
-    std::string pop();
+    bool empty() const;
+    size_t size() const;
+    void clear();
+    void push(Item&& item);
+    bool canSendNext() const;   // true if the next command can be popped and sent
+    Item pop();
+    void onCommandSent();       // a command in flight has been written, or failed to be sent
+    unsigned inFlight() const;
+    unsigned window() const;
+    void setWindow(unsigned window);
+    size_t mergedCommands() const;
+
+protected:
+    std::deque<Item> mItems;
+    unsigned mWindow = kDefaultWindow;
+    unsigned mInFlight = 0;
+    bool mBarrierInFlight = false;
+    size_t mMergedCommands = 0;  // commands merged into (or cancelled by) another one
 };
 
 class Peer
@@ -112,6 +148,8 @@ public:
     bool hasAnyKey() const;
     Keyid_t getCurrentKeyId() const;
     std::string getKey(Keyid_t keyid) const;
+    // copies the key into a caller-provided buffer (no allocations). Returns false if not found or length doesn't match
+    bool copyKey(Keyid_t keyid, uint8_t* key, size_t keyLength) const;
     void addKey(Keyid_t keyid, const std::string& key);
     void resetKeys();
     const std::vector<std::string>& getIvs() const;
@@ -770,12 +808,16 @@ public:
     void doConnect(const std::string &ipv4, const std::string &ipv6);
     void retryPendingConnection(bool disconnect);
     bool sendCommand(const std::string& command);
+    bool sendCommand(CommandsQueue::Item&& item);
     static bool parseSfuData(const char* data, rapidjson::Document& jsonDoc, SfuData& outdata);
     static void setCallbackToCommands(sfu::SfuInterface &call, std::map<std::string, std::unique_ptr<sfu::Command>>& commands);
     bool handleIncomingData(const char *data, size_t len);
-    void addNewCommand(const std::string &command);
-    void processNextCommand(bool resetSending = false);
+    void addNewCommand(CommandsQueue::Item&& item);
+    void processNextCommand(bool commandSent = false);
     void clearCommandsQueue();
+    // number of commands that can be in flight, 1 disables pipelining
+    void setCommandsWindow(unsigned window);
+    std::string serializeCommand(const CommandsQueue::Item& item) const;
     void checkThreadId();
     const karere::Url& getSfuUrl();
 
@@ -848,7 +890,7 @@ protected:
 
     void wsConnectCb() override;
     void wsCloseCb(int errcode, int errtype, const char *preason, size_t preason_len) override;
-    void wsHandleMsgCb(char *data, size_t len) override;
+    void wsHandleMsgCb(const RecvBuffer& msg) override;
     void wsSendMsgCb(const char *, size_t) override;
     void wsProcessNextMsgCb() override;
 #if WEBSOCKETS_TLS_SESSION_CACHE_ENABLED
@@ -30,6 +30,8 @@
 #endif
 #include <locale>
 #include <karereCommon.h>
+#include <workerPool.h>
+#include <atomic>
 
 namespace strongvelope
 {
@@ -44,6 +46,63 @@ struct Context
     EcKey edKey;
 };
 
+/**
+ * @brief Messages being decrypted by the karere::WorkerPool
+ *
+ * Everything the workers need is copied from the app thread when the batch is created,
+ * so they never access the chatd::Message objects nor the ProtocolHandler. The results
+ * are applied to the messages back in the app thread, in the same order.
+ */
+struct DecryptBatch
+{
+    // Number of messages decrypted by each task scheduled in the pool
+    static constexpr size_t kMessagesPerTask = 32;
+
+    struct Item
+    {
+        chatd::Message* msg;
+        std::shared_ptr<ParsedMessage> parsedMsg;
+        std::shared_ptr<SendKey> sendKey;
+        std::string edKey;
+        bool signatureValid = true;
+        bool decrypted = false;
+        std::string cleartext;
+    };
+
+    std::vector<Item> items;
+    bool verifySignatures;
+    unsigned int cacheVersion;
+    // the last task to finish hands the batch over to the app thread. Until then, the batch is
+    // owned by the tasks, so it's released if the pool drops them at exit
+    std::atomic<size_t> pendingTasks;
+    std::function<bool()> canApply;
+    std::function<void()> onComplete;
+
+    void decrypt(size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; i++)
+        {
+            Item& item = items[i];
+            if (verifySignatures
+                    && !item.parsedMsg->verifySignature(StaticBuffer(item.edKey, false), *item.sendKey))
+            {
+                item.signatureValid = false;
+                continue;
+            }
+
+            try
+            {
+                item.cleartext = item.parsedMsg->decryptPayload(*item.sendKey);
+                item.decrypted = true;
+            }
+            catch (std::exception&)
+            {
+                // the message is marked as malformed when the results are applied
+            }
+        }
+    }
+};
+
 chatd::KeyId ProtocolHandler::mCurrentLocalKeyId = static_cast<chatd::KeyId>(CHATD_KEYID_MAX);
 
 const std::string SVCRYPTO_PAIRWISE_KEY = "strongvelope pairwise key\x01";
@@ -114,6 +173,13 @@ void ParsedMessage::symmetricDecrypt(const StaticBuffer& key, Message& outMsg)
     }
     Id chatid = mProtoHandler.chatid;   // for the log below
     STRONGVELOPE_LOG_DEBUG("Decrypting msg %s", outMsg.id().toString().c_str());
+    std::string cleartext = decryptPayload(key);
+    parsePayload(StaticBuffer(cleartext, false), outMsg);
+    outMsg.setEncrypted(Message::kNotEncrypted);
+}
+
+std::string ParsedMessage::decryptPayload(const StaticBuffer& key) const
+{
     Key<32> derivedNonce;
     // deriveNonceSecret() needs at least 32 bytes output buffer
     deriveNonceSecret(nonce, derivedNonce);
@@ -121,10 +187,8 @@ void ParsedMessage::symmetricDecrypt(const StaticBuffer& key, Message& outMsg)
     // For AES CRT mode, we take the first 12 bytes as the nonce,
     // and the remaining 4 bytes as the counter, which is initialized to zero
     *reinterpret_cast<uint32_t*>(derivedNonce.buf()+SVCRYPTO_NONCE_SIZE) = 0;
-    std::string cleartext = aesCTRDecrypt(std::string(payload.buf(), payload.dataSize()),
+    return aesCTRDecrypt(std::string(payload.buf(), payload.dataSize()),
         key, derivedNonce);
-    parsePayload(StaticBuffer(cleartext, false), outMsg);
-    outMsg.setEncrypted(Message::kNotEncrypted);
 }
 
 /**
@@ -1202,6 +1266,37 @@ Promise<Message*> ProtocolHandler::msgDecrypt(Message* message)
                                   " keyid: "+std::to_string(message->keyid), EINVAL, SVCRYPTO_EMALFORMED);
         }
 
+        // Fast path: if both keys are already in memory, decrypt right away, without
+        // chaining promises
+        std::shared_ptr<SendKey> sendKey = getCachedKey(*message);
+        const Buffer* edKey = (sendKey && !isPublicChat()) ? getCachedSigningKey(parsedMsg->sender) : nullptr;
+        if (sendKey && (isPublicChat() || edKey))
+        {
+            mKeyLookupStats.sendKeyHits++;
+            if (!isPublicChat())
+            {
+                mKeyLookupStats.signingKeyHits++;
+                if (!parsedMsg->verifySignature(*edKey, *sendKey))
+                {
+                    return ::promise::Error("Signature invalid for message "+
+                                          message->id().toString(), EINVAL, SVCRYPTO_ESIGNATURE);
+                }
+            }
+
+            parsedMsg->symmetricDecrypt(*sendKey, *message);
+            return message;
+        }
+
+        if (sendKey)
+        {
+            mKeyLookupStats.sendKeyHits++;
+            mKeyLookupStats.signingKeyMisses++;
+        }
+        else
+        {
+            mKeyLookupStats.sendKeyMisses++;
+        }
+
         // Get keyid
         uint32_t keyid = message->keyid;
         auto ctx = std::make_shared<Context>();
@@ -1274,13 +1369,153 @@ Promise<Message*> ProtocolHandler::msgDecrypt(Message* message)
             return message;
         });
     }
-    catch(std::runtime_error& e)
+    catch(std::exception& e)
     {
-        // ParsedMessage ctor throws if unexpected format, unknown/missing TLVs, etc.
+        // ParsedMessage ctor throws if unexpected format, unknown/missing TLVs, etc., and
+        // so may the payload decryption in the fast path
         return ::promise::Error(e.what(), EINVAL, SVCRYPTO_EMALFORMED);
     }
 }
 
+size_t ProtocolHandler::msgDecryptBatch(const std::vector<Message*>& msgs,
+    std::function<bool()> canApply, std::function<void()> onComplete)
+{
+    std::shared_ptr<DecryptBatch> batch = std::make_shared<DecryptBatch>();
+    batch->verifySignatures = !isPublicChat();
+    batch->cacheVersion = mCacheVersion;
+    batch->items.reserve(msgs.size());
+    for (Message* message: msgs)
+    {
+        // Stop at the first message that msgDecrypt() has to handle: deleted and management
+        // messages, and those whose keys are not available yet
+        if (message->empty() || message->userid == karere::Id::COMMANDER())
+        {
+            break;
+        }
+
+        std::shared_ptr<ParsedMessage> parsedMsg;
+        try
+        {
+            parsedMsg = std::make_shared<ParsedMessage>(*message, *this);
+        }
+        catch (std::runtime_error&)
+        {
+            break;  // msgDecrypt() will mark it as malformed
+        }
+
+        if (parsedMsg->payload.empty()
+                || (parsedMsg->type >= Message::kMsgManagementLowest
+                    && parsedMsg->type <= Message::kMsgManagementHighest))
+        {
+            break;
+        }
+
+        std::shared_ptr<SendKey> sendKey = getCachedKey(*message);
+        if (!sendKey)
+        {
+            break;
+        }
+
+        const Buffer* edKey = nullptr;
+        if (batch->verifySignatures)
+        {
+            edKey = getCachedSigningKey(parsedMsg->sender);
+            if (!edKey)
+            {
+                break;
+            }
+            mKeyLookupStats.signingKeyHits++;
+        }
+        mKeyLookupStats.sendKeyHits++;
+
+        message->type = static_cast<Message::Type>(parsedMsg->type);
+        batch->items.emplace_back();
+        DecryptBatch::Item& item = batch->items.back();
+        item.msg = message;
+        item.parsedMsg = std::move(parsedMsg);
+        item.sendKey = std::move(sendKey);
+        if (edKey)
+        {
+            item.edKey.assign(edKey->buf(), edKey->dataSize());
+        }
+    }
+
+    size_t count = batch->items.size();
+    if (!count)
+    {
+        return 0;
+    }
+
+    size_t numTasks = (count + DecryptBatch::kMessagesPerTask - 1) / DecryptBatch::kMessagesPerTask;
+    STRONGVELOPE_LOG_DEBUG("Decrypting %zu messages in %zu tasks", count, numTasks);
+    batch->pendingTasks = numTasks;
+    batch->canApply = std::move(canApply);
+    batch->onComplete = std::move(onComplete);
+
+    auto wptr = weakHandle();
+    void* ctx = appCtx;
+    for (size_t first = 0; first < count; first += DecryptBatch::kMessagesPerTask)
+    {
+        size_t last = std::min(first + DecryptBatch::kMessagesPerTask, count);
+        karere::WorkerPool::getInstance().schedule([this, wptr, ctx, batch, first, last]()
+        {
+            batch->decrypt(first, last);
+            if (--batch->pendingTasks)
+            {
+                return;
+            }
+
+            marshallCall([this, wptr, batch]()
+            {
+                if (wptr.deleted())
+                {
+                    return;
+                }
+
+                if (batch->cacheVersion != mCacheVersion)
+                {
+                    STRONGVELOPE_LOG_DEBUG("msgDecryptBatch: history was reloaded, ignoring %zu messages",
+                                           batch->items.size());
+                    return;
+                }
+
+                if (!batch->canApply())
+                {
+                    return;
+                }
+
+                for (DecryptBatch::Item& item: batch->items)
+                {
+                    Message& message = *item.msg;
+                    if (!item.signatureValid)
+                    {
+                        STRONGVELOPE_LOG_ERROR("Signature invalid for message %s", message.id().toString().c_str());
+                        message.setEncrypted(Message::kEncryptedSignature);
+                        continue;
+                    }
+
+                    try
+                    {
+                        if (!item.decrypted)
+                        {
+                            throw std::runtime_error("payload decryption failed");
+                        }
+                        item.parsedMsg->parsePayload(StaticBuffer(item.cleartext, false), message);
+                        message.setEncrypted(Message::kNotEncrypted);
+                    }
+                    catch (std::exception& e)
+                    {
+                        STRONGVELOPE_LOG_ERROR("Malformed message %s: %s", message.id().toString().c_str(), e.what());
+                        message.setEncrypted(Message::kEncryptedMalformed);
+                    }
+                }
+                batch->onComplete();
+            }, ctx);
+        });
+    }
+    return count;
+}
+
 void ProtocolHandler::onKeyReceived(KeyId keyid, Id sender, Id receiver,
                                     const char* data, uint16_t dataLen, bool isEncrypted)
 {
@@ -1356,6 +1591,8 @@ void ProtocolHandler::addDecryptedKey(UserKeyId ukid, const std::shared_ptr<Send
         {
             mDb.query("insert or ignore into sendkeys(chatid, userid, keyid, key, ts) values(?,?,?,?,?)",
                 chatid, ukid.user, ukid.keyid, *key, (int)time(NULL));
+            // messages stored with this key can't be decrypted after a restart without it
+            mDb.flushGroupedWrites();
         }
         catch(std::exception& e)
         {
@@ -1371,6 +1608,32 @@ void ProtocolHandler::addDecryptedKey(UserKeyId ukid, const std::shared_ptr<Send
         entry.pms.reset();
     }
 }
+std::shared_ptr<SendKey> ProtocolHandler::getCachedKey(const Message& msg) const
+{
+    if (msg.keyid == CHATD_KEYID_INVALID)   // message was posted while open mode
+    {
+        return (mHasUnifiedKey && mUnifiedKeyDecrypted.succeeded())
+                ? mUnifiedKeyDecrypted.value()
+                : nullptr;
+    }
+
+    auto kit = mKeys.find(UserKeyId(msg.userid, msg.keyid));
+    return (kit != mKeys.end()) ? kit->second.key : nullptr;
+}
+
+const Buffer* ProtocolHandler::getCachedSigningKey(karere::Id sender) const
+{
+    const Buffer* edKey = mUserAttrCache.getDataFromCache(sender,
+        ::mega::MegaApi::USER_ATTR_ED25519_PUBLIC_KEY);
+    // keys of unexpected size are left to the promise path, which reports the error
+    return (edKey && edKey->dataSize() == EcKey::bufSize()) ? edKey : nullptr;
+}
+
+chatd::KeyLookupStats ProtocolHandler::keyLookupStats() const
+{
+    return mKeyLookupStats;
+}
+
 promise::Promise<std::shared_ptr<SendKey>>
 ProtocolHandler::getKey(UserKeyId ukid)
 {
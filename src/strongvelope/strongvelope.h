@@ -189,6 +189,8 @@ struct ParsedMessage: public karere::DeleteTrackable
     void parsePayload(const StaticBuffer& data, chatd::Message& msg);
     void parsePayloadWithUtfBackrefs(const StaticBuffer& data, chatd::Message& msg);
     void symmetricDecrypt(const StaticBuffer& key, chatd::Message& outMsg);
+    /** Returns the decrypted payload. It doesn't use mProtoHandler, so it can run in any thread */
+    std::string decryptPayload(const StaticBuffer& key) const;
     promise::Promise<chatd::Message*> decryptChatTitle(chatd::Message* msg, bool msgCanBeDeleted);
 };
 
@@ -321,6 +323,7 @@ protected:
     std::shared_ptr<UnifiedKey> mUnifiedKey;
     promise::Promise<std::shared_ptr<UnifiedKey>> mUnifiedKeyDecrypted;
     bool mHasUnifiedKey; // indicates if chat has unified key (although it's pending to be decrypted)
+    chatd::KeyLookupStats mKeyLookupStats;
 
 public:
     karere::Id chatid;
@@ -352,6 +355,11 @@ protected:
     void loadUnconfirmedKeysFromDb();
 
     promise::Promise<std::shared_ptr<SendKey>> getKey(UserKeyId ukid);
+    /** Returns the key to decrypt \c msg if it's already decrypted in memory, or nullptr.
+     * Unlike getKey(), no promise is created, so it's cheap for every received message */
+    std::shared_ptr<SendKey> getCachedKey(const chatd::Message& msg) const;
+    /** Returns the Ed25519 pubkey of \c sender if it's already in the user attribute cache, or nullptr */
+    const Buffer* getCachedSigningKey(karere::Id sender) const;
     void addDecryptedKey(UserKeyId ukid, const std::shared_ptr<SendKey>& key);
     /**
      * Updates our own sender key. Done when a message is sent and users
@@ -407,6 +415,9 @@ public:
     promise::Promise<std::pair<chatd::MsgCommand*, chatd::KeyCommand*>>
     msgEncrypt(chatd::Message *message, const karere::SetOfIds &recipients, chatd::MsgCommand* msgCmd) override;
     promise::Promise<chatd::Message*> msgDecrypt(chatd::Message* message) override;
+    size_t msgDecryptBatch(const std::vector<chatd::Message*>& msgs,
+        std::function<bool()> canApply, std::function<void()> onComplete) override;
+    chatd::KeyLookupStats keyLookupStats() const override;
     void onKeyReceived(chatd::KeyId keyid, karere::Id sender,
         karere::Id receiver, const char* data, uint16_t dataLen, bool isEncrypted) override;
     void onKeyConfirmed(chatd::KeyId localkeyid, chatd::KeyId keyid) override;
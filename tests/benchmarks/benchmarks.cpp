@@ -0,0 +1,387 @@
+/**
+ * @file benchmarks.cpp
+ * @brief Timing and memory measurements of MEGAchat internals
+ *
+ * The correctness of the code measured here is checked by the unit tests in sdk_test.
+ * These benchmarks only report figures (they don't fail because of them), so they
+ * aren't run along with the tests. Run them with --gtest_filter to select some of them.
+ *
+ * (c) 2013-2015 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include "urlTestData.h"
+
+#include <megachatapi_impl.h>
+
+#ifndef KARERE_DISABLE_WEBRTC
+#include <rtcModule/webrtcAdapter.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-compare"
+#endif
+#include "gtest/gtest.h"
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+using namespace megachat;
+
+namespace
+{
+struct TestChatListItem : public MegaChatListItem
+{
+    MegaChatHandle chatid = MEGACHAT_INVALID_HANDLE;
+    int unread = 0;
+    int64_t ts = 0;
+    bool group = false;
+    bool archived = false;
+    MegaChatHandle getChatId() const override { return chatid; }
+    int getUnreadCount() const override { return unread; }
+    int64_t getLastTimestamp() const override { return ts; }
+    bool isGroup() const override { return group; }
+    bool isArchived() const override { return archived; }
+    MegaChatHandle getPeerHandle() const override { return group ? MEGACHAT_INVALID_HANDLE : chatid; }
+    const char* getTitle() const override { return "Chat title"; }
+    const char* getLastMessage() const override { return "Last message of the chat"; }
+};
+
+double elapsedSince(std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return std::max(elapsed.count(), 1e-9);
+}
+}
+
+TEST(MegaChatBenchmark, ParseUrl)
+{
+    const std::vector<std::string> corpus = urltest::urlCorpus(20000);
+    size_t corpusBytes = 0;
+    for (const std::string& text : corpus)
+    {
+        corpusBytes += text.size();
+    }
+
+    auto throughput = [&corpus, corpusBytes](bool (*hasUrl)(const std::string&, std::string&))
+    {
+        std::string url;
+        auto start = std::chrono::steady_clock::now();
+        for (const std::string& text : corpus)
+        {
+            hasUrl(text, url);
+        }
+        return static_cast<double>(corpusBytes) / (1024 * 1024) / elapsedSince(start);
+    };
+    double legacyMBps = throughput(&urltest::legacyHasUrl);
+    double newMBps = throughput(&chatd::Message::hasUrl);
+    std::cout << "ParseUrl: " << corpus.size() << " texts, " << corpusBytes << " bytes. "
+              << "Regex: " << legacyMBps << " MB/s, scanner: " << newMBps << " MB/s" << std::endl;
+}
+
+TEST(MegaChatBenchmark, MessageArenaMemory)
+{
+    // payload sizes between 16 and 400 bytes, like most text messages
+    const size_t numMsgs = 10000;
+    std::vector<std::unique_ptr<chatd::Message>> msgs;
+    uint32_t seed = 7;
+    for (size_t i = 0; i < numMsgs; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        std::string text(16 + (seed >> 8) % 385, static_cast<char>('a' + i % 26));
+        msgs.emplace_back(std::make_unique<chatd::Message>(karere::Id(1), karere::Id(2), 0, 0,
+                                                           Buffer(), false, 0, false,
+                                                           chatd::Message::kMsgNormal));
+        msgs.back()->assign(text.data(), text.size());
+    }
+
+    // estimate of the heap used by a block: 8 bytes of header, rounded up to 16 bytes
+    auto heapBlock = [](size_t size) { return (size + 8 + 15) & ~static_cast<size_t>(15); };
+
+    size_t heapBytes = 0;
+    for (const auto& msg: msgs)
+    {
+        heapBytes += heapBlock(sizeof(chatd::Message)) + heapBlock(msg->bufSize());
+    }
+
+    BufferArena arena;
+    for (auto& msg: msgs)
+    {
+        arena.adopt(*msg);
+    }
+    size_t arenaBytes = msgs.size() * heapBlock(sizeof(chatd::Message)) + arena.liveBytes();
+
+    std::cout << "MessageArenaMemory: " << numMsgs << " messages, sizeof(Message): " << sizeof(chatd::Message)
+              << ". Bytes per message with heap payloads: " << heapBytes / numMsgs
+              << ", with arena payloads: " << arenaBytes / numMsgs << std::endl;
+}
+
+#ifndef KARERE_DISABLE_WEBRTC
+TEST(MegaChatBenchmark, SfuFrameCrypto)
+{
+    const std::string key("0123456789abcdef");
+    sfu::Peer peer(karere::Id(0x1234), sfu::SfuProtocol::SFU_PROTO_PROD, 0, nullptr, 7);
+    peer.addKey(3, key);
+    const IvStatic_t iv = 0x0102030405060708;
+    rtc::scoped_refptr<artc::MegaEncryptor> encryptor(new artc::MegaEncryptor(peer, nullptr, iv, 0));
+    rtc::scoped_refptr<artc::MegaDecryptor> decryptor(new artc::MegaDecryptor(peer, nullptr, iv, 0));
+
+    // typical sizes of an Opus frame (20 ms) and a VP8 frame
+    for (size_t frameSize : {160u, 12000u})
+    {
+        std::vector<uint8_t> frame(frameSize);
+        std::mt19937 rng(static_cast<unsigned>(frameSize));
+        std::generate(frame.begin(), frame.end(), [&rng]() { return static_cast<uint8_t>(rng()); });
+        std::vector<uint8_t> encrypted(encryptor->GetMaxCiphertextByteSize(cricket::MEDIA_TYPE_VIDEO, frame.size()));
+        std::vector<uint8_t> decrypted(decryptor->GetMaxPlaintextByteSize(cricket::MEDIA_TYPE_VIDEO, encrypted.size()));
+        size_t written = 0;
+
+        // throughput of the encrypt + decrypt round trip
+        const int iterations = frameSize < 1000 ? 20000 : 2000;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++)
+        {
+            encryptor->Encrypt(cricket::MEDIA_TYPE_VIDEO, 0, {}, frame, encrypted, &written);
+            decryptor->Decrypt(cricket::MEDIA_TYPE_VIDEO, {}, {}, encrypted, decrypted);
+        }
+        double seconds = elapsedSince(start);
+        std::cout << "SfuFrameCrypto: frame size " << frameSize << " bytes: " << iterations / seconds << " frames/s, "
+                  << seconds * 1e9 / (static_cast<double>(iterations) * frameSize) << " ns/byte (encrypt + decrypt)" << std::endl;
+    }
+}
+#endif
+
+TEST(MegaChatBenchmark, PromiseThenChain)
+{
+    // throughput of then() chains, on resolved promises and on promises resolved afterwards
+    const int iterations = 200000;
+    int64_t sum = 0;
+    auto chainsPerSec = [iterations, &sum](bool resolveFirst)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++)
+        {
+            promise::Promise<int> input;
+            if (resolveFirst)
+            {
+                input.resolve(i);
+            }
+            input.then([](int val) { return val + 1; })
+                 .then([](int val) { return val * 2; })
+                 .then([&sum](int val) { sum += val; });
+            if (!resolveFirst)
+            {
+                input.resolve(i);
+            }
+        }
+        return iterations / elapsedSince(start);
+    };
+    double resolvedRate = chainsPerSec(true);
+    double pendingRate = chainsPerSec(false);
+    EXPECT_EQ(sum, 2 * 2 * (static_cast<int64_t>(iterations) * (iterations + 1) / 2));
+    std::cout << "PromiseThenChain: chains of 3 then() per second. Resolved: " << resolvedRate
+              << ", resolved afterwards: " << pendingRate << std::endl;
+}
+
+TEST(MegaChatBenchmark, ChatListSnapshotReaders)
+{
+    // reader threads listing the chats while the karere thread holds the sdkMutex for every
+    // loop iteration (i.e. loading history), served under the mutex or from the snapshot
+    const int numChats = 1000;
+    const int numReaders = 4;
+    ChatListSnapshot snapshot;
+    std::vector<std::unique_ptr<TestChatListItem>> chats;
+    for (int i = 0; i < numChats; i++)
+    {
+        chats.emplace_back(new TestChatListItem());
+        chats.back()->chatid = static_cast<MegaChatHandle>(i + 1);
+        snapshot.update(*chats.back());
+    }
+
+    std::recursive_mutex sdkMutex;
+    auto contention = [&](bool fromSnapshot, double& maxLatencyMs)
+    {
+        std::atomic<bool> stop{false};
+        std::atomic<int> reads{0};
+        std::thread karere([&]()
+        {
+            std::mt19937 gen(1);
+            while (!stop)
+            {
+                {
+                    std::lock_guard<std::recursive_mutex> g(sdkMutex);
+                    auto iterationEnd = std::chrono::steady_clock::now() + std::chrono::milliseconds(5);
+                    while (std::chrono::steady_clock::now() < iterationEnd)
+                    {
+                        TestChatListItem& chat = *chats[gen() % numChats];
+                        chat.unread++;
+                        snapshot.update(chat);
+                    }
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+
+        std::vector<double> maxLatency(numReaders, 0);
+        std::vector<std::thread> readers;
+        for (int i = 0; i < numReaders; i++)
+        {
+            readers.emplace_back([&, i]()
+            {
+                while (!stop)
+                {
+                    auto start = std::chrono::steady_clock::now();
+                    std::unique_ptr<MegaChatListItemListPrivate> items(new MegaChatListItemListPrivate());
+                    if (fromSnapshot)
+                    {
+                        snapshot.forEach(0, [&items](const ChatListSnapshot::EntryPtr& entry)
+                        {
+                            items->addChatListItem(ChatListSnapshot::itemOf(entry));
+                        });
+                    }
+                    else
+                    {
+                        std::lock_guard<std::recursive_mutex> g(sdkMutex);
+                        for (const auto& chat : chats)
+                        {
+                            items->addChatListItem(new MegaChatListItemPrivate(chat.get()));
+                        }
+                    }
+                    maxLatency[i] = std::max(maxLatency[i], elapsedSince(start) * 1000);
+                    reads++;
+                }
+            });
+        }
+
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        stop = true;
+        karere.join();
+        for (auto& reader : readers)
+        {
+            reader.join();
+        }
+        maxLatencyMs = *std::max_element(maxLatency.begin(), maxLatency.end());
+        return reads.load();
+    };
+
+    double lockedLatency = 0;
+    double snapshotLatency = 0;
+    int lockedReads = contention(false, lockedLatency);
+    int snapshotReads = contention(true, snapshotLatency);
+    std::cout << "ChatListSnapshotReaders: " << numReaders << " readers listing " << numChats
+              << " chats per second. Under sdkMutex: " << lockedReads << " (max " << lockedLatency
+              << " ms), from snapshot: " << snapshotReads << " (max " << snapshotLatency << " ms)" << std::endl;
+}
+
+TEST(MegaChatBenchmark, ChatListFilterIndexes)
+{
+    // a filtered listing costs the size of its result, not the number of chats
+    const int numChats = 5000;
+    std::mt19937 gen(1);
+    ChatListSnapshot snapshot;
+    for (int i = 0; i < numChats; i++)
+    {
+        TestChatListItem item;
+        item.chatid = static_cast<MegaChatHandle>(i + 1);
+        item.unread = (gen() % 3) ? 0 : static_cast<int>(gen() % 5) - 1;
+        item.group = gen() % 2;
+        item.archived = !(i % 500);
+        snapshot.update(item);
+    }
+
+    const int iterations = 2000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        std::unique_ptr<MegaChatListItemListPrivate> archived(new MegaChatListItemListPrivate());
+        snapshot.forEach(ChatListSnapshot::indexesOf(MegaChatApi::CHAT_FILTER_BY_ARCHIVED_OR_NON_ARCHIVED, MegaChatApi::CHAT_GET_ARCHIVED),
+                         [&archived](const ChatListSnapshot::EntryPtr& entry)
+        {
+            archived->addChatListItem(ChatListSnapshot::itemOf(entry));
+        });
+        EXPECT_EQ(archived->size(), static_cast<unsigned>(numChats / 500));
+    }
+    std::cout << "ChatListFilterIndexes: listing " << numChats / 500 << " archived chats out of " << numChats
+              << " takes " << elapsedSince(start) * 1e6 / iterations << " us" << std::endl;
+}
+
+TEST(MegaChatBenchmark, ChatListActivityPages)
+{
+    // the first page costs its size, not the number of chats that have to be sorted
+    const int numChats = 10000;
+    const size_t pageSize = 20;
+    std::mt19937 gen(1);
+    ChatListSnapshot snapshot;
+    std::vector<TestChatListItem> items(numChats);
+    for (int i = 0; i < numChats; i++)
+    {
+        items[i].chatid = static_cast<MegaChatHandle>(i + 1);
+        items[i].ts = gen() % 1000000;
+        snapshot.update(items[i]);
+    }
+
+    const int iterations = 200;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        std::vector<ChatListSnapshot::EntryPtr> all;
+        snapshot.forEach(0, [&all](const ChatListSnapshot::EntryPtr& entry)
+        {
+            all.push_back(entry);
+        });
+        std::partial_sort(all.begin(), all.begin() + pageSize, all.end(), [](const ChatListSnapshot::EntryPtr& a, const ChatListSnapshot::EntryPtr& b)
+        {
+            return ChatListSnapshot::activityKeyOf(a->item) < ChatListSnapshot::activityKeyOf(b->item);
+        });
+    }
+    double sortTime = elapsedSince(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        EXPECT_EQ(snapshot.page(0, nullptr, pageSize).size(), pageSize);
+    }
+    double pageTime = elapsedSince(start);
+
+    // new activity in a chat moves it to the front
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < numChats; i++)
+    {
+        items[i].ts = 1000000 + i;
+        snapshot.update(items[i]);
+    }
+    double updateTime = elapsedSince(start);
+
+    std::cout << "ChatListActivityPages: first " << pageSize << " of " << numChats << " chats by sorting them: "
+              << sortTime * 1e6 / iterations << " us, from the index: " << pageTime * 1e6 / iterations
+              << " us. Updating the timestamp of a chat: " << updateTime * 1e6 / numChats << " us" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
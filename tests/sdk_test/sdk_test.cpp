@@ -1,16 +1,28 @@
 #include "gtest_common.h"
 #include "sdk_test.h"
 #include "sdk_test_utils.h"
+#include "urlTestData.h"
 
 #include <mega.h>
 #include <megaapi.h>
 #include <mega/process.h>
+#include <chatdDb.h>
+#include <megachatapi_impl.h>
+
+#ifndef KARERE_DISABLE_WEBRTC
+#include <rtcModule/webrtcAdapter.h>
+#endif
 
 #ifdef _WIN32
 #include <direct.h>
 #endif
 
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <future>
 #include <memory>
+#include <random>
 
 using namespace mega;
 using namespace megachat;
@@ -2196,6 +2208,142 @@ TEST_F(MegaChatApiTest, RejectCall)
 }
 #endif
 
+/**
+ * @brief MegaChatApiTest.ChatListSnapshotFreshness
+ *
+ * After every iteration of the karere loop, the chat list items served to the app
+ * must match a fresh MegaChatListItem of their chatroom, including the properties
+ * that change without a notification of the list item.
+ *
+ * - Test1: Send messages and mark them as seen
+ * - Test2: Change the title
+ * - Test3: Archive and unarchive the chat
+ * - Test4: Start and end a call (with WebRTC)
+ */
+TEST_F(MegaChatApiTest, ChatListSnapshotFreshness)
+{
+    const unsigned a1 = 0;
+    const unsigned a2 = 1;
+
+    // mismatches found by the karere threads of both accounts
+    struct Mismatches
+    {
+        std::mutex mutex;
+        std::vector<std::string> found;
+    };
+    auto mismatches = std::make_shared<Mismatches>();
+
+    CleanupFunction testCleanup = [this, a1, a2]() -> void
+    {
+        LOG_debug << "MegaChatApiTest.ChatListSnapshotFreshness: Cleanup";
+        MegaChatApiTestAccess::setLoopIterationObserver(*megaChatApi[a1], nullptr);
+        MegaChatApiTestAccess::setLoopIterationObserver(*megaChatApi[a2], nullptr);
+        clearTemporalVars();
+#ifndef KARERE_DISABLE_WEBRTC
+        ExitBoolFlags eF;
+        addBoolVarAndExitFlag(mData.mOpIdx, eF, "callDestroyed", false); // mOpIdx - onChatCallUpdate(CALL_STATUS_DESTROYED)
+        endChatCall(mData.mOpIdx, eF, mData.mChatid);
+#endif
+        closeOpenedChatrooms();
+        logoutTestAccounts();
+    };
+    MegaMrProper p (testCleanup);
+
+    mData.mOpIdx = a1;  // set test operator role index
+    mData.mSessions.emplace(a1, login(a1));
+    mData.mSessions.emplace(a2, login(a2));
+    const MegaChatHandle a1Uh = megaChatApi[a1]->getMyUserHandle();
+    const MegaChatHandle a2Uh = megaChatApi[a2]->getMyUserHandle();
+    mData.mAccounts.emplace(a1, a1Uh);
+    mData.mAccounts.emplace(a2, a2Uh);
+    ASSERT_NO_FATAL_FAILURE(mData.areSessionsValid());
+    ASSERT_NO_FATAL_FAILURE(makeContacts(a1, a2));
+    ASSERT_NO_FATAL_FAILURE(mData.checkSessionsAndAccounts());
+
+    // set chat selection criteria
+    mData.mChatOptions.mCreate          = true;
+    mData.mChatOptions.mPublicChat      = false;
+    mData.mChatOptions.mMeetingRoom     = false;
+    mData.mChatOptions.mWaitingRoom     = false;
+    mData.mChatOptions.mSpeakRequest    = false;
+    mData.mChatOptions.mOpenInvite      = false;
+    mData.mChatOptions.mChatOpIdx = a1;
+    mData.mChatOptions.mOpPriv = megachat::MegaChatPeerList::PRIV_MODERATOR;
+    mData.mChatOptions.mChatPeerList.reset(megachat::MegaChatPeerList::createInstance());
+    mData.mChatOptions.mChatPeerList->addPeer(a2Uh, MegaChatPeerList::PRIV_STANDARD);
+    mData.mChatOptions.mChatPeerIdx.emplace_back(a2);
+
+    mData.mChatid = getGroupChatRoom();
+    const MegaChatHandle chatid = mData.mChatid;
+    ASSERT_NE(chatid, MEGACHAT_INVALID_HANDLE) << "Invalid chatid returned by getGroupChatRoom";
+
+    std::shared_ptr<TestChatRoomListener> crl(new TestChatRoomListener(this, megaChatApi, chatid));
+    mData.mChatroomListeners.emplace(a1, crl);
+    mData.mChatroomListeners.emplace(a2, crl);
+    ASSERT_TRUE(megaChatApi[a1]->openChatRoom(chatid, crl.get())) << "Can't open chatRoom a1 account";
+    ASSERT_TRUE(megaChatApi[a2]->openChatRoom(chatid, crl.get())) << "Can't open chatRoom a2 account";
+
+    for (unsigned i : {a1, a2})
+    {
+        MegaChatApi* api = megaChatApi[i];
+        MegaChatApiTestAccess::setLoopIterationObserver(*api, [api, i, mismatches]()
+        {
+            std::string stale = MegaChatApiTestAccess::staleChatListItem(*api);
+            if (!stale.empty())
+            {
+                std::lock_guard<std::mutex> lock(mismatches->mutex);
+                mismatches->found.push_back("account " + std::to_string(i) + ", chat " + stale);
+            }
+        });
+    }
+
+    LOG_debug << "#### Test1: Send messages and mark them as seen ####";
+    std::unique_ptr<MegaChatMessage> msgSent;
+    for (int i = 0; i < 3; i++)
+    {
+        msgSent.reset(sendTextMessageOrUpdate(a1, a2, chatid, "Chat list freshness " + std::to_string(i), crl.get()));
+        ASSERT_TRUE(msgSent) << "Failed to send message " << i;
+    }
+    ASSERT_TRUE(megaChatApi[a2]->setMessageSeen(chatid, msgSent->getMsgId())) << "Couldn't mark message as seen";
+
+    LOG_debug << "#### Test2: Change the title ####";
+    ASSERT_NO_FATAL_FAILURE(changeTitle(a1, crl.get(), chatid, "Chat list freshness"));
+
+    LOG_debug << "#### Test3: Archive and unarchive the chat ####";
+    for (bool archive : {true, false})
+    {
+        ChatRequestTracker crtArchive(megaChatApi[a2]);
+        megaChatApi[a2]->archiveChat(chatid, archive, &crtArchive);
+        ASSERT_EQ(crtArchive.waitForResult(), MegaChatError::ERROR_OK) << "Failed to (un)archive chat. Error: " << crtArchive.getErrorString();
+    }
+
+#ifndef KARERE_DISABLE_WEBRTC
+    LOG_debug << "#### Test4: Start and end a call ####";
+    ExitBoolFlags eF;
+    MegaChatHandle invalHandle = MEGACHAT_INVALID_HANDLE;
+    ASSERT_NO_FATAL_FAILURE(addHandleVar(a1, "CallIdInProgress", invalHandle));                           // a1 - callId received at onChatCallUpdate(CALL_STATUS_IN_PROGRESS)
+    ASSERT_NO_FATAL_FAILURE(addBoolVarAndExitFlag(a1, eF, "CallReceived"  , false));                      // a1 - onChatCallUpdate(CALL_STATUS_INITIAL)
+    ASSERT_NO_FATAL_FAILURE(addBoolVarAndExitFlag(a2, eF, "CallReceived"  , false));                      // a2 - onChatCallUpdate(CALL_STATUS_INITIAL)
+    ASSERT_NO_FATAL_FAILURE(addBoolVarAndExitFlag(a1, eF, "CallInProgress", false));                      // a1 - onChatCallUpdate(CALL_STATUS_IN_PROGRESS)
+    ASSERT_NO_FATAL_FAILURE(startCallInChat(a1, eF, chatid, false /*audio*/,
+                                            false /*video*/, false /*notRinging*/));
+    clearTemporalVars();
+
+    ExitBoolFlags eF1;
+    ASSERT_NO_FATAL_FAILURE(addBoolVarAndExitFlag(a1, eF1, "callDestroyed", false));                      // a1 - onChatCallUpdate(CALL_STATUS_DESTROYED)
+    ASSERT_NO_FATAL_FAILURE(endChatCall(a1, eF1, chatid));
+    clearTemporalVars();
+#endif
+
+    MegaChatApiTestAccess::setLoopIterationObserver(*megaChatApi[a1], nullptr);
+    MegaChatApiTestAccess::setLoopIterationObserver(*megaChatApi[a2], nullptr);
+    std::lock_guard<std::mutex> lock(mismatches->mutex);
+    for (const std::string& mismatch : mismatches->found)
+    {
+        ADD_FAILURE() << "Stale chat list item: " << mismatch;
+    }
+}
+
 /**
  * @brief MegaChatApiTest.ResumeSession
  *
@@ -3585,6 +3733,99 @@ TEST_F(MegaChatApiTest, DISABLED_OfflineMode)
     delete [] sessionSecondary;
 }
 
+/**
+ * @brief MegaChatApiTest.LazyChatroomInit
+ *
+ * Requirements:
+ * - Both accounts should be conctacts
+ * - The 1on1 chatroom between them should exist
+ * (if not accomplished, the test automatically solves the above)
+ *
+ * This test does the following:
+ *
+ * - Test1: Resume the session from cache with the lazy init of chatrooms enabled
+ * - Test2: Check the getters of chats and chat list items don't initialize the chatrooms
+ * - Test3: Open a chatroom and check only that one is initialized
+ *
+ */
+TEST_F(MegaChatApiTest, LazyChatroomInit)
+{
+    unsigned a1 = 0;
+    unsigned a2 = 1;
+
+    std::unique_ptr<MegaUser> user;
+    MegaChatHandle chatid = MEGACHAT_INVALID_HANDLE;
+    std::unique_ptr<char[]> primarySession;
+    std::unique_ptr<char[]> secondarySession;
+    std::unique_ptr<TestChatRoomListener> chatroomListener;
+    ASSERT_NO_FATAL_FAILURE(initChat(a1, a2, user, chatid, primarySession, secondarySession, chatroomListener));
+    megaChatApi[a1]->closeChatRoom(chatid, chatroomListener.get());
+    megaChatApi[a2]->closeChatRoom(chatid, chatroomListener.get());
+
+    LOG_debug << "#### Test1: Resume the session from cache, without connecting to chatd ####";
+    ASSERT_NO_FATAL_FAILURE(logout(a1, false));
+    megaChatApi[a1]->setLazyChatroomInit(true);
+    ASSERT_TRUE(chatApiInit(a1, primarySession.get()));
+
+    MegaChatApiImpl& impl = MegaChatApiTestAccess::impl(*megaChatApi[a1]);
+    auto isPending = [&impl](MegaChatHandle id)
+    {
+        MegaChatApiImpl::SdkMutexGuard g(impl.sdkMutex);
+        karere::ChatRoom* room = impl.findChatRoom(id);
+        return room && room->isChatdChatPending();
+    };
+
+    // rooms whose cached summary doesn't match their history (ie. with unsent messages) aren't lazy
+    std::vector<MegaChatHandle> lazyChats;
+    std::unique_ptr<MegaChatListItemList> items(megaChatApi[a1]->getChatListItems());
+    for (unsigned i = 0; i < items->size(); i++)
+    {
+        if (isPending(items->get(i)->getChatId()))
+        {
+            lazyChats.push_back(items->get(i)->getChatId());
+        }
+    }
+    ASSERT_FALSE(lazyChats.empty()) << "No chatroom has been loaded lazily";
+
+    LOG_debug << "#### Test2: Get chats and chat list items ####";
+    for (MegaChatHandle id : lazyChats)
+    {
+        std::unique_ptr<MegaChatRoom> room(megaChatApi[a1]->getChatRoom(id));
+        ASSERT_TRUE(room) << "Can't get the chatroom " << karere::Id(id).toString();
+        EXPECT_EQ(room->getRetentionTime(), 0u);
+        std::unique_ptr<MegaChatListItem> item(megaChatApi[a1]->getChatListItem(id));
+        ASSERT_TRUE(item) << "Can't get the chat list item " << karere::Id(id).toString();
+        EXPECT_EQ(megaChatApi[a1]->getChatConnectionState(id), MegaChatApi::CHAT_CONNECTION_OFFLINE);
+    }
+    megaChatApi[a1]->getUnreadChats();
+    std::unique_ptr<MegaChatListItemList> unreadItems(megaChatApi[a1]->getUnreadChatListItems());
+
+    // let the event loop run for a while: nothing else initializes them until they are opened
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+    for (MegaChatHandle id : lazyChats)
+    {
+        EXPECT_TRUE(isPending(id)) << "Chatroom " << karere::Id(id).toString() << " initialized before it's opened";
+    }
+
+    LOG_debug << "#### Test3: Open a chatroom ####";
+    MegaChatHandle openedChatid = lazyChats.front();
+    TestChatRoomListener openedListener(this, megaChatApi, openedChatid);
+    ASSERT_TRUE(megaChatApi[a1]->openChatRoom(openedChatid, &openedListener)) << "Can't open chatRoom account " << (a1+1);
+    EXPECT_FALSE(isPending(openedChatid)) << "Chatroom not initialized when it's opened";
+    for (size_t i = 1; i < lazyChats.size(); i++)
+    {
+        EXPECT_TRUE(isPending(lazyChats[i])) << "Chatroom " << karere::Id(lazyChats[i]).toString()
+                                             << " initialized when another one is opened";
+    }
+    megaChatApi[a1]->closeChatRoom(openedChatid, &openedListener);
+
+    // We need to ensure we finish the test being logged in for the tear down
+    megaChatApi[a1]->setLazyChatroomInit(false);
+    ASSERT_NO_FATAL_FAILURE(logout(a1));
+    primarySession.reset(login(a1));
+    ASSERT_TRUE(primarySession);
+}
+
 /**
  * @brief MegaChatApiTest.ClearHistory
  *
@@ -11821,142 +12062,1651 @@ TEST_F(MegaChatApiUnitaryTest, ParseUrl)
     }
 }
 
-#ifndef KARERE_DISABLE_WEBRTC
-TEST_F(MegaChatApiUnitaryTest, SfuDataReception)
+TEST_F(MegaChatApiUnitaryTest, ParseUrlDifferential)
 {
-    LOG_info << "___TEST SfuDataReception___";
-
-    MockupCall call;
-    std::map<std::string, std::unique_ptr<sfu::Command>> commands;
-    sfu::SfuConnection::setCallbackToCommands(call, commands);
-    std::map<std::string, bool> checkCommands;
-    checkCommands["{\"warn\":\"warn msg\"}"]                                                    = true;
-    checkCommands["{\"deny\":\"audio\",\"msg\":\"deny msg\"}"]                                  = true;
-    checkCommands["{\"err\":129,\"msg\":\"Error\"}"]                                            = true;
-    checkCommands["{\"a\":\"HIRES_STOP\"}"]                                                     = true;
-    checkCommands["{\"a\":\"PEERLEFT\",\"cid\":2,\"rsn\":65}"]                                  = true;
-    checkCommands["{\"a\":\"PEERJOIN\",\"cid\":2,\"userId\":\"amECEsVQJQ8\",\"av\":0,\"v\":2}"] = true;
-    checkCommands["{\"a\":\"HIRES_START\"}"]                                                    = true;
-    checkCommands["{\"a\":\"HELLO\",\"cid\":1,\"na\":20,\"mods\":[\"amECEsVQJQ8\"]}"]           = true;
-    checkCommands["{\"a\":\"AV\",\"cid\":3,\"av\":1}"]                                          = true;
-    checkCommands["{\"a\":\"VTHUMBS\",\"tracks\":[[2,0]]}"]                                     = true;
-    checkCommands["{\"a\":\"HIRES\",\"tracks\":[[2,0,1]]}"]                                     = true;
-    checkCommands["{\"a\":\"VTHUMB_START\"}"]                                                   = true;
-    checkCommands["{\"a\":\"VTHUMB_STOP\"}"]                                                    = true;
-    checkCommands["{\"a\":\"KEY\",\"id\":0,\"from\":2,"
-                  "\"key\":\"RE8HjOLZl8ITM7FMIbAcigPWxq7i6DGqLQm-aNLAkEk\"}"]                   = true;
+    LOG_info << "___TEST ParseUrlDifferential___";
 
-    for (const auto& testCase : checkCommands)
+    for (const std::string& text : urltest::urlCorpus(20000))
     {
-        rapidjson::Document document;
-        sfu::SfuConnection::SfuData outdata;
-        EXPECT_TRUE(sfu::SfuConnection::parseSfuData(testCase.first.c_str(), document, outdata))
-                << "[FAILED processing SFU command]: " << testCase.first << ". " << outdata.msg;
-
-        if (outdata.notificationType == sfu::SfuConnection::SfuData::SFU_COMMAND)
+        std::string url;
+        std::string legacyUrl;
+        bool found = chatd::Message::hasUrl(text, url);
+        bool legacyFound = urltest::legacyHasUrl(text, legacyUrl);
+        EXPECT_EQ(found, legacyFound) << "Different result for: " << text;
+        if (found && legacyFound)
         {
-            bool commandProcSuccess = (commands.find(outdata.notification) != commands.end()
-                    && commands[outdata.notification]->processCommand(document));
-            EXPECT_EQ(commandProcSuccess, testCase.second)
-                    << "[FAILED processing SFU command (notification)]: " << testCase.first << ". " << outdata.msg;
+            EXPECT_EQ(url, legacyUrl) << "Different url for: " << text;
         }
-        // else => SFU_WARN | SFU_ERROR | SFU_DENY
     }
 }
-#endif
 
-#ifdef USE_CRYPTOPP
-TEST_F(MegaChatApiUnitaryTest, EncryptMediaKeyWithEphemKey)
+TEST_F(MegaChatApiUnitaryTest, MessagePayloadSlices)
 {
-    LOG_info << "___TEST EncryptMediaKeyWithEphemKey___";
+    LOG_info << "___TEST MessagePayloadSlices___";
 
-    std::string encryptedMediaKeyBin, decryptedMediaKeyBin;
-    const std::string expEncryptedMediaKeyB64     = "IqVDFXcCDQKfazBoZxhNSjKMvk9eZYQISMYl_7S71K4"; //gitleaks:allow
-    const std::vector<::mega::byte> mediaKeyBin   = { 60,181,43,125,112,4,248,203,228,50,177,231,232,185,172,194 };
-    const std::vector<::mega::byte> ephemKeyBin   = { 129,216,111,114,44,70,116,227,184,43,159,102,5,134,9,84,125,16,221,217,31,4,37,11,89,137,120,133,205,7,141,247 };
-    const std::string ephemeralkeyStr(ephemKeyBin.begin(), ephemKeyBin.end());
-    const std::string mediaKeyStr(mediaKeyBin.begin(), mediaKeyBin.end());
+    auto pool = std::make_shared<RecvBufferPool>();
+    std::shared_ptr<Buffer> slab = pool->getSlab(64);
+    const Buffer* slabPtr = slab.get();
+    slab->append("first payload|second payload");
+    RecvBuffer frame(slab->buf(), slab->dataSize(), slab);
+    slab.reset();
 
-    // Encrypt media key with ephemeral key
-    ::mega::SymmCipher mSymCipher;
-    bool encryptResult = mSymCipher.cbc_encrypt_with_key(mediaKeyStr, encryptedMediaKeyBin, reinterpret_cast<const unsigned char *>(ephemeralkeyStr.data()), ephemeralkeyStr.size(), nullptr);
-    EXPECT_TRUE(encryptResult) << "Failed Media key cbc_encrypt";
+    auto makeMsg = [&frame](size_t offset, size_t len)
+    {
+        auto msg = std::make_unique<chatd::Message>(karere::Id(1), karere::Id(2), 0, 0,
+                                                    frame.slice(offset, len).share(), false,
+                                                    0, false, chatd::Message::kMsgInvalid);
+        msg->setEncrypted(chatd::Message::kEncryptedPending);
+        return msg;
+    };
+    std::unique_ptr<chatd::Message> first = makeMsg(0, 13);
+    std::unique_ptr<chatd::Message> second = makeMsg(14, 14);
+    ASSERT_TRUE(first->isShared() && second->isShared()) << "Payloads should reference the frame";
+    EXPECT_EQ(first->buf(), frame.buf()) << "Payload was copied";
+    EXPECT_TRUE(second->dataEquals("second payload", 14));
 
-    // Check encrypted key with expected one
-    const std::string encryptedMediaKeyB64 = ::mega::Base64::btoa(encryptedMediaKeyBin);
-    EXPECT_EQ(encryptedMediaKeyB64.compare(expEncryptedMediaKeyB64), 0) << "Expected encrypted key:" << expEncryptedMediaKeyB64 << " doesn't match with obtained: " << encryptedMediaKeyB64;
+    // decrypting (assigning the plain text) or giving up on it drops the reference
+    first->assign("plain text", 10);
+    EXPECT_FALSE(first->isShared());
+    EXPECT_TRUE(first->dataEquals("plain text", 10));
+    second->setEncrypted(chatd::Message::kEncryptedNoKey);
+    EXPECT_FALSE(second->isShared());
+    EXPECT_TRUE(second->dataEquals("second payload", 14));
 
-    // Decrypt media key with ephemeral key
-    bool decryptResult = mSymCipher.cbc_decrypt_with_key(encryptedMediaKeyBin, decryptedMediaKeyBin, reinterpret_cast<const unsigned char*>(ephemeralkeyStr.data()), ephemeralkeyStr.size(), nullptr);
-    EXPECT_TRUE(decryptResult) << "Failed Media key cbc_decrypt";
+    // a copy of a view without slab never references the original data
+    std::string transient = "transient";
+    Buffer copy = RecvBuffer(transient.data(), transient.size()).share();
+    EXPECT_FALSE(copy.isShared());
 
-    // Check decrypted key with expected one
-    EXPECT_EQ(decryptedMediaKeyBin.compare(mediaKeyStr), 0) << "Expected decrypted key: " << mediaKeyStr << " doesn't match with obtained: " << decryptedMediaKeyBin;
-}
-#endif
+    // once the frame is released, its slab is recycled
+    frame = RecvBuffer(nullptr, 0);
+    EXPECT_EQ(pool->getSlab(32).get(), slabPtr) << "Slab was not recycled";
 
-TestMegaRequestListener::TestMegaRequestListener(MegaApi *megaApi, MegaChatApi *megaChatApi)
-    : RequestListener(megaApi, megaChatApi)
-{
-}
+    // adopting payloads that reference a frame copies them, so they don't keep its slab alive
+    std::shared_ptr<Buffer> bigSlab = pool->getSlab(2048);
+    bigSlab->append(std::string(1500, 'x'));
+    bigSlab->append("short payload");
+    RecvBuffer bigFrame(bigSlab->buf(), bigSlab->dataSize(), bigSlab);
+    std::weak_ptr<const void> bigSlabRef = bigFrame.slab();
+    bigSlab.reset();
+    Buffer small = bigFrame.slice(1500, 13).share();
+    Buffer large = bigFrame.slice(0, 1500).share();
+    ASSERT_TRUE(small.isShared() && large.isShared()) << "Payloads should reference the frame";
 
-TestMegaRequestListener::~TestMegaRequestListener()
-{
-    delete mRequest;
-    delete mError;
-}
+    BufferArena arena;
+    EXPECT_TRUE(arena.adopt(small));
+    EXPECT_TRUE(BufferArena::contains(small));
+    EXPECT_TRUE(small.dataEquals("short payload", 13));
+    EXPECT_EQ(arena.liveBytes(), static_cast<size_t>(BufferArena::kChunkSize));
+    EXPECT_FALSE(arena.adopt(small)) << "Payload adopted twice";
 
-void TestMegaRequestListener::onRequestFinish(MegaApi *, MegaRequest *request, MegaError *e)
-{
-    mFinished = true;
-    mRequest = request->copy();
-    mError = e->copy();
+    // too large for the arena, but copied to its own block anyway
+    EXPECT_FALSE(arena.adopt(large));
+    EXPECT_FALSE(large.isShared()) << "Large payload still references the frame";
+    EXPECT_TRUE(large.dataEquals(std::string(1500, 'x').c_str(), 1500));
 
+    bigFrame = RecvBuffer(nullptr, 0);
+    EXPECT_TRUE(bigSlabRef.expired()) << "Adopted payloads keep the slab alive";
 }
 
-int TestMegaRequestListener::getErrorCode() const
+TEST_F(MegaChatApiUnitaryTest, MessageArenaMemory)
 {
-    assert(mFinished);
-    assert(mError);
-    return mError->getErrorCode();
-}
+    LOG_info << "___TEST MessageArenaMemory___";
 
-MegaRequest *TestMegaRequestListener::getMegaRequest() const
-{
-    assert(mFinished);
-    assert(mRequest);
-    return mRequest;
-}
+    // payload sizes between 16 and 400 bytes, like most text messages
+    const size_t numMsgs = 2000;
+    std::vector<std::string> texts;
+    uint32_t seed = 7;
+    for (size_t i = 0; i < numMsgs; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        texts.emplace_back(16 + (seed >> 8) % 385, static_cast<char>('a' + i % 26));
+    }
 
-TestMegaChatRequestListener::TestMegaChatRequestListener(MegaApi *megaApi, MegaChatApi *megaChatApi)
-    : RequestListener(megaApi, megaChatApi)
-{
-}
+    // plain text is assigned to the message when decrypted
+    std::vector<std::unique_ptr<chatd::Message>> msgs;
+    for (const std::string& text: texts)
+    {
+        msgs.emplace_back(std::make_unique<chatd::Message>(karere::Id(1), karere::Id(2), 0, 0,
+                                                           Buffer(), false, 0, false,
+                                                           chatd::Message::kMsgNormal));
+        msgs.back()->assign(text.data(), text.size());
+    }
 
-TestMegaChatRequestListener::~TestMegaChatRequestListener()
-{
-    delete mRequest;
-    delete mError;
-}
+    auto arena = std::make_unique<BufferArena>();
+    for (auto& msg: msgs)
+    {
+        ASSERT_TRUE(arena->adopt(*msg));
+        ASSERT_TRUE(msg->isShared());
+    }
+    for (size_t i = 0; i < numMsgs; i++)
+    {
+        ASSERT_TRUE(msgs[i]->dataEquals(texts[i].data(), texts[i].size())) << "Payload " << i << " differs";
+    }
 
-void TestMegaChatRequestListener::onRequestFinish(MegaChatApi *, MegaChatRequest *request, MegaChatError *e)
-{
-    mFinished = true;
-    mRequest = request->copy();
-    mError = e->copy();
-}
+    // payloads are packed, only padded to the alignment (the space left at the end of the chunks
+    // and in the current one is less than two chunks)
+    size_t payloadBytes = 0;
+    for (const std::string& text: texts)
+    {
+        payloadBytes += text.size() + BufferArena::kAlignment - 1;
+    }
+    EXPECT_LT(arena->liveBytes(), payloadBytes + 2 * static_cast<size_t>(BufferArena::kChunkSize))
+            << "Payloads are not packed in the arena";
 
-int TestMegaChatRequestListener::getErrorCode() const
-{
-    assert(mFinished);
-    assert(mError);
-    return mError->getErrorCode();
+    // modifying an adopted payload copies it out of the arena, without affecting its neighbours
+    msgs[0]->append("!", 1);
+    EXPECT_FALSE(msgs[0]->isShared());
+    EXPECT_TRUE(msgs[1]->dataEquals(texts[1].data(), texts[1].size()));
+
+    // chunks are released along with the last payload referencing them, even after the arena
+    std::unique_ptr<chatd::Message> survivor = std::move(msgs[numMsgs / 2]);
+    size_t chunkBytes = arena->liveBytes();
+    msgs.clear();
+    EXPECT_EQ(arena->liveBytes(), 2 * static_cast<size_t>(BufferArena::kChunkSize))
+            << "Only the current chunk and the survivor's should be alive (out of " << chunkBytes << " bytes)";
+    arena.reset();
+    EXPECT_TRUE(survivor->dataEquals(texts[numMsgs / 2].data(), texts[numMsgs / 2].size()));
 }
 
-MegaChatRequest *TestMegaChatRequestListener::getMegaChatRequest() const
+TEST_F(MegaChatApiUnitaryTest, DbHotQueryPlans)
 {
-    assert(mFinished);
-    assert(mRequest);
+    LOG_info << "___TEST DbHotQueryPlans___";
+
+    sqlite3* db = nullptr;
+    ASSERT_EQ(sqlite3_open(":memory:", &db), SQLITE_OK);
+    std::unique_ptr<sqlite3, decltype(&sqlite3_close)> dbCloser(db, &sqlite3_close);
+    ASSERT_EQ(sqlite3_exec(db, karere::gDbSchema, nullptr, nullptr, nullptr), SQLITE_OK) << sqlite3_errmsg(db);
+
+    auto queryPlan = [db](const std::string& sql)
+    {
+        std::string plan;
+        sqlite3_stmt* stmt = nullptr;
+        std::string explain = "EXPLAIN QUERY PLAN " + sql;
+        if (sqlite3_prepare_v2(db, explain.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            return std::string("error: ") + sqlite3_errmsg(db);
+        }
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            plan.append(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3))).append("\n");
+        }
+        sqlite3_finalize(stmt);
+        return plan;
+    };
+
+    const ChatdSqliteDb::HotQueries& queries = ChatdSqliteDb::hotQueries();
+    for (const std::string& sql: queries.all())
+    {
+        std::string plan = queryPlan(sql);
+        EXPECT_EQ(plan.find("error: "), std::string::npos) << sql << "\n" << plan;
+        EXPECT_EQ(plan.find("SCAN "), std::string::npos) << "Full scan in the plan of: " << sql << "\n" << plan;
+    }
+
+    // unread counters must be computed without reading the messages themselves
+    EXPECT_NE(queryPlan(queries.unreadCountInRange).find("COVERING INDEX history_unread"), std::string::npos);
+
+    // the WHERE of history_unread in dbSchema.sql is written with the values of the enums
+    std::string unreadIndex;
+    sqlite3_stmt* stmt = nullptr;
+    ASSERT_EQ(sqlite3_prepare_v2(db, "select sql from sqlite_master where name = 'history_unread'", -1, &stmt, nullptr), SQLITE_OK);
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        unreadIndex = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
+    std::replace_if(unreadIndex.begin(), unreadIndex.end(), [](char c) { return std::isspace(static_cast<unsigned char>(c)); }, ' ');
+    unreadIndex.erase(std::unique(unreadIndex.begin(), unreadIndex.end(), [](char a, char b) { return a == ' ' && b == ' '; }), unreadIndex.end());
+    std::string unreadCondition = " WHERE " + ChatdSqliteDb::HotQueries::unreadIndexCondition();
+    ASSERT_GE(unreadIndex.size(), unreadCondition.size()) << unreadIndex;
+    EXPECT_EQ(unreadIndex.substr(unreadIndex.size() - unreadCondition.size()), unreadCondition) << unreadIndex;
+
+    // chat summaries read every chat once, but nothing else is scanned
+    std::string summariesPlan = queryPlan(queries.chatSummaries);
+    EXPECT_EQ(summariesPlan.find("error: "), std::string::npos) << summariesPlan;
+    size_t chatsScan = summariesPlan.find("SCAN ");
+    ASSERT_NE(chatsScan, std::string::npos) << summariesPlan;
+    EXPECT_EQ(summariesPlan.find("SCAN ", chatsScan + 1), std::string::npos) << summariesPlan;
+}
+
+TEST_F(MegaChatApiUnitaryTest, DbGroupCommit)
+{
+    LOG_info << "___TEST DbGroupCommit___";
+
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "karere_group_commit_test.db";
+    std::filesystem::path crashPath = path;
+    crashPath += ".crash";
+    auto removeDb = [](const std::filesystem::path& dbPath)
+    {
+        for (const char* suffix: {"", "-wal", "-shm"})
+        {
+            std::filesystem::path file = dbPath;
+            file += suffix;
+            std::filesystem::remove(file);
+        }
+    };
+    removeDb(path);
+
+    // rows that survive a crash: the files as they are now, opened by a new connection
+    auto rowsAfterCrash = [&path, &crashPath, &removeDb]()
+    {
+        removeDb(crashPath);
+        for (const char* suffix: {"", "-wal"})
+        {
+            std::filesystem::path from = path;
+            from += suffix;
+            std::filesystem::path to = crashPath;
+            to += suffix;
+            if (std::filesystem::exists(from))
+            {
+                std::filesystem::copy_file(from, to);
+            }
+        }
+
+        int rows = -1;
+        sqlite3* crashDb = nullptr;
+        if (sqlite3_open(crashPath.string().c_str(), &crashDb) == SQLITE_OK)
+        {
+            sqlite3_stmt* stmt = nullptr;
+            if (sqlite3_prepare_v2(crashDb, "select count(*) from writes", -1, &stmt, nullptr) == SQLITE_OK
+                && sqlite3_step(stmt) == SQLITE_ROW)
+            {
+                rows = sqlite3_column_int(stmt, 0);
+            }
+            sqlite3_finalize(stmt);
+        }
+        sqlite3_close(crashDb);
+        removeDb(crashPath);
+        return rows;
+    };
+
+    MockupApp app;
+    SqliteDb db(app);
+    ASSERT_TRUE(db.open(path.string().c_str()));
+    db.simpleQuery("create table writes(id integer primary key, value text)");
+
+    EXPECT_EQ(SqliteDb::GroupCommitPolicy().maxLatencyMs, 500u);
+
+    // the latency trigger commits the transaction opened by the first write
+    std::vector<unsigned> scheduled;
+    SqliteDb::GroupCommitPolicy policy;
+    policy.maxPendingWrites = 4;
+    policy.maxLatencyMs = 50;
+    policy.idleMs = 10000;
+    db.setGroupCommit(true, [&scheduled](unsigned ms) { scheduled.push_back(ms); }, policy);
+
+    db.query("insert into writes(value) values(?)", "first");
+    EXPECT_EQ(db.pendingWrites(), 1u);
+    ASSERT_EQ(scheduled.size(), 1u);
+    EXPECT_EQ(scheduled.back(), policy.idleMs);
+    {
+        SqliteStmt read(db, "select count(*) from writes");
+        ASSERT_TRUE(read.step());
+        EXPECT_EQ(read.integralCol<int>(0), 1);   // pending writes are visible on the same connection
+    }
+    EXPECT_EQ(rowsAfterCrash(), 0);
+
+    db.onFlushTimer();              // neither idle nor old enough: scheduled again
+    EXPECT_EQ(db.groupCommitStats().commits, 0u);
+    ASSERT_EQ(scheduled.size(), 2u);
+    EXPECT_LE(scheduled.back(), policy.maxLatencyMs);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(policy.maxLatencyMs + 10));
+    db.onFlushTimer();
+    EXPECT_EQ(db.groupCommitStats().commits, 1u);
+    EXPECT_EQ(db.pendingWrites(), 0u);
+    EXPECT_EQ(scheduled.size(), 2u);
+    EXPECT_EQ(rowsAfterCrash(), 1);
+
+    // the size trigger commits without waiting for the timer
+    for (int i = 0; i < 4; i++)
+    {
+        db.query("insert into writes(value) values(?)", "size");
+    }
+    EXPECT_EQ(db.groupCommitStats().commits, 2u);
+    EXPECT_EQ(rowsAfterCrash(), 5);
+
+    // flush() is the barrier used by addSendingItem(): the write survives without the timer
+    db.query("insert into writes(value) values(?)", "sending");
+    EXPECT_EQ(rowsAfterCrash(), 5);
+    db.flush();
+    EXPECT_EQ(db.groupCommitStats().barriers, 1u);
+    EXPECT_EQ(db.pendingWrites(), 0u);
+    EXPECT_EQ(rowsAfterCrash(), 6);
+
+    // as flushGroupedWrites(), used by the writes of seen pointers and keys
+    db.query("insert into writes(value) values(?)", "seen");
+    db.flushGroupedWrites();
+    EXPECT_EQ(db.groupCommitStats().barriers, 2u);
+    EXPECT_EQ(rowsAfterCrash(), 7);
+
+    // the idle trigger
+    policy.maxLatencyMs = 10000;
+    policy.idleMs = 20;
+    db.setGroupCommit(true, [&scheduled](unsigned ms) { scheduled.push_back(ms); }, policy);
+    db.query("insert into writes(value) values(?)", "idle");
+    std::this_thread::sleep_for(std::chrono::milliseconds(policy.idleMs + 10));
+    db.onFlushTimer();
+    EXPECT_EQ(rowsAfterCrash(), 8);
+
+    // writes left pending are committed on close
+    db.query("insert into writes(value) values(?)", "close");
+    EXPECT_EQ(rowsAfterCrash(), 8);
+    db.close();
+    EXPECT_EQ(rowsAfterCrash(), 9);
+    EXPECT_TRUE(app.dbErrors.empty());
+    removeDb(path);
+}
+
+TEST_F(MegaChatApiUnitaryTest, PersistedUnreadCounter)
+{
+    LOG_info << "___TEST PersistedUnreadCounter___";
+
+    MockupApp app;
+    SqliteDb db(app);
+    ASSERT_TRUE(db.open(":memory:"));
+    db.simpleQuery(karere::gDbSchema);
+
+    const karere::Id chatid(1);
+    const karere::Id myHandle(100);
+    const karere::Id peer(200);
+    db.query("insert into chats(chatid, shard, own_priv) values(?, 0, 2)", chatid);
+    ChatdHistoryWriter history(db, chatid, myHandle, false);
+
+    auto makeMsg = [](chatd::Idx idx, karere::Id userid, chatd::Message::Type type, const std::string& text,
+                      uint8_t encrypted, uint16_t updated)
+    {
+        chatd::Message msg(karere::Id(static_cast<uint64_t>(1000 + idx)), userid, 1000 + static_cast<uint32_t>(idx),
+                           updated, Buffer(text.c_str(), text.size()), false, 0, false, type);
+        msg.setEncrypted(encrypted);
+        return msg;
+    };
+    auto addMsg = [&](chatd::Idx idx, karere::Id userid, chatd::Message::Type type = chatd::Message::kMsgNormal,
+                      uint8_t encrypted = chatd::Message::kNotEncrypted)
+    {
+        history.addMessage(makeMsg(idx, userid, type, "text", encrypted, 0), idx);
+    };
+    auto updateMsg = [&](chatd::Idx idx, chatd::Message::Type type, const std::string& text, uint8_t encrypted, uint16_t updated)
+    {
+        chatd::Message msg = makeMsg(idx, peer, type, text, encrypted, updated);
+        EXPECT_EQ(history.updateMessage(msg.id(), msg), 1);
+    };
+    auto removeMsgs = [&](chatd::Idx idx)
+    {
+        history.removeMessages(idx);
+    };
+    // the counter as persisted, without counting anything: -1 if unknown
+    auto persisted = [&db, &chatid]()
+    {
+        SqliteStmt stmt(db, "select unread_count, unread_idx from chats where chatid = ?");
+        stmt << chatid;
+        stmt.stepMustHaveData();
+        return std::make_pair(stmt.integralCol<int>(0), stmt.integralCol<chatd::Idx>(1));
+    };
+
+    addMsg(0, peer);
+    addMsg(1, myHandle);                                                        // own message
+    addMsg(2, peer, chatd::Message::kMsgNormal, chatd::Message::kEncryptedPending);
+    addMsg(3, peer);
+    addMsg(4, peer, chatd::Message::kMsgAttachment);
+    EXPECT_EQ(persisted().first, -1);
+    EXPECT_EQ(history.getUnreadCountAfterIdx(CHATD_IDX_INVALID), 3);                 // 0, 3, 4
+    EXPECT_EQ(persisted(), std::make_pair(3, CHATD_IDX_INVALID));
+
+    // insert and update deltas
+    addMsg(5, peer);
+    EXPECT_EQ(persisted().first, 4);
+    updateMsg(2, chatd::Message::kMsgNormal, "decrypted", chatd::Message::kNotEncrypted, 0);
+    EXPECT_EQ(persisted().first, 5);
+    updateMsg(3, chatd::Message::kMsgNormal, "", chatd::Message::kNotEncrypted, 1);     // deleted
+    EXPECT_EQ(persisted().first, 4);
+    EXPECT_EQ(history.getUnreadCountAfterIdx(CHATD_IDX_INVALID), 4);                 // 0, 2, 4, 5
+
+    // moving the last-seen idx counts only the messages in between
+    EXPECT_EQ(history.getUnreadCountAfterIdx(2), 2);                                  // 4, 5
+    EXPECT_EQ(persisted(), std::make_pair(2, 2));
+    addMsg(6, peer);
+    EXPECT_EQ(persisted().first, 3);
+    updateMsg(0, chatd::Message::kMsgNormal, "", chatd::Message::kNotEncrypted, 1);     // not counted
+    EXPECT_EQ(persisted().first, 3);
+    updateMsg(2, chatd::Message::kMsgNormal, "", chatd::Message::kNotEncrypted, 1);     // last seen, not counted
+    EXPECT_EQ(persisted().first, 3);
+    EXPECT_EQ(history.getUnreadCountAfterIdx(0), 3);                                  // 4, 5, 6
+    EXPECT_EQ(history.getUnreadCountAfterIdx(4), 2);                                  // 5, 6
+
+    // retention: the counter is kept unless it counts removed messages
+    removeMsgs(2);
+    EXPECT_EQ(persisted(), std::make_pair(2, 4));
+    removeMsgs(4);
+    EXPECT_EQ(persisted(), std::make_pair(2, 4));
+    removeMsgs(5);
+    EXPECT_EQ(persisted().first, -1);
+    EXPECT_EQ(history.getUnreadCountAfterIdx(4), 1);                                  // 6
+
+    // truncate: previous messages are removed and the truncate replaces the message
+    addMsg(7, peer);
+    EXPECT_EQ(persisted().first, 2);
+    removeMsgs(6);
+    EXPECT_EQ(persisted().first, -1);
+    updateMsg(7, chatd::Message::kMsgTruncate, "", chatd::Message::kNotEncrypted, 0);
+    EXPECT_EQ(persisted().first, -1);
+    EXPECT_EQ(history.getUnreadCountAfterIdx(4), 0);
+
+    // clear history
+    addMsg(8, peer);
+    EXPECT_EQ(persisted(), std::make_pair(1, 4));
+    removeMsgs(CHATD_IDX_INVALID);
+    EXPECT_EQ(persisted().first, -1);
+    EXPECT_EQ(history.getUnreadCountAfterIdx(4), 0);
+    db.close();
+    EXPECT_TRUE(app.dbErrors.empty());
+}
+
+TEST_F(MegaChatApiUnitaryTest, HistoryBudget)
+{
+    LOG_info << "___TEST HistoryBudget___";
+
+    // stands for a chatd::Chat whose oldest messages can be evicted, except the last minMsgs ones
+    struct TestChat
+    {
+        chatd::Idx msgs;
+        uint64_t mLastHistoryAccess;
+        bool pinned = false;
+        chatd::Idx minMsgs = 0;
+
+        chatd::Idx size() const { return msgs; }
+        bool empty() const { return !msgs; }
+        bool isHistoryPinned() const { return pinned; }
+        chatd::Idx evictOldHistory(chatd::Idx count)
+        {
+            count = pinned ? 0 : std::min(count, msgs - minMsgs);
+            if (count <= 0)
+            {
+                return 0;
+            }
+            msgs -= count;
+            return count;
+        }
+    };
+
+    // every chat is trimmed to the per-chat budget, except pinned ones
+    std::array<TestChat, 3> chats = {{{100, 1}, {30, 2}, {60, 3}}};
+    chats[2].pinned = true;
+    std::vector<TestChat*> ptrs = {&chats[0], &chats[1], &chats[2]};
+    EXPECT_EQ(chatd::Client::enforceHistoryBudget(ptrs, 50, 0), 140u);
+    EXPECT_EQ(chats[0].msgs, 50);
+    EXPECT_EQ(chats[1].msgs, 30);
+    EXPECT_EQ(chats[2].msgs, 60);
+
+    // the total budget is met by evicting from the least recently used chats first
+    chats = {{{40, 3}, {40, 1}, {40, 2}}};
+    EXPECT_EQ(chatd::Client::enforceHistoryBudget(ptrs, 0, 70), 70u);
+    EXPECT_EQ(chats[0].msgs, 40);
+    EXPECT_EQ(chats[1].msgs, 0);
+    EXPECT_EQ(chats[2].msgs, 30);
+
+    // both budgets together: the per-chat one is applied first
+    chats = {{{100, 1}, {20, 2}, {80, 3}}};
+    EXPECT_EQ(chatd::Client::enforceHistoryBudget(ptrs, 50, 60), 60u);
+    EXPECT_EQ(chats[0].msgs, 0);
+    EXPECT_EQ(chats[1].msgs, 10);
+    EXPECT_EQ(chats[2].msgs, 50);
+
+    // pinned chats and messages that can't be evicted are kept, even if the budget isn't met
+    chats = {{{40, 1}, {40, 2}, {40, 3}}};
+    chats[0].pinned = true;
+    chats[1].minMsgs = 30;
+    EXPECT_EQ(chatd::Client::enforceHistoryBudget(ptrs, 0, 50), 70u);
+    EXPECT_EQ(chats[0].msgs, 40);
+    EXPECT_EQ(chats[1].msgs, 30);
+    EXPECT_EQ(chats[2].msgs, 0);
+
+    // within budget, nothing is evicted
+    chats = {{{40, 1}, {40, 2}, {40, 3}}};
+    EXPECT_EQ(chatd::Client::enforceHistoryBudget(ptrs, 40, 120), 120u);
+    EXPECT_EQ(chats[0].msgs + chats[1].msgs + chats[2].msgs, 120);
+}
+
+TEST_F(MegaChatApiUnitaryTest, WorkerPool)
+{
+    LOG_info << "___TEST WorkerPool___";
+
+    // every scheduled task runs
+    {
+        std::atomic<int> ran{0};
+        std::promise<void> done;
+        karere::WorkerPool pool(2);
+        for (int i = 0; i < 100; i++)
+        {
+            pool.schedule([&ran, &done]()
+            {
+                if (++ran == 100)
+                {
+                    done.set_value();
+                }
+            });
+        }
+        ASSERT_EQ(done.get_future().wait_for(std::chrono::seconds(10)), std::future_status::ready);
+    }
+
+    // destroying the pool releases what the tasks that didn't get to run own, like a DecryptBatch
+    std::vector<std::weak_ptr<int>> owned;
+    std::atomic<int> ran{0};
+    std::promise<void> release;
+    std::thread releaser;
+    {
+        karere::WorkerPool pool(1);
+        std::shared_future<void> released = release.get_future().share();
+        pool.schedule([released]() { released.wait(); });
+        for (int i = 0; i < 10; i++)
+        {
+            auto batch = std::make_shared<int>(i);
+            owned.push_back(batch);
+            pool.schedule([batch, &ran]() { ran += *batch >= 0; });
+        }
+        EXPECT_GE(pool.pendingTasks(), 10u);
+
+        // the worker is released while the pool is being destroyed
+        releaser = std::thread([&release]()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            release.set_value();
+        });
+    }
+    releaser.join();
+    EXPECT_LE(ran, 10);
+    for (const std::weak_ptr<int>& batch : owned)
+    {
+        EXPECT_TRUE(batch.expired());
+    }
+
+    // the tokens taken before invalidate() or the destruction of the owner aren't valid anymore
+    auto generation = std::make_unique<karere::WorkGeneration>();
+    karere::WorkGeneration::Token first = generation->token();
+    EXPECT_TRUE(first.valid());
+    generation->invalidate();
+    EXPECT_FALSE(first.valid());
+    karere::WorkGeneration::Token second = generation->token();
+    EXPECT_TRUE(second.valid());
+    generation.reset();
+    EXPECT_FALSE(second.valid());
+    EXPECT_FALSE(karere::WorkGeneration::Token().valid());
+
+    // results are computed in the pool and applied in this thread (the event loop of a
+    // chatd::Chat), unless the chat reloaded its history or was destroyed meanwhile
+    struct TestChat
+    {
+        karere::WorkGeneration mDecryptBatchGeneration;
+        std::vector<int> applied;
+    };
+
+    std::mutex resultsMutex;
+    std::vector<std::function<void()>> results;   // stands for marshallCall()
+    karere::WorkerPool pool(2);
+    auto decrypt = [&pool, &resultsMutex, &results](TestChat* chat, int value)
+    {
+        karere::WorkGeneration::Token generation = chat->mDecryptBatchGeneration.token();
+        auto done = std::make_shared<std::promise<void>>();
+        std::future<void> finished = done->get_future();
+        pool.schedule([&resultsMutex, &results, done, chat, generation, value]()
+        {
+            int result = value * 2;
+            {
+                std::lock_guard<std::mutex> lock(resultsMutex);
+                results.push_back([chat, generation, result]()
+                {
+                    if (generation.valid())
+                    {
+                        chat->applied.push_back(result);
+                    }
+                });
+            }
+            done->set_value();
+        });
+        ASSERT_EQ(finished.wait_for(std::chrono::seconds(10)), std::future_status::ready);
+    };
+    auto runResults = [&resultsMutex, &results]()
+    {
+        std::vector<std::function<void()>> pending;
+        {
+            std::lock_guard<std::mutex> lock(resultsMutex);
+            pending.swap(results);
+        }
+        for (std::function<void()>& result : pending)
+        {
+            result();
+        }
+    };
+
+    auto chat = std::make_unique<TestChat>();
+    decrypt(chat.get(), 1);
+    runResults();
+    EXPECT_EQ(chat->applied, std::vector<int>({2}));
+
+    decrypt(chat.get(), 2);
+    chat->mDecryptBatchGeneration.invalidate();
+    decrypt(chat.get(), 3);
+    runResults();
+    EXPECT_EQ(chat->applied, std::vector<int>({2, 6}));
+
+    // the result arrives once the chat has been destroyed: it's discarded without touching it
+    decrypt(chat.get(), 4);
+    chat.reset();
+    runResults();
+}
+
+namespace
+{
+// Drives a TimerWheel with explicit ticks, since the time of a loop that isn't running doesn't advance
+class TestTimerWheel: public karere::TimerWheel
+{
+public:
+    using TimerWheel::TimerWheel;
+    uint64_t now() const { return mNow; }
+    void advance(uint64_t tick) { process(tick); }
+};
+
+struct TestTimer: public karere::TimerWheel::Timer
+{
+    std::function<void()> cb;
+    TestTimer(std::function<void()>&& aCb): cb(std::move(aCb)) {}
+    void fire() override { cb(); }
+};
+
+// stands for the app's message loop, where the marshalled calls are posted
+std::mutex gTestMessagesMutex;
+std::vector<megaMessage*> gTestMessages;
+
+void postTestMessage(megaMessage* msg, void* /*appCtx*/)
+{
+    std::lock_guard<std::mutex> lock(gTestMessagesMutex);
+    gTestMessages.push_back(msg);
+}
+
+void processTestMessages()
+{
+    std::vector<megaMessage*> msgs;
+    {
+        std::lock_guard<std::mutex> lock(gTestMessagesMutex);
+        msgs.swap(gTestMessages);
+    }
+    for (megaMessage* msg : msgs)
+    {
+        megaProcessMessage(msg);
+    }
+}
+}
+
+TEST_F(MegaChatApiUnitaryTest, TimerWheel)
+{
+    LOG_info << "___TEST TimerWheel___";
+
+    GcmPostFunc postFunc = megaPostMessageToGui;
+    megaPostMessageToGui = postTestMessage;
+    uv_loop_t loop;
+    uv_loop_init(&loop);
+    karere::SdkMutex mutex;
+    typedef std::vector<std::pair<int, uint64_t>> FiredTimers;   // id, tick
+    FiredTimers fired;
+    auto add = [&fired](TestTimerWheel& wheel, int id, unsigned delay) -> megaHandle
+    {
+        return wheel.add(new TestTimer([&fired, &wheel, id]() { fired.emplace_back(id, wheel.now()); }),
+                         delay, 0);
+    };
+
+    // timers fire in order of expiration, and in order of addition if they expire at the same tick
+    {
+        TestTimerWheel wheel(&loop, mutex, nullptr);
+        add(wheel, 1, 5);
+        add(wheel, 2, 3);
+        add(wheel, 3, 5);
+        add(wheel, 4, 1);
+        wheel.advance(4);
+        EXPECT_EQ(fired, FiredTimers({{4, 1}, {2, 3}}));
+        wheel.advance(10);
+        EXPECT_EQ(fired, FiredTimers({{4, 1}, {2, 3}, {1, 5}, {3, 5}}));
+        EXPECT_EQ(wheel.size(), 0u);
+    }
+
+    // timers moved down from the upper levels at the first tick of their span fire on time
+    fired.clear();
+    {
+        TestTimerWheel wheel(&loop, mutex, nullptr);
+        const unsigned delays[] = {262145, 64, 4096, 63, 65, 4095, 4097, 262144, 128};
+        for (unsigned delay : delays)
+        {
+            add(wheel, static_cast<int>(delay), delay);
+        }
+        wheel.advance(300000);
+        FiredTimers expected;
+        for (unsigned delay : {63, 64, 65, 128, 4095, 4096, 4097, 262144, 262145})
+        {
+            expected.emplace_back(static_cast<int>(delay), delay);
+        }
+        EXPECT_EQ(fired, expected);
+    }
+
+    // a cancelled timer doesn't fire, and its handle is invalid once it has fired
+    fired.clear();
+    {
+        TestTimerWheel wheel(&loop, mutex, nullptr);
+        megaHandle cancelled = add(wheel, 1, 10);
+        megaHandle kept = add(wheel, 2, 100);
+        EXPECT_TRUE(wheel.cancel(cancelled));
+        EXPECT_FALSE(wheel.cancel(cancelled));
+        wheel.advance(200);
+        EXPECT_EQ(fired, FiredTimers({{2, 100}}));
+        EXPECT_FALSE(wheel.cancel(kept));
+        EXPECT_EQ(wheel.size(), 0u);
+    }
+
+    // a timer added from another thread can be cancelled from the loop before it's started
+    fired.clear();
+    {
+        TestTimerWheel wheel(&loop, mutex, nullptr);
+        megaHandle handle = 0;
+        std::thread([&]() { handle = add(wheel, 1, 5); }).join();
+        EXPECT_EQ(wheel.size(), 0u);
+        EXPECT_TRUE(wheel.cancel(handle));
+        processTestMessages();
+        wheel.advance(20);
+        EXPECT_TRUE(fired.empty());
+        EXPECT_EQ(wheel.size(), 0u);
+
+        // otherwise, it's started when the marshalled call is processed by the loop
+        std::thread([&]() { handle = add(wheel, 2, 5); }).join();
+        processTestMessages();
+        EXPECT_EQ(wheel.size(), 1u);
+        wheel.advance(40);
+        ASSERT_EQ(fired.size(), 1u);
+        EXPECT_EQ(fired[0].first, 2);
+        EXPECT_FALSE(wheel.cancel(handle));
+    }
+
+    processTestMessages();
+    megaPostMessageToGui = postFunc;
+    uv_run(&loop, UV_RUN_DEFAULT);  // frees the uv timers of the wheels
+    EXPECT_EQ(uv_loop_close(&loop), 0);
+}
+
+TEST_F(MegaChatApiUnitaryTest, EventQueue)
+{
+    LOG_info << "___TEST EventQueue___";
+
+    struct TestMessage: public megaMessage
+    {
+        TestMessage(int aProducer, int aSeq): megaMessage(nullptr), producer(aProducer), seq(aSeq) {}
+        int producer;
+        int seq;
+    };
+
+    // only the push that finds the queue empty has to wake up the consumer
+    EventQueue queue;
+    EXPECT_TRUE(queue.isEmpty());
+    EXPECT_EQ(queue.pop(), nullptr);
+    EXPECT_TRUE(queue.push(new TestMessage(0, 0)));
+    EXPECT_FALSE(queue.push(new TestMessage(0, 1)));
+    EXPECT_EQ(queue.size(), 2u);
+    for (int seq = 0; seq < 2; seq++)
+    {
+        std::unique_ptr<TestMessage> msg(static_cast<TestMessage*>(queue.pop()));
+        ASSERT_TRUE(msg);
+        EXPECT_EQ(msg->seq, seq);
+    }
+    EXPECT_TRUE(queue.isEmpty());
+    EXPECT_EQ(queue.pop(), nullptr);
+    EXPECT_TRUE(queue.push(new TestMessage(0, 2)));
+    delete queue.pop();
+
+    // several producers: the events of each one are received in order, and a consumer that
+    // sleeps while the queue is empty is always woken up (see MegaChatApiImpl::loop)
+    static constexpr int kProducers = 4;
+    static constexpr int kEventsPerProducer = 20000;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool notified = false;  // like a Waiter, a notification is kept until the consumer waits
+    std::vector<std::thread> producers;
+    for (int producer = 0; producer < kProducers; producer++)
+    {
+        producers.emplace_back([&, producer]()
+        {
+            for (int seq = 0; seq < kEventsPerProducer; seq++)
+            {
+                if (queue.push(new TestMessage(producer, seq)))
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    notified = true;
+                    condition.notify_one();
+                }
+            }
+        });
+    }
+
+    std::array<int, kProducers> nextSeq = {};
+    int received = 0;
+    bool ordered = true;
+    while (received < kProducers * kEventsPerProducer)
+    {
+        megaMessage* msg;
+        while ((msg = queue.pop()))
+        {
+            std::unique_ptr<TestMessage> event(static_cast<TestMessage*>(msg));
+            ordered = ordered && event->seq == nextSeq[event->producer];
+            nextSeq[event->producer] = event->seq + 1;
+            received++;
+        }
+
+        if (!queue.isEmpty())
+        {
+            std::this_thread::yield();  // a push is in progress
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        if (received < kProducers * kEventsPerProducer
+                && !condition.wait_for(lock, std::chrono::seconds(10), [&notified]() { return notified; }))
+        {
+            break;  // missed wakeup
+        }
+        notified = false;
+    }
+    for (std::thread& producer : producers)
+    {
+        producer.join();
+    }
+
+    EXPECT_EQ(received, kProducers * kEventsPerProducer);
+    EXPECT_TRUE(ordered);
+    EXPECT_TRUE(queue.isEmpty());
+    while (megaMessage* msg = queue.pop())
+    {
+        delete msg;
+    }
+}
+
+#ifndef KARERE_DISABLE_WEBRTC
+TEST_F(MegaChatApiUnitaryTest, SfuDataReception)
+{
+    LOG_info << "___TEST SfuDataReception___";
+
+    MockupCall call;
+    std::map<std::string, std::unique_ptr<sfu::Command>> commands;
+    sfu::SfuConnection::setCallbackToCommands(call, commands);
+    std::map<std::string, bool> checkCommands;
+    checkCommands["{\"warn\":\"warn msg\"}"]                                                    = true;
+    checkCommands["{\"deny\":\"audio\",\"msg\":\"deny msg\"}"]                                  = true;
+    checkCommands["{\"err\":129,\"msg\":\"Error\"}"]                                            = true;
+    checkCommands["{\"a\":\"HIRES_STOP\"}"]                                                     = true;
+    checkCommands["{\"a\":\"PEERLEFT\",\"cid\":2,\"rsn\":65}"]                                  = true;
+    checkCommands["{\"a\":\"PEERJOIN\",\"cid\":2,\"userId\":\"amECEsVQJQ8\",\"av\":0,\"v\":2}"] = true;
+    checkCommands["{\"a\":\"HIRES_START\"}"]                                                    = true;
+    checkCommands["{\"a\":\"HELLO\",\"cid\":1,\"na\":20,\"mods\":[\"amECEsVQJQ8\"]}"]           = true;
+    checkCommands["{\"a\":\"AV\",\"cid\":3,\"av\":1}"]                                          = true;
+    checkCommands["{\"a\":\"VTHUMBS\",\"tracks\":[[2,0]]}"]                                     = true;
+    checkCommands["{\"a\":\"HIRES\",\"tracks\":[[2,0,1]]}"]                                     = true;
+    checkCommands["{\"a\":\"VTHUMB_START\"}"]                                                   = true;
+    checkCommands["{\"a\":\"VTHUMB_STOP\"}"]                                                    = true;
+    checkCommands["{\"a\":\"KEY\",\"id\":0,\"from\":2,"
+                  "\"key\":\"RE8HjOLZl8ITM7FMIbAcigPWxq7i6DGqLQm-aNLAkEk\"}"]                   = true;
+
+    for (const auto& testCase : checkCommands)
+    {
+        rapidjson::Document document;
+        sfu::SfuConnection::SfuData outdata;
+        EXPECT_TRUE(sfu::SfuConnection::parseSfuData(testCase.first.c_str(), document, outdata))
+                << "[FAILED processing SFU command]: " << testCase.first << ". " << outdata.msg;
+
+        if (outdata.notificationType == sfu::SfuConnection::SfuData::SFU_COMMAND)
+        {
+            bool commandProcSuccess = (commands.find(outdata.notification) != commands.end()
+                    && commands[outdata.notification]->processCommand(document));
+            EXPECT_EQ(commandProcSuccess, testCase.second)
+                    << "[FAILED processing SFU command (notification)]: " << testCase.first << ". " << outdata.msg;
+        }
+        // else => SFU_WARN | SFU_ERROR | SFU_DENY
+    }
+}
+
+TEST_F(MegaChatApiUnitaryTest, SfuCommandsQueue)
+{
+    LOG_info << "___TEST SfuCommandsQueue___";
+
+    auto makeItem = [](sfu::CommandsQueue::MergeType type, std::vector<Cid_t> cids, const std::string& command = std::string())
+    {
+        sfu::CommandsQueue::Item item;
+        item.mergeType = type;
+        item.cids = std::move(cids);
+        item.command = command;
+        return item;
+    };
+    auto makeBarrier = [](const std::string& command)
+    {
+        sfu::CommandsQueue::Item item;
+        item.command = command;
+        item.barrier = true;
+        return item;
+    };
+
+    sfu::CommandsQueue queue;
+    queue.setWindow(2);
+
+    // a JOIN is sent alone: commands queued after it wait until it's written
+    queue.push(makeBarrier("JOIN"));
+    queue.push(makeItem(sfu::CommandsQueue::kGetVthumbs, {1, 2}));
+    queue.push(makeItem(sfu::CommandsQueue::kGetVthumbs, {2, 3}));  // merged
+    queue.push(makeItem(sfu::CommandsQueue::kDelVthumbs, {1, 6}));  // cancels GET_VTHUMBS for 1, only 6 is removed
+    queue.push(makeItem(sfu::CommandsQueue::kGetHiRes, {4}, "GET_HIRES"));
+    queue.push(makeItem(sfu::CommandsQueue::kDelHiRes, {4}));       // cancels GET_HIRES, and isn't sent
+    queue.push(makeItem(sfu::CommandsQueue::kDelHiRes, {5}));
+    queue.push(makeBarrier("BYE"));
+    EXPECT_EQ(queue.mergedCommands(), 3u);
+    ASSERT_EQ(queue.size(), 5u);
+
+    ASSERT_TRUE(queue.canSendNext());
+    EXPECT_EQ(queue.pop().command, "JOIN");
+    EXPECT_FALSE(queue.canSendNext()) << "Commands sent with JOIN in flight";
+    queue.onCommandSent();
+
+    sfu::CommandsQueue::Item item = queue.pop();
+    EXPECT_EQ(item.mergeType, sfu::CommandsQueue::kGetVthumbs);
+    EXPECT_EQ(item.cids, std::vector<Cid_t>({2, 3}));
+    ASSERT_TRUE(queue.canSendNext()) << "Pipelining disabled";
+    item = queue.pop();
+    EXPECT_EQ(item.mergeType, sfu::CommandsQueue::kDelVthumbs);
+    EXPECT_EQ(item.cids, std::vector<Cid_t>({6}));
+    EXPECT_FALSE(queue.canSendNext()) << "Window exceeded";
+    queue.onCommandSent();
+
+    item = queue.pop();
+    EXPECT_EQ(item.mergeType, sfu::CommandsQueue::kDelHiRes);
+    EXPECT_EQ(item.cids, std::vector<Cid_t>({5}));
+    EXPECT_FALSE(queue.canSendNext()) << "BYE sent before previous commands were written";
+    queue.onCommandSent();
+    queue.onCommandSent();
+
+    ASSERT_TRUE(queue.canSendNext());
+    EXPECT_EQ(queue.pop().command, "BYE");
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST_F(MegaChatApiUnitaryTest, SfuFrameCrypto)
+{
+    LOG_info << "___TEST SfuFrameCrypto___";
+
+    const std::string key("0123456789abcdef");
+    sfu::Peer peer(karere::Id(0x1234), sfu::SfuProtocol::SFU_PROTO_PROD, 0, nullptr, 7);
+    peer.addKey(3, key);
+    const IvStatic_t iv = 0x0102030405060708;
+    rtc::scoped_refptr<artc::MegaEncryptor> encryptor(new artc::MegaEncryptor(peer, nullptr, iv, 0));
+    rtc::scoped_refptr<artc::MegaDecryptor> decryptor(new artc::MegaDecryptor(peer, nullptr, iv, 0));
+
+    // typical sizes of an Opus frame (20 ms) and a VP8 frame
+    for (size_t frameSize : {160u, 12000u})
+    {
+        std::vector<uint8_t> frame(frameSize);
+        std::mt19937 rng(static_cast<unsigned>(frameSize));
+        std::generate(frame.begin(), frame.end(), [&rng]() { return static_cast<uint8_t>(rng()); });
+
+        std::vector<uint8_t> encrypted(encryptor->GetMaxCiphertextByteSize(cricket::MEDIA_TYPE_VIDEO, frame.size()));
+        std::vector<uint8_t> decrypted(decryptor->GetMaxPlaintextByteSize(cricket::MEDIA_TYPE_VIDEO, encrypted.size()));
+        size_t written = 0;
+        ASSERT_EQ(encryptor->Encrypt(cricket::MEDIA_TYPE_VIDEO, 0, {}, frame, encrypted, &written), artc::MegaEncryptor::kOk);
+        ASSERT_EQ(written, encrypted.size());
+
+        // frames must remain decryptable by the generic AES-GCM implementation (previous clients)
+        std::string plain(frameSize, '\0');
+        ::mega::byte frameIv[artc::FRAME_IV_LENGTH];
+        memcpy(frameIv, encrypted.data() + artc::FRAME_KEYID_LENGTH + artc::FRAME_CID_LENGTH, artc::FRAME_CTR_LENGTH);
+        memcpy(frameIv + artc::FRAME_CTR_LENGTH, &iv, artc::FRAME_IV_LENGTH - artc::FRAME_CTR_LENGTH);
+        ::mega::SymmCipher symmCipher;
+        symmCipher.setkey(reinterpret_cast<const ::mega::byte*>(key.data()));
+        EXPECT_TRUE(symmCipher.gcm_decrypt_aad(encrypted.data() + artc::FRAME_HEADER_LENGTH, static_cast<unsigned>(frameSize),
+                                               encrypted.data(), artc::FRAME_HEADER_LENGTH,
+                                               encrypted.data() + encrypted.size() - artc::FRAME_GCM_TAG_LENGTH, artc::FRAME_GCM_TAG_LENGTH,
+                                               frameIv, artc::FRAME_IV_LENGTH,
+                                               reinterpret_cast<::mega::byte*>(&plain[0]), plain.size()));
+        EXPECT_EQ(0, memcmp(plain.data(), frame.data(), frameSize));
+
+        auto result = decryptor->Decrypt(cricket::MEDIA_TYPE_VIDEO, {}, {}, encrypted, decrypted);
+        ASSERT_TRUE(result.IsOk());
+        ASSERT_EQ(result.bytes_written, frameSize);
+        EXPECT_EQ(decrypted, frame);
+
+        // tampered frames must be rejected
+        encrypted[artc::FRAME_HEADER_LENGTH] ^= 1;
+        EXPECT_FALSE(decryptor->Decrypt(cricket::MEDIA_TYPE_VIDEO, {}, {}, encrypted, decrypted).IsOk());
+    }
+}
+#endif
+
+#ifdef USE_CRYPTOPP
+TEST_F(MegaChatApiUnitaryTest, EncryptMediaKeyWithEphemKey)
+{
+    LOG_info << "___TEST EncryptMediaKeyWithEphemKey___";
+
+    std::string encryptedMediaKeyBin, decryptedMediaKeyBin;
+    const std::string expEncryptedMediaKeyB64     = "IqVDFXcCDQKfazBoZxhNSjKMvk9eZYQISMYl_7S71K4"; //gitleaks:allow
+    const std::vector<::mega::byte> mediaKeyBin   = { 60,181,43,125,112,4,248,203,228,50,177,231,232,185,172,194 };
+    const std::vector<::mega::byte> ephemKeyBin   = { 129,216,111,114,44,70,116,227,184,43,159,102,5,134,9,84,125,16,221,217,31,4,37,11,89,137,120,133,205,7,141,247 };
+    const std::string ephemeralkeyStr(ephemKeyBin.begin(), ephemKeyBin.end());
+    const std::string mediaKeyStr(mediaKeyBin.begin(), mediaKeyBin.end());
+
+    // Encrypt media key with ephemeral key
+    ::mega::SymmCipher mSymCipher;
+    bool encryptResult = mSymCipher.cbc_encrypt_with_key(mediaKeyStr, encryptedMediaKeyBin, reinterpret_cast<const unsigned char *>(ephemeralkeyStr.data()), ephemeralkeyStr.size(), nullptr);
+    EXPECT_TRUE(encryptResult) << "Failed Media key cbc_encrypt";
+
+    // Check encrypted key with expected one
+    const std::string encryptedMediaKeyB64 = ::mega::Base64::btoa(encryptedMediaKeyBin);
+    EXPECT_EQ(encryptedMediaKeyB64.compare(expEncryptedMediaKeyB64), 0) << "Expected encrypted key:" << expEncryptedMediaKeyB64 << " doesn't match with obtained: " << encryptedMediaKeyB64;
+
+    // Decrypt media key with ephemeral key
+    bool decryptResult = mSymCipher.cbc_decrypt_with_key(encryptedMediaKeyBin, decryptedMediaKeyBin, reinterpret_cast<const unsigned char*>(ephemeralkeyStr.data()), ephemeralkeyStr.size(), nullptr);
+    EXPECT_TRUE(decryptResult) << "Failed Media key cbc_decrypt";
+
+    // Check decrypted key with expected one
+    EXPECT_EQ(decryptedMediaKeyBin.compare(mediaKeyStr), 0) << "Expected decrypted key: " << mediaKeyStr << " doesn't match with obtained: " << decryptedMediaKeyBin;
+}
+#endif
+
+TEST_F(MegaChatApiUnitaryTest, PromiseThenChain)
+{
+    LOG_info << "___TEST PromiseThenChain___";
+
+    // callbacks run in the order they were added, the first one is stored inline and the rest on the heap
+    std::string order;
+    promise::Promise<int> pms;
+    pms.then([&order](int val) { order += "a" + std::to_string(val); });
+    pms.then([&order](int val) { order += "b" + std::to_string(val); });
+    pms.fail([&order](const promise::Error&) { order += "!"; return 0; });
+    pms.resolve(1);
+    EXPECT_EQ(order, "a1b1");
+
+    // callbacks attached to a chained promise are moved to the promise returned by the handler
+    order.clear();
+    promise::Promise<int> first;
+    promise::Promise<int> second;
+    auto chained = first.then([second](int) { return second; });
+    chained.then([&order](int val) { order += "c" + std::to_string(val); return val + 1; })
+           .then([&order](int val) { order += "d" + std::to_string(val); });
+    chained.then([&order](int val) { order += "e" + std::to_string(val); });
+    first.resolve(0);
+    EXPECT_TRUE(order.empty());
+    second.resolve(5);
+    EXPECT_EQ(order, "c5d6e5");
+    EXPECT_TRUE(chained.succeeded() && chained.value() == 5);
+
+    // exceptions reject the chain, also when the promise was already resolved
+    std::string errMsg;
+    promise::Promise<int>(1)
+        .then([](int) -> int { throw std::runtime_error("thrown"); })
+        .then([&order](int) { order += "!"; })
+        .fail([&errMsg](const promise::Error& err) { errMsg = err.msg(); });
+    EXPECT_EQ(errMsg, "thrown");
+    EXPECT_EQ(order, "c5d6e5");
+
+    // callbacks can be move-only
+    int moved = 0;
+    promise::Promise<void> pmsVoid;
+    pmsVoid.then([&moved, ptr = std::make_unique<int>(3)]() { moved = *ptr; });
+    pmsVoid.resolve();
+    EXPECT_EQ(moved, 3);
+}
+
+TEST_F(MegaChatApiUnitaryTest, ChatListSnapshotReaders)
+{
+    LOG_info << "___TEST ChatListSnapshotReaders___";
+
+    struct TestItem : public MegaChatListItem
+    {
+        MegaChatHandle chatid;
+        int unread = 0;
+        TestItem(MegaChatHandle id) : chatid(id) {}
+        MegaChatHandle getChatId() const override { return chatid; }
+        int getUnreadCount() const override { return unread; }
+        int getChanges() const override { return CHANGE_TYPE_UNREAD_COUNT; }
+        const char* getTitle() const override { return "Chat title"; }
+        const char* getLastMessage() const override { return "Last message of the chat"; }
+    };
+
+    // entries are kept in order of chatid, without changes, and keep their peers when updated
+    ChatListSnapshot snapshot;
+    for (MegaChatHandle chatid : {30, 10, 20})
+    {
+        snapshot.update(TestItem(chatid));
+    }
+    snapshot.updatePeers(20, std::make_shared<const std::vector<MegaChatHandle>>(std::vector<MegaChatHandle>{1, 2}));
+    TestItem updated(20);
+    updated.unread = 5;
+    snapshot.update(updated);
+    std::vector<MegaChatHandle> order;
+    snapshot.forEach(0, [&order](const ChatListSnapshot::EntryPtr& entry)
+    {
+        order.push_back(entry->item.getChatId());
+        EXPECT_EQ(entry->item.getChanges(), 0);
+    });
+    EXPECT_EQ(order, std::vector<MegaChatHandle>({10, 20, 30}));
+    ASSERT_TRUE(snapshot.find(20));
+    EXPECT_EQ(snapshot.find(20)->item.getUnreadCount(), 5);
+    EXPECT_EQ(snapshot.find(20)->peers->size(), 2u);
+    snapshot.remove(10);
+    EXPECT_FALSE(snapshot.find(10));
+    EXPECT_EQ(snapshot.size(), 2u);
+    snapshot.clear();
+
+    // reader threads list all the chats, with consistent items, while they're updated
+    const int numChats = 200;
+    const int numReaders = 4;
+    std::vector<std::unique_ptr<TestItem>> chats;
+    for (int i = 0; i < numChats; i++)
+    {
+        chats.emplace_back(new TestItem(i + 1));
+        snapshot.update(*chats.back());
+    }
+
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> readers;
+    for (int i = 0; i < numReaders; i++)
+    {
+        readers.emplace_back([&]()
+        {
+            while (!stop)
+            {
+                std::unique_ptr<MegaChatListItemListPrivate> items(new MegaChatListItemListPrivate());
+                snapshot.forEach(0, [&items](const ChatListSnapshot::EntryPtr& entry)
+                {
+                    items->addChatListItem(ChatListSnapshot::itemOf(entry));
+                });
+                EXPECT_EQ(items->size(), static_cast<unsigned>(numChats));
+                for (unsigned j = 0; j < items->size(); j++)
+                {
+                    EXPECT_EQ(items->get(j)->getChatId(), static_cast<MegaChatHandle>(j + 1));
+                }
+            }
+        });
+    }
+
+    std::mt19937 gen(1);
+    for (int i = 0; i < 20000; i++)
+    {
+        TestItem& chat = *chats[gen() % numChats];
+        chat.unread++;
+        snapshot.update(chat);
+    }
+    stop = true;
+    for (auto& reader : readers)
+    {
+        reader.join();
+    }
+
+    int unread = 0;
+    snapshot.forEach(0, [&unread](const ChatListSnapshot::EntryPtr& entry)
+    {
+        unread += entry->item.getUnreadCount();
+    });
+    EXPECT_EQ(unread, 20000);
+}
+
+TEST_F(MegaChatApiUnitaryTest, ChatListFilterIndexes)
+{
+    LOG_info << "___TEST ChatListFilterIndexes___";
+
+    struct TestItem : public MegaChatListItem
+    {
+        MegaChatHandle chatid = MEGACHAT_INVALID_HANDLE;
+        int unread = 0;
+        bool group = false;
+        bool publicChat = false;
+        bool meeting = false;
+        bool archived = false;
+        bool active = false;
+        MegaChatHandle getChatId() const override { return chatid; }
+        int getUnreadCount() const override { return unread; }
+        bool isGroup() const override { return group; }
+        bool isPublic() const override { return publicChat; }
+        bool isMeeting() const override { return meeting; }
+        bool isArchived() const override { return archived; }
+        bool isActive() const override { return active; }
+        MegaChatHandle getPeerHandle() const override { return group ? MEGACHAT_INVALID_HANDLE : chatid; }
+        const char* getTitle() const override { return "Chat title"; }
+        const char* getLastMessage() const override { return "Last message of the chat"; }
+    };
+
+    // filters of getChatListItems(mask, filter), evaluated chat by chat
+    auto passFilter = [](const MegaChatListItem& item, int mask, int filter)
+    {
+        const int types[][2] = {{MegaChatApi::CHAT_TYPE_GROUP, MegaChatApi::CHAT_TYPE_INDIVIDUAL},
+                                {MegaChatApi::CHAT_TYPE_GROUP_PRIVATE, MegaChatApi::CHAT_TYPE_GROUP_PUBLIC},
+                                {MegaChatApi::CHAT_TYPE_NON_MEETING, MegaChatApi::CHAT_TYPE_MEETING_ROOM}};
+        for (int i = 0; i < 3; i++)
+        {
+            if ((mask & (1 << i)) && !ChatListSnapshot::isOfType(item, types[i][(filter >> i) & 1]))
+            {
+                return false;
+            }
+        }
+        return (!(mask & MegaChatApi::CHAT_FILTER_BY_ARCHIVED_OR_NON_ARCHIVED) || item.isArchived() == bool(filter & MegaChatApi::CHAT_GET_ARCHIVED))
+            && (!(mask & MegaChatApi::CHAT_FILTER_BY_ACTIVE_OR_NON_ACTIVE) || item.isActive() == bool(filter & MegaChatApi::CHAT_GET_ACTIVE))
+            && (!(mask & MegaChatApi::CHAT_FILTER_BY_READ_OR_UNREAD) || (item.getUnreadCount() == 0) == bool(filter & MegaChatApi::CHAT_GET_READ));
+    };
+
+    // the indexes must return the same chats than the filters, while chats are added, updated and removed
+    std::mt19937 gen(1);
+    auto randomItem = [&gen](MegaChatHandle chatid)
+    {
+        TestItem item;
+        item.chatid = chatid;
+        item.unread = (gen() % 3) ? 0 : static_cast<int>(gen() % 5) - 1;
+        item.group = gen() % 2;
+        item.publicChat = item.group && gen() % 2;
+        item.meeting = item.publicChat && gen() % 2;
+        item.archived = !(gen() % 4);
+        item.active = gen() % 3;
+        return item;
+    };
+    ChatListSnapshot snapshot;
+    std::map<MegaChatHandle, TestItem> chats;
+    for (int i = 0; i < 20000; i++)
+    {
+        MegaChatHandle chatid = gen() % 300 + 1;
+        int action = gen() % 8;
+        if (action < 5)
+        {
+            chats[chatid] = randomItem(chatid);
+            snapshot.update(chats[chatid]);
+        }
+        else if (action == 5)
+        {
+            chats.erase(chatid);
+            snapshot.remove(chatid);
+        }
+        else
+        {
+            int mask = gen() % 64;
+            int filter = gen() % 64;
+            std::vector<MegaChatHandle> expected;
+            std::vector<MegaChatHandle> found;
+            for (const auto& chat : chats)
+            {
+                if (passFilter(chat.second, mask, filter))
+                {
+                    expected.push_back(chat.first);
+                }
+            }
+            snapshot.forEach(ChatListSnapshot::indexesOf(mask, filter), [&found](const ChatListSnapshot::EntryPtr& entry)
+            {
+                found.push_back(entry->item.getChatId());
+            });
+            ASSERT_EQ(found, expected) << "mask " << mask << ", filter " << filter;
+        }
+    }
+
+    // items are shared by the returned lists and outlive the snapshot
+    std::unique_ptr<MegaChatListItemListPrivate> list(new MegaChatListItemListPrivate());
+    snapshot.forEach(0, [&list](const ChatListSnapshot::EntryPtr& entry)
+    {
+        list->addChatListItem(ChatListSnapshot::itemOf(entry));
+    });
+    std::unique_ptr<MegaChatListItemList> listCopy(list->copy());
+    snapshot.clear();
+    ASSERT_EQ(list->size(), static_cast<unsigned>(chats.size()));
+    ASSERT_EQ(listCopy->size(), list->size());
+    EXPECT_EQ(list->get(0)->getChatId(), chats.begin()->first);
+}
+
+TEST_F(MegaChatApiUnitaryTest, ChatListActivityPages)
+{
+    LOG_info << "___TEST ChatListActivityPages___";
+
+    struct TestItem : public MegaChatListItem
+    {
+        MegaChatHandle chatid = MEGACHAT_INVALID_HANDLE;
+        int64_t ts = 0;
+        bool archived = false;
+        MegaChatHandle getChatId() const override { return chatid; }
+        int64_t getLastTimestamp() const override { return ts; }
+        bool isArchived() const override { return archived; }
+        const char* getTitle() const override { return "Chat title"; }
+        const char* getLastMessage() const override { return "Last message of the chat"; }
+    };
+
+    // reads all the pages, passing the last item of every page to get the next one
+    auto readPages = [](const ChatListSnapshot& snapshot, ChatListSnapshot::Indexes indexes, size_t pageSize)
+    {
+        std::vector<MegaChatHandle> chatids;
+        std::unique_ptr<MegaChatListItem> last;
+        while (true)
+        {
+            ChatListSnapshot::ActivityKey cursor{};
+            if (last)
+            {
+                cursor = ChatListSnapshot::activityKeyOf(*last);
+            }
+            std::vector<ChatListSnapshot::EntryPtr> page = snapshot.page(indexes, last ? &cursor : nullptr, pageSize);
+            EXPECT_LE(page.size(), pageSize);
+            for (const ChatListSnapshot::EntryPtr& entry : page)
+            {
+                chatids.push_back(entry->item.getChatId());
+            }
+            if (page.size() < pageSize)
+            {
+                return chatids;
+            }
+            last.reset(page.back()->item.copy());
+        }
+    };
+
+    // pages must return the chats sorted by last timestamp, while chats are added, updated and removed
+    std::mt19937 gen(1);
+    ChatListSnapshot snapshot;
+    std::map<MegaChatHandle, TestItem> chats;
+    for (int i = 0; i < 20000; i++)
+    {
+        MegaChatHandle chatid = gen() % 1000 + 1;
+        int action = gen() % 10;
+        if (action < 7)
+        {
+            TestItem& item = chats[chatid];
+            item.chatid = chatid;
+            item.ts = gen() % 500;  // with ties
+            item.archived = !(gen() % 4);
+            snapshot.update(item);
+        }
+        else if (action < 9)
+        {
+            chats.erase(chatid);
+            snapshot.remove(chatid);
+        }
+        else
+        {
+            bool filterArchived = gen() % 2;
+            std::vector<const TestItem*> sorted;
+            for (const auto& chat : chats)
+            {
+                if (!filterArchived || !chat.second.archived)
+                {
+                    sorted.push_back(&chat.second);
+                }
+            }
+            std::sort(sorted.begin(), sorted.end(), [](const TestItem* a, const TestItem* b)
+            {
+                return a->ts > b->ts || (a->ts == b->ts && a->chatid < b->chatid);
+            });
+            std::vector<MegaChatHandle> expected;
+            for (const TestItem* item : sorted)
+            {
+                expected.push_back(item->chatid);
+            }
+            ChatListSnapshot::Indexes indexes = filterArchived
+                    ? ChatListSnapshot::indexesOf(MegaChatApi::CHAT_FILTER_BY_ARCHIVED_OR_NON_ARCHIVED, MegaChatApi::CHAT_GET_NON_ARCHIVED)
+                    : 0;
+            ASSERT_EQ(readPages(snapshot, indexes, gen() % 50 + 1), expected) << "iteration " << i;
+        }
+    }
+
+    // new activity in a chat moves it to the front
+    snapshot.clear();
+    const int numChats = 100;
+    std::vector<TestItem> items(numChats);
+    for (int i = 0; i < numChats; i++)
+    {
+        items[i].chatid = i + 1;
+        items[i].ts = gen() % 1000;
+        snapshot.update(items[i]);
+    }
+    for (int i = 0; i < numChats; i++)
+    {
+        items[i].ts = 1000 + i;
+        snapshot.update(items[i]);
+        ASSERT_EQ(snapshot.page(0, nullptr, 1).front()->item.getChatId(), items[i].chatid);
+    }
+}
+
+TEST_F(MegaChatApiUnitaryTest, CoalescedChatListItemChanges)
+{
+    LOG_info << "___TEST CoalescedChatListItemChanges___";
+
+    struct TestItem : public MegaChatListItem
+    {
+        MegaChatHandle chatid = 1;
+        int unread = 0;
+        int64_t ts = 0;
+        int changes = 0;
+        bool deleted = false;
+        MegaChatHandle getChatId() const override { return chatid; }
+        int getUnreadCount() const override { return unread; }
+        int64_t getLastTimestamp() const override { return ts; }
+        int getChanges() const override { return changes; }
+        bool isDeleted() const override { return deleted; }
+        const char* getTitle() const override { return "Chat title"; }
+        const char* getLastMessage() const override { return "Last message of the chat"; }
+    };
+
+    // a burst of updates of a chat is notified once, with the latest state and all the changes
+    TestItem update;
+    update.changes = MegaChatListItem::CHANGE_TYPE_DELETED;
+    update.deleted = true;
+    std::unique_ptr<MegaChatListItemPrivate> held(new MegaChatListItemPrivate(&update));
+    const int burst[] = {MegaChatListItem::CHANGE_TYPE_UNREAD_COUNT, MegaChatListItem::CHANGE_TYPE_LAST_MSG,
+                         MegaChatListItem::CHANGE_TYPE_LAST_TS, MegaChatListItem::CHANGE_TYPE_UNREAD_COUNT};
+    for (int change : burst)
+    {
+        update.changes = change;
+        update.deleted = false;
+        update.unread++;
+        update.ts += 10;
+        std::unique_ptr<MegaChatListItemPrivate> newer(new MegaChatListItemPrivate(&update));
+        newer->mergeChanges(*held);
+        held = std::move(newer);
+    }
+
+    EXPECT_EQ(held->getChanges(), MegaChatListItem::CHANGE_TYPE_DELETED | MegaChatListItem::CHANGE_TYPE_UNREAD_COUNT
+              | MegaChatListItem::CHANGE_TYPE_LAST_MSG | MegaChatListItem::CHANGE_TYPE_LAST_TS);
+    EXPECT_EQ(held->getUnreadCount(), 4);
+    EXPECT_EQ(held->getLastTimestamp(), 40);
+    EXPECT_TRUE(held->isDeleted());
+}
+
+namespace
+{
+// Records the message callbacks of a chatroom, which are called by the karere thread or
+// by the thread that holds the sdkMutex
+class CoalescingRoomListener : public MegaChatRoomListener
+{
+public:
+    void onMessageReceived(MegaChatApi*, MegaChatMessage* msg) override
+    {
+        addEvent("received " + std::to_string(msg->getMsgId()));
+    }
+
+    void onMessageUpdate(MegaChatApi*, MegaChatMessage* msg) override
+    {
+        addEvent("update " + std::to_string(msg->getMsgId()) + " status " + std::to_string(msg->getStatus()));
+    }
+
+    void onMessagesSeen(MegaChatApi*, MegaChatHandle oldestMsgid, MegaChatHandle newestMsgid, unsigned int count) override
+    {
+        addEvent("seen " + std::to_string(oldestMsgid) + "-" + std::to_string(newestMsgid) + " count " + std::to_string(count));
+    }
+
+    // Waits until \c n events have been received and returns them, or the events received until the timeout
+    std::vector<std::string> takeEvents(size_t n, std::chrono::milliseconds timeout = std::chrono::seconds(10))
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait_for(lock, timeout, [this, n]() { return mEvents.size() >= n; });
+        std::vector<std::string> events;
+        events.swap(mEvents);
+        return events;
+    }
+
+private:
+    void addEvent(std::string event)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mEvents.push_back(std::move(event));
+        }
+        mCondition.notify_all();
+    }
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::vector<std::string> mEvents;
+};
+}
+
+TEST_F(MegaChatApiUnitaryTest, CoalescedMessageNotifications)
+{
+    LOG_info << "___TEST CoalescedMessageNotifications___";
+
+    // no session is needed: the status changes are fed to the handler of the chatroom
+    std::unique_ptr<MegaApi> megaApi(new MegaApi(APPLICATION_KEY.c_str(), fs::current_path().string().c_str(), USER_AGENT_DESCRIPTION.c_str()));
+    std::unique_ptr<MegaChatApi> megaChatApi(new MegaChatApi(megaApi.get()));
+    MegaChatApiImpl& impl = MegaChatApiTestAccess::impl(*megaChatApi);
+    const MegaChatHandle chatid = 1000;
+    const karere::Id peer(2000);
+    CoalescingRoomListener listener;
+    megaChatApi->addChatRoomListener(chatid, &listener);
+
+    std::vector<std::unique_ptr<chatd::Message>> msgs;
+    auto statusChange = [&impl, &msgs, &peer, chatid](chatd::Idx idx, chatd::Message::Status status)
+    {
+        msgs.emplace_back(std::make_unique<chatd::Message>(karere::Id(static_cast<uint64_t>(idx)), peer, 0, 0,
+                                                           Buffer("text", 4), false, 0, false,
+                                                           chatd::Message::kMsgNormal));
+        impl.getChatRoomHandler(chatid)->onMessageStatusChange(idx, status, *msgs.back());
+    };
+    const std::string seen = " status " + std::to_string(MegaChatMessage::STATUS_SEEN);
+
+    LOG_debug << "#### Test1: Seen ranges and merged updates, fired after the loop iteration ####";
+    megaChatApi->setNotificationCoalescing(true);
+    {
+        MegaChatApiImpl::SdkMutexGuard g(impl.sdkMutex);
+        statusChange(1, chatd::Message::kSeen);
+        statusChange(2, chatd::Message::kSeen);
+        statusChange(3, chatd::Message::kSeen);
+        statusChange(10, chatd::Message::kServerReceived);
+        statusChange(10, chatd::Message::kDelivered);
+        statusChange(4, chatd::Message::kSeen);
+    }
+    EXPECT_EQ(listener.takeEvents(3), std::vector<std::string>({"seen 1-3 count 3",
+                                                                "update 10 status " + std::to_string(MegaChatMessage::STATUS_DELIVERED),
+                                                                "update 4" + seen}));
+
+    LOG_debug << "#### Test2: Held updates are fired before any other callback ####";
+    megaChatApi->setNotificationCoalescing(true, 60000);
+    {
+        MegaChatApiImpl::SdkMutexGuard g(impl.sdkMutex);
+        statusChange(5, chatd::Message::kSeen);
+        statusChange(6, chatd::Message::kSeen);
+        chatd::Message received(karere::Id(7), peer, 0, 0, Buffer("text", 4), false, 0, false, chatd::Message::kMsgNormal);
+        impl.getChatRoomHandler(chatid)->fireOnMessageReceived(new MegaChatMessagePrivate(received, chatd::Message::kNotSeen, 7));
+    }
+    EXPECT_EQ(listener.takeEvents(2), std::vector<std::string>({"seen 5-6 count 2", "received 7"}));
+
+    LOG_debug << "#### Test3: Held updates are fired when the window expires ####";
+    const std::chrono::milliseconds window(300);
+    megaChatApi->setNotificationCoalescing(true, static_cast<unsigned int>(window.count()));
+    auto start = std::chrono::steady_clock::now();
+    {
+        MegaChatApiImpl::SdkMutexGuard g(impl.sdkMutex);
+        statusChange(8, chatd::Message::kSeen);
+        statusChange(9, chatd::Message::kSeen);
+    }
+    EXPECT_EQ(listener.takeEvents(1), std::vector<std::string>({"seen 8-9 count 2"}));
+    // the timer may run up to a tick earlier than measured here
+    EXPECT_GE(std::chrono::steady_clock::now() - start, window - std::chrono::milliseconds(50)) << "Fired before the window expired";
+
+    LOG_debug << "#### Test4: Held updates are discarded when the chatroom is closed ####";
+    megaChatApi->setNotificationCoalescing(true, 60000);
+    {
+        MegaChatApiImpl::SdkMutexGuard g(impl.sdkMutex);
+        statusChange(11, chatd::Message::kSeen);
+        statusChange(12, chatd::Message::kSeen);
+    }
+    megaChatApi->closeChatRoom(chatid, &listener);
+
+    // disabling the coalescing fires the held updates in the next loop iteration
+    std::promise<void> flushed;
+    MegaChatApiTestAccess::setLoopIterationObserver(*megaChatApi, [&impl, &flushed, done = false]() mutable
+    {
+        if (!done && !impl.isCoalescingNotifications())
+        {
+            done = true;
+            flushed.set_value();
+        }
+    });
+    megaChatApi->setNotificationCoalescing(false);
+    ASSERT_EQ(flushed.get_future().wait_for(std::chrono::seconds(10)), std::future_status::ready);
+    MegaChatApiTestAccess::setLoopIterationObserver(*megaChatApi, nullptr);
+    EXPECT_TRUE(listener.takeEvents(0, std::chrono::milliseconds(0)).empty()) << "Updates of a closed chatroom were fired";
+
+    megaChatApi.reset();
+    megaApi.reset();
+}
+
+TestMegaRequestListener::TestMegaRequestListener(MegaApi *megaApi, MegaChatApi *megaChatApi)
+    : RequestListener(megaApi, megaChatApi)
+{
+}
+
+TestMegaRequestListener::~TestMegaRequestListener()
+{
+    delete mRequest;
+    delete mError;
+}
+
+void TestMegaRequestListener::onRequestFinish(MegaApi *, MegaRequest *request, MegaError *e)
+{
+    mFinished = true;
+    mRequest = request->copy();
+    mError = e->copy();
+
+}
+
+int TestMegaRequestListener::getErrorCode() const
+{
+    assert(mFinished);
+    assert(mError);
+    return mError->getErrorCode();
+}
+
+MegaRequest *TestMegaRequestListener::getMegaRequest() const
+{
+    assert(mFinished);
+    assert(mRequest);
+    return mRequest;
+}
+
+TestMegaChatRequestListener::TestMegaChatRequestListener(MegaApi *megaApi, MegaChatApi *megaChatApi)
+    : RequestListener(megaApi, megaChatApi)
+{
+}
+
+TestMegaChatRequestListener::~TestMegaChatRequestListener()
+{
+    delete mRequest;
+    delete mError;
+}
+
+void TestMegaChatRequestListener::onRequestFinish(MegaChatApi *, MegaChatRequest *request, MegaChatError *e)
+{
+    mFinished = true;
+    mRequest = request->copy();
+    mError = e->copy();
+}
+
+int TestMegaChatRequestListener::getErrorCode() const
+{
+    assert(mFinished);
+    assert(mError);
+    return mError->getErrorCode();
+}
+
+MegaChatRequest *TestMegaChatRequestListener::getMegaChatRequest() const
+{
+    assert(mFinished);
+    assert(mRequest);
     return mRequest;
 }
 
@@ -12005,6 +13755,39 @@ RequestListener::RequestListener(MegaApi *megaApi, MegaChatApi* megaChatApi)
 
 }
 
+void MegaChatApiTestAccess::setLoopIterationObserver(MegaChatApi& api, std::function<void()> observer)
+{
+    MegaChatApiImpl& chatApi = impl(api);
+    MegaChatApiImpl::SdkMutexGuard g(chatApi.sdkMutex);
+    chatApi.mLoopIterationObserver = std::move(observer);
+}
+
+std::string MegaChatApiTestAccess::staleChatListItem(MegaChatApi& api)
+{
+    MegaChatApiImpl& chatApi = impl(api);
+    if (!chatApi.mClient || chatApi.mTerminating)
+    {
+        return std::string();
+    }
+
+    for (const auto& chat : *chatApi.mClient->chats)
+    {
+        ChatListSnapshot::EntryPtr entry = chatApi.mChatListSnapshot.find(chat.first);
+        if (!entry)
+        {
+            return karere::Id(chat.first).toString() + ": missing";
+        }
+
+        MegaChatListItemPrivate item(*chat.second);
+        const char* property = ChatListSnapshot::differingProperty(entry->item, item);
+        if (property)
+        {
+            return karere::Id(chat.first).toString() + ": " + property;
+        }
+    }
+    return std::string();
+}
+
 #ifndef KARERE_DISABLE_WEBRTC
 bool MockupCall::handleAvCommand(Cid_t, unsigned, uint32_t)
 {
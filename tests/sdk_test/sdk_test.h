@@ -1415,6 +1415,37 @@ public:
     }
 };
 
+// karere app for the unit tests of components that only report errors to it (ie. SqliteDb)
+class MockupApp : public karere::IApp
+{
+public:
+    IChatListHandler* chatListHandler() override { return nullptr; }
+    void onPresenceConfigChanged(const presenced::Config&, bool) override {}
+    void onPresenceLastGreenUpdated(karere::Id, uint16_t) override {}
+    void onDbError(int error, const std::string& errStr) override
+    {
+        dbErrors.emplace_back(error, errStr);
+    }
+
+    std::vector<std::pair<int, std::string>> dbErrors;
+};
+
+namespace megachat
+{
+// gives the tests access to the state of a MegaChatApi that isn't exposed by the API
+class MegaChatApiTestAccess
+{
+public:
+    static MegaChatApiImpl& impl(MegaChatApi& api) { return *api.pImpl; }
+
+    static void setLoopIterationObserver(MegaChatApi& api, std::function<void()> observer);
+
+    // To be called from the karere thread. Returns the first chat whose entry in the snapshot
+    // differs from a fresh item of its chatroom, and the differing property, or empty if none
+    static std::string staleChatListItem(MegaChatApi& api);
+};
+}
+
 #ifndef KARERE_DISABLE_WEBRTC
 class MockupCall : public sfu::SfuInterface
 {
@@ -0,0 +1,114 @@
+#ifndef URLTESTDATA_H
+#define URLTESTDATA_H
+
+#include <chatd.h>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+namespace urltest
+{
+// Former regex-based implementation of chatd::Message::hasUrl() (with the expressions compiled only once),
+// used as reference by the tests and benchmarks of the url scanner
+inline bool legacyParseUrl(const std::string& url)
+{
+    if (url.find('.') == std::string::npos)
+    {
+        return false;
+    }
+
+    static const std::regex emailExpression("^[a-z0-9A-Z._%+-]+@[a-z0-9A-Z.-]+[.][a-zA-Z]{2,6}");
+    if (std::regex_match(url, emailExpression))
+    {
+        return false;
+    }
+
+    std::string urlToParse = url;
+    std::string::size_type position = urlToParse.find("://");
+    if (position != std::string::npos)
+    {
+        static const std::regex expresion("^(http://|https://)(.+)");
+        if (!std::regex_match(urlToParse, expresion))
+        {
+            return false;
+        }
+        urlToParse = urlToParse.substr(position + 3);
+    }
+
+    static const std::regex megaUrlExpression("((WWW.|www.)?mega.+(nz/|co.nz/)).*((#F!|#!|C!|chat/|file/|folder/)[a-z0-9A-Z-._~:/?#!$&'()*+,;= \\-@]+)$");
+    if (std::regex_match(urlToParse, megaUrlExpression))
+    {
+        return false;
+    }
+
+    static const std::regex regularExpresion("((^([0-9]{1,3}[.]{1}[0-9]{1,3}[.]{1}[0-9]{1,3}[.]{1}[0-9]{1,3}))|((^(WWW.|www.))?([a-z0-9A-Z]+)([a-z0-9A-Z-._~?#!$&'()*+,;=])*([a-z0-9A-Z]+)([.]{1}[a-zA-Z]{2,5}){1,2}))([:]{1}[0-9]{1,5})?([/]{1}[a-z0-9A-Z-._~:?#/@!$&'()*+,;=]*)?$");
+    return std::regex_match(urlToParse, regularExpresion);
+}
+
+inline bool legacyHasUrl(const std::string& text, std::string& url)
+{
+    std::string partialString;
+    for (std::string::size_type position = 0; position <= text.size(); position++)
+    {
+        char character = position < text.size() ? text[position] : ' ';
+        if ((character >= 33 && character <= 126)
+                && character != '"' && character != '\'' && character != '\\'
+                && character != '<' && character != '>'
+                && character != '{' && character != '}' && character != '|')
+        {
+            partialString.push_back(character);
+            continue;
+        }
+
+        chatd::Message::removeUnnecessaryFirstCharacters(partialString);
+        chatd::Message::removeUnnecessaryLastCharacters(partialString);
+        if (!partialString.empty() && legacyParseUrl(partialString))
+        {
+            url = partialString;
+            return true;
+        }
+        partialString.clear();
+    }
+    return false;
+}
+
+// Random texts mixing url-like fragments, separators and chars that are relevant for any of the expressions
+inline std::vector<std::string> urlCorpus(size_t count)
+{
+    static const std::vector<std::string> fragments =
+    {
+        "http://", "https://", "ftp://", "://", "www.", "WWW.", "wwwx", "mega", "mega.nz/", "mega.co.nz/", "nz/",
+        "#F!", "#!", "C!", "chat/", "file/", "folder/", ".com", ".es", ".co", ".museum", ".a", "..", ".", ":",
+        ":8080", ":123456", "/", "/path", "?q=1", "#frag", "@", "user@", "%", "[", "]", "^", "`", "-", "_", "~",
+        "1", "123", "1234", "ab", "Z", "x.y", "google", "foo_bar", "(", ")", "!", "$", "&", "*", "+", ",", ";",
+        "=", "\n", "\r", " ", "\t", "\"", "'", "\xC3\xA9", "|", "10.1.1.0", "255.255.255.255"
+    };
+    static const std::string chars = "abcxyzABCW019.:/?#!@-_~%$&'()*+,;=[]^` nz";
+
+    std::mt19937 rng(42);
+    std::vector<std::string> corpus;
+    for (size_t i = 0; i < count; i++)
+    {
+        std::string text;
+        for (auto j = rng() % 7 + 1; j > 0; j--)
+        {
+            if (rng() % 3)
+            {
+                text.append(fragments[rng() % fragments.size()]);
+            }
+            else
+            {
+                for (auto k = rng() % 4 + 1; k > 0; k--)
+                {
+                    text.push_back(chars[rng() % chars.size()]);
+                }
+            }
+        }
+        corpus.emplace_back(std::move(text));
+    }
+    return corpus;
+}
+}
+
+#endif // URLTESTDATA_H